@@ -0,0 +1,713 @@
+/* m210-bench - benchmark note decoding and conversion
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libm210/dev.h"
+#include "libm210/note.h"
+#include "libm210/rawnote.h"
+#include "libm210/stroke.h"
+
+#include "svg.h"
+
+extern char *program_invocation_name;
+
+/* Synthetic note streams, the same for the same parameters. */
+struct bench_dump {
+	int notes;
+	size_t size;
+	int stroke_length;
+	int penup_density; /* Percent of bodies. */
+	uint64_t seed;
+	char *data;
+	size_t data_size;
+	size_t points;
+};
+
+struct bench_result {
+	char name[64];
+	struct bench_dump const *dump;
+	double seconds;
+};
+
+struct bench_settings {
+	double min_time;
+	int threads;
+};
+
+/* Dumps measured when none is given on the command line. */
+static const struct {
+	int notes;
+	size_t size;
+} bench_default_dumps[] = {
+	{1, 65536},
+	{16, 1048576},
+	{64, M210_DEV_MAX_MEMORY}
+};
+
+#define BENCH_DEFAULT_DUMP_COUNT (sizeof(bench_default_dumps)		\
+				  / sizeof(bench_default_dumps[0]))
+
+/* Smallest number of timed runs of each benchmark. */
+static const int bench_min_runs = 3;
+
+static void print_help_hint(void)
+{
+	fprintf(stderr, "Try `%s --help' for more information.\n",
+		program_invocation_name);
+}
+
+static void print_help(void)
+{
+	printf("Usage: %s [--notes=N] [--size=BYTES] [--stroke-length=N]\n"
+	       "          [--penup-density=PERCENT] [--seed=N] [--threads=N]\n"
+	       "          [--min-time=SECONDS] [--json=FILE]\n"
+	       "          [--baseline=FILE [--tolerance=PERCENT]]\n"
+	       "\n"
+	       "Time decoding and SVG conversion of synthetic note streams.\n"
+	       "\n"
+	       "Options:\n"
+	       " --notes=N                  generate N notes (1..255), default 1\n"
+	       " --size=BYTES               generate BYTES of notes, at most %d,\n"
+	       "                            default %d; without --notes and --size,\n"
+	       "                            a set of dumps from 1 note up to the\n"
+	       "                            device memory is measured\n"
+	       " --stroke-length=N          average points per stroke, default 64\n"
+	       " --penup-density=PERCENT    share of pen-up bodies, default 2\n"
+	       " --seed=N                   seed of the generator, default 1\n"
+	       " --threads=N                convert notes with N threads, default 1\n"
+	       " --min-time=SECONDS         time each benchmark at least SECONDS,\n"
+	       "                            default 0.5\n"
+	       " --json=FILE                write results to FILE as JSON\n"
+	       " --baseline=FILE            compare results to the JSON FILE of an\n"
+	       "                            earlier run and fail if any is slower\n"
+	       " --tolerance=PERCENT        allowed slowdown, default 10\n"
+	       " -h, --help                 display this help and exit\n",
+	       program_invocation_name, M210_DEV_MAX_MEMORY,
+	       M210_DEV_MAX_MEMORY);
+}
+
+/* Return the non-negative integer in STR, or -1 if STR is not one. */
+static long parse_count(char const *const str)
+{
+	char *end;
+	long value;
+
+	value = strtol(str, &end, 10);
+	if (end == str || *end != '\0' || value < 0) {
+		return -1;
+	}
+	return value;
+}
+
+/* xorshift64*, good enough for plausible scribbles. */
+static uint32_t bench_random(uint64_t *const statep)
+{
+	*statep ^= *statep >> 12;
+	*statep ^= *statep << 25;
+	*statep ^= *statep >> 27;
+	return (*statep * 2685821657736338717ULL) >> 32;
+}
+
+static int16_t bench_clamp(int const value, int const min, int const max)
+{
+	return value < min ? min : value > max ? max : value;
+}
+
+static void bench_put_body(char *const dst, int16_t const x, int16_t const y)
+{
+	uint16_t const x_le = htole16(x);
+	uint16_t const y_le = htole16(y);
+
+	memcpy(dst, &x_le, 2);
+	memcpy(dst + 2, &y_le, 2);
+}
+
+/*
+  Generate the note stream of DUMP: NOTES notes sharing SIZE bytes,
+  each a random walk of strokes of about STROKE_LENGTH points separated
+  by runs of pen-ups, so that PENUP_DENSITY percent of bodies are
+  pen-ups. The stream is padded to full packets like a download.
+*/
+static int generate_dump(struct bench_dump *const dump)
+{
+	int result = -1;
+	size_t const head_size = sizeof(struct m210_rawnote_head);
+	size_t const body_size = sizeof(struct m210_rawnote_body);
+	size_t const bodyc = ((dump->size - head_size) / dump->notes
+			      - head_size) / body_size;
+	int const penup_run = dump->penup_density ?
+		(dump->stroke_length * dump->penup_density
+		 + 100 - dump->penup_density - 1) / (100 - dump->penup_density)
+		: 0;
+	uint64_t state = dump->seed * 2 + 1;
+	size_t pos = 0;
+	int notei;
+
+	dump->data_size = (dump->notes * (head_size + bodyc * body_size)
+			   + head_size);
+	dump->data_size += (62 - dump->data_size % 62) % 62;
+	dump->data = calloc(1, dump->data_size);
+	if (dump->data == NULL) {
+		perror("error: failed to generate notes");
+		goto out;
+	}
+	dump->points = 0;
+
+	for (notei = 0; notei < dump->notes; ++notei) {
+		struct m210_rawnote_head head;
+		uint32_t const next_pos = htole32(pos + head_size
+						  + bodyc * body_size);
+		size_t left = bodyc;
+
+		memset(&head, 0, sizeof(head));
+		memcpy(head.next_pos, &next_pos, sizeof(head.next_pos));
+		head.state = M210_RAWNOTE_STATE_FINISHED_BY_USER;
+		head.number = notei + 1;
+		head.last_number = dump->notes;
+		memcpy(dump->data + pos, &head, head_size);
+		pos += head_size;
+
+		while (left) {
+			int length = (dump->stroke_length / 2 + 1
+				      + bench_random(&state)
+				      % (dump->stroke_length + 1));
+			int x = bench_random(&state) % 14000 - 7000;
+			int y = bench_random(&state) % 20000;
+			int i;
+
+			for (i = 0; i < length && left; ++i, --left) {
+				x = bench_clamp(x + (int) (bench_random(&state) % 33) - 16,
+						-7000, 7000);
+				y = bench_clamp(y + (int) (bench_random(&state) % 33) - 16,
+						0, 20000);
+				bench_put_body(dump->data + pos, x, y);
+				pos += body_size;
+				++dump->points;
+			}
+			for (i = 0; i < penup_run && left; ++i, --left) {
+				memcpy(dump->data + pos, &M210_RAWNOTE_BODY_PENUP,
+				       body_size);
+				pos += body_size;
+			}
+		}
+	}
+	/* The last head and the padding are zeros already. */
+
+	result = 0;
+out:
+	return result;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Decode every head and body of the stream one at a time. */
+static int bench_read_body(struct bench_dump const *const dump,
+			   struct bench_settings const *const settings)
+{
+	int result = -1;
+	FILE *input = NULL;
+	size_t points = 0;
+	enum m210_err err;
+
+	(void) settings;
+
+	input = fmemopen(dump->data, dump->data_size, "rb");
+	if (input == NULL) {
+		perror("error: failed to open notes");
+		goto out;
+	}
+
+	while (1) {
+		struct m210_note_head head;
+		ssize_t bodyi;
+
+		err = m210_note_read_head(&head, input);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note head");
+			goto out;
+		}
+		if (head.number == 0) {
+			break;
+		}
+		for (bodyi = 0; bodyi < head.bodyc; ++bodyi) {
+			struct m210_note_body body;
+
+			err = m210_note_read_body(&body, input);
+			if (err) {
+				m210_err_perror(err,
+						"error: failed to read note body");
+				goto out;
+			}
+			points += body.pressure;
+		}
+	}
+
+	if (points != dump->points) {
+		fprintf(stderr, "error: decoded %zu points instead of %zu\n",
+			points, dump->points);
+		goto out;
+	}
+
+	result = 0;
+out:
+	if (input) {
+		fclose(input);
+	}
+	return result;
+}
+
+/* Decode the stream in blocks of bodies. */
+static int bench_read_bodies(struct bench_dump const *const dump,
+			     struct bench_settings const *const settings)
+{
+	int result = -1;
+	FILE *input = NULL;
+	enum m210_err err;
+
+	(void) settings;
+
+	input = fmemopen(dump->data, dump->data_size, "rb");
+	if (input == NULL) {
+		perror("error: failed to open notes");
+		goto out;
+	}
+
+	while (1) {
+		struct m210_note_head head;
+		size_t left;
+
+		err = m210_note_read_head(&head, input);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note head");
+			goto out;
+		}
+		if (head.number == 0) {
+			break;
+		}
+		for (left = head.bodyc; left;) {
+			struct m210_note_body bodies[1024];
+			size_t const count = left < 1024 ? left : 1024;
+
+			err = m210_note_read_bodies(bodies, count, input);
+			if (err) {
+				m210_err_perror(err,
+						"error: failed to read note body");
+				goto out;
+			}
+			left -= count;
+		}
+	}
+
+	result = 0;
+out:
+	if (input) {
+		fclose(input);
+	}
+	return result;
+}
+
+/* Convert every note to SVG, discarding the output. */
+static int bench_note_to_svg(struct bench_dump const *const dump,
+			     struct bench_settings const *const settings)
+{
+	int result = -1;
+	FILE *input = NULL;
+	m210_strokes strokes = NULL;
+	struct svg_options options;
+	enum m210_err err;
+
+	memset(&options, 0, sizeof(options));
+	options.threads = settings->threads;
+	options.input_data = dump->data;
+
+	options.output_file = fopen("/dev/null", "w");
+	if (options.output_file == NULL) {
+		perror("error: failed to open /dev/null");
+		goto out;
+	}
+
+	input = fmemopen(dump->data, dump->data_size, "rb");
+	if (input == NULL) {
+		perror("error: failed to open notes");
+		goto out;
+	}
+	options.input_file = input;
+
+	err = m210_strokes_open(&strokes, input);
+	if (err) {
+		m210_err_perror(err, "error: failed to read notes");
+		goto out;
+	}
+
+	while ((result = note_to_svg(strokes, &options)) == 1);
+out:
+	m210_strokes_close(&strokes);
+	if (input) {
+		fclose(input);
+	}
+	if (options.output_file) {
+		fclose(options.output_file);
+	}
+	return result;
+}
+
+/*
+  Run BENCH until MIN_TIME has passed, but at least bench_min_runs
+  times, and record the fastest run.
+*/
+static int bench_run(char const *const name,
+		     int (*const bench)(struct bench_dump const *,
+					struct bench_settings const *),
+		     struct bench_dump const *const dump,
+		     struct bench_settings const *const settings,
+		     struct bench_result *const resultp)
+{
+	double const start = bench_now();
+	int runs = 0;
+
+	snprintf(resultp->name, sizeof(resultp->name), "%s/%d-notes", name,
+		 dump->notes);
+	resultp->dump = dump;
+	resultp->seconds = 0;
+
+	while (runs < bench_min_runs
+	       || bench_now() - start < settings->min_time) {
+		double const run_start = bench_now();
+		double seconds;
+
+		if (bench(dump, settings)) {
+			return -1;
+		}
+		seconds = bench_now() - run_start;
+		if (!runs || seconds < resultp->seconds) {
+			resultp->seconds = seconds;
+		}
+		++runs;
+	}
+
+	printf("%-28s %10.0f points/s %8.1f MB/s\n", resultp->name,
+	       dump->points / resultp->seconds,
+	       dump->data_size / 1e6 / resultp->seconds);
+	return 0;
+}
+
+/*
+  Write RESULTS as JSON. Each result is on a line of its own, which
+  is all read_baseline() relies on.
+*/
+static int write_json(FILE *const file, struct bench_result const *results,
+		      size_t const count, struct bench_dump const *const dump)
+{
+	size_t i;
+
+	fprintf(file, "{\n"
+		"  \"version\": 1,\n"
+		"  \"stroke_length\": %d,\n"
+		"  \"penup_density\": %d,\n"
+		"  \"seed\": %llu,\n"
+		"  \"results\": [\n",
+		dump->stroke_length, dump->penup_density,
+		(unsigned long long) dump->seed);
+	for (i = 0; i < count; ++i) {
+		struct bench_result const *const r = &results[i];
+
+		fprintf(file, "    {\"name\": \"%s\", \"notes\": %d, "
+			"\"size\": %zu, \"points\": %zu, \"seconds\": %.9f, "
+			"\"points_per_s\": %.0f, \"mb_per_s\": %.3f}%s\n",
+			r->name, r->dump->notes, r->dump->data_size,
+			r->dump->points, r->seconds,
+			r->dump->points / r->seconds,
+			r->dump->data_size / 1e6 / r->seconds,
+			i + 1 < count ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+
+	return ferror(file) ? -1 : 0;
+}
+
+/*
+  Compare RESULTS to the baseline in FILE, written by write_json().
+  Return the number of results slower than the baseline by more than
+  TOLERANCE percent, or -1 on error.
+*/
+static int compare_baseline(FILE *const file,
+			    struct bench_result const *const results,
+			    size_t const count, int const tolerance)
+{
+	int slower = 0;
+	char line[512];
+
+	printf("\n%-28s %10s\n", "compared to baseline", "speed");
+
+	while (fgets(line, sizeof(line), file)) {
+		char name[64];
+		char const *rate;
+		double baseline;
+		size_t i;
+
+		if (sscanf(line, " {\"name\": \"%63[^\"]\"", name) != 1) {
+			continue;
+		}
+		rate = strstr(line, "\"points_per_s\": ");
+		if (rate == NULL) {
+			continue;
+		}
+		baseline = strtod(rate + strlen("\"points_per_s\": "), NULL);
+		if (baseline <= 0) {
+			continue;
+		}
+
+		for (i = 0; i < count; ++i) {
+			double ratio;
+
+			if (strcmp(results[i].name, name)) {
+				continue;
+			}
+			ratio = (results[i].dump->points / results[i].seconds
+				 / baseline);
+			printf("%-28s %9.2fx%s\n", name, ratio,
+			       ratio < 1 - tolerance / 100.0 ? " SLOWER" : "");
+			if (ratio < 1 - tolerance / 100.0) {
+				++slower;
+			}
+		}
+	}
+
+	if (ferror(file)) {
+		perror("error: failed to read baseline");
+		return -1;
+	}
+	return slower;
+}
+
+int main(int argc, char **argv)
+{
+	int exitval = EXIT_FAILURE;
+	struct bench_dump dumps[BENCH_DEFAULT_DUMP_COUNT];
+	struct bench_result results[BENCH_DEFAULT_DUMP_COUNT * 3];
+	struct bench_settings settings = {0.5, 1};
+	struct bench_dump params;
+	size_t dump_count = BENCH_DEFAULT_DUMP_COUNT;
+	size_t result_count = 0;
+	FILE *json_file = NULL;
+	FILE *baseline_file = NULL;
+	int tolerance = 10;
+	int custom = 0;
+	size_t i;
+	const struct option opts[] = {
+		{"notes", required_argument, NULL, 'n'},
+		{"size", required_argument, NULL, 's'},
+		{"stroke-length", required_argument, NULL, 'l'},
+		{"penup-density", required_argument, NULL, 'p'},
+		{"seed", required_argument, NULL, 'S'},
+		{"threads", required_argument, NULL, 'j'},
+		{"min-time", required_argument, NULL, 't'},
+		{"json", required_argument, NULL, 'o'},
+		{"baseline", required_argument, NULL, 'b'},
+		{"tolerance", required_argument, NULL, 'T'},
+		{"help", no_argument, NULL, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	memset(dumps, 0, sizeof(dumps));
+	memset(&params, 0, sizeof(params));
+	params.notes = 1;
+	params.size = M210_DEV_MAX_MEMORY;
+	params.stroke_length = 64;
+	params.penup_density = 2;
+	params.seed = 1;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "h", opts, NULL);
+		long value = 0;
+		char *end;
+
+		if (option == -1) {
+			break;
+		}
+
+		if (option != 'h' && option != 't' && option != 'o'
+		    && option != 'b' && option != '?') {
+			value = parse_count(optarg);
+		}
+
+		switch (option) {
+		case 'n':
+			if (value < 1 || value > 255) {
+				fprintf(stderr, "error: invalid note count\n");
+				goto out;
+			}
+			params.notes = value;
+			custom = 1;
+			break;
+		case 's':
+			if (value < 0 || value > M210_DEV_MAX_MEMORY) {
+				fprintf(stderr, "error: invalid size\n");
+				goto out;
+			}
+			params.size = value;
+			custom = 1;
+			break;
+		case 'l':
+			if (value < 1 || value > 65536) {
+				fprintf(stderr, "error: invalid stroke length\n");
+				goto out;
+			}
+			params.stroke_length = value;
+			break;
+		case 'p':
+			if (value < 0 || value > 99) {
+				fprintf(stderr, "error: invalid pen-up density\n");
+				goto out;
+			}
+			params.penup_density = value;
+			break;
+		case 'S':
+			if (value < 0) {
+				fprintf(stderr, "error: invalid seed\n");
+				goto out;
+			}
+			params.seed = value;
+			break;
+		case 'j':
+			if (value < 1) {
+				fprintf(stderr, "error: invalid thread count\n");
+				goto out;
+			}
+			settings.threads = value;
+			break;
+		case 't':
+			settings.min_time = strtod(optarg, &end);
+			if (end == optarg || *end != '\0'
+			    || settings.min_time < 0) {
+				fprintf(stderr, "error: invalid time\n");
+				goto out;
+			}
+			break;
+		case 'o':
+			json_file = fopen(optarg, "w");
+			if (json_file == NULL) {
+				perror("error: failed to open JSON file");
+				goto out;
+			}
+			break;
+		case 'b':
+			baseline_file = fopen(optarg, "r");
+			if (baseline_file == NULL) {
+				perror("error: failed to open baseline");
+				goto out;
+			}
+			break;
+		case 'T':
+			if (value < 0 || value > 100) {
+				fprintf(stderr, "error: invalid tolerance\n");
+				goto out;
+			}
+			tolerance = value;
+			break;
+		case 'h':
+			print_help();
+			exitval = EXIT_SUCCESS;
+			goto out;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (custom) {
+		dump_count = 1;
+		dumps[0] = params;
+	} else {
+		for (i = 0; i < dump_count; ++i) {
+			dumps[i] = params;
+			dumps[i].notes = bench_default_dumps[i].notes;
+			dumps[i].size = bench_default_dumps[i].size;
+		}
+	}
+
+	for (i = 0; i < dump_count; ++i) {
+		size_t const min_size = (dumps[i].notes + 1)
+			* (sizeof(struct m210_rawnote_head)
+			   + sizeof(struct m210_rawnote_body));
+
+		if (dumps[i].size < min_size) {
+			fprintf(stderr, "error: %d notes need at least %zu "
+				"bytes\n", dumps[i].notes, min_size);
+			goto out;
+		}
+		if (generate_dump(&dumps[i])) {
+			goto out;
+		}
+	}
+
+	for (i = 0; i < dump_count; ++i) {
+		if (bench_run("read_body", bench_read_body, &dumps[i],
+			      &settings, &results[result_count++])
+		    || bench_run("read_bodies", bench_read_bodies, &dumps[i],
+				 &settings, &results[result_count++])
+		    || bench_run("note_to_svg", bench_note_to_svg, &dumps[i],
+				 &settings, &results[result_count++])) {
+			goto out;
+		}
+	}
+
+	if (json_file && write_json(json_file, results, result_count,
+				    &params)) {
+		perror("error: failed to write JSON file");
+		goto out;
+	}
+
+	if (baseline_file && compare_baseline(baseline_file, results,
+					      result_count, tolerance)) {
+		goto out;
+	}
+
+	exitval = EXIT_SUCCESS;
+out:
+	for (i = 0; i < BENCH_DEFAULT_DUMP_COUNT; ++i) {
+		free(dumps[i].data);
+	}
+	if (json_file && fclose(json_file) && exitval == EXIT_SUCCESS) {
+		perror("error: failed to close JSON file");
+		exitval = EXIT_FAILURE;
+	}
+	if (baseline_file) {
+		fclose(baseline_file);
+	}
+	return exitval;
+}
@@ -0,0 +1,640 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libm210/simd.h"
+
+#include "curve.h"
+
+/* Newton-Raphson rounds tried before a range is split. */
+#define CURVE_MAX_ITERATIONS 4
+
+/* A range of points still to be fitted, with unit tangents at both
+   ends pointing inwards. */
+struct curve_range {
+	size_t first;
+	size_t last;
+	struct curve_point t1;
+	struct curve_point t2;
+};
+
+/*
+  Sums of the least squares system of a range, see
+  curve_generate(). B1 and B2 are the Bernstein polynomials of the
+  control points and D the distance of a point from the straight
+  interpolation of the end points.
+*/
+struct curve_system {
+	double b11;
+	double b12;
+	double b22;
+	double b1dx;
+	double b1dy;
+	double b2dx;
+	double b2dy;
+};
+
+static inline struct curve_point curve_point_at(struct curve_fit const *const fit,
+						size_t const i)
+{
+	struct curve_point const point = {fit->x[i], fit->y[i]};
+	return point;
+}
+
+static inline struct curve_point curve_unit(double const x, double const y)
+{
+	double const length = sqrt(x * x + y * y);
+	struct curve_point unit = {0.0, 0.0};
+
+	if (length > 0.0) {
+		unit.x = x / length;
+		unit.y = y / length;
+	}
+	return unit;
+}
+
+void curve_fit_init(struct curve_fit *const fit, double const tolerance)
+{
+	memset(fit, 0, sizeof(struct curve_fit));
+	fit->tolerance = tolerance;
+}
+
+void curve_fit_free(struct curve_fit *const fit)
+{
+	free(fit->beziers);
+	free(fit->x);
+	free(fit->y);
+	free(fit->u);
+	free(fit->v);
+	free(fit->ranges);
+	memset(fit, 0, sizeof(struct curve_fit));
+}
+
+static int curve_reserve(struct curve_fit *const fit, size_t const count)
+{
+	size_t capacity = fit->capacity ? fit->capacity : 256;
+
+	if (count <= fit->capacity) {
+		return 0;
+	}
+	while (capacity < count) {
+		capacity *= 2;
+	}
+
+	free(fit->beziers);
+	free(fit->x);
+	free(fit->y);
+	free(fit->u);
+	free(fit->v);
+	free(fit->ranges);
+	fit->beziers = malloc(capacity * sizeof(struct curve_bezier));
+	fit->x = malloc(capacity * sizeof(double));
+	fit->y = malloc(capacity * sizeof(double));
+	fit->u = malloc(capacity * sizeof(double));
+	fit->v = malloc(capacity * sizeof(double));
+	fit->ranges = malloc(capacity * sizeof(struct curve_range));
+	if (!fit->beziers || !fit->x || !fit->y || !fit->u || !fit->v
+	    || !fit->ranges) {
+		fit->capacity = 0;
+		return -1;
+	}
+	fit->capacity = capacity;
+	return 0;
+}
+
+/* Chord length parameterization of the points from FIRST to LAST. */
+static void curve_parameterize(struct curve_fit *const fit, size_t const first,
+			       size_t const last)
+{
+	double *const u = fit->u;
+	double length;
+
+	u[first] = 0.0;
+	for (size_t i = first + 1; i <= last; ++i) {
+		double const dx = fit->x[i] - fit->x[i - 1];
+		double const dy = fit->y[i] - fit->y[i - 1];
+		u[i] = u[i - 1] + sqrt(dx * dx + dy * dy);
+	}
+	length = u[last];
+	for (size_t i = first + 1; i <= last; ++i) {
+		u[i] /= length;
+	}
+}
+
+/*
+  The kernels below work on COUNT points of the coordinate and
+  parameter arrays, in place. Each has a scalar version, which also
+  handles the tail of the SSE2 version, two points at a time.
+*/
+
+static void curve_sums_scalar(double const *const x, double const *const y,
+			      double const *const u, size_t const count,
+			      struct curve_point const p0,
+			      struct curve_point const p3,
+			      struct curve_system *const sums)
+{
+	for (size_t i = 0; i < count; ++i) {
+		double const t = u[i];
+		double const s = 1.0 - t;
+		double const b0 = s * s * s;
+		double const b1 = 3.0 * t * s * s;
+		double const b2 = 3.0 * t * t * s;
+		double const b3 = t * t * t;
+		double const dx = x[i] - (p0.x * (b0 + b1) + p3.x * (b2 + b3));
+		double const dy = y[i] - (p0.y * (b0 + b1) + p3.y * (b2 + b3));
+
+		sums->b11 += b1 * b1;
+		sums->b12 += b1 * b2;
+		sums->b22 += b2 * b2;
+		sums->b1dx += b1 * dx;
+		sums->b1dy += b1 * dy;
+		sums->b2dx += b2 * dx;
+		sums->b2dy += b2 * dy;
+	}
+}
+
+/* Squared distances of the points from BEZIER to V, return the
+   largest. */
+static double curve_errors_scalar(double const *const x,
+				  double const *const y,
+				  double const *const u, double *const v,
+				  size_t const count,
+				  struct curve_bezier const *const bezier)
+{
+	struct curve_point const *const p = bezier->p;
+	double max = 0.0;
+
+	for (size_t i = 0; i < count; ++i) {
+		double const t = u[i];
+		double const s = 1.0 - t;
+		double const b0 = s * s * s;
+		double const b1 = 3.0 * t * s * s;
+		double const b2 = 3.0 * t * t * s;
+		double const b3 = t * t * t;
+		double const dx = (p[0].x * b0 + p[1].x * b1 + p[2].x * b2
+				   + p[3].x * b3 - x[i]);
+		double const dy = (p[0].y * b0 + p[1].y * b1 + p[2].y * b2
+				   + p[3].y * b3 - y[i]);
+
+		v[i] = dx * dx + dy * dy;
+		if (v[i] > max) {
+			max = v[i];
+		}
+	}
+	return max;
+}
+
+/* One Newton-Raphson step towards the parameters of the points of
+   BEZIER closest to the points, clamped to [0, 1]. */
+static void curve_reparameterize_scalar(double const *const x,
+					double const *const y,
+					double *const u, size_t const count,
+					struct curve_bezier const *const bezier)
+{
+	struct curve_point const *const p = bezier->p;
+	/* Control points of the first and second derivatives, scaled
+	 * by 1/3 and 1/6. */
+	double const d1x[3] = {p[1].x - p[0].x, p[2].x - p[1].x,
+			       p[3].x - p[2].x};
+	double const d1y[3] = {p[1].y - p[0].y, p[2].y - p[1].y,
+			       p[3].y - p[2].y};
+	double const d2x[2] = {d1x[1] - d1x[0], d1x[2] - d1x[1]};
+	double const d2y[2] = {d1y[1] - d1y[0], d1y[2] - d1y[1]};
+
+	for (size_t i = 0; i < count; ++i) {
+		double const t = u[i];
+		double const s = 1.0 - t;
+		double const b0 = s * s * s;
+		double const b1 = 3.0 * t * s * s;
+		double const b2 = 3.0 * t * t * s;
+		double const b3 = t * t * t;
+		double const ex = (p[0].x * b0 + p[1].x * b1 + p[2].x * b2
+				   + p[3].x * b3 - x[i]);
+		double const ey = (p[0].y * b0 + p[1].y * b1 + p[2].y * b2
+				   + p[3].y * b3 - y[i]);
+		double const q1x = 3.0 * (d1x[0] * s * s + 2.0 * d1x[1] * t * s
+					  + d1x[2] * t * t);
+		double const q1y = 3.0 * (d1y[0] * s * s + 2.0 * d1y[1] * t * s
+					  + d1y[2] * t * t);
+		double const q2x = 6.0 * (d2x[0] * s + d2x[1] * t);
+		double const q2y = 6.0 * (d2y[0] * s + d2y[1] * t);
+		double const num = ex * q1x + ey * q1y;
+		double const den = q1x * q1x + q1y * q1y + ex * q2x + ey * q2y;
+		double next = den != 0.0 ? t - num / den : t;
+
+		if (next < 0.0) {
+			next = 0.0;
+		} else if (next > 1.0) {
+			next = 1.0;
+		}
+		u[i] = next;
+	}
+}
+
+#ifdef M210_HAVE_SSE2
+
+static inline double curve_sum_lanes(__m128d const value)
+{
+	return _mm_cvtsd_f64(_mm_add_sd(value, _mm_unpackhi_pd(value, value)));
+}
+
+static void curve_sums_sse2(double const *const x, double const *const y,
+			    double const *const u, size_t const count,
+			    struct curve_point const p0,
+			    struct curve_point const p3,
+			    struct curve_system *const sums)
+{
+	__m128d const one = _mm_set1_pd(1.0);
+	__m128d const three = _mm_set1_pd(3.0);
+	__m128d const p0x = _mm_set1_pd(p0.x);
+	__m128d const p0y = _mm_set1_pd(p0.y);
+	__m128d const p3x = _mm_set1_pd(p3.x);
+	__m128d const p3y = _mm_set1_pd(p3.y);
+	__m128d b11 = _mm_setzero_pd();
+	__m128d b12 = _mm_setzero_pd();
+	__m128d b22 = _mm_setzero_pd();
+	__m128d b1dx = _mm_setzero_pd();
+	__m128d b1dy = _mm_setzero_pd();
+	__m128d b2dx = _mm_setzero_pd();
+	__m128d b2dy = _mm_setzero_pd();
+	size_t i;
+
+	for (i = 0; i + 2 <= count; i += 2) {
+		__m128d const t = _mm_loadu_pd(u + i);
+		__m128d const s = one - t;
+		__m128d const b1 = three * t * s * s;
+		__m128d const b2 = three * t * t * s;
+		__m128d const head = s * s * s + b1;
+		__m128d const tail = b2 + t * t * t;
+		__m128d const dx = _mm_loadu_pd(x + i) - (p0x * head + p3x * tail);
+		__m128d const dy = _mm_loadu_pd(y + i) - (p0y * head + p3y * tail);
+
+		b11 += b1 * b1;
+		b12 += b1 * b2;
+		b22 += b2 * b2;
+		b1dx += b1 * dx;
+		b1dy += b1 * dy;
+		b2dx += b2 * dx;
+		b2dy += b2 * dy;
+	}
+
+	sums->b11 += curve_sum_lanes(b11);
+	sums->b12 += curve_sum_lanes(b12);
+	sums->b22 += curve_sum_lanes(b22);
+	sums->b1dx += curve_sum_lanes(b1dx);
+	sums->b1dy += curve_sum_lanes(b1dy);
+	sums->b2dx += curve_sum_lanes(b2dx);
+	sums->b2dy += curve_sum_lanes(b2dy);
+	curve_sums_scalar(x + i, y + i, u + i, count - i, p0, p3, sums);
+}
+
+static double curve_errors_sse2(double const *const x, double const *const y,
+				double const *const u, double *const v,
+				size_t const count,
+				struct curve_bezier const *const bezier)
+{
+	struct curve_point const *const p = bezier->p;
+	__m128d const one = _mm_set1_pd(1.0);
+	__m128d const three = _mm_set1_pd(3.0);
+	__m128d max = _mm_setzero_pd();
+	double lanes[2];
+	double tail_max;
+	size_t i;
+
+	for (i = 0; i + 2 <= count; i += 2) {
+		__m128d const t = _mm_loadu_pd(u + i);
+		__m128d const s = one - t;
+		__m128d const b0 = s * s * s;
+		__m128d const b1 = three * t * s * s;
+		__m128d const b2 = three * t * t * s;
+		__m128d const b3 = t * t * t;
+		__m128d const dx = (_mm_set1_pd(p[0].x) * b0
+				    + _mm_set1_pd(p[1].x) * b1
+				    + _mm_set1_pd(p[2].x) * b2
+				    + _mm_set1_pd(p[3].x) * b3
+				    - _mm_loadu_pd(x + i));
+		__m128d const dy = (_mm_set1_pd(p[0].y) * b0
+				    + _mm_set1_pd(p[1].y) * b1
+				    + _mm_set1_pd(p[2].y) * b2
+				    + _mm_set1_pd(p[3].y) * b3
+				    - _mm_loadu_pd(y + i));
+		__m128d const error = dx * dx + dy * dy;
+
+		_mm_storeu_pd(v + i, error);
+		max = _mm_max_pd(max, error);
+	}
+
+	_mm_storeu_pd(lanes, max);
+	tail_max = curve_errors_scalar(x + i, y + i, u + i, v + i, count - i,
+				       bezier);
+	if (lanes[1] > lanes[0]) {
+		lanes[0] = lanes[1];
+	}
+	return tail_max > lanes[0] ? tail_max : lanes[0];
+}
+
+static void curve_reparameterize_sse2(double const *const x,
+				      double const *const y,
+				      double *const u, size_t const count,
+				      struct curve_bezier const *const bezier)
+{
+	struct curve_point const *const p = bezier->p;
+	__m128d const zero = _mm_setzero_pd();
+	__m128d const one = _mm_set1_pd(1.0);
+	__m128d const two = _mm_set1_pd(2.0);
+	__m128d const three = _mm_set1_pd(3.0);
+	__m128d const six = _mm_set1_pd(6.0);
+	__m128d const d1x[3] = {
+		_mm_set1_pd(p[1].x - p[0].x), _mm_set1_pd(p[2].x - p[1].x),
+		_mm_set1_pd(p[3].x - p[2].x)};
+	__m128d const d1y[3] = {
+		_mm_set1_pd(p[1].y - p[0].y), _mm_set1_pd(p[2].y - p[1].y),
+		_mm_set1_pd(p[3].y - p[2].y)};
+	__m128d const d2x[2] = {d1x[1] - d1x[0], d1x[2] - d1x[1]};
+	__m128d const d2y[2] = {d1y[1] - d1y[0], d1y[2] - d1y[1]};
+	size_t i;
+
+	for (i = 0; i + 2 <= count; i += 2) {
+		__m128d const t = _mm_loadu_pd(u + i);
+		__m128d const s = one - t;
+		__m128d const b0 = s * s * s;
+		__m128d const b1 = three * t * s * s;
+		__m128d const b2 = three * t * t * s;
+		__m128d const b3 = t * t * t;
+		__m128d const ex = (_mm_set1_pd(p[0].x) * b0
+				    + _mm_set1_pd(p[1].x) * b1
+				    + _mm_set1_pd(p[2].x) * b2
+				    + _mm_set1_pd(p[3].x) * b3
+				    - _mm_loadu_pd(x + i));
+		__m128d const ey = (_mm_set1_pd(p[0].y) * b0
+				    + _mm_set1_pd(p[1].y) * b1
+				    + _mm_set1_pd(p[2].y) * b2
+				    + _mm_set1_pd(p[3].y) * b3
+				    - _mm_loadu_pd(y + i));
+		__m128d const q1x = three * (d1x[0] * s * s
+					     + two * d1x[1] * t * s
+					     + d1x[2] * t * t);
+		__m128d const q1y = three * (d1y[0] * s * s
+					     + two * d1y[1] * t * s
+					     + d1y[2] * t * t);
+		__m128d const q2x = six * (d2x[0] * s + d2x[1] * t);
+		__m128d const q2y = six * (d2y[0] * s + d2y[1] * t);
+		__m128d const num = ex * q1x + ey * q1y;
+		__m128d const den = q1x * q1x + q1y * q1y + ex * q2x + ey * q2y;
+		__m128d const nonzero = _mm_cmpneq_pd(den, zero);
+		/* Lanes with a zero denominator keep their parameter. */
+		__m128d const step = _mm_and_pd(nonzero, num / den);
+		__m128d const next = _mm_min_pd(_mm_max_pd(t - step, zero), one);
+
+		_mm_storeu_pd(u + i, next);
+	}
+
+	curve_reparameterize_scalar(x + i, y + i, u + i, count - i, bezier);
+}
+
+#define curve_sums curve_sums_sse2
+#define curve_errors curve_errors_sse2
+#define curve_reparameterize curve_reparameterize_sse2
+#else
+#define curve_sums curve_sums_scalar
+#define curve_errors curve_errors_scalar
+#define curve_reparameterize curve_reparameterize_scalar
+#endif /* M210_HAVE_SSE2 */
+
+/*
+  Fit a curve to the points of RANGE at their parameters by least
+  squares, with the inner control points on the end tangents.
+*/
+static void curve_generate(struct curve_fit const *const fit,
+			   struct curve_range const *const range,
+			   struct curve_bezier *const bezier)
+{
+	size_t const first = range->first;
+	size_t const count = range->last - first + 1;
+	struct curve_point const p0 = curve_point_at(fit, first);
+	struct curve_point const p3 = curve_point_at(fit, range->last);
+	struct curve_point const t1 = range->t1;
+	struct curve_point const t2 = range->t2;
+	struct curve_system sums;
+	double c01;
+	double x0;
+	double x1;
+	double det;
+	double alpha1 = 0.0;
+	double alpha2 = 0.0;
+	double length;
+
+	memset(&sums, 0, sizeof(sums));
+	curve_sums(fit->x + first, fit->y + first, fit->u + first, count, p0,
+		   p3, &sums);
+
+	c01 = sums.b12 * (t1.x * t2.x + t1.y * t2.y);
+	x0 = t1.x * sums.b1dx + t1.y * sums.b1dy;
+	x1 = t2.x * sums.b2dx + t2.y * sums.b2dy;
+	det = sums.b11 * sums.b22 - c01 * c01;
+	if (det != 0.0) {
+		alpha1 = (x0 * sums.b22 - x1 * c01) / det;
+		alpha2 = (sums.b11 * x1 - c01 * x0) / det;
+	}
+
+	/* If the fit puts a control point behind its end point, far
+	 * away from the chord or past the other one along the chord,
+	 * the curve loops. Fall back to a third of the chord then. */
+	length = sqrt((p3.x - p0.x) * (p3.x - p0.x)
+		      + (p3.y - p0.y) * (p3.y - p0.y));
+	if (alpha1 < 1.0e-6 * length || alpha2 < 1.0e-6 * length
+	    || alpha1 > 2.0 * length || alpha2 > 2.0 * length
+	    || ((alpha1 * t1.x - alpha2 * t2.x) * (p3.x - p0.x)
+		+ (alpha1 * t1.y - alpha2 * t2.y) * (p3.y - p0.y))
+	    > length * length) {
+		alpha1 = length / 3.0;
+		alpha2 = length / 3.0;
+	}
+
+	bezier->p[0] = p0;
+	bezier->p[1].x = p0.x + t1.x * alpha1;
+	bezier->p[1].y = p0.y + t1.y * alpha1;
+	bezier->p[2].x = p3.x + t2.x * alpha2;
+	bezier->p[2].y = p3.y + t2.y * alpha2;
+	bezier->p[3] = p3;
+}
+
+/* Largest squared error of the inner points of RANGE and the point
+   where it is. */
+static double curve_max_error(struct curve_fit const *const fit,
+			      struct curve_range const *const range,
+			      struct curve_bezier const *const bezier,
+			      size_t *const split_ptr)
+{
+	size_t const first = range->first + 1;
+	size_t const count = range->last - first;
+	double const max = curve_errors(fit->x + first, fit->y + first,
+					fit->u + first, fit->v + first, count,
+					bezier);
+
+	*split_ptr = first;
+	for (size_t i = first; i < first + count; ++i) {
+		if (fit->v[i] == max) {
+			*split_ptr = i;
+			break;
+		}
+	}
+	return max;
+}
+
+/*
+  Fit a curve to RANGE. Returns 1 if it is within the tolerance,
+  otherwise 0 and the point to split the range at.
+*/
+static int curve_fit_range(struct curve_fit *const fit,
+			   struct curve_range const *const range,
+			   struct curve_bezier *const bezier,
+			   size_t *const split_ptr)
+{
+	double const max_error = fit->tolerance * fit->tolerance;
+	size_t const first = range->first;
+	size_t const count = range->last - first + 1;
+	double error;
+
+	if (count == 2) {
+		struct curve_point const p0 = curve_point_at(fit, first);
+		struct curve_point const p3 = curve_point_at(fit, range->last);
+		double const third = sqrt((p3.x - p0.x) * (p3.x - p0.x)
+					  + (p3.y - p0.y) * (p3.y - p0.y)) / 3.0;
+
+		bezier->p[0] = p0;
+		bezier->p[1].x = p0.x + range->t1.x * third;
+		bezier->p[1].y = p0.y + range->t1.y * third;
+		bezier->p[2].x = p3.x + range->t2.x * third;
+		bezier->p[2].y = p3.y + range->t2.y * third;
+		bezier->p[3] = p3;
+		return 1;
+	}
+
+	curve_parameterize(fit, first, range->last);
+	curve_generate(fit, range, bezier);
+	error = curve_max_error(fit, range, bezier, split_ptr);
+	if (error < max_error) {
+		return 1;
+	}
+
+	/* Close enough to be worth improving the parameters. */
+	if (error < 4.0 * max_error) {
+		for (int i = 0; i < CURVE_MAX_ITERATIONS; ++i) {
+			curve_reparameterize(fit->x + first + 1,
+					     fit->y + first + 1,
+					     fit->u + first + 1, count - 2,
+					     bezier);
+			curve_generate(fit, range, bezier);
+			error = curve_max_error(fit, range, bezier, split_ptr);
+			if (error < max_error) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+  Fit curves to the COUNT points of a stroke. Repeated points are
+  dropped first. Returns 0 on success and -1 if memory runs out.
+*/
+int curve_fit_stroke(struct curve_fit *const fit,
+		     struct m210_note_body const *const points,
+		     size_t const count)
+{
+	size_t point_count = 0;
+	size_t range_count = 0;
+
+	fit->bezier_count = 0;
+	if (count == 0) {
+		return 0;
+	}
+	if (curve_reserve(fit, count)) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (point_count
+		    && fit->x[point_count - 1] == points[i].x
+		    && fit->y[point_count - 1] == points[i].y) {
+			continue;
+		}
+		fit->x[point_count] = points[i].x;
+		fit->y[point_count] = points[i].y;
+		++point_count;
+	}
+
+	fit->start = curve_point_at(fit, 0);
+	if (point_count < 2) {
+		return 0;
+	}
+
+	fit->ranges[0].first = 0;
+	fit->ranges[0].last = point_count - 1;
+	fit->ranges[0].t1 = curve_unit(fit->x[1] - fit->x[0],
+				       fit->y[1] - fit->y[0]);
+	fit->ranges[0].t2 = curve_unit(
+		fit->x[point_count - 2] - fit->x[point_count - 1],
+		fit->y[point_count - 2] - fit->y[point_count - 1]);
+	range_count = 1;
+
+	/* Ranges are disjoint, so there are never more of them, nor
+	 * curves, than points. The left half of a split range is
+	 * pushed last to emit the curves in order. */
+	while (range_count) {
+		struct curve_range const range = fit->ranges[--range_count];
+		struct curve_range *left;
+		struct curve_range *right;
+		struct curve_point center;
+		size_t split;
+
+		if (curve_fit_range(fit, &range,
+				    &fit->beziers[fit->bezier_count], &split)) {
+			++fit->bezier_count;
+			continue;
+		}
+
+		right = &fit->ranges[range_count++];
+		left = &fit->ranges[range_count++];
+		right->first = split;
+		right->last = range.last;
+		right->t2 = range.t2;
+		left->first = range.first;
+		left->last = split;
+		left->t1 = range.t1;
+
+		center = curve_unit(fit->x[split - 1] - fit->x[split + 1],
+				    fit->y[split - 1] - fit->y[split + 1]);
+		if (center.x == 0.0 && center.y == 0.0) {
+			/* The stroke turns back, leave a corner. */
+			left->t2 = curve_unit(fit->x[split - 1] - fit->x[split],
+					      fit->y[split - 1] - fit->y[split]);
+			right->t1 = curve_unit(fit->x[split + 1] - fit->x[split],
+					       fit->y[split + 1] - fit->y[split]);
+		} else {
+			left->t2 = center;
+			right->t1.x = -center.x;
+			right->t1.y = -center.y;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,64 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CURVE_H
+#define CURVE_H
+
+#include <stddef.h>
+
+#include "libm210/note.h"
+
+/*
+  Fitting of piecewise cubic Bézier curves to strokes with Schneider's
+  algorithm ("An Algorithm for Automatically Fitting Digitized
+  Curves", Graphics Gems, 1990): a curve is fitted to the points by
+  least squares and, if some point is farther than TOLERANCE from it,
+  the points are split at the farthest one and both halves are fitted
+  in turn, with a common tangent at the split point.
+*/
+
+struct curve_point {
+	double x;
+	double y;
+};
+
+struct curve_bezier {
+	struct curve_point p[4];
+};
+
+struct curve_fit {
+	double tolerance;
+	/* Result of curve_fit_stroke(): BEZIER_COUNT curves from
+	 * START, each starting where the previous one ends. */
+	struct curve_point start;
+	struct curve_bezier *beziers;
+	size_t bezier_count;
+	/* Scratch, grown as needed and reused from stroke to stroke. */
+	double *x;
+	double *y;
+	double *u;
+	double *v;
+	struct curve_range *ranges;
+	size_t capacity;
+};
+
+void curve_fit_init(struct curve_fit *fit, double tolerance);
+void curve_fit_free(struct curve_fit *fit);
+int curve_fit_stroke(struct curve_fit *fit,
+		     struct m210_note_body const *points, size_t count);
+
+#endif /* CURVE_H */
@@ -0,0 +1,581 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "crc.h"
+#include "rawnote.h"
+
+#define M210_ARCHIVE_LOG_MAGIC "M210LOG"
+#define M210_ARCHIVE_INDEX_MAGIC "M210IDX"
+#define M210_ARCHIVE_MAGIC_SIZE 7
+#define M210_ARCHIVE_LOG_HEADER_SIZE 8
+#define M210_ARCHIVE_INDEX_HEADER_SIZE 16
+
+struct m210_archive {
+	int log_fd;
+	int index_fd;
+	uint8_t const *log;
+	size_t log_size;
+	uint8_t const *index;
+	size_t index_size;
+	size_t count;
+};
+
+/* A note, stored or about to be, in the deduplication table. */
+struct m210_archive_slot {
+	uint8_t const *bodies;
+	uint32_t bodyc;
+	uint32_t hash;
+};
+
+static inline uint32_t m210_archive_le24(uint8_t const *const bytes)
+{
+	return bytes[0] | bytes[1] << 8 | (uint32_t) bytes[2] << 16;
+}
+
+static inline void m210_archive_put_le24(uint8_t *const bytes,
+					 uint32_t const value)
+{
+	bytes[0] = value & 0xff;
+	bytes[1] = (value >> 8) & 0xff;
+	bytes[2] = (value >> 16) & 0xff;
+}
+
+static void m210_archive_unmap(struct m210_archive *const archive_ptr)
+{
+	if (archive_ptr->log) {
+		munmap((void *) archive_ptr->log, archive_ptr->log_size);
+		archive_ptr->log = NULL;
+	}
+	if (archive_ptr->index) {
+		munmap((void *) archive_ptr->index, archive_ptr->index_size);
+		archive_ptr->index = NULL;
+	}
+}
+
+static enum m210_err m210_archive_map_file(int const fd,
+					   uint8_t const **const data_ptr,
+					   size_t *const size_ptr)
+{
+	struct stat st;
+	void *data;
+
+	if (fstat(fd, &st)) {
+		return M210_ERR_SYS;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		return M210_ERR_SYS;
+	}
+
+	*data_ptr = data;
+	*size_ptr = st.st_size;
+	return M210_ERR_OK;
+}
+
+/*
+  Map the log and the index as they are now and check them. A torn
+  entry at the end of the index, left by an interrupted add, is not
+  counted.
+*/
+static enum m210_err m210_archive_map(struct m210_archive *const archive_ptr)
+{
+	enum m210_err err;
+	size_t i;
+
+	m210_archive_unmap(archive_ptr);
+
+	err = m210_archive_map_file(archive_ptr->log_fd, &archive_ptr->log,
+				    &archive_ptr->log_size);
+	if (err) {
+		goto out;
+	}
+	err = m210_archive_map_file(archive_ptr->index_fd,
+				    &archive_ptr->index,
+				    &archive_ptr->index_size);
+	if (err) {
+		goto out;
+	}
+
+	if (archive_ptr->log_size < M210_ARCHIVE_LOG_HEADER_SIZE
+	    || archive_ptr->index_size < M210_ARCHIVE_INDEX_HEADER_SIZE
+	    || memcmp(archive_ptr->log, M210_ARCHIVE_LOG_MAGIC,
+		      M210_ARCHIVE_MAGIC_SIZE)
+	    || archive_ptr->log[7] != M210_ARCHIVE_VERSION
+	    || memcmp(archive_ptr->index, M210_ARCHIVE_INDEX_MAGIC,
+		      M210_ARCHIVE_MAGIC_SIZE)
+	    || archive_ptr->index[7] != M210_ARCHIVE_VERSION) {
+		err = M210_ERR_BAD_ARCHIVE;
+		goto out;
+	}
+
+	archive_ptr->count = ((archive_ptr->index_size
+			       - M210_ARCHIVE_INDEX_HEADER_SIZE)
+			      / sizeof(struct m210_archive_entry));
+
+	for (i = 0; i < archive_ptr->count; ++i) {
+		struct m210_archive_entry const *const entry_ptr =
+			m210_archive_entry(archive_ptr, i);
+		uint64_t const offset = le64toh(entry_ptr->offset);
+		uint32_t const size = le32toh(entry_ptr->size);
+
+		if (offset < M210_ARCHIVE_LOG_HEADER_SIZE
+		    || offset > archive_ptr->log_size
+		    || size > archive_ptr->log_size - offset
+		    || size != (sizeof(struct m210_rawnote_head)
+				+ (uint64_t) le32toh(entry_ptr->bodyc)
+				* sizeof(struct m210_rawnote_body))) {
+			err = M210_ERR_BAD_ARCHIVE;
+			goto out;
+		}
+	}
+out:
+	return err;
+}
+
+/* Open the file NAME in DIR_FD, writing HEADER to it if it is new. */
+static int m210_archive_open_file(int const dir_fd, char const *const name,
+				  void const *const header,
+				  size_t const header_size)
+{
+	int fd;
+	struct stat st;
+
+	fd = openat(dir_fd, name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+		    0644);
+	if (fd == -1) {
+		return -1;
+	}
+
+	if (fstat(fd, &st)
+	    || (st.st_size == 0
+		&& write(fd, header, header_size) != (ssize_t) header_size)) {
+		int const original_errno = errno;
+		close(fd);
+		errno = original_errno;
+		return -1;
+	}
+	return fd;
+}
+
+enum m210_err m210_archive_open(struct m210_archive **const archive_ptr_ptr,
+				char const *const path)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_archive *archive_ptr = NULL;
+	uint8_t log_header[M210_ARCHIVE_LOG_HEADER_SIZE];
+	uint8_t index_header[M210_ARCHIVE_INDEX_HEADER_SIZE];
+	int dir_fd = -1;
+
+	memset(log_header, 0, sizeof(log_header));
+	memcpy(log_header, M210_ARCHIVE_LOG_MAGIC, M210_ARCHIVE_MAGIC_SIZE);
+	log_header[7] = M210_ARCHIVE_VERSION;
+	memset(index_header, 0, sizeof(index_header));
+	memcpy(index_header, M210_ARCHIVE_INDEX_MAGIC, M210_ARCHIVE_MAGIC_SIZE);
+	index_header[7] = M210_ARCHIVE_VERSION;
+
+	archive_ptr = calloc(1, sizeof(struct m210_archive));
+	if (!archive_ptr) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	archive_ptr->log_fd = -1;
+	archive_ptr->index_fd = -1;
+
+	if (mkdir(path, 0755) && errno != EEXIST) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	archive_ptr->log_fd = m210_archive_open_file(
+		dir_fd, M210_ARCHIVE_LOG_NAME, log_header, sizeof(log_header));
+	if (archive_ptr->log_fd == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	archive_ptr->index_fd = m210_archive_open_file(
+		dir_fd, M210_ARCHIVE_INDEX_NAME, index_header,
+		sizeof(index_header));
+	if (archive_ptr->index_fd == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	err = m210_archive_map(archive_ptr);
+out:
+	if (dir_fd != -1) {
+		close(dir_fd);
+	}
+	if (err && archive_ptr) {
+		m210_archive_close(&archive_ptr);
+	}
+	*archive_ptr_ptr = archive_ptr;
+	return err;
+}
+
+void m210_archive_close(struct m210_archive **const archive_ptr_ptr)
+{
+	struct m210_archive *const archive_ptr = *archive_ptr_ptr;
+
+	if (!archive_ptr) {
+		return;
+	}
+
+	m210_archive_unmap(archive_ptr);
+	if (archive_ptr->log_fd != -1) {
+		close(archive_ptr->log_fd);
+	}
+	if (archive_ptr->index_fd != -1) {
+		close(archive_ptr->index_fd);
+	}
+	free(archive_ptr);
+	*archive_ptr_ptr = NULL;
+}
+
+size_t m210_archive_count(struct m210_archive *const archive_ptr)
+{
+	return archive_ptr->count;
+}
+
+struct m210_archive_entry const *m210_archive_entry(
+	struct m210_archive *const archive_ptr, size_t const i)
+{
+	return ((struct m210_archive_entry const *)
+		(archive_ptr->index + M210_ARCHIVE_INDEX_HEADER_SIZE) + i);
+}
+
+void const *m210_archive_record(struct m210_archive *const archive_ptr,
+				size_t const i)
+{
+	return (archive_ptr->log
+		+ le64toh(m210_archive_entry(archive_ptr, i)->offset));
+}
+
+/*
+  Find SLOT_PTR in the open addressing TABLE of TABLE_SIZE slots, a
+  power of two. Return the slot holding the same note, or the empty
+  slot where it belongs.
+*/
+static struct m210_archive_slot *m210_archive_find(
+	struct m210_archive_slot *const table, size_t const table_size,
+	struct m210_archive_slot const *const slot_ptr)
+{
+	size_t i = slot_ptr->hash & (table_size - 1);
+
+	while (table[i].bodies) {
+		if (table[i].hash == slot_ptr->hash
+		    && table[i].bodyc == slot_ptr->bodyc
+		    && !memcmp(table[i].bodies, slot_ptr->bodies,
+			       (size_t) slot_ptr->bodyc
+			       * sizeof(struct m210_rawnote_body))) {
+			break;
+		}
+		i = (i + 1) & (table_size - 1);
+	}
+	return &table[i];
+}
+
+static enum m210_err m210_archive_write(int const fd, void const *const data,
+					size_t size)
+{
+	uint8_t const *bytes = data;
+
+	while (size) {
+		ssize_t const written = write(fd, bytes, size);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return M210_ERR_SYS;
+		}
+		bytes += written;
+		size -= written;
+	}
+	return M210_ERR_OK;
+}
+
+/*
+  Append the notes of the raw note stream RAW_DATA which are not in the
+  archive yet, and set *ADDED_COUNT_PTR to their number. Records are
+  synced to the log before their index entries are written, so an
+  interrupted add never leaves entries pointing to missing records.
+*/
+enum m210_err m210_archive_add(struct m210_archive *const archive_ptr,
+			       void const *const raw_data,
+			       size_t const raw_size,
+			       char const *const device,
+			       size_t *const added_count_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t const *const raw = raw_data;
+	struct m210_archive_slot *table = NULL;
+	size_t table_size = 64;
+	struct m210_archive_entry *entries = NULL;
+	size_t entry_count = 0;
+	size_t entry_capacity = 0;
+	uint64_t log_end;
+	size_t pos = 0;
+	int locked = 0;
+	size_t i;
+
+	*added_count_ptr = 0;
+
+	if (strlen(device) >= M210_ARCHIVE_DEVICE_SIZE) {
+		errno = EINVAL;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	/* One writer at a time, readers do not need to care. */
+	if (flock(archive_ptr->index_fd, LOCK_EX)) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	locked = 1;
+
+	/* Others may have added notes since we mapped the files. */
+	err = m210_archive_map(archive_ptr);
+	if (err) {
+		goto out;
+	}
+	log_end = archive_ptr->log_size;
+
+	/* Notes in the raw stream take at least a head each. */
+	while (table_size < 2 * (archive_ptr->count + raw_size
+				 / sizeof(struct m210_rawnote_head) + 1)) {
+		table_size *= 2;
+	}
+	table = calloc(table_size, sizeof(struct m210_archive_slot));
+	if (!table) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	for (i = 0; i < archive_ptr->count; ++i) {
+		struct m210_archive_entry const *const entry_ptr =
+			m210_archive_entry(archive_ptr, i);
+		struct m210_archive_slot slot;
+
+		slot.bodies = ((uint8_t const *) m210_archive_record(archive_ptr, i)
+			       + sizeof(struct m210_rawnote_head));
+		slot.bodyc = le32toh(entry_ptr->bodyc);
+		slot.hash = le32toh(entry_ptr->hash);
+		*m210_archive_find(table, table_size, &slot) = slot;
+	}
+
+	while (1) {
+		struct m210_rawnote_head head;
+		struct m210_archive_slot slot;
+		struct m210_archive_slot *slot_ptr;
+		struct m210_archive_entry *entry_ptr;
+		size_t const body_pos = pos + sizeof(head);
+		uint32_t next_pos;
+
+		if (raw_size - pos < sizeof(head)) {
+			err = M210_ERR_UNEXPECTED_EOF;
+			goto out;
+		}
+		memcpy(&head, raw + pos, sizeof(head));
+		if (!memcmp(&head, &M210_RAWNOTE_HEAD_LAST, sizeof(head))) {
+			break;
+		}
+
+		next_pos = m210_archive_le24(head.next_pos);
+		if (next_pos < body_pos || next_pos > raw_size
+		    || (next_pos - body_pos) % sizeof(struct m210_rawnote_body)) {
+			err = M210_ERR_BAD_RAWNOTE_HEAD;
+			goto out;
+		}
+
+		slot.bodies = raw + body_pos;
+		slot.bodyc = ((next_pos - body_pos)
+			      / sizeof(struct m210_rawnote_body));
+		slot.hash = m210_crc32c(0, slot.bodies, next_pos - body_pos);
+		pos = next_pos;
+
+		slot_ptr = m210_archive_find(table, table_size, &slot);
+		if (slot_ptr->bodies) {
+			/* Seen before. */
+			continue;
+		}
+		*slot_ptr = slot;
+
+		if (entry_count == entry_capacity) {
+			struct m210_archive_entry *new_entries;
+			entry_capacity = entry_capacity ? entry_capacity * 2 : 16;
+			new_entries = realloc(entries, entry_capacity
+					      * sizeof(struct m210_archive_entry));
+			if (!new_entries) {
+				err = M210_ERR_SYS;
+				goto out;
+			}
+			entries = new_entries;
+		}
+
+		entry_ptr = &entries[entry_count++];
+		memset(entry_ptr, 0, sizeof(struct m210_archive_entry));
+		memcpy(entry_ptr->device, device, strlen(device));
+		entry_ptr->offset = htole64(log_end);
+		entry_ptr->size = htole32(sizeof(head) + next_pos - body_pos);
+		entry_ptr->hash = htole32(slot.hash);
+		entry_ptr->bodyc = htole32(slot.bodyc);
+		entry_ptr->number = head.number;
+		entry_ptr->state = head.state;
+		entry_ptr->time = htole64(time(NULL));
+
+		/* The record does not know where it was downloaded. */
+		m210_archive_put_le24(head.next_pos,
+				      sizeof(head) + next_pos - body_pos);
+		err = m210_archive_write(archive_ptr->log_fd, &head,
+					 sizeof(head));
+		if (err) {
+			goto out;
+		}
+		err = m210_archive_write(archive_ptr->log_fd, slot.bodies,
+					 next_pos - body_pos);
+		if (err) {
+			goto out;
+		}
+		log_end += sizeof(head) + next_pos - body_pos;
+	}
+
+	if (entry_count) {
+		if (fdatasync(archive_ptr->log_fd)) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		/* Drop a torn entry, new ones must stay aligned. */
+		if (ftruncate(archive_ptr->index_fd,
+			      M210_ARCHIVE_INDEX_HEADER_SIZE
+			      + (archive_ptr->count
+				 * sizeof(struct m210_archive_entry)))) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		err = m210_archive_write(archive_ptr->index_fd, entries,
+					 (entry_count
+					  * sizeof(struct m210_archive_entry)));
+		if (err) {
+			goto out;
+		}
+		if (fdatasync(archive_ptr->index_fd)) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		err = m210_archive_map(archive_ptr);
+		if (err) {
+			goto out;
+		}
+	}
+
+	*added_count_ptr = entry_count;
+out:
+	if (locked) {
+		flock(archive_ptr->index_fd, LOCK_UN);
+	}
+	free(entries);
+	free(table);
+	return err;
+}
+
+/*
+  Write the notes of the archive with indices IDS, or all of them if
+  IDS is NULL, as a raw note stream. The bodies are written straight
+  from the mapped log.
+*/
+enum m210_err m210_archive_export(struct m210_archive *const archive_ptr,
+				  size_t const *const ids,
+				  size_t const id_count,
+				  FILE *const raw_file)
+{
+	enum m210_err err = M210_ERR_OK;
+	size_t const count = ids ? id_count : archive_ptr->count;
+	uint64_t pos = 0;
+	size_t i;
+
+	for (i = 0; ids && i < count; ++i) {
+		if (ids[i] >= archive_ptr->count) {
+			errno = EINVAL;
+			err = M210_ERR_SYS;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		size_t const id = ids ? ids[i] : i;
+		struct m210_rawnote_head head;
+		uint8_t const *record;
+		uint32_t size;
+
+		record = m210_archive_record(archive_ptr, id);
+		size = le32toh(m210_archive_entry(archive_ptr, id)->size);
+
+		if (pos + size > 0xffffff) {
+			err = M210_ERR_BAD_RAWNOTE_HEAD;
+			goto out;
+		}
+		memcpy(&head, record, sizeof(head));
+		m210_archive_put_le24(head.next_pos, pos + size);
+
+		if (fwrite(&head, sizeof(head), 1, raw_file) != 1
+		    || (size > sizeof(head)
+			&& fwrite(record + sizeof(head), size - sizeof(head),
+				  1, raw_file) != 1)) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		pos += size;
+	}
+
+	if (fwrite(&M210_RAWNOTE_HEAD_LAST, sizeof(M210_RAWNOTE_HEAD_LAST), 1,
+		   raw_file) != 1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	pos += sizeof(M210_RAWNOTE_HEAD_LAST);
+
+	/* Pad to whole packets, like a download. */
+	while (pos % 62) {
+		if (fputc(0, raw_file) == EOF) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		++pos;
+	}
+out:
+	return err;
+}
@@ -0,0 +1,74 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_ARCHIVE_H
+#define M210_ARCHIVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+/*
+  An archive is a directory of two append-only files. Every distinct
+  note is stored once, however many dumps it appears in. All integers
+  are little-endian.
+
+  M210_ARCHIVE_LOG_NAME:
+    header     8 bytes, "M210LOG" and M210_ARCHIVE_VERSION
+    records    raw note heads, with next_pos relative to the head,
+               each followed by the bodies of the note
+
+  M210_ARCHIVE_INDEX_NAME, meant to be mapped to memory:
+    header     16 bytes, "M210IDX", M210_ARCHIVE_VERSION, 8 zeros
+    entries    struct m210_archive_entry, one per record
+*/
+
+#define M210_ARCHIVE_VERSION 1
+
+#define M210_ARCHIVE_LOG_NAME "notes.log"
+#define M210_ARCHIVE_INDEX_NAME "notes.idx"
+
+#define M210_ARCHIVE_DEVICE_SIZE 16
+
+struct m210_archive_entry {
+	char device[M210_ARCHIVE_DEVICE_SIZE]; /* Zero padded. */
+	uint64_t offset; /* Position of the record in the log. */
+	uint32_t size; /* Size of the record. */
+	uint32_t hash; /* CRC-32C of the bodies. */
+	uint32_t bodyc;
+	uint8_t number;
+	uint8_t state;
+	uint8_t reserved[2];
+	uint64_t time; /* When the note was added, seconds since epoch. */
+} __attribute__((packed));
+
+typedef struct m210_archive *m210_archive;
+
+enum m210_err m210_archive_open(m210_archive *archivep, char const *path);
+void m210_archive_close(m210_archive *archivep);
+enum m210_err m210_archive_add(m210_archive archive, void const *raw_data,
+			       size_t raw_size, char const *device,
+			       size_t *added_countp);
+size_t m210_archive_count(m210_archive archive);
+struct m210_archive_entry const *m210_archive_entry(m210_archive archive,
+						    size_t i);
+void const *m210_archive_record(m210_archive archive, size_t i);
+enum m210_err m210_archive_export(m210_archive archive, size_t const *ids,
+				  size_t id_count, FILE *raw_file);
+
+#endif /* M210_ARCHIVE_H */
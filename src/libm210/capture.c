@@ -0,0 +1,231 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+
+#define M210_CAPTURE_MAGIC "M210CAP"
+#define M210_CAPTURE_MAGIC_SIZE 7
+#define M210_CAPTURE_RECORD_HEAD_SIZE 7
+
+struct m210_capture {
+	FILE *file;
+	int realtime;
+	/* Writer: time of the previous record. Reader: time when the
+	 * previous record was due. */
+	struct timespec clock;
+};
+
+static uint64_t m210_capture_usecs(struct timespec const *const tsp)
+{
+	return (uint64_t) tsp->tv_sec * 1000000 + tsp->tv_nsec / 1000;
+}
+
+static enum m210_err m210_capture_open(struct m210_capture **const capture_ptr_ptr,
+				       FILE *const file,
+				       int const realtime)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_capture *capture_ptr = NULL;
+
+	capture_ptr = malloc(sizeof(struct m210_capture));
+	if (!capture_ptr) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	capture_ptr->file = file;
+	capture_ptr->realtime = realtime;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &capture_ptr->clock) == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	if (err) {
+		free(capture_ptr);
+		capture_ptr = NULL;
+	}
+	*capture_ptr_ptr = capture_ptr;
+	return err;
+}
+
+enum m210_err m210_capture_open_writer(struct m210_capture **const capture_ptr_ptr,
+				       FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t const version = M210_CAPTURE_VERSION;
+
+	if (fwrite(M210_CAPTURE_MAGIC, M210_CAPTURE_MAGIC_SIZE, 1, file) != 1
+	    || fwrite(&version, sizeof(version), 1, file) != 1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	err = m210_capture_open(capture_ptr_ptr, file, 0);
+out:
+	return err;
+}
+
+enum m210_err m210_capture_open_reader(struct m210_capture **const capture_ptr_ptr,
+				       FILE *const file,
+				       int const realtime)
+{
+	enum m210_err err = M210_ERR_OK;
+	char magic[M210_CAPTURE_MAGIC_SIZE];
+	uint8_t version;
+
+	if (fread(magic, sizeof(magic), 1, file) != 1
+	    || fread(&version, sizeof(version), 1, file) != 1) {
+		err = ferror(file) ? M210_ERR_SYS : M210_ERR_BAD_CAPTURE;
+		goto out;
+	}
+
+	if (memcmp(magic, M210_CAPTURE_MAGIC, sizeof(magic))
+	    || version != M210_CAPTURE_VERSION) {
+		err = M210_ERR_BAD_CAPTURE;
+		goto out;
+	}
+
+	err = m210_capture_open(capture_ptr_ptr, file, realtime);
+out:
+	return err;
+}
+
+void m210_capture_close(struct m210_capture **const capture_ptr_ptr)
+{
+	free(*capture_ptr_ptr);
+	*capture_ptr_ptr = NULL;
+}
+
+enum m210_err m210_capture_write(struct m210_capture *const capture_ptr,
+				 struct m210_capture_record *const record_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t head[M210_CAPTURE_RECORD_HEAD_SIZE];
+	struct timespec now;
+	uint64_t delay;
+	uint32_t delay_le;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	delay = (m210_capture_usecs(&now)
+		 - m210_capture_usecs(&capture_ptr->clock));
+	record_ptr->delay = delay > UINT32_MAX ? UINT32_MAX : delay;
+	capture_ptr->clock = now;
+
+	head[0] = record_ptr->type;
+	head[1] = record_ptr->interface;
+	head[2] = record_ptr->size;
+	delay_le = htole32(record_ptr->delay);
+	memcpy(head + 3, &delay_le, sizeof(delay_le));
+
+	if (fwrite(head, sizeof(head), 1, capture_ptr->file) != 1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	if (record_ptr->size
+	    && fwrite(record_ptr->data, record_ptr->size, 1,
+		      capture_ptr->file) != 1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	return err;
+}
+
+/*
+  In realtime mode, records are not returned before they are due:
+  each record is due its delay after the previous one was due. Due
+  times are absolute, so the time spent by the caller between reads
+  does not accumulate as drift.
+*/
+static enum m210_err m210_capture_wait(struct m210_capture *const capture_ptr,
+				       uint32_t const delay)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint64_t const due = (m210_capture_usecs(&capture_ptr->clock)
+			      + delay);
+
+	capture_ptr->clock.tv_sec = due / 1000000;
+	capture_ptr->clock.tv_nsec = (due % 1000000) * 1000;
+
+	if (!capture_ptr->realtime) {
+		goto out;
+	}
+
+	while (1) {
+		int const retval = clock_nanosleep(CLOCK_MONOTONIC,
+						   TIMER_ABSTIME,
+						   &capture_ptr->clock,
+						   NULL);
+		if (retval == 0) {
+			break;
+		}
+		if (retval != EINTR) {
+			errno = retval;
+			err = M210_ERR_SYS;
+			goto out;
+		}
+	}
+out:
+	return err;
+}
+
+enum m210_err m210_capture_read(struct m210_capture *const capture_ptr,
+				struct m210_capture_record *const record_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t head[M210_CAPTURE_RECORD_HEAD_SIZE];
+	uint32_t delay_le;
+
+	if (fread(head, sizeof(head), 1, capture_ptr->file) != 1) {
+		if (ferror(capture_ptr->file)) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		err = M210_ERR_UNEXPECTED_EOF;
+		goto out;
+	}
+
+	record_ptr->type = head[0];
+	record_ptr->interface = head[1];
+	record_ptr->size = head[2];
+	memcpy(&delay_le, head + 3, sizeof(delay_le));
+	record_ptr->delay = le32toh(delay_le);
+
+	if (record_ptr->size
+	    && fread(record_ptr->data, record_ptr->size, 1,
+		     capture_ptr->file) != 1) {
+		err = ferror(capture_ptr->file) ? M210_ERR_SYS
+			: M210_ERR_BAD_CAPTURE;
+		goto out;
+	}
+
+	err = m210_capture_wait(capture_ptr, record_ptr->delay);
+out:
+	return err;
+}
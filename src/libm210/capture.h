@@ -0,0 +1,68 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_CAPTURE_H
+#define M210_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+/*
+  Capture file format:
+
+  HEADER (8 bytes): "M210CAP" followed by a format version byte.
+
+  RECORD (7 + N bytes):
+    type       1 byte, one of M210_CAPTURE_TYPE_*
+    interface  1 byte, USB interface number
+    size       1 byte, N
+    delay      4 bytes, little-endian, microseconds since the
+               previous record (or since the capture was started)
+    data       N bytes, request payload or response bytes
+*/
+
+#define M210_CAPTURE_VERSION 1
+
+#define M210_CAPTURE_TYPE_WRITE   'W'
+#define M210_CAPTURE_TYPE_READ    'R'
+#define M210_CAPTURE_TYPE_TIMEOUT 'T'
+#define M210_CAPTURE_TYPE_ERROR   'E'
+
+#define M210_CAPTURE_MAX_DATA_SIZE 255
+
+typedef struct m210_capture *m210_capture;
+
+struct m210_capture_record {
+	uint8_t type;
+	uint8_t interface;
+	uint8_t size;
+	uint32_t delay;
+	uint8_t data[M210_CAPTURE_MAX_DATA_SIZE];
+};
+
+enum m210_err m210_capture_open_writer(m210_capture *capturep, FILE *file);
+enum m210_err m210_capture_open_reader(m210_capture *capturep, FILE *file,
+				       int realtime);
+void m210_capture_close(m210_capture *capturep);
+enum m210_err m210_capture_write(m210_capture capture,
+				 struct m210_capture_record *recordp);
+enum m210_err m210_capture_read(m210_capture capture,
+				struct m210_capture_record *recordp);
+
+#endif /* M210_CAPTURE_H */
@@ -0,0 +1,330 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "columnar.h"
+#include "note.h"
+
+struct m210_columnar {
+	struct m210_columnar_note *notes;
+	size_t note_count;
+	size_t note_capacity;
+	struct m210_columnar_stroke *strokes;
+	size_t stroke_count;
+	size_t stroke_capacity;
+	struct m210_note_body *bodies;
+	size_t body_count;
+	size_t body_capacity;
+};
+
+/*
+  Make room for COUNT more elements of SIZE bytes in the array at
+  *ARRAY_PTR.
+*/
+static enum m210_err m210_columnar_reserve(void *const array_ptr,
+					   size_t *const capacity_ptr,
+					   size_t const used,
+					   size_t const count,
+					   size_t const size)
+{
+	void **const ptr_ptr = array_ptr;
+	size_t capacity = *capacity_ptr;
+	void *array;
+
+	if (used + count <= capacity) {
+		return M210_ERR_OK;
+	}
+
+	if (!capacity) {
+		capacity = 256;
+	}
+	while (capacity < used + count) {
+		capacity *= 2;
+	}
+
+	array = realloc(*ptr_ptr, capacity * size);
+	if (!array) {
+		return M210_ERR_SYS;
+	}
+	*ptr_ptr = array;
+	*capacity_ptr = capacity;
+	return M210_ERR_OK;
+}
+
+static enum m210_err m210_columnar_read(struct m210_columnar *const col_ptr,
+					FILE *const raw_file)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	while (1) {
+		struct m210_note_head head;
+		struct m210_columnar_note *note_ptr;
+		size_t i;
+		int pen_down = 0;
+
+		err = m210_note_read_head(&head, raw_file);
+		if (err) {
+			goto out;
+		}
+
+		if (head.number == 0) {
+			/* End of note stream. */
+			break;
+		}
+
+		if (head.bodyc < 0) {
+			err = M210_ERR_BAD_RAWNOTE_HEAD;
+			goto out;
+		}
+
+		err = m210_columnar_reserve(&col_ptr->notes,
+					    &col_ptr->note_capacity,
+					    col_ptr->note_count, 1,
+					    sizeof(struct m210_columnar_note));
+		if (err) {
+			goto out;
+		}
+		err = m210_columnar_reserve(&col_ptr->bodies,
+					    &col_ptr->body_capacity,
+					    col_ptr->body_count, head.bodyc,
+					    sizeof(struct m210_note_body));
+		if (err) {
+			goto out;
+		}
+
+		err = m210_note_read_bodies(col_ptr->bodies
+					    + col_ptr->body_count,
+					    head.bodyc, raw_file);
+		if (err) {
+			goto out;
+		}
+
+		note_ptr = &col_ptr->notes[col_ptr->note_count++];
+		memset(note_ptr, 0, sizeof(struct m210_columnar_note));
+		note_ptr->number = head.number;
+		note_ptr->first_point = col_ptr->body_count;
+		note_ptr->point_count = head.bodyc;
+		note_ptr->first_stroke = col_ptr->stroke_count;
+
+		for (i = col_ptr->body_count;
+		     i < col_ptr->body_count + head.bodyc; ++i) {
+			if (!col_ptr->bodies[i].pressure) {
+				pen_down = 0;
+				continue;
+			}
+			if (!pen_down) {
+				struct m210_columnar_stroke *stroke_ptr;
+				err = m210_columnar_reserve(
+					&col_ptr->strokes,
+					&col_ptr->stroke_capacity,
+					col_ptr->stroke_count, 1,
+					sizeof(struct m210_columnar_stroke));
+				if (err) {
+					goto out;
+				}
+				stroke_ptr = &col_ptr->strokes[
+					col_ptr->stroke_count++];
+				stroke_ptr->first_point = i;
+				stroke_ptr->point_count = 0;
+				pen_down = 1;
+			}
+			++col_ptr->strokes[col_ptr->stroke_count - 1].point_count;
+		}
+
+		note_ptr->stroke_count = (col_ptr->stroke_count
+					  - note_ptr->first_stroke);
+		col_ptr->body_count += head.bodyc;
+	}
+out:
+	return err;
+}
+
+static uint64_t m210_columnar_align(uint64_t const offset)
+{
+	return ((offset + M210_COLUMNAR_ALIGNMENT - 1)
+		/ M210_COLUMNAR_ALIGNMENT * M210_COLUMNAR_ALIGNMENT);
+}
+
+/*
+  Write SIZE bytes of DATA at OFFSET, padding the file from *POS_PTR
+  with zeros.
+*/
+static enum m210_err m210_columnar_put(FILE *const file,
+				       uint64_t *const pos_ptr,
+				       uint64_t const offset,
+				       void const *const data,
+				       size_t const size)
+{
+	static uint8_t const zeros[M210_COLUMNAR_ALIGNMENT];
+
+	if (offset > *pos_ptr
+	    && fwrite(zeros, offset - *pos_ptr, 1, file) != 1) {
+		return M210_ERR_SYS;
+	}
+	if (size && fwrite(data, size, 1, file) != 1) {
+		return M210_ERR_SYS;
+	}
+	*pos_ptr = offset + size;
+	return M210_ERR_OK;
+}
+
+static enum m210_err m210_columnar_put_coords(FILE *const file,
+					      uint64_t *const pos_ptr,
+					      uint64_t const offset,
+					      struct m210_note_body const *bodies,
+					      size_t const count,
+					      int const is_y)
+{
+	enum m210_err err;
+	int16_t coords[1024];
+	size_t i;
+
+	err = m210_columnar_put(file, pos_ptr, offset, NULL, 0);
+	for (i = 0; !err && i < count; i += 1024) {
+		size_t const chunk = count - i < 1024 ? count - i : 1024;
+		size_t j;
+
+		for (j = 0; j < chunk; ++j) {
+			coords[j] = htole16(is_y ? bodies[i + j].y
+					    : bodies[i + j].x);
+		}
+		err = m210_columnar_put(file, pos_ptr, *pos_ptr, coords,
+					chunk * sizeof(int16_t));
+	}
+	return err;
+}
+
+static enum m210_err m210_columnar_write_all(struct m210_columnar *const col_ptr,
+					     FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_columnar_header header;
+	size_t const pen_size = (col_ptr->body_count + 7) / 8;
+	uint8_t *pen = NULL;
+	uint64_t pos = 0;
+	size_t i;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, M210_COLUMNAR_MAGIC, M210_COLUMNAR_MAGIC_SIZE);
+	header.version = M210_COLUMNAR_VERSION;
+	header.note_count = col_ptr->note_count;
+	header.stroke_count = col_ptr->stroke_count;
+	header.point_count = col_ptr->body_count;
+	header.notes = m210_columnar_align(sizeof(header));
+	header.strokes = m210_columnar_align(
+		header.notes
+		+ col_ptr->note_count * sizeof(struct m210_columnar_note));
+	header.x = m210_columnar_align(
+		header.strokes
+		+ col_ptr->stroke_count * sizeof(struct m210_columnar_stroke));
+	header.y = m210_columnar_align(
+		header.x + col_ptr->body_count * sizeof(int16_t));
+	header.pen = m210_columnar_align(
+		header.y + col_ptr->body_count * sizeof(int16_t));
+
+	pen = calloc(pen_size ? pen_size : 1, 1);
+	if (!pen) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	for (i = 0; i < col_ptr->body_count; ++i) {
+		pen[i / 8] |= (col_ptr->bodies[i].pressure != 0) << (i % 8);
+	}
+
+	for (i = 0; i < col_ptr->note_count; ++i) {
+		struct m210_columnar_note *const note_ptr = &col_ptr->notes[i];
+		note_ptr->first_point = htole32(note_ptr->first_point);
+		note_ptr->point_count = htole32(note_ptr->point_count);
+		note_ptr->first_stroke = htole32(note_ptr->first_stroke);
+		note_ptr->stroke_count = htole32(note_ptr->stroke_count);
+	}
+	for (i = 0; i < col_ptr->stroke_count; ++i) {
+		struct m210_columnar_stroke *const stroke_ptr =
+			&col_ptr->strokes[i];
+		stroke_ptr->first_point = htole32(stroke_ptr->first_point);
+		stroke_ptr->point_count = htole32(stroke_ptr->point_count);
+	}
+
+	header.note_count = htole32(header.note_count);
+	header.stroke_count = htole32(header.stroke_count);
+	header.point_count = htole32(header.point_count);
+	header.notes = htole64(header.notes);
+	header.strokes = htole64(header.strokes);
+	header.x = htole64(header.x);
+	header.y = htole64(header.y);
+	header.pen = htole64(header.pen);
+
+	err = m210_columnar_put(file, &pos, 0, &header, sizeof(header));
+	if (err) {
+		goto out;
+	}
+	err = m210_columnar_put(file, &pos, le64toh(header.notes),
+				col_ptr->notes,
+				(col_ptr->note_count
+				 * sizeof(struct m210_columnar_note)));
+	if (err) {
+		goto out;
+	}
+	err = m210_columnar_put(file, &pos, le64toh(header.strokes),
+				col_ptr->strokes,
+				(col_ptr->stroke_count
+				 * sizeof(struct m210_columnar_stroke)));
+	if (err) {
+		goto out;
+	}
+	err = m210_columnar_put_coords(file, &pos, le64toh(header.x),
+				       col_ptr->bodies, col_ptr->body_count,
+				       0);
+	if (err) {
+		goto out;
+	}
+	err = m210_columnar_put_coords(file, &pos, le64toh(header.y),
+				       col_ptr->bodies, col_ptr->body_count,
+				       1);
+	if (err) {
+		goto out;
+	}
+	err = m210_columnar_put(file, &pos, le64toh(header.pen), pen,
+				pen_size);
+out:
+	free(pen);
+	return err;
+}
+
+enum m210_err m210_columnar_write(FILE *const raw_file,
+				  FILE *const columnar_file)
+{
+	enum m210_err err;
+	struct m210_columnar col;
+
+	memset(&col, 0, sizeof(col));
+
+	err = m210_columnar_read(&col, raw_file);
+	if (err) {
+		goto out;
+	}
+
+	err = m210_columnar_write_all(&col, columnar_file);
+out:
+	free(col.bodies);
+	free(col.strokes);
+	free(col.notes);
+	return err;
+}
@@ -0,0 +1,93 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_COLUMNAR_H
+#define M210_COLUMNAR_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+/*
+  Columnar note file format, meant to be mmap'ed and read without
+  parsing. All integers are little-endian and every section starts at
+  an offset aligned to M210_COLUMNAR_ALIGNMENT bytes.
+
+  HEADER (64 bytes):
+    magic         7 bytes, "M210COL"
+    version       1 byte, M210_COLUMNAR_VERSION
+    note_count    4 bytes
+    stroke_count  4 bytes
+    point_count   4 bytes, including pen-ups
+    reserved      4 bytes, zero
+    notes         8 bytes, offset of the note table
+    strokes       8 bytes, offset of the stroke table
+    x             8 bytes, offset of the x array
+    y             8 bytes, offset of the y array
+    pen           8 bytes, offset of the pen state bitmap
+
+  NOTE TABLE (note_count * struct m210_columnar_note)
+  STROKE TABLE (stroke_count * struct m210_columnar_stroke)
+  X ARRAY (point_count * int16)
+  Y ARRAY (point_count * int16)
+  PEN STATE BITMAP ((point_count + 7) / 8 bytes): bit i % 8 of byte
+    i / 8 is set if the pen was down at point i, clear if the point
+    is a pen-up.
+
+  Points of all notes are stored back to back in the order they were
+  read from the raw note stream. Strokes are maximal runs of pen-down
+  points.
+*/
+
+#define M210_COLUMNAR_VERSION 1
+
+#define M210_COLUMNAR_MAGIC "M210COL"
+#define M210_COLUMNAR_MAGIC_SIZE 7
+#define M210_COLUMNAR_ALIGNMENT 64
+
+struct m210_columnar_header {
+	char magic[M210_COLUMNAR_MAGIC_SIZE];
+	uint8_t version;
+	uint32_t note_count;
+	uint32_t stroke_count;
+	uint32_t point_count;
+	uint32_t reserved;
+	uint64_t notes;
+	uint64_t strokes;
+	uint64_t x;
+	uint64_t y;
+	uint64_t pen;
+};
+
+struct m210_columnar_note {
+	uint8_t number;
+	uint8_t reserved[3];
+	uint32_t first_point;
+	uint32_t point_count;
+	uint32_t first_stroke;
+	uint32_t stroke_count;
+};
+
+struct m210_columnar_stroke {
+	uint32_t first_point;
+	uint32_t point_count;
+};
+
+enum m210_err m210_columnar_write(FILE *raw_file, FILE *columnar_file);
+
+#endif /* M210_COLUMNAR_H */
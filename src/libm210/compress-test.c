@@ -0,0 +1,340 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Tests of compressed raw note streams, run by `make check'. Streams
+  written by m210_compress_open_writer() must read back as they were
+  written, and malformed LZ streams, built by hand below, must be
+  rejected with M210_ERR_BAD_COMPRESSED.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "crc.h"
+
+static int failures;
+
+static void fail(char const *const name, char const *const what)
+{
+	fprintf(stderr, "FAIL: %s: %s\n", name, what);
+	++failures;
+}
+
+static enum m210_err decode(uint8_t const *const data, size_t const size,
+			    char **const raw_ptr, size_t *const raw_size_ptr)
+{
+	enum m210_err err;
+	FILE *raw_file = open_memstream(raw_ptr, raw_size_ptr);
+
+	if (raw_file == NULL) {
+		return M210_ERR_SYS;
+	}
+	err = m210_compress_decode(data, size, raw_file);
+	if (fclose(raw_file) && !err) {
+		err = M210_ERR_SYS;
+	}
+	return err;
+}
+
+static void test_round_trip(char const *const name,
+			    uint8_t const *const data, size_t const size)
+{
+	char *compressed = NULL;
+	size_t compressed_size = 0;
+	char *raw = NULL;
+	size_t raw_size = 0;
+	FILE *compressed_file = NULL;
+	FILE *file = NULL;
+	enum m210_err err;
+
+	compressed_file = open_memstream(&compressed, &compressed_size);
+	if (compressed_file == NULL) {
+		fail(name, "open_memstream failed");
+		goto out;
+	}
+
+	err = m210_compress_open_writer(&file, compressed_file);
+	if (err) {
+		fail(name, m210_err_strerror(err));
+		goto out;
+	}
+	if (size && fwrite(data, size, 1, file) != 1) {
+		fail(name, "write failed");
+		goto out;
+	}
+	if (fclose(file)) {
+		file = NULL;
+		fail(name, "close failed");
+		goto out;
+	}
+	file = NULL;
+	if (fclose(compressed_file)) {
+		compressed_file = NULL;
+		fail(name, "close failed");
+		goto out;
+	}
+	compressed_file = NULL;
+
+	if (!m210_compress_is_compressed(compressed, compressed_size)) {
+		fail(name, "output is not compressed");
+		goto out;
+	}
+
+	err = decode((uint8_t *) compressed, compressed_size, &raw, &raw_size);
+	if (err) {
+		fail(name, m210_err_strerror(err));
+		goto out;
+	}
+	if (raw_size != size || memcmp(raw, data, size)) {
+		fail(name, "decoded data differs");
+		goto out;
+	}
+
+	/* Truncations past the header must be noticed. */
+	for (size_t cut = 8; cut < compressed_size;
+	     cut += 1 + compressed_size / 64) {
+		char *cut_raw = NULL;
+		size_t cut_raw_size = 0;
+
+		err = decode((uint8_t *) compressed, cut, &cut_raw,
+			     &cut_raw_size);
+		free(cut_raw);
+		if (err != M210_ERR_BAD_COMPRESSED) {
+			fail(name, "truncated stream was accepted");
+			break;
+		}
+	}
+out:
+	if (file) {
+		fclose(file);
+	}
+	if (compressed_file) {
+		fclose(compressed_file);
+	}
+	free(compressed);
+	free(raw);
+}
+
+/*
+  A hand-built LZ stream of one block: a pen moving by (1, 2) at each
+  point, which the delta filter turns into the first point followed by
+  a run of (1, 2) deltas, coded as 8 literals and one overlapping match.
+*/
+
+#define LZ_RAW_SIZE 64
+
+static uint8_t const lz_data[] = {
+	0x8f,					/* 8 literals, long match */
+	0x64, 0x00, 0xc8, 0x00, 0x01, 0x00, 0x02, 0x00,
+	0x04, 0x00,				/* offset */
+	37					/* 15 + 37 + 4 = 56 */
+};
+
+static void lz_raw(uint8_t *const raw)
+{
+	for (int i = 0; i < LZ_RAW_SIZE / 4; ++i) {
+		uint16_t const x = 100 + i;
+		uint16_t const y = 200 + 2 * i;
+
+		raw[4 * i] = x & 0xff;
+		raw[4 * i + 1] = x >> 8;
+		raw[4 * i + 2] = y & 0xff;
+		raw[4 * i + 3] = y >> 8;
+	}
+}
+
+static void put32(uint8_t *const bytes, uint32_t const value)
+{
+	for (int i = 0; i < 4; ++i) {
+		bytes[i] = value >> (8 * i);
+	}
+}
+
+/*
+  Write a stream of one block to STREAM and return its size. The
+  block header fields can be overridden to build malformed streams.
+*/
+static size_t lz_stream(uint8_t *const stream, uint8_t const version,
+			uint32_t const raw_size, uint8_t const *const data,
+			uint32_t const size, uint32_t const crc,
+			int const terminated)
+{
+	size_t pos = 0;
+
+	memcpy(stream, M210_COMPRESS_MAGIC, M210_COMPRESS_MAGIC_SIZE);
+	stream[7] = version;
+	pos = 8;
+
+	put32(stream + pos, raw_size);
+	put32(stream + pos + 4, size);
+	put32(stream + pos + 8, crc);
+	pos += 12;
+	memcpy(stream + pos, data, size);
+	pos += size;
+
+	if (terminated) {
+		memset(stream + pos, 0, 12);
+		pos += 12;
+	}
+	return pos;
+}
+
+static void expect_bad(char const *const name, uint8_t const *const stream,
+		       size_t const size)
+{
+	char *raw = NULL;
+	size_t raw_size = 0;
+
+	if (decode(stream, size, &raw, &raw_size) != M210_ERR_BAD_COMPRESSED) {
+		fail(name, "malformed stream was accepted");
+	}
+	free(raw);
+}
+
+static void test_lz(void)
+{
+	uint8_t raw[LZ_RAW_SIZE];
+	uint8_t data[sizeof(lz_data)];
+	uint8_t stream[256];
+	char *decoded = NULL;
+	size_t decoded_size = 0;
+	uint32_t crc;
+	size_t size;
+
+	lz_raw(raw);
+	crc = m210_crc32c(0, raw, sizeof(raw));
+
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE, lz_data,
+			 sizeof(lz_data), crc, 1);
+	if (decode(stream, size, &decoded, &decoded_size)
+	    || decoded_size != sizeof(raw)
+	    || memcmp(decoded, raw, sizeof(raw))) {
+		fail("lz", "valid stream was not decoded");
+	}
+	free(decoded);
+
+	/* Any single flipped byte must be noticed, from the version to
+	 * the end of the stream, whose size and checksum are not read. */
+	for (size_t i = 7; i < size - 8; ++i) {
+		decoded = NULL;
+		decoded_size = 0;
+		stream[i] ^= 0x5a;
+		if (!decode(stream, size, &decoded, &decoded_size)) {
+			fail("lz flipped byte", "stream was accepted");
+		}
+		stream[i] ^= 0x5a;
+		free(decoded);
+	}
+
+	size = lz_stream(stream, M210_COMPRESS_VERSION + 1, LZ_RAW_SIZE,
+			 lz_data, sizeof(lz_data), crc, 1);
+	expect_bad("lz version", stream, size);
+
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE, lz_data,
+			 sizeof(lz_data), crc, 0);
+	expect_bad("lz unterminated", stream, size);
+
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE, lz_data,
+			 sizeof(lz_data), crc ^ 1, 1);
+	expect_bad("lz checksum", stream, size);
+
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE, lz_data,
+			 sizeof(lz_data) - 1, crc, 1);
+	expect_bad("lz short block", stream, size);
+
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE + 1,
+			 lz_data, sizeof(lz_data), crc, 1);
+	expect_bad("lz short output", stream, size);
+
+	size = lz_stream(stream, M210_COMPRESS_VERSION,
+			 M210_COMPRESS_BLOCK_SIZE + 1, lz_data,
+			 sizeof(lz_data), crc, 1);
+	expect_bad("lz oversized block", stream, size);
+
+	size = lz_stream(stream, M210_COMPRESS_VERSION, 4, lz_data,
+			 sizeof(lz_data), crc, 1);
+	expect_bad("lz data larger than raw", stream, size);
+
+	memcpy(data, lz_data, sizeof(data));
+	data[9] = 0;
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE, data,
+			 sizeof(data), crc, 1);
+	expect_bad("lz zero offset", stream, size);
+
+	memcpy(data, lz_data, sizeof(data));
+	data[9] = 9;
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE, data,
+			 sizeof(data), crc, 1);
+	expect_bad("lz offset before block", stream, size);
+
+	memcpy(data, lz_data, sizeof(data));
+	data[11] = 38;
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE, data,
+			 sizeof(data), crc, 1);
+	expect_bad("lz match past block", stream, size);
+
+	memcpy(data, lz_data, sizeof(data));
+	data[0] = 0xff;
+	size = lz_stream(stream, M210_COMPRESS_VERSION, LZ_RAW_SIZE, data,
+			 sizeof(data), crc, 1);
+	expect_bad("lz literals past data", stream, size);
+}
+
+int main(void)
+{
+	size_t const size = 3 * M210_COMPRESS_BLOCK_SIZE + 1000;
+	uint8_t *const data = malloc(size);
+	uint32_t seed = 1;
+
+	if (data == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	test_lz();
+
+	test_round_trip("empty", data, 0);
+
+	memset(data, 0, size);
+	test_round_trip("zeros", data, size);
+
+	/* Smooth strokes, like the bodies of real notes. */
+	for (size_t i = 0; i + 4 <= size; i += 4) {
+		uint16_t const x = 5000 + (i / 4) % 700;
+		uint16_t const y = 3000 + (i / 4) % 300 * 2;
+
+		memcpy(data + i, &x, 2);
+		memcpy(data + i + 2, &y, 2);
+	}
+	test_round_trip("strokes", data, size);
+
+	/* Incompressible data is stored as is. */
+	for (size_t i = 0; i < size; ++i) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+	test_round_trip("noise", data, size);
+
+	free(data);
+	return failures ? 1 : 0;
+}
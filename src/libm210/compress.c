@@ -0,0 +1,772 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+#include "crc.h"
+
+#define M210_COMPRESS_HEADER_SIZE 8
+#define M210_COMPRESS_BLOCK_HEADER_SIZE 12
+
+/* Block data never grows past this, even if every byte is a literal. */
+#define M210_COMPRESS_MAX_DATA_SIZE (M210_COMPRESS_BLOCK_SIZE		\
+				     + M210_COMPRESS_BLOCK_SIZE / 255 + 16)
+
+#define M210_COMPRESS_MIN_MATCH 4
+#define M210_COMPRESS_MAX_OFFSET 65535
+#define M210_COMPRESS_HASH_BITS 14
+
+#define M210_COMPRESS_ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+#define M210_COMPRESS_ZSTD_MAGIC_SIZE 4
+
+enum m210_compress_format {
+	M210_COMPRESS_FORMAT_RAW,
+	M210_COMPRESS_FORMAT_LZ,
+	M210_COMPRESS_FORMAT_ZSTD
+};
+
+struct m210_compress_writer {
+	FILE *file;
+	size_t used;
+	uint8_t raw[M210_COMPRESS_BLOCK_SIZE];
+	uint8_t filtered[M210_COMPRESS_BLOCK_SIZE];
+	uint8_t data[M210_COMPRESS_MAX_DATA_SIZE];
+	uint32_t table[1 << M210_COMPRESS_HASH_BITS];
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *cctx;
+#endif
+};
+
+struct m210_compress_reader {
+	FILE *file;
+	enum m210_compress_format format;
+	int eof;
+	size_t pos;
+	size_t size;
+	uint8_t raw[M210_COMPRESS_BLOCK_SIZE];
+	uint8_t data[M210_COMPRESS_MAX_DATA_SIZE];
+#ifdef HAVE_ZSTD
+	ZSTD_DCtx *dctx;
+	ZSTD_inBuffer input;
+	size_t frame_left;
+#endif
+};
+
+static inline uint32_t m210_compress_get32(uint8_t const *const bytes)
+{
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return le32toh(value);
+}
+
+static inline uint16_t m210_compress_get16(uint8_t const *const bytes)
+{
+	return bytes[0] | (bytes[1] << 8);
+}
+
+static inline void m210_compress_put16(uint8_t *const bytes,
+				       uint16_t const value)
+{
+	bytes[0] = value & 0xff;
+	bytes[1] = value >> 8;
+}
+
+/* Undo m210_compress_filter() in place. */
+static void m210_compress_unfilter(uint8_t *const data, size_t const size)
+{
+	for (size_t i = 4; i + 1 < size; i += 2) {
+		m210_compress_put16(data + i,
+				    m210_compress_get16(data + i)
+				    + m210_compress_get16(data + i - 4));
+	}
+}
+
+#ifndef HAVE_ZSTD
+
+/*
+  Replace each 16-bit word of IN, from the third on, by its difference
+  to the word four bytes before it. Coordinates of consecutive bodies
+  are four bytes apart, so smooth strokes turn into small values which
+  repeat more often than the coordinates themselves.
+*/
+static void m210_compress_filter(uint8_t *const out, uint8_t const *const in,
+				 size_t const size)
+{
+	memcpy(out, in, size);
+	for (size_t i = 4; i + 1 < size; i += 2) {
+		m210_compress_put16(out + i,
+				    m210_compress_get16(in + i)
+				    - m210_compress_get16(in + i - 4));
+	}
+}
+
+static inline void m210_compress_put32(uint8_t *const bytes,
+				       uint32_t const value)
+{
+	uint32_t const value_le = htole32(value);
+	memcpy(bytes, &value_le, sizeof(value_le));
+}
+
+static inline uint32_t m210_compress_hash(uint8_t const *const bytes)
+{
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return (value * 2654435761U) >> (32 - M210_COMPRESS_HASH_BITS);
+}
+
+static inline uint8_t *m210_compress_put_length(uint8_t *out, size_t length)
+{
+	while (length >= 255) {
+		*out++ = 255;
+		length -= 255;
+	}
+	*out++ = length;
+	return out;
+}
+
+static uint8_t *m210_compress_put_sequence(uint8_t *out,
+					   uint8_t const *const literals,
+					   size_t const literal_count,
+					   size_t const offset,
+					   size_t const match_length)
+{
+	uint8_t *const token = out++;
+
+	*token = (literal_count < 15 ? literal_count : 15) << 4;
+	if (literal_count >= 15) {
+		out = m210_compress_put_length(out, literal_count - 15);
+	}
+	memcpy(out, literals, literal_count);
+	out += literal_count;
+
+	if (match_length) {
+		size_t const length = match_length - M210_COMPRESS_MIN_MATCH;
+		*out++ = offset & 0xff;
+		*out++ = offset >> 8;
+		*token |= length < 15 ? length : 15;
+		if (length >= 15) {
+			out = m210_compress_put_length(out, length - 15);
+		}
+	}
+	return out;
+}
+
+/*
+  Compress SIZE bytes of IN to OUT with greedy hash matching and
+  return the size of the block data. The search skips ahead faster
+  the longer it goes without a match, so incompressible data costs
+  little time.
+*/
+static size_t m210_compress_block(uint8_t *const out, uint8_t const *const in,
+				  size_t const size, uint32_t *const table)
+{
+	uint8_t *op = out;
+	size_t anchor = 0;
+	size_t pos = 0;
+
+	memset(table, 0, sizeof(uint32_t) << M210_COMPRESS_HASH_BITS);
+
+	while (pos + M210_COMPRESS_MIN_MATCH <= size) {
+		uint32_t const hash = m210_compress_hash(in + pos);
+		size_t const candidate = table[hash];
+		size_t length;
+
+		/* Positions are stored plus one, zero is empty. */
+		table[hash] = pos + 1;
+		if (!candidate
+		    || pos - (candidate - 1) > M210_COMPRESS_MAX_OFFSET
+		    || memcmp(in + candidate - 1, in + pos,
+			      M210_COMPRESS_MIN_MATCH)) {
+			pos += 1 + ((pos - anchor) >> 6);
+			continue;
+		}
+
+		length = M210_COMPRESS_MIN_MATCH;
+		while (pos + length < size
+		       && in[candidate - 1 + length] == in[pos + length]) {
+			++length;
+		}
+
+		op = m210_compress_put_sequence(op, in + anchor, pos - anchor,
+						pos - (candidate - 1), length);
+		pos += length;
+		anchor = pos;
+	}
+
+	op = m210_compress_put_sequence(op, in + anchor, size - anchor, 0, 0);
+	return op - out;
+}
+
+#endif
+
+static inline int m210_compress_get_length(uint8_t const **const in_ptr,
+					   uint8_t const *const end,
+					   size_t *const length_ptr)
+{
+	uint8_t byte;
+
+	do {
+		if (*in_ptr == end) {
+			return -1;
+		}
+		byte = *(*in_ptr)++;
+		*length_ptr += byte;
+	} while (byte == 255);
+	return 0;
+}
+
+/*
+  Decompress SIZE bytes of block data IN to exactly RAW_SIZE bytes of
+  OUT. Returns -1 if the block data is malformed.
+*/
+static int m210_compress_unblock(uint8_t *const out, size_t const raw_size,
+				 uint8_t const *in, size_t const size)
+{
+	uint8_t const *const end = in + size;
+	size_t op = 0;
+
+	while (in < end) {
+		uint8_t const token = *in++;
+		size_t literal_count = token >> 4;
+		size_t length = token & 15;
+		size_t offset;
+
+		if (literal_count == 15
+		    && m210_compress_get_length(&in, end, &literal_count)) {
+			return -1;
+		}
+		if (literal_count > (size_t) (end - in)
+		    || literal_count > raw_size - op) {
+			return -1;
+		}
+		memcpy(out + op, in, literal_count);
+		in += literal_count;
+		op += literal_count;
+
+		if (in == end) {
+			break;
+		}
+
+		if (end - in < 2) {
+			return -1;
+		}
+		offset = in[0] | (in[1] << 8);
+		in += 2;
+		if (length == 15
+		    && m210_compress_get_length(&in, end, &length)) {
+			return -1;
+		}
+		length += M210_COMPRESS_MIN_MATCH;
+		if (offset == 0 || offset > op || length > raw_size - op) {
+			return -1;
+		}
+
+		if (offset >= length) {
+			memcpy(out + op, out + op - offset, length);
+			op += length;
+		} else {
+			/* Overlapping match, such as a run of zeros. */
+			while (length--) {
+				out[op] = out[op - offset];
+				++op;
+			}
+		}
+	}
+
+	return op == raw_size ? 0 : -1;
+}
+
+int m210_compress_is_compressed(void const *const data, size_t const size)
+{
+	return ((size >= M210_COMPRESS_MAGIC_SIZE
+		 && !memcmp(data, M210_COMPRESS_MAGIC,
+			    M210_COMPRESS_MAGIC_SIZE))
+		|| (size >= M210_COMPRESS_ZSTD_MAGIC_SIZE
+		    && !memcmp(data, M210_COMPRESS_ZSTD_MAGIC,
+			       M210_COMPRESS_ZSTD_MAGIC_SIZE)));
+}
+
+static int m210_compress_write_fully(FILE *const file, void const *const data,
+				     size_t const size)
+{
+	return fwrite(data, 1, size, file) == size ? 0 : -1;
+}
+
+#ifdef HAVE_ZSTD
+
+static int m210_compress_zstd(struct m210_compress_writer *const writer,
+			      void const *const data, size_t const size,
+			      ZSTD_EndDirective const directive)
+{
+	ZSTD_inBuffer input = {data, size, 0};
+	size_t left;
+
+	do {
+		ZSTD_outBuffer output = {writer->data, sizeof(writer->data), 0};
+
+		left = ZSTD_compressStream2(writer->cctx, &output, &input,
+					    directive);
+		if (ZSTD_isError(left)) {
+			errno = EIO;
+			return -1;
+		}
+		if (m210_compress_write_fully(writer->file, writer->data,
+					      output.pos)) {
+			return -1;
+		}
+	} while (input.pos < input.size
+		 || (directive == ZSTD_e_end && left));
+	return 0;
+}
+
+#else
+
+static int m210_compress_put_block(struct m210_compress_writer *const writer)
+{
+	uint8_t header[M210_COMPRESS_BLOCK_HEADER_SIZE];
+	uint8_t const *data = writer->data;
+	size_t size;
+
+	m210_compress_filter(writer->filtered, writer->raw, writer->used);
+	size = m210_compress_block(writer->data, writer->filtered,
+				   writer->used, writer->table);
+	if (size >= writer->used) {
+		data = writer->raw;
+		size = writer->used;
+	}
+
+	m210_compress_put32(header, writer->used);
+	m210_compress_put32(header + 4, size);
+	m210_compress_put32(header + 8,
+			    m210_crc32c(0, writer->raw, writer->used));
+	writer->used = 0;
+
+	if (m210_compress_write_fully(writer->file, header, sizeof(header))
+	    || m210_compress_write_fully(writer->file, data, size)) {
+		return -1;
+	}
+	return 0;
+}
+
+#endif
+
+static ssize_t m210_compress_write(void *const cookie, char const *const buf,
+				   size_t const size)
+{
+	struct m210_compress_writer *const writer = cookie;
+#ifdef HAVE_ZSTD
+	if (m210_compress_zstd(writer, buf, size, ZSTD_e_continue)) {
+		return -1;
+	}
+#else
+	size_t done = 0;
+
+	while (done < size) {
+		size_t chunk = M210_COMPRESS_BLOCK_SIZE - writer->used;
+
+		if (chunk > size - done) {
+			chunk = size - done;
+		}
+		memcpy(writer->raw + writer->used, buf + done, chunk);
+		writer->used += chunk;
+		done += chunk;
+
+		if (writer->used == M210_COMPRESS_BLOCK_SIZE
+		    && m210_compress_put_block(writer)) {
+			return -1;
+		}
+	}
+#endif
+	return size;
+}
+
+static int m210_compress_close_writer(void *const cookie)
+{
+	struct m210_compress_writer *const writer = cookie;
+	int result = -1;
+#ifdef HAVE_ZSTD
+	if (m210_compress_zstd(writer, NULL, 0, ZSTD_e_end)) {
+		goto out;
+	}
+#else
+	uint8_t end[M210_COMPRESS_BLOCK_HEADER_SIZE];
+
+	if (writer->used && m210_compress_put_block(writer)) {
+		goto out;
+	}
+	memset(end, 0, sizeof(end));
+	if (m210_compress_write_fully(writer->file, end, sizeof(end))) {
+		goto out;
+	}
+#endif
+	if (fflush(writer->file)) {
+		goto out;
+	}
+
+	result = 0;
+out:
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(writer->cctx);
+#endif
+	free(writer);
+	return result;
+}
+
+/*
+  Open a stream to *FILE_PTR_PTR which compresses everything written
+  to it to OUTPUT_FILE. The compressed stream is finished when the
+  stream is closed, OUTPUT_FILE is left open.
+*/
+enum m210_err m210_compress_open_writer(FILE **const file_ptr_ptr,
+					FILE *const output_file)
+{
+	static cookie_io_functions_t const functions = {
+		.write = m210_compress_write,
+		.close = m210_compress_close_writer
+	};
+	enum m210_err err = M210_ERR_SYS;
+	struct m210_compress_writer *writer;
+
+	writer = calloc(1, sizeof(struct m210_compress_writer));
+	if (writer == NULL) {
+		goto out;
+	}
+	writer->file = output_file;
+
+#ifdef HAVE_ZSTD
+	writer->cctx = ZSTD_createCCtx();
+	if (writer->cctx == NULL) {
+		errno = ENOMEM;
+		goto out;
+	}
+#else
+	uint8_t header[M210_COMPRESS_HEADER_SIZE];
+
+	memcpy(header, M210_COMPRESS_MAGIC, M210_COMPRESS_MAGIC_SIZE);
+	header[7] = M210_COMPRESS_VERSION;
+	if (m210_compress_write_fully(output_file, header, sizeof(header))) {
+		goto out;
+	}
+#endif
+
+	*file_ptr_ptr = fopencookie(writer, "w", functions);
+	if (*file_ptr_ptr == NULL) {
+		goto out;
+	}
+	writer = NULL;
+
+	err = M210_ERR_OK;
+out:
+	if (writer) {
+		int const original_errno = errno;
+#ifdef HAVE_ZSTD
+		ZSTD_freeCCtx(writer->cctx);
+#endif
+		free(writer);
+		errno = original_errno;
+	}
+	return err;
+}
+
+/*
+  Read and decompress the next block of the raw stream to the reader.
+  Malformed input is reported as a read error with errno EBADMSG.
+*/
+static int m210_compress_refill(struct m210_compress_reader *const reader)
+{
+	uint8_t header[M210_COMPRESS_BLOCK_HEADER_SIZE];
+	uint32_t raw_size;
+	uint32_t size;
+
+	reader->pos = 0;
+	reader->size = 0;
+
+	if (reader->eof) {
+		return 0;
+	}
+
+	switch (reader->format) {
+	case M210_COMPRESS_FORMAT_RAW:
+		reader->size = fread(reader->raw, 1, sizeof(reader->raw),
+				     reader->file);
+		if (reader->size == 0) {
+			reader->eof = 1;
+			return ferror(reader->file) ? -1 : 0;
+		}
+		return 0;
+	case M210_COMPRESS_FORMAT_ZSTD:
+#ifdef HAVE_ZSTD
+		while (reader->size == 0) {
+			ZSTD_outBuffer output = {reader->raw,
+						 sizeof(reader->raw), 0};
+
+			if (reader->input.pos == reader->input.size) {
+				reader->input.size = fread(reader->data, 1,
+							   sizeof(reader->data),
+							   reader->file);
+				reader->input.pos = 0;
+				if (reader->input.size == 0) {
+					if (ferror(reader->file)) {
+						return -1;
+					}
+					if (reader->frame_left) {
+						errno = EBADMSG;
+						return -1;
+					}
+					reader->eof = 1;
+					return 0;
+				}
+			}
+
+			reader->frame_left = ZSTD_decompressStream(
+				reader->dctx, &output, &reader->input);
+			if (ZSTD_isError(reader->frame_left)) {
+				errno = EBADMSG;
+				return -1;
+			}
+			reader->size = output.pos;
+		}
+		return 0;
+#else
+		errno = ENOTSUP;
+		return -1;
+#endif
+	case M210_COMPRESS_FORMAT_LZ:
+		break;
+	}
+
+	if (fread(header, sizeof(header), 1, reader->file) != 1) {
+		if (!ferror(reader->file)) {
+			errno = EBADMSG;
+		}
+		return -1;
+	}
+
+	raw_size = m210_compress_get32(header);
+	size = m210_compress_get32(header + 4);
+	if (raw_size == 0) {
+		reader->eof = 1;
+		return 0;
+	}
+	if (raw_size > M210_COMPRESS_BLOCK_SIZE || size > raw_size) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	if (fread(size == raw_size ? reader->raw : reader->data, size, 1,
+		  reader->file) != 1) {
+		if (!ferror(reader->file)) {
+			errno = EBADMSG;
+		}
+		return -1;
+	}
+
+	if (size != raw_size) {
+		if (m210_compress_unblock(reader->raw, raw_size, reader->data,
+					  size)) {
+			errno = EBADMSG;
+			return -1;
+		}
+		m210_compress_unfilter(reader->raw, raw_size);
+	}
+
+	if (m210_crc32c(0, reader->raw, raw_size)
+	    != m210_compress_get32(header + 8)) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	reader->size = raw_size;
+	return 0;
+}
+
+static ssize_t m210_compress_read(void *const cookie, char *const buf,
+				  size_t const size)
+{
+	struct m210_compress_reader *const reader = cookie;
+	size_t done = 0;
+
+	while (done < size) {
+		size_t chunk;
+
+		if (reader->pos == reader->size) {
+			if (m210_compress_refill(reader)) {
+				return -1;
+			}
+			if (reader->size == 0) {
+				break;
+			}
+		}
+
+		chunk = reader->size - reader->pos;
+		if (chunk > size - done) {
+			chunk = size - done;
+		}
+		memcpy(buf + done, reader->raw + reader->pos, chunk);
+		reader->pos += chunk;
+		done += chunk;
+	}
+	return done;
+}
+
+static int m210_compress_close_reader(void *const cookie)
+{
+	struct m210_compress_reader *const reader = cookie;
+
+#ifdef HAVE_ZSTD
+	ZSTD_freeDCtx(reader->dctx);
+#endif
+	free(reader);
+	return 0;
+}
+
+/*
+  Open a stream to *FILE_PTR_PTR which reads and decompresses
+  INPUT_FILE. Input which is not compressed is read as is. Reading the
+  stream fails with errno EBADMSG if the input is malformed.
+  INPUT_FILE is left open when the stream is closed.
+*/
+enum m210_err m210_compress_open_reader(FILE **const file_ptr_ptr,
+					FILE *const input_file)
+{
+	static cookie_io_functions_t const functions = {
+		.read = m210_compress_read,
+		.close = m210_compress_close_reader
+	};
+	enum m210_err err = M210_ERR_SYS;
+	struct m210_compress_reader *reader;
+	uint8_t header[M210_COMPRESS_HEADER_SIZE];
+	size_t header_size;
+
+	reader = calloc(1, sizeof(struct m210_compress_reader));
+	if (reader == NULL) {
+		goto out;
+	}
+	reader->file = input_file;
+
+	header_size = fread(header, 1, sizeof(header), input_file);
+	if (header_size < sizeof(header) && ferror(input_file)) {
+		goto out;
+	}
+
+	if (header_size == sizeof(header)
+	    && !memcmp(header, M210_COMPRESS_MAGIC,
+		       M210_COMPRESS_MAGIC_SIZE)) {
+		if (header[7] != M210_COMPRESS_VERSION) {
+			err = M210_ERR_BAD_COMPRESSED;
+			goto out;
+		}
+		reader->format = M210_COMPRESS_FORMAT_LZ;
+	} else if (header_size >= M210_COMPRESS_ZSTD_MAGIC_SIZE
+		   && !memcmp(header, M210_COMPRESS_ZSTD_MAGIC,
+			      M210_COMPRESS_ZSTD_MAGIC_SIZE)) {
+#ifdef HAVE_ZSTD
+		reader->format = M210_COMPRESS_FORMAT_ZSTD;
+		reader->dctx = ZSTD_createDCtx();
+		if (reader->dctx == NULL) {
+			errno = ENOMEM;
+			goto out;
+		}
+		/* The header is the start of the first frame. */
+		memcpy(reader->data, header, header_size);
+		reader->input.src = reader->data;
+		reader->input.size = header_size;
+		reader->input.pos = 0;
+#else
+		errno = ENOTSUP;
+		goto out;
+#endif
+	} else {
+		/* Not compressed, the header is the start of the raw
+		 * stream. */
+		reader->format = M210_COMPRESS_FORMAT_RAW;
+		memcpy(reader->raw, header, header_size);
+		reader->size = header_size;
+	}
+
+	*file_ptr_ptr = fopencookie(reader, "r", functions);
+	if (*file_ptr_ptr == NULL) {
+		goto out;
+	}
+	reader = NULL;
+
+	err = M210_ERR_OK;
+out:
+	if (reader) {
+		int const original_errno = errno;
+		m210_compress_close_reader(reader);
+		errno = original_errno;
+	}
+	return err;
+}
+
+/* Decompress SIZE bytes of compressed DATA to RAW_FILE. */
+enum m210_err m210_compress_decode(void const *const data, size_t const size,
+				   FILE *const raw_file)
+{
+	enum m210_err err = M210_ERR_SYS;
+	FILE *data_file = NULL;
+	FILE *file = NULL;
+
+	data_file = fmemopen((void *) data, size, "rb");
+	if (data_file == NULL) {
+		goto out;
+	}
+
+	err = m210_compress_open_reader(&file, data_file);
+	if (err) {
+		goto out;
+	}
+
+	while (1) {
+		char buffer[65536];
+		size_t const count = fread(buffer, 1, sizeof(buffer), file);
+
+		if (fwrite(buffer, 1, count, raw_file) != count) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		if (count < sizeof(buffer)) {
+			break;
+		}
+	}
+
+	if (ferror(file)) {
+		err = errno == EBADMSG ? M210_ERR_BAD_COMPRESSED : M210_ERR_SYS;
+		goto out;
+	}
+
+	err = M210_ERR_OK;
+out:
+	if (file) {
+		fclose(file);
+	}
+	if (data_file) {
+		fclose(data_file);
+	}
+	return err;
+}
@@ -0,0 +1,72 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_COMPRESS_H
+#define M210_COMPRESS_H
+
+#include <stdio.h>
+
+#include "err.h"
+
+/*
+  Compressed raw note streams. Streams are compressed while they are
+  written and decompressed while they are read, through stdio
+  streams. If libm210 is built with zstd, streams are compressed to
+  zstd frames, otherwise to the built-in LZ format below. Readers tell
+  the formats apart by their magic bytes. All integers are
+  little-endian.
+
+  HEADER (8 bytes):
+    magic      7 bytes, "M210LZC"
+    version    1 byte, M210_COMPRESS_VERSION
+
+  BLOCKS, each holding the next at most M210_COMPRESS_BLOCK_SIZE
+  bytes of the raw stream:
+    raw_size   4 bytes, size of the raw data, 0 ends the stream
+    size       4 bytes, size of the block data, equal to raw_size if
+               the raw data is stored as is
+    crc        4 bytes, CRC-32C of the raw data
+    data       size bytes
+
+  Raw data is compressed after a delta filter: each 16-bit word, from
+  the third on, is replaced by its difference to the word four bytes
+  before it, modulo 2^16. The filtered data is a sequence of LZ77
+  sequences, which never refer outside of the block:
+    token      1 byte, literal count in the high nibble and match
+               length minus 4 in the low nibble; if a nibble is 15,
+               bytes are added to it until a byte is not 255
+    literals   literal count bytes
+    offset     2 bytes, distance back to the start of the match
+  The last sequence of a block has only the token and the literals.
+*/
+
+#define M210_COMPRESS_VERSION 1
+
+#define M210_COMPRESS_MAGIC "M210LZC"
+#define M210_COMPRESS_MAGIC_SIZE 7
+
+#define M210_COMPRESS_BLOCK_SIZE 65536
+
+int m210_compress_is_compressed(void const *data, size_t size);
+enum m210_err m210_compress_open_writer(FILE **file_ptr_ptr,
+					FILE *output_file);
+enum m210_err m210_compress_open_reader(FILE **file_ptr_ptr,
+					FILE *input_file);
+enum m210_err m210_compress_decode(void const *data, size_t size,
+				   FILE *raw_file);
+
+#endif /* M210_COMPRESS_H */
@@ -0,0 +1,130 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "crc.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define M210_CRC32C_HAVE_SSE42 1
+#endif
+
+#define M210_CRC32C_POLY 0x82f63b78 /* Reversed 0x1edc6f41. */
+
+/* Slicing-by-8 tables: table[k][b] is the CRC of byte b followed by
+ * k zero bytes. */
+static uint32_t m210_crc32c_table[8][256];
+
+static void m210_crc32c_init_table(void)
+{
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; ++j) {
+			crc = (crc >> 1) ^ (M210_CRC32C_POLY & -(crc & 1));
+		}
+		m210_crc32c_table[0][i] = crc;
+	}
+
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = m210_crc32c_table[0][i];
+		for (int k = 1; k < 8; ++k) {
+			crc = (crc >> 8) ^ m210_crc32c_table[0][crc & 0xff];
+			m210_crc32c_table[k][i] = crc;
+		}
+	}
+}
+
+static uint32_t m210_crc32c_sw(uint32_t crc, uint8_t const *bytes,
+			       size_t size)
+{
+	while (size >= 8) {
+		uint32_t lo;
+		uint32_t hi;
+
+		memcpy(&lo, bytes, 4);
+		memcpy(&hi, bytes + 4, 4);
+		lo = le32toh(lo) ^ crc;
+		hi = le32toh(hi);
+		crc = (m210_crc32c_table[7][lo & 0xff]
+		       ^ m210_crc32c_table[6][(lo >> 8) & 0xff]
+		       ^ m210_crc32c_table[5][(lo >> 16) & 0xff]
+		       ^ m210_crc32c_table[4][lo >> 24]
+		       ^ m210_crc32c_table[3][hi & 0xff]
+		       ^ m210_crc32c_table[2][(hi >> 8) & 0xff]
+		       ^ m210_crc32c_table[1][(hi >> 16) & 0xff]
+		       ^ m210_crc32c_table[0][hi >> 24]);
+		bytes += 8;
+		size -= 8;
+	}
+
+	while (size--) {
+		crc = (crc >> 8) ^ m210_crc32c_table[0][(crc ^ *bytes++) & 0xff];
+	}
+
+	return crc;
+}
+
+#ifdef M210_CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t m210_crc32c_sse42(uint32_t crc, uint8_t const *bytes,
+				  size_t size)
+{
+	uint64_t crc64 = crc;
+
+	while (size >= 8) {
+		uint64_t word;
+		memcpy(&word, bytes, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		bytes += 8;
+		size -= 8;
+	}
+
+	crc = crc64;
+	while (size--) {
+		crc = _mm_crc32_u8(crc, *bytes++);
+	}
+
+	return crc;
+}
+#endif
+
+static uint32_t (*m210_crc32c_impl)(uint32_t, uint8_t const *, size_t);
+static pthread_once_t m210_crc32c_once = PTHREAD_ONCE_INIT;
+
+static void m210_crc32c_init(void)
+{
+#ifdef M210_CRC32C_HAVE_SSE42
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		m210_crc32c_impl = m210_crc32c_sse42;
+		return;
+	}
+#endif
+	m210_crc32c_init_table();
+	m210_crc32c_impl = m210_crc32c_sw;
+}
+
+uint32_t m210_crc32c(uint32_t const crc, void const *const data,
+		     size_t const size)
+{
+	pthread_once(&m210_crc32c_once, m210_crc32c_init);
+
+	return ~m210_crc32c_impl(~crc, data, size);
+}
@@ -27,7 +27,12 @@
 
 #include "libudev.h"
 
+#include "capture.h"
+#include "crc.h"
 #include "dev.h"
+#include "rawnote.h"
+#include "sum.h"
+#include "trace.h"
 
 #define M210_DEV_READ_INTERVAL 100000 /* Microseconds. */
 #define M210_DEV_RESPONSE_SIZE 64
@@ -38,8 +43,14 @@
 
 #define M210_DEV_MAX_TIMEOUT_RETRIES 5
 
+#define M210_DEV_MAX_ERASE_CHECKS 5
+
 struct m210_dev {
 	int fds[M210_DEV_USB_INTERFACE_COUNT];
+	char paths[M210_DEV_USB_INTERFACE_COUNT][PATH_MAX];
+	m210_capture capture; /* Records the traffic, if not NULL. */
+	m210_capture replay;  /* Replaces the device, if not NULL. */
+	m210_sum sum;         /* Checksums downloaded notes, if not NULL. */
 };
 
 struct m210_dev_packet {
@@ -53,14 +64,113 @@ static struct hidraw_devinfo const DEVINFO_M210 = {
 	0x0101,
 };
 
+static enum m210_err m210_dev_capture(struct m210_dev const *const dev_ptr,
+				      uint8_t const type,
+				      int const interface,
+				      void const *const data,
+				      size_t const data_size)
+{
+	struct m210_capture_record record;
+
+	if (!dev_ptr->capture) {
+		return M210_ERR_OK;
+	}
+
+	record.type = type;
+	record.interface = interface;
+	record.size = (data_size > M210_CAPTURE_MAX_DATA_SIZE
+		       ? M210_CAPTURE_MAX_DATA_SIZE : data_size);
+	if (record.size) {
+		memcpy(record.data, data, record.size);
+	}
+
+	return m210_capture_write(dev_ptr->capture, &record);
+}
+
+static enum m210_err m210_dev_replay_write(struct m210_dev const *const dev_ptr,
+					   uint8_t const *const bytes,
+					   size_t const bytes_size)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_capture_record record;
+
+	err = m210_capture_read(dev_ptr->replay, &record);
+	if (err) {
+		goto out;
+	}
+
+	if (record.type != M210_CAPTURE_TYPE_WRITE
+	    || record.interface != 0
+	    || record.size != bytes_size
+	    || memcmp(record.data, bytes, bytes_size)) {
+		err = M210_ERR_CAPTURE_MISMATCH;
+		goto out;
+	}
+out:
+	return err;
+}
+
+static enum m210_err m210_dev_replay_read(struct m210_dev const *const dev_ptr,
+					  int const interface,
+					  void *const response,
+					  size_t const response_size)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_capture_record record;
+
+	err = m210_capture_read(dev_ptr->replay, &record);
+	if (err) {
+		if (err == M210_ERR_UNEXPECTED_EOF) {
+			/* The captured session has ended, from now on
+			 * the device just keeps quiet. */
+			err = M210_ERR_DEV_TIMEOUT;
+		}
+		goto out;
+	}
+
+	if (record.interface != interface) {
+		err = M210_ERR_CAPTURE_MISMATCH;
+		goto out;
+	}
+
+	switch (record.type) {
+	case M210_CAPTURE_TYPE_READ:
+		memset(response, 0, response_size);
+		memcpy(response, record.data,
+		       record.size < response_size ? record.size : response_size);
+		break;
+	case M210_CAPTURE_TYPE_TIMEOUT:
+		err = M210_ERR_DEV_TIMEOUT;
+		break;
+	case M210_CAPTURE_TYPE_ERROR:
+		errno = EIO;
+		err = M210_ERR_SYS;
+		break;
+	default:
+		err = M210_ERR_CAPTURE_MISMATCH;
+		break;
+	}
+out:
+	return err;
+}
+
 static enum m210_err m210_dev_write(struct m210_dev const *const dev_ptr,
 				    uint8_t const *const bytes,
 				    size_t const bytes_size)
 {
 	enum m210_err err = M210_ERR_OK;
 	size_t const request_size = bytes_size + 3;
-	uint8_t *request = malloc(request_size);
+	uint8_t *request = NULL;
+
+	if (dev_ptr->replay) {
+		err = m210_dev_replay_write(dev_ptr, bytes, bytes_size);
+		if (err) {
+			goto out;
+		}
+		goto capture;
+	}
 
+	request = malloc(request_size);
 	if (request == NULL) {
 		err = M210_ERR_SYS;
 		goto out;
@@ -79,6 +189,9 @@ static enum m210_err m210_dev_write(struct m210_dev const *const dev_ptr,
 		goto out;
 	}
 
+capture:
+	err = m210_dev_capture(dev_ptr, M210_CAPTURE_TYPE_WRITE, 0,
+			       bytes, bytes_size);
 out:
 	free(request);
 	return err;
@@ -92,7 +205,14 @@ static enum m210_err m210_dev_read(struct m210_dev const *const dev_ptr,
 	enum m210_err err = M210_ERR_OK;
 	fd_set readfds;
 	int const fd = dev_ptr->fds[interface];
-	static struct timeval select_interval;
+	struct timeval select_interval;
+	ssize_t read_size = response_size;
+
+	if (dev_ptr->replay) {
+		err = m210_dev_replay_read(dev_ptr, interface, response,
+					   response_size);
+		goto capture;
+	}
 
 	memset(&select_interval, 0, sizeof(struct timeval));
 	FD_ZERO(&readfds);
@@ -103,20 +223,40 @@ static enum m210_err m210_dev_read(struct m210_dev const *const dev_ptr,
 	switch (select(fd + 1, &readfds, NULL, NULL, &select_interval)) {
 	case 0:
 		err = M210_ERR_DEV_TIMEOUT;
-		goto out;
+		goto capture;
 	case -1:
 		err = M210_ERR_SYS;
-		goto out;
+		goto capture;
 	default:
 		break;
 	}
 
-	if (read(fd, response, response_size) == -1) {
+	read_size = read(fd, response, response_size);
+	if (read_size == -1) {
 		err = M210_ERR_SYS;
-		goto out;
+		goto capture;
 	}
 
-out:
+capture:
+	switch (err) {
+	case M210_ERR_OK:
+		err = m210_dev_capture(dev_ptr, M210_CAPTURE_TYPE_READ,
+				       interface, response, read_size);
+		break;
+	case M210_ERR_DEV_TIMEOUT:
+		m210_dev_capture(dev_ptr, M210_CAPTURE_TYPE_TIMEOUT,
+				 interface, NULL, 0);
+		break;
+	case M210_ERR_SYS: {
+		int const original_errno = errno;
+		m210_dev_capture(dev_ptr, M210_CAPTURE_TYPE_ERROR,
+				 interface, NULL, 0);
+		errno = original_errno;
+		break;
+	}
+	default:
+		break;
+	}
 	return err;
 }
 
@@ -214,19 +354,20 @@ static enum m210_err m210_dev_reject_download(struct m210_dev const *const dev_p
 	return m210_dev_write(dev_ptr, bytes, sizeof(bytes));
 }
 
-static enum m210_err m210_dev_connect_hidraw(struct m210_dev *const dev_ptr,
-					     char *const *const hidraw_path_ptrs)
+static enum m210_err m210_dev_connect_hidraw(struct m210_dev *const dev_ptr)
 {
 	enum m210_err err = M210_ERR_OK;
 	int fds[M210_DEV_USB_INTERFACE_COUNT];
+	size_t fd_count = 0;
 
 	for (size_t i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
 		struct hidraw_devinfo devinfo;
-		int fd = open(hidraw_path_ptrs[i], O_RDWR);
+		int fd = open(dev_ptr->paths[i], O_RDWR);
 		if (fd == -1) {
 			err = M210_ERR_SYS;
 			goto out;
 		}
+		fds[fd_count++] = fd;
 
 		if (ioctl(fd, HIDIOCGRAWINFO, &devinfo)) {
 			err = M210_ERR_SYS;
@@ -238,17 +379,40 @@ static enum m210_err m210_dev_connect_hidraw(struct m210_dev *const dev_ptr,
 			err = M210_ERR_BAD_DEV;
 			goto out;
 		}
-
-		fds[i] = fd;
 	}
 
 out:
-	if (!err) {
+	if (err) {
+		int const original_errno = errno;
+		for (size_t i = 0; i < fd_count; ++i) {
+			close(fds[i]);
+		}
+		errno = original_errno;
+	} else {
 		memcpy(dev_ptr->fds, fds, sizeof(fds));
 	}
 	return err;
 }
 
+static enum m210_err m210_dev_find_hidraw_devnodes(struct m210_dev *const dev_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	M210_TRACE_BEGIN("udev lookup");
+	for (size_t i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
+		memset(dev_ptr->paths[i], 0, PATH_MAX);
+
+		err = m210_dev_find_hidraw_devnode(i, dev_ptr->paths[i],
+						   PATH_MAX);
+		if (err) {
+			goto out;
+		}
+	}
+out:
+	M210_TRACE_END("udev lookup");
+	return err;
+}
+
 /*
   Download request can be used for two purposes:
 
@@ -288,6 +452,7 @@ static enum m210_err m210_dev_begin_download(struct m210_dev const *const dev_pt
 	enum m210_err err = M210_ERR_OK;
 	int timeout_retries = 0;
 
+	M210_TRACE_BEGIN("begin download");
 	while (timeout_retries < M210_DEV_MAX_TIMEOUT_RETRIES) {
 		err = m210_dev_write(dev_ptr, bytes, sizeof(bytes));
 		if (err) {
@@ -341,6 +506,7 @@ out:
 			m210_dev_reject_download(dev_ptr);
 		}
 	}
+	M210_TRACE_END("begin download");
 	return err;
 }
 
@@ -359,25 +525,51 @@ enum m210_err m210_dev_connect(struct m210_dev **const dev_ptr_ptr)
 {
 	struct m210_dev *dev_ptr = NULL;
 	enum m210_err err = M210_ERR_OK;
-	char iface0_path[PATH_MAX];
-	char iface1_path[PATH_MAX];
-	char *paths[M210_DEV_USB_INTERFACE_COUNT] = {iface0_path, iface1_path};
 
 	dev_ptr = malloc(sizeof(struct m210_dev));
 	if (!dev_ptr) {
 		err = M210_ERR_SYS;
 		goto out;
 	}
+	dev_ptr->capture = NULL;
+	dev_ptr->replay = NULL;
+	dev_ptr->sum = NULL;
 
-	for (size_t i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
-		memset(paths[i], 0, PATH_MAX);
+	err = m210_dev_find_hidraw_devnodes(dev_ptr);
+	if (err) {
+		goto out;
+	}
 
-		err = m210_dev_find_hidraw_devnode(i, paths[i], PATH_MAX);
-		if (err) {
-			goto out;
-		}
+	err = m210_dev_connect_hidraw(dev_ptr);
+out:
+	if (err) {
+		free(dev_ptr);
+		dev_ptr = NULL;
+	}
+	*dev_ptr_ptr = dev_ptr;
+	return err;
+}
+
+enum m210_err m210_dev_connect_replay(struct m210_dev **const dev_ptr_ptr,
+				     FILE *const file,
+				     int const realtime)
+{
+	struct m210_dev *dev_ptr = NULL;
+	enum m210_err err = M210_ERR_OK;
+
+	dev_ptr = malloc(sizeof(struct m210_dev));
+	if (!dev_ptr) {
+		err = M210_ERR_SYS;
+		goto out;
 	}
-	err = m210_dev_connect_hidraw(dev_ptr, paths);
+
+	for (size_t i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
+		dev_ptr->fds[i] = -1;
+	}
+	dev_ptr->capture = NULL;
+	dev_ptr->sum = NULL;
+
+	err = m210_capture_open_reader(&dev_ptr->replay, file, realtime);
 out:
 	if (err) {
 		free(dev_ptr);
@@ -397,16 +589,73 @@ enum m210_err m210_dev_disconnect(struct m210_dev **const dev_ptr_ptr)
 	}
 
 	for (int i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
-		if (close(dev_ptr->fds[i]) == -1) {
+		if (dev_ptr->fds[i] != -1 && close(dev_ptr->fds[i]) == -1) {
 			err = M210_ERR_SYS;
 		}
 	}
+	m210_capture_close(&dev_ptr->capture);
+	m210_capture_close(&dev_ptr->replay);
 	free(dev_ptr);
 	*dev_ptr_ptr = NULL;
 out:
 	return err;
 }
 
+/*
+  Reopen the device, for example after it has been unplugged and
+  plugged back in. The hidraw device nodes found when the device was
+  connected are tried first, udev is consulted only if they do not
+  lead to the device anymore.
+*/
+enum m210_err m210_dev_reconnect(struct m210_dev *const dev_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	if (dev_ptr->replay) {
+		goto out;
+	}
+
+	for (int i = 0; i < M210_DEV_USB_INTERFACE_COUNT; ++i) {
+		if (dev_ptr->fds[i] != -1) {
+			close(dev_ptr->fds[i]);
+			dev_ptr->fds[i] = -1;
+		}
+	}
+
+	err = m210_dev_connect_hidraw(dev_ptr);
+	if (!err) {
+		goto out;
+	}
+
+	err = m210_dev_find_hidraw_devnodes(dev_ptr);
+	if (err) {
+		goto out;
+	}
+
+	err = m210_dev_connect_hidraw(dev_ptr);
+out:
+	return err;
+}
+
+enum m210_err m210_dev_set_capture(struct m210_dev *const dev_ptr,
+				   FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	m210_capture_close(&dev_ptr->capture);
+
+	if (file) {
+		err = m210_capture_open_writer(&dev_ptr->capture, file);
+	}
+
+	return err;
+}
+
+void m210_dev_set_sum(struct m210_dev *const dev_ptr, m210_sum const sum)
+{
+	dev_ptr->sum = sum;
+}
+
 /*
   Return the total size of notes in bytes. Theoretical maximum size
   is 4063232:
@@ -449,6 +698,7 @@ enum m210_err m210_dev_get_info(struct m210_dev *const dev_ptr,
 	uint8_t response[M210_DEV_RESPONSE_SIZE];
 	uint32_t used_memory = 0;
 
+	M210_TRACE_BEGIN("info exchange");
 	err = m210_dev_write(dev_ptr, bytes, sizeof(bytes));
 	if (err) {
 		goto out;
@@ -486,6 +736,7 @@ enum m210_err m210_dev_get_info(struct m210_dev *const dev_ptr,
 	info_ptr->used_memory = used_memory;
 
 out:
+	M210_TRACE_END("info exchange");
 	return err;
 }
 
@@ -495,110 +746,1064 @@ enum m210_err m210_dev_delete_notes(struct m210_dev *const dev_ptr)
 	return m210_dev_write(dev_ptr, bytes, sizeof(bytes));
 }
 
-static enum m210_err m210_dev_download(struct m210_dev const *const dev_ptr,
-				       uint16_t packet_count,
-				       uint16_t *const lost_nums,
-				       FILE *const file)
+/*
+  Delete notes and confirm that they are gone by querying the packet
+  count until it drops to zero. The device does not acknowledge the
+  delete request, so this is the only way to know it was carried out.
+*/
+enum m210_err m210_dev_erase_notes(struct m210_dev *const dev_ptr)
 {
 	enum m210_err err = M210_ERR_OK;
-	uint16_t lost_count = 0;
+	uint16_t packet_count = 0;
 
-	for (int i = 0; i < packet_count; ++i) {
-		struct m210_dev_packet packet;
-		uint16_t const expected_packet_number = i + 1;
+	err = m210_dev_delete_notes(dev_ptr);
+	if (err) {
+		goto out;
+	}
 
-		err = m210_dev_read_packet(dev_ptr, &packet);
+	for (int i = 0; i < M210_DEV_MAX_ERASE_CHECKS; ++i) {
+		err = m210_dev_begin_download(dev_ptr, &packet_count);
+		if (err) {
+			goto out;
+		}
+
+		err = m210_dev_reject_download(dev_ptr);
 		if (err) {
 			goto out;
 		}
 
-		if (packet.num != expected_packet_number) {
-			lost_nums[lost_count++] = expected_packet_number;
+		if (packet_count == 0) {
+			goto out;
 		}
 
-		if (!lost_count) {
-			if (fwrite(packet.data, sizeof(packet.data), 1,
-				   file) != 1) {
-				err = M210_ERR_SYS;
-				goto out;
-			}
+		if (!dev_ptr->replay) {
+			usleep(M210_DEV_READ_INTERVAL);
 		}
 	}
+	err = M210_ERR_NOT_ERASED;
+out:
+	return err;
+}
 
-	while (lost_count > 0) {
-		struct m210_dev_packet packet;
-
-		uint8_t resend_request[] = {0xb7, 0x00};
-		resend_request[1] = htobe16(lost_nums[0]);
-
-		err = m210_dev_write(dev_ptr, resend_request,
-				     sizeof(resend_request));
-		if (err) {
-			goto out;
-		}
+/*
+  In tablet mode, the device reports pen events from the interface 1:
+
+  Byte  Description
+  ====================================
+  0     0x40: battery state unknown, 0x41: battery low,
+        0x42: battery good, other values are not pen events
+  1     bit 0: pen tip pressed, bit 1: pen button pressed
+  2-3   X coordinate (little-endian, signed)
+  4-5   Y coordinate (little-endian)
+
+  X and Y are both zero when the pen leaves the range of the
+  device.
+*/
+enum m210_err m210_dev_read_pen(struct m210_dev *const dev_ptr,
+				struct m210_dev_pen *const pen_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t response[M210_DEV_RESPONSE_SIZE];
+	int16_t x;
+	int16_t y;
 
-		err = m210_dev_read_packet(dev_ptr, &packet);
+	while (1) {
+		memset(response, 0, sizeof(response));
+		err = m210_dev_read(dev_ptr, 1, response, sizeof(response));
 		if (err) {
 			goto out;
 		}
 
-		if (packet.num == lost_nums[0]) {
-			lost_nums[0] = lost_nums[--lost_count];
-			if (fwrite(packet.data, sizeof(packet.data), 1,
-				   file) != 1) {
-				err = M210_ERR_SYS;
-				goto out;
-			}
+		if (response[0] == M210_DEV_PEN_BATTERY_UNKNOWN
+		    || response[0] == M210_DEV_PEN_BATTERY_LOW
+		    || response[0] == M210_DEV_PEN_BATTERY_GOOD) {
+			break;
 		}
 	}
+
+	memcpy(&x, response + 2, 2);
+	memcpy(&y, response + 4, 2);
+
+	pen_ptr->x = le16toh(x);
+	pen_ptr->y = le16toh(y);
+	pen_ptr->in_range = pen_ptr->x || pen_ptr->y;
+	pen_ptr->tip = pen_ptr->in_range && (response[1] & 0x01);
+	pen_ptr->button = pen_ptr->in_range && (response[1] & 0x02);
+	pen_ptr->battery = response[0];
 out:
 	return err;
 }
 
-enum m210_err m210_dev_download_notes(struct m210_dev *const dev_ptr, FILE *file)
+/*
+  Checkpoint file format (all integers little-endian):
+
+  HEADER (20 bytes):
+    magic             7 bytes, "M210CKP"
+    version           1 byte
+    packet_count      2 bytes, as reported by the device
+    validation_count  2 bytes, number of packets covered by the
+                      validation checksum
+    validation_crc    4 bytes, CRC-32C of the data of the first
+                      validation_count packets
+    flags             1 byte, bit 0 is set if validation_crc has been
+                      computed, i.e. the first packets have been
+                      received
+    reserved          3 bytes, 0
+
+  BITMAP (ceil(packet_count / 8) bytes): bit (N - 1) is set if packet
+  N has been received.
+
+  DATA (packet_count * 62 bytes): packet N is stored at offset
+  (N - 1) * 62.
+
+  Packet data is written as soon as it is received, the bitmap is
+  synced every M210_DEV_CHECKPOINT_INTERVAL packets. Therefore, the
+  bitmap might lag behind the data, but never the other way around.
+*/
+
+#define M210_DEV_CHECKPOINT_MAGIC "M210CKP"
+#define M210_DEV_CHECKPOINT_VERSION 2
+#define M210_DEV_CHECKPOINT_HEAD_SIZE 20
+#define M210_DEV_CHECKPOINT_HAVE_VALIDATION_CRC 0x01
+#define M210_DEV_CHECKPOINT_INTERVAL 256
+#define M210_DEV_CHECKPOINT_VALIDATION_COUNT 8
+
+struct m210_dev_download {
+	uint16_t packet_count;
+	uint32_t received_count;
+	uint32_t committed_count;
+	uint8_t *received;	/* Bitmap, see above. */
+	uint8_t *data;		/* packet_count * M210_DEV_PACKET_SIZE bytes. */
+	FILE *file;
+	m210_sum sum;		/* Checksums committed data, if not NULL. */
+	int checkpoint_fd;	/* -1 if not checkpointed. */
+	uint16_t validation_count;
+	uint32_t validation_crc;
+	int have_validation_crc;
+	uint32_t unsynced_count;
+	int validating;		/* Resuming, see m210_dev_download(). */
+};
+
+static inline int m210_dev_download_has(struct m210_dev_download const *const dl_ptr,
+					uint16_t const num)
 {
-	enum m210_err err = M210_ERR_OK;
-	uint16_t *lost_nums = NULL;
-	uint16_t packet_count = 0;
+	return dl_ptr->received[(num - 1) / 8] & (1 << ((num - 1) % 8));
+}
 
-	err = m210_dev_begin_download(dev_ptr, &packet_count);
-	if (err) {
+static size_t m210_dev_download_bitmap_size(struct m210_dev_download const *const dl_ptr)
+{
+	return (dl_ptr->packet_count + 7) / 8;
+}
+
+static off_t m210_dev_download_data_offset(struct m210_dev_download const *const dl_ptr)
+{
+	return (M210_DEV_CHECKPOINT_HEAD_SIZE
+		+ m210_dev_download_bitmap_size(dl_ptr));
+}
+
+static enum m210_err m210_dev_download_sync(struct m210_dev_download *const dl_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t head[M210_DEV_CHECKPOINT_HEAD_SIZE];
+	uint16_t const packet_count_le = htole16(dl_ptr->packet_count);
+	uint16_t const validation_count_le = htole16(dl_ptr->validation_count);
+	uint32_t const validation_crc_le = htole32(dl_ptr->validation_crc);
+	size_t const bitmap_size = m210_dev_download_bitmap_size(dl_ptr);
+
+	/* While a resumed download is being validated, the checkpoint
+	 * on disk must keep describing the earlier download. */
+	if (dl_ptr->checkpoint_fd == -1 || dl_ptr->validating) {
 		goto out;
 	}
 
-	if (packet_count == 0) {
-		err = m210_dev_reject_download(dev_ptr);
+	memset(head, 0, sizeof(head));
+	memcpy(head, M210_DEV_CHECKPOINT_MAGIC, 7);
+	head[7] = M210_DEV_CHECKPOINT_VERSION;
+	memcpy(head + 8, &packet_count_le, 2);
+	memcpy(head + 10, &validation_count_le, 2);
+	memcpy(head + 12, &validation_crc_le, 4);
+	if (dl_ptr->have_validation_crc) {
+		head[16] |= M210_DEV_CHECKPOINT_HAVE_VALIDATION_CRC;
+	}
+
+	if (pwrite(dl_ptr->checkpoint_fd, head, sizeof(head), 0)
+	    != (ssize_t) sizeof(head)) {
+		err = M210_ERR_SYS;
 		goto out;
 	}
 
-	lost_nums = calloc(packet_count, sizeof(uint16_t));
-	if (lost_nums == NULL) {
-		int const original_errno = errno;
-		m210_dev_reject_download(dev_ptr);
-		errno = original_errno;
+	if (pwrite(dl_ptr->checkpoint_fd, dl_ptr->received, bitmap_size,
+		   sizeof(head)) != (ssize_t) bitmap_size) {
 		err = M210_ERR_SYS;
 		goto out;
 	}
 
-	err = m210_dev_accept_download(dev_ptr);
-	if (err) {
+	dl_ptr->unsynced_count = 0;
+out:
+	return err;
+}
+
+/*
+  Load the state of an earlier, interrupted download from the
+  checkpoint: the bitmap of the packets it holds is read to HELD and
+  the data of the packets to the download buffer. The checkpoint is
+  usable only if it was taken from a device which had the same number
+  of packets. Returns 1 if the checkpoint was loaded, 0 otherwise.
+*/
+static int m210_dev_download_load(struct m210_dev_download *const dl_ptr,
+				  uint8_t *const held,
+				  uint32_t *const validation_crc_ptr)
+{
+	uint8_t head[M210_DEV_CHECKPOINT_HEAD_SIZE];
+	uint16_t packet_count;
+	uint16_t validation_count;
+	uint32_t validation_crc;
+	size_t const bitmap_size = m210_dev_download_bitmap_size(dl_ptr);
+	size_t const data_size = (dl_ptr->packet_count
+				  * M210_DEV_PACKET_SIZE);
+
+	if (pread(dl_ptr->checkpoint_fd, head, sizeof(head), 0)
+	    != (ssize_t) sizeof(head)) {
+		return 0;
+	}
+
+	memcpy(&packet_count, head + 8, 2);
+	memcpy(&validation_count, head + 10, 2);
+	memcpy(&validation_crc, head + 12, 4);
+
+	if (memcmp(head, M210_DEV_CHECKPOINT_MAGIC, 7)
+	    || head[7] != M210_DEV_CHECKPOINT_VERSION
+	    || le16toh(packet_count) != dl_ptr->packet_count
+	    || le16toh(validation_count) != dl_ptr->validation_count
+	    || !(head[16] & M210_DEV_CHECKPOINT_HAVE_VALIDATION_CRC)) {
+		return 0;
+	}
+
+	if (pread(dl_ptr->checkpoint_fd, held, bitmap_size,
+		  sizeof(head)) != (ssize_t) bitmap_size) {
+		return 0;
+	}
+
+	/* Packets after the last received one have never been
+	 * written, the data section can therefore be short. */
+	memset(dl_ptr->data, 0, data_size);
+	if (pread(dl_ptr->checkpoint_fd, dl_ptr->data, data_size,
+		  m210_dev_download_data_offset(dl_ptr)) == -1) {
+		return 0;
+	}
+
+	*validation_crc_ptr = le32toh(validation_crc);
+
+	return 1;
+}
+
+static void m210_dev_download_reset(struct m210_dev_download *const dl_ptr)
+{
+	memset(dl_ptr->received, 0, m210_dev_download_bitmap_size(dl_ptr));
+	dl_ptr->received_count = 0;
+	dl_ptr->validation_crc = 0;
+	dl_ptr->have_validation_crc = 0;
+}
+
+/*
+  Write the contiguous run of received packets following the already
+  committed ones to the output file. This way the output is written in
+  order even if packets are received out of order.
+*/
+static enum m210_err m210_dev_download_commit(struct m210_dev_download *const dl_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint32_t const first = dl_ptr->committed_count;
+	uint32_t last = first;
+
+	while (last < dl_ptr->packet_count
+	       && m210_dev_download_has(dl_ptr, last + 1)) {
+		++last;
+	}
+
+	if (last == first || !dl_ptr->file) {
 		goto out;
 	}
 
-	err = m210_dev_download(dev_ptr, packet_count, lost_nums, file);
-	if (err) {
+	if (fwrite(dl_ptr->data + first * M210_DEV_PACKET_SIZE,
+		   M210_DEV_PACKET_SIZE, last - first,
+		   dl_ptr->file) != last - first) {
+		err = M210_ERR_SYS;
 		goto out;
 	}
 
-	/*
-	  All packets have been received, time to thank the device for
-	  cooperation.
-	*/
-	err = m210_dev_accept_download(dev_ptr);
-out:
+	if (dl_ptr->sum) {
+		m210_sum_update(dl_ptr->sum,
+				dl_ptr->data + first * M210_DEV_PACKET_SIZE,
+				(last - first) * M210_DEV_PACKET_SIZE);
+	}
+
+	dl_ptr->committed_count = last;
+out:
+	return err;
+}
+
+/* Write the data of packet NUM to the checkpoint, if any. */
+static enum m210_err m210_dev_download_save(struct m210_dev_download *const dl_ptr,
+					    uint16_t const num)
+{
+	enum m210_err err = M210_ERR_OK;
+	off_t const offset = (m210_dev_download_data_offset(dl_ptr)
+			      + (off_t) (num - 1) * M210_DEV_PACKET_SIZE);
+
+	if (dl_ptr->checkpoint_fd == -1) {
+		goto out;
+	}
+
+	if (pwrite(dl_ptr->checkpoint_fd,
+		   dl_ptr->data + (num - 1) * M210_DEV_PACKET_SIZE,
+		   M210_DEV_PACKET_SIZE, offset) != M210_DEV_PACKET_SIZE) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	if (++dl_ptr->unsynced_count == M210_DEV_CHECKPOINT_INTERVAL) {
+		err = m210_dev_download_sync(dl_ptr);
+	}
+out:
+	return err;
+}
+
+static enum m210_err m210_dev_download_store(struct m210_dev_download *const dl_ptr,
+					     struct m210_dev_packet const *const packet_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint16_t const num = packet_ptr->num;
+	uint8_t *const data = dl_ptr->data + (num - 1) * M210_DEV_PACKET_SIZE;
+
+	if (num == 0 || num > dl_ptr->packet_count
+	    || m210_dev_download_has(dl_ptr, num)) {
+		goto out;
+	}
+
+	memcpy(data, packet_ptr->data, M210_DEV_PACKET_SIZE);
+	dl_ptr->received[(num - 1) / 8] |= 1 << ((num - 1) % 8);
+	++dl_ptr->received_count;
+
+	if (!dl_ptr->have_validation_crc) {
+		uint16_t i;
+		for (i = 1; i <= dl_ptr->validation_count; ++i) {
+			if (!m210_dev_download_has(dl_ptr, i)) {
+				break;
+			}
+		}
+		if (i > dl_ptr->validation_count) {
+			dl_ptr->validation_crc = m210_crc32c(
+				0, dl_ptr->data,
+				dl_ptr->validation_count * M210_DEV_PACKET_SIZE);
+			dl_ptr->have_validation_crc = 1;
+		}
+	}
+
+	/* While a resumed download is being validated, the checkpoint
+	 * is left as it is, see m210_dev_download(). */
+	if (dl_ptr->validating) {
+		goto out;
+	}
+
+	err = m210_dev_download_save(dl_ptr, num);
+	if (err) {
+		goto out;
+	}
+
+	err = m210_dev_download_commit(dl_ptr);
+out:
+	return err;
+}
+
+/*
+  Request packet NUM with RESEND #NUM and wait until the device sends
+  it. Other packets still in flight, such as the rest of the stream
+  started with ACCEPT, are stored as well.
+*/
+static enum m210_err m210_dev_download_fetch(struct m210_dev const *const dev_ptr,
+					     struct m210_dev_download *const dl_ptr,
+					     uint16_t const num)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t resend_request[] = {0xb7, 0x00};
+
+	resend_request[1] = htobe16(num);
+
+	M210_TRACE_BEGIN_ARG("resend", "packet", num);
+	for (int retries = 0; retries < M210_DEV_MAX_TIMEOUT_RETRIES; ++retries) {
+		err = m210_dev_write(dev_ptr, resend_request,
+				     sizeof(resend_request));
+		if (err) {
+			goto out;
+		}
+
+		do {
+			struct m210_dev_packet packet;
+
+			err = m210_dev_read_packet(dev_ptr, &packet);
+			if (err) {
+				break;
+			}
+
+			err = m210_dev_download_store(dl_ptr, &packet);
+			if (err) {
+				goto out;
+			}
+		} while (!m210_dev_download_has(dl_ptr, num));
+
+		if (err != M210_ERR_DEV_TIMEOUT) {
+			goto out;
+		}
+	}
+	err = M210_ERR_DEV_TIMEOUT;
+out:
+	M210_TRACE_END("resend");
+	return err;
+}
+
+/* Read the next COUNT packets streamed after ACCEPT. */
+static enum m210_err m210_dev_download_stream(struct m210_dev const *const dev_ptr,
+					      struct m210_dev_download *const dl_ptr,
+					      uint32_t const count)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	M210_TRACE_BEGIN_ARG("stream packets", "packet_count", count);
+	for (uint32_t i = 0; i < count; ++i) {
+		struct m210_dev_packet packet;
+
+		err = m210_dev_read_packet(dev_ptr, &packet);
+		if (err) {
+			if (err == M210_ERR_DEV_TIMEOUT) {
+				/* Tail packets are lost, they will be
+				 * requested again. */
+				err = M210_ERR_OK;
+				break;
+			}
+			goto out;
+		}
+
+		err = m210_dev_download_store(dl_ptr, &packet);
+		if (err) {
+			goto out;
+		}
+	}
+out:
+	M210_TRACE_END("stream packets");
+	return err;
+}
+
+/*
+  Stream all packets after ACCEPT, then request the lost ones with
+  RESEND #X.
+
+  When resuming from a checkpoint, only the first validation_count
+  packets are read from the stream. If they match the checkpoint, the
+  memory has not been rewritten since the checkpoint was taken, and
+  only the packets missing from the checkpoint are requested with
+  RESEND #X. Otherwise the checkpoint is dropped and the rest of the
+  stream is read as usual. Until then, the checkpoint on disk is left
+  describing the earlier download.
+*/
+static enum m210_err m210_dev_download(struct m210_dev const *const dev_ptr,
+				       struct m210_dev_download *const dl_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t *held = NULL;
+	uint32_t held_validation_crc = 0;
+	int resumed = 0;
+
+	m210_dev_download_reset(dl_ptr);
+
+	if (dl_ptr->checkpoint_fd != -1) {
+		held = malloc(m210_dev_download_bitmap_size(dl_ptr));
+		if (held == NULL) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		resumed = m210_dev_download_load(dl_ptr, held,
+						 &held_validation_crc);
+	}
+
+	err = m210_dev_accept_download(dev_ptr);
+	if (err) {
+		goto out;
+	}
+
+	if (!resumed) {
+		err = m210_dev_download_stream(dev_ptr, dl_ptr,
+					       dl_ptr->packet_count);
+		if (err) {
+			goto out;
+		}
+	} else {
+		dl_ptr->validating = 1;
+		err = m210_dev_download_stream(dev_ptr, dl_ptr,
+					       dl_ptr->validation_count);
+		if (err) {
+			goto out;
+		}
+		for (uint16_t num = 1; num <= dl_ptr->validation_count; ++num) {
+			if (m210_dev_download_has(dl_ptr, num)) {
+				continue;
+			}
+			err = m210_dev_download_fetch(dev_ptr, dl_ptr, num);
+			if (err) {
+				goto out;
+			}
+		}
+		dl_ptr->validating = 0;
+
+		/* The packets received so far are fresh in any case. */
+		for (uint32_t num = 1; num <= dl_ptr->packet_count; ++num) {
+			if (!m210_dev_download_has(dl_ptr, num)) {
+				continue;
+			}
+			err = m210_dev_download_save(dl_ptr, num);
+			if (err) {
+				goto out;
+			}
+		}
+
+		if (dl_ptr->validation_crc == held_validation_crc) {
+			for (uint32_t num = 1; num <= dl_ptr->packet_count; ++num) {
+				uint8_t const bit = 1 << ((num - 1) % 8);
+				if (m210_dev_download_has(dl_ptr, num)
+				    || !(held[(num - 1) / 8] & bit)) {
+					continue;
+				}
+				dl_ptr->received[(num - 1) / 8] |= bit;
+				++dl_ptr->received_count;
+			}
+		} else {
+			err = m210_dev_download_stream(
+				dev_ptr, dl_ptr,
+				dl_ptr->packet_count - dl_ptr->validation_count);
+			if (err) {
+				goto out;
+			}
+		}
+	}
+
+	for (uint32_t num = 1; num <= dl_ptr->packet_count; ++num) {
+		if (m210_dev_download_has(dl_ptr, num)) {
+			continue;
+		}
+		err = m210_dev_download_fetch(dev_ptr, dl_ptr, num);
+		if (err) {
+			goto out;
+		}
+	}
+
+	err = m210_dev_download_commit(dl_ptr);
+out:
+	free(held);
+	return err;
+}
+
+enum m210_err m210_dev_download_notes_checkpointed(struct m210_dev *const dev_ptr,
+						   FILE *const file,
+						   FILE *const checkpoint_file)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_dev_download dl;
+	uint16_t packet_count = 0;
+
+	memset(&dl, 0, sizeof(dl));
+	dl.file = file;
+	dl.sum = dev_ptr->sum;
+	dl.checkpoint_fd = checkpoint_file ? fileno(checkpoint_file) : -1;
+
+	err = m210_dev_begin_download(dev_ptr, &packet_count);
+	if (err) {
+		goto out;
+	}
+
+	if (packet_count == 0) {
+		err = m210_dev_reject_download(dev_ptr);
+		goto out;
+	}
+
+	dl.packet_count = packet_count;
+	dl.validation_count = (packet_count < M210_DEV_CHECKPOINT_VALIDATION_COUNT
+			       ? packet_count
+			       : M210_DEV_CHECKPOINT_VALIDATION_COUNT);
+	dl.received = calloc(m210_dev_download_bitmap_size(&dl), 1);
+	dl.data = malloc(packet_count * M210_DEV_PACKET_SIZE);
+	if (dl.received == NULL || dl.data == NULL) {
+		int const original_errno = errno;
+		m210_dev_reject_download(dev_ptr);
+		errno = original_errno;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	err = m210_dev_download(dev_ptr, &dl);
+	if (err) {
+		goto out;
+	}
+
+	/*
+	  All packets have been received, time to thank the device for
+	  cooperation.
+	*/
+	err = m210_dev_accept_download(dev_ptr);
+	if (err) {
+		goto out;
+	}
+
+	if (dl.checkpoint_fd != -1 && ftruncate(dl.checkpoint_fd, 0) == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	if (err && dl.received && dl.data) {
+		int const original_errno = errno;
+		m210_dev_download_sync(&dl);
+		errno = original_errno;
+	}
+	if (file) {
+		fflush(file);
+	}
+	free(dl.received);
+	free(dl.data);
+	return err;
+}
+
+enum m210_err m210_dev_download_notes(struct m210_dev *const dev_ptr, FILE *file)
+{
+	return m210_dev_download_notes_checkpointed(dev_ptr, file, NULL);
+}
+
+/*
+  Partial download parses the note heads as the packets are streamed
+  and follows the note chain. As soon as the selected notes have been
+  received, the rest of the transfer is rejected. The newest notes are
+  at the end of the chain, so selecting the last notes saves only the
+  unused tail of the memory; selecting notes by number stops right
+  after the last selected note. Packets lost from
+  the stream are requested with RESEND #X before rejecting, like in a
+  full download.
+
+  HOST		    DEVICE
+  ==============================
+  GET_PACKET_COUNT  >
+  < PACKET_COUNT
+  ACCEPT	    >
+  < PACKET #1
+  < PACKET #2
+  .
+  .
+  .
+  < PACKET #M
+  REJECT	    >
+
+*/
+
+#define M210_DEV_MAX_NOTES 256
+
+struct m210_dev_note_pos {
+	uint32_t head_pos;
+	uint32_t next_pos;
+	uint8_t number;
+};
+
+struct m210_dev_note_chain {
+	struct m210_dev_note_pos notes[M210_DEV_MAX_NOTES];
+	size_t note_count;
+	uint32_t pos;		/* Position of the next head. */
+	int ended;
+	uint8_t const *numbers;	/* If not NULL, select notes by number. */
+	size_t number_count;
+};
+
+static int m210_dev_download_has_range(struct m210_dev_download const *const dl_ptr,
+				       uint32_t const pos,
+				       uint32_t const size)
+{
+	uint32_t const first = pos / M210_DEV_PACKET_SIZE + 1;
+	uint32_t const last = (pos + size - 1) / M210_DEV_PACKET_SIZE + 1;
+
+	for (uint32_t num = first; num <= last; ++num) {
+		if (!m210_dev_download_has(dl_ptr, num)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static enum m210_err m210_dev_download_range(struct m210_dev const *const dev_ptr,
+					     struct m210_dev_download *const dl_ptr,
+					     uint32_t const pos,
+					     uint32_t const size)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint32_t const first = pos / M210_DEV_PACKET_SIZE + 1;
+	uint32_t const last = (pos + size - 1) / M210_DEV_PACKET_SIZE + 1;
+
+	for (uint32_t num = first; num <= last; ++num) {
+		if (m210_dev_download_has(dl_ptr, num)) {
+			continue;
+		}
+		err = m210_dev_download_fetch(dev_ptr, dl_ptr, num);
+		if (err) {
+			goto out;
+		}
+	}
+out:
+	return err;
+}
+
+static int m210_dev_note_chain_has_number(struct m210_dev_note_chain const *const chain_ptr,
+					  uint8_t const number)
+{
+	for (size_t i = 0; i < chain_ptr->note_count; ++i) {
+		if (chain_ptr->notes[i].number == number) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+  Return 1 if all selected notes are known, i.e. the chain has ended
+  or all requested note numbers have been found in it.
+*/
+static int m210_dev_note_chain_complete(struct m210_dev_note_chain const *const chain_ptr)
+{
+	if (chain_ptr->ended) {
+		return 1;
+	}
+
+	if (!chain_ptr->numbers) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < chain_ptr->number_count; ++i) {
+		if (!m210_dev_note_chain_has_number(chain_ptr,
+						    chain_ptr->numbers[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+  Follow the note chain until the selected notes are known, or as far
+  as the received packets allow. If DEV_PTR is not NULL, packets
+  holding the heads are requested with RESEND #X when missing,
+  otherwise the walk stops at the first head which has not been
+  received yet.
+*/
+static enum m210_err m210_dev_download_chain(struct m210_dev const *const dev_ptr,
+					     struct m210_dev_download *const dl_ptr,
+					     struct m210_dev_note_chain *const chain_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint32_t const memory_size = dl_ptr->packet_count * M210_DEV_PACKET_SIZE;
+
+	while (!m210_dev_note_chain_complete(chain_ptr)) {
+		struct m210_rawnote_head head;
+		uint32_t const pos = chain_ptr->pos;
+		uint32_t next_pos = 0;
+
+		if (chain_ptr->note_count == M210_DEV_MAX_NOTES
+		    || pos + sizeof(head) > memory_size) {
+			chain_ptr->ended = 1;
+			break;
+		}
+
+		if (!m210_dev_download_has_range(dl_ptr, pos, sizeof(head))) {
+			if (!dev_ptr) {
+				break;
+			}
+			err = m210_dev_download_range(dev_ptr, dl_ptr, pos,
+						      sizeof(head));
+			if (err) {
+				goto out;
+			}
+		}
+
+		memcpy(&head, dl_ptr->data + pos, sizeof(head));
+		memcpy(&next_pos, head.next_pos, sizeof(head.next_pos));
+		next_pos = le32toh(next_pos);
+
+		/* The chain ends to an empty note. */
+		if (!memcmp(&head, &M210_RAWNOTE_HEAD_LAST, sizeof(head))
+		    || head.state == M210_RAWNOTE_STATE_EMPTY
+		    || next_pos == 0xffffff
+		    || next_pos < pos + sizeof(head)
+		    || next_pos > memory_size) {
+			chain_ptr->ended = 1;
+			break;
+		}
+
+		chain_ptr->notes[chain_ptr->note_count].head_pos = pos;
+		chain_ptr->notes[chain_ptr->note_count].next_pos = next_pos;
+		chain_ptr->notes[chain_ptr->note_count].number = head.number;
+		++chain_ptr->note_count;
+
+		chain_ptr->pos = next_pos;
+	}
+out:
+	return err;
+}
+
+/*
+  Stream packets until the selected notes have been received. The
+  notes precede the next head in the chain, so they have been
+  received when all packets before the next head have been.
+*/
+static enum m210_err m210_dev_download_stream_notes(struct m210_dev const *const dev_ptr,
+						    struct m210_dev_download *const dl_ptr,
+						    struct m210_dev_note_chain *const chain_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint32_t received_prefix = 0;
+
+	M210_TRACE_BEGIN_ARG("stream notes", "packet_count",
+			     dl_ptr->packet_count);
+	err = m210_dev_accept_download(dev_ptr);
+	if (err) {
+		goto out;
+	}
+
+	for (int i = 0; i < dl_ptr->packet_count; ++i) {
+		struct m210_dev_packet packet;
+
+		err = m210_dev_read_packet(dev_ptr, &packet);
+		if (err) {
+			if (err == M210_ERR_DEV_TIMEOUT) {
+				/* Tail packets are lost, they will be
+				 * requested again if needed. */
+				err = M210_ERR_OK;
+				break;
+			}
+			goto out;
+		}
+
+		err = m210_dev_download_store(dl_ptr, &packet);
+		if (err) {
+			goto out;
+		}
+
+		while (received_prefix < dl_ptr->packet_count
+		       && m210_dev_download_has(dl_ptr, received_prefix + 1)) {
+			++received_prefix;
+		}
+
+		err = m210_dev_download_chain(NULL, dl_ptr, chain_ptr);
+		if (err) {
+			goto out;
+		}
+
+		if (m210_dev_note_chain_complete(chain_ptr)
+		    && chain_ptr->pos <= received_prefix * M210_DEV_PACKET_SIZE) {
+			break;
+		}
+	}
+out:
+	M210_TRACE_END("stream notes");
+	return err;
+}
+
+/*
+  Write the selected notes as a self-contained raw note stream: heads
+  are relocated to point to the next note in the stream, and the
+  stream is terminated with an empty head and padded to the packet
+  size, just like a full download.
+*/
+static enum m210_err m210_dev_download_write(struct m210_dev_download const *const dl_ptr,
+					     void const *const data,
+					     size_t const size,
+					     FILE *const file)
+{
+	if (size && file && fwrite(data, size, 1, file) != 1) {
+		return M210_ERR_SYS;
+	}
+
+	if (dl_ptr->sum) {
+		m210_sum_update(dl_ptr->sum, data, size);
+	}
+
+	return M210_ERR_OK;
+}
+
+static enum m210_err m210_dev_download_write_notes(struct m210_dev_download const *const dl_ptr,
+						   struct m210_dev_note_pos const *const notes,
+						   size_t const note_count,
+						   FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+	static uint8_t const padding[M210_DEV_PACKET_SIZE];
+	uint32_t pos = 0;
+
+	for (size_t i = 0; i < note_count; ++i) {
+		struct m210_rawnote_head head;
+		uint32_t const body_size = (notes[i].next_pos
+					    - notes[i].head_pos
+					    - sizeof(head));
+		uint32_t const next_pos = htole32(pos + sizeof(head)
+						  + body_size);
+
+		memcpy(&head, dl_ptr->data + notes[i].head_pos, sizeof(head));
+		memcpy(head.next_pos, &next_pos, sizeof(head.next_pos));
+
+		err = m210_dev_download_write(dl_ptr, &head, sizeof(head),
+					      file);
+		if (err) {
+			goto out;
+		}
+
+		err = m210_dev_download_write(dl_ptr,
+					      dl_ptr->data + notes[i].head_pos
+					      + sizeof(head), body_size, file);
+		if (err) {
+			goto out;
+		}
+		pos += sizeof(head) + body_size;
+	}
+
+	err = m210_dev_download_write(dl_ptr, &M210_RAWNOTE_HEAD_LAST,
+				      sizeof(M210_RAWNOTE_HEAD_LAST), file);
+	if (err) {
+		goto out;
+	}
+	pos += sizeof(M210_RAWNOTE_HEAD_LAST);
+
+	if (pos % M210_DEV_PACKET_SIZE) {
+		err = m210_dev_download_write(dl_ptr, padding,
+					      M210_DEV_PACKET_SIZE
+					      - pos % M210_DEV_PACKET_SIZE,
+					      file);
+	}
+out:
+	return err;
+}
+
+/*
+  Download the LAST_COUNT last notes, or if NUMBERS is not NULL, notes
+  whose numbers are listed in NUMBERS.
+*/
+static enum m210_err m210_dev_download_partial(struct m210_dev *const dev_ptr,
+					       FILE *const file,
+					       size_t const last_count,
+					       uint8_t const *const numbers,
+					       size_t const number_count)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_dev_download dl;
+	struct m210_dev_note_chain *chain = NULL;
+	size_t selected_count = 0;
+	uint16_t packet_count = 0;
+
+	memset(&dl, 0, sizeof(dl));
+	dl.sum = dev_ptr->sum;
+	dl.checkpoint_fd = -1;
+
+	err = m210_dev_begin_download(dev_ptr, &packet_count);
+	if (err) {
+		goto out;
+	}
+
+	if (packet_count == 0) {
+		err = m210_dev_reject_download(dev_ptr);
+		if (err) {
+			goto out;
+		}
+		err = m210_dev_download_write_notes(&dl, NULL, 0, file);
+		goto out;
+	}
+
+	dl.packet_count = packet_count;
+	dl.received = calloc(m210_dev_download_bitmap_size(&dl), 1);
+	dl.data = malloc(packet_count * M210_DEV_PACKET_SIZE);
+	chain = calloc(1, sizeof(struct m210_dev_note_chain));
+	if (dl.received == NULL || dl.data == NULL || chain == NULL) {
+		int const original_errno = errno;
+		m210_dev_reject_download(dev_ptr);
+		errno = original_errno;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	chain->numbers = numbers;
+	chain->number_count = number_count;
+
+	err = m210_dev_download_stream_notes(dev_ptr, &dl, chain);
+	if (err) {
+		goto out;
+	}
+
+	/* Request the packets lost from the stream, if any. */
+	if (!m210_dev_note_chain_complete(chain)) {
+		err = m210_dev_download_chain(dev_ptr, &dl, chain);
+		if (err) {
+			goto out;
+		}
+	}
+
+	/* Keep only the selected notes, in the original order. */
+	for (size_t i = 0; i < chain->note_count; ++i) {
+		int selected = 0;
+
+		if (numbers) {
+			for (size_t j = 0; j < number_count; ++j) {
+				if (chain->notes[i].number == numbers[j]) {
+					selected = 1;
+					break;
+				}
+			}
+		} else {
+			selected = i + last_count >= chain->note_count;
+		}
+
+		if (selected) {
+			chain->notes[selected_count++] = chain->notes[i];
+		}
+	}
+
+	for (size_t i = 0; i < selected_count; ++i) {
+		err = m210_dev_download_range(dev_ptr, &dl,
+					      chain->notes[i].head_pos,
+					      chain->notes[i].next_pos
+					      - chain->notes[i].head_pos);
+		if (err) {
+			goto out;
+		}
+	}
+
+	/* All wanted packets have been received, the rest of the
+	 * transfer is not needed. */
+	err = m210_dev_reject_download(dev_ptr);
+	if (err) {
+		goto out;
+	}
+
+	err = m210_dev_download_write_notes(&dl, chain->notes, selected_count,
+					    file);
+out:
 	if (file) {
 		fflush(file);
 	}
-	free(lost_nums);
+	free(dl.received);
+	free(dl.data);
+	free(chain);
 	return err;
 }
+
+enum m210_err m210_dev_download_last_notes(struct m210_dev *const dev_ptr,
+					   FILE *const file,
+					   size_t const count)
+{
+	return m210_dev_download_partial(dev_ptr, file, count, NULL, 0);
+}
+
+enum m210_err m210_dev_download_numbered_notes(struct m210_dev *const dev_ptr,
+					       FILE *const file,
+					       uint8_t const *const numbers,
+					       size_t const number_count)
+{
+	return m210_dev_download_partial(dev_ptr, file, 0, numbers,
+					 number_count);
+}
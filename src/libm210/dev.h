@@ -15,19 +15,24 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef DEV_H
-#define DEV_H
+#ifndef M210_DEV_H
+#define M210_DEV_H
 
 #include <stdio.h>
 #include <stdint.h>
 
 #include "err.h"
+#include "sum.h"
 
 #define M210_DEV_MODE_MOUSE  0x01
 #define M210_DEV_MODE_TABLET 0x02
 
 #define M210_DEV_MAX_MEMORY 4063232 /* Bytes. */
 
+#define M210_DEV_PEN_BATTERY_UNKNOWN 0x40
+#define M210_DEV_PEN_BATTERY_LOW     0x41
+#define M210_DEV_PEN_BATTERY_GOOD    0x42
+
 typedef struct m210_dev *m210_dev;
 
 struct m210_dev_info {
@@ -38,10 +43,33 @@ struct m210_dev_info {
 	uint32_t used_memory;
 };
 
+struct m210_dev_pen {
+	int16_t x;
+	int16_t y;
+	uint8_t in_range;
+	uint8_t tip;
+	uint8_t button;
+	uint8_t battery;
+};
+
 enum m210_err m210_dev_connect(m210_dev *devp);
+enum m210_err m210_dev_connect_replay(m210_dev *devp, FILE *file,
+				     int realtime);
 enum m210_err m210_dev_disconnect(m210_dev *devp);
+enum m210_err m210_dev_reconnect(m210_dev dev);
+enum m210_err m210_dev_set_capture(m210_dev dev, FILE *file);
+void m210_dev_set_sum(m210_dev dev, m210_sum sum);
 enum m210_err m210_dev_get_info(m210_dev dev, struct m210_dev_info *infop);
 enum m210_err m210_dev_download_notes(m210_dev dev, FILE *file);
+enum m210_err m210_dev_download_notes_checkpointed(m210_dev dev, FILE *file,
+						   FILE *checkpoint_file);
+enum m210_err m210_dev_download_last_notes(m210_dev dev, FILE *file,
+					   size_t count);
+enum m210_err m210_dev_download_numbered_notes(m210_dev dev, FILE *file,
+					       uint8_t const *numbers,
+					       size_t number_count);
 enum m210_err m210_dev_delete_notes(m210_dev dev);
+enum m210_err m210_dev_erase_notes(m210_dev dev);
+enum m210_err m210_dev_read_pen(m210_dev dev, struct m210_dev_pen *penp);
 
-#endif /* DEV_H */
+#endif /* M210_DEV_H */
@@ -33,7 +33,15 @@ char const *m210_err_strerror(enum m210_err const err)
 		"response waiting timeouted",
 		"raw note has malformed head",
 		"raw note has malformed body",
-		"unexpected end-of-file"
+		"unexpected end-of-file",
+		"capture file is malformed",
+		"request does not match the capture",
+		"checksum file is malformed",
+		"checksum mismatch",
+		"notes were not erased",
+		"packed file is malformed",
+		"archive is malformed",
+		"compressed file is malformed"
 	};
 	return err_strs[err];
 }
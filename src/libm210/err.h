@@ -15,8 +15,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef ERR_H
-#define ERR_H
+#ifndef M210_ERR_H
+#define M210_ERR_H
 
 enum m210_err {
 	M210_ERR_OK,
@@ -27,10 +27,18 @@ enum m210_err {
 	M210_ERR_DEV_TIMEOUT,
 	M210_ERR_BAD_RAWNOTE_HEAD,
 	M210_ERR_BAD_RAWNOTE_BODY,
-	M210_ERR_UNEXPECTED_EOF
+	M210_ERR_UNEXPECTED_EOF,
+	M210_ERR_BAD_CAPTURE,
+	M210_ERR_CAPTURE_MISMATCH,
+	M210_ERR_BAD_SUM,
+	M210_ERR_SUM_MISMATCH,
+	M210_ERR_NOT_ERASED,
+	M210_ERR_BAD_PACK,
+	M210_ERR_BAD_ARCHIVE,
+	M210_ERR_BAD_COMPRESSED
 };
 
 char const *m210_err_strerror(enum m210_err err);
 enum m210_err m210_err_perror(enum m210_err err, char const *msg);
 
-#endif /* ERR_H */
+#endif /* M210_ERR_H */
@@ -0,0 +1,287 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Tests of the grid index, run by `make check'. The segments a query
+  returns must be exactly those intersecting the region, found by
+  checking every segment of the note, in stroke order and clipped to
+  the region.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grid.h"
+#include "rawnote.h"
+#include "stroke.h"
+
+#define NOTE_COUNT 4
+#define MAX_BODIES 3000
+#define QUERY_COUNT 500
+
+static int failures;
+static uint32_t seed = 1;
+
+static void fail(int const note, char const *const what)
+{
+	fprintf(stderr, "FAIL: note %d: %s\n", note, what);
+	++failures;
+}
+
+static uint32_t random_next(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static int16_t random_coord(int const spread)
+{
+	return (int16_t) (random_next() % (2 * spread + 1)) - spread;
+}
+
+/*
+  Write NOTE_COUNT notes of random strokes to RAW, the size of each
+  note growing with its number from none at all, and return the size
+  of the stream.
+*/
+static size_t raw_notes(uint8_t *const raw)
+{
+	size_t pos = 0;
+	int i;
+
+	for (i = 0; i < NOTE_COUNT; ++i) {
+		struct m210_rawnote_head head = M210_RAWNOTE_HEAD_LAST;
+		size_t const bodyc = i * MAX_BODIES / (NOTE_COUNT - 1);
+		size_t const next_pos = (pos + sizeof(head) + bodyc
+					 * sizeof(struct m210_rawnote_body));
+		int16_t x = 0;
+		int16_t y = 5000;
+		size_t j;
+
+		head.next_pos[0] = next_pos & 0xff;
+		head.next_pos[1] = (next_pos >> 8) & 0xff;
+		head.next_pos[2] = (next_pos >> 16) & 0xff;
+		head.state = M210_RAWNOTE_STATE_FINISHED_BY_USER;
+		head.number = i + 1;
+		head.last_number = NOTE_COUNT;
+		memcpy(raw + pos, &head, sizeof(head));
+		pos += sizeof(head);
+
+		for (j = 0; j < bodyc; ++j) {
+			struct m210_rawnote_body body = M210_RAWNOTE_BODY_PENUP;
+			uint32_t const r = random_next();
+
+			/* Jumps, single points and long strokes. */
+			if (r % 50 == 0) {
+				x = random_coord(6000);
+				y = 5000 + random_coord(5000);
+			} else if (r % 13) {
+				x += random_coord(300);
+				y += random_coord(300);
+				if (x == 0) {
+					x = 1;
+				}
+				body.x[0] = (uint16_t) x & 0xff;
+				body.x[1] = (uint16_t) x >> 8;
+				body.y[0] = (uint16_t) y & 0xff;
+				body.y[1] = (uint16_t) y >> 8;
+			}
+			memcpy(raw + pos, &body, sizeof(body));
+			pos += sizeof(body);
+		}
+	}
+
+	memcpy(raw + pos, &M210_RAWNOTE_HEAD_LAST,
+	       sizeof(M210_RAWNOTE_HEAD_LAST));
+	return pos + sizeof(M210_RAWNOTE_HEAD_LAST);
+}
+
+/* Orientation of C relative to the line from A to B. */
+static int orientation(int64_t const ax, int64_t const ay,
+		       int64_t const bx, int64_t const by,
+		       int64_t const cx, int64_t const cy)
+{
+	int64_t const cross = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+
+	return (cross > 0) - (cross < 0);
+}
+
+/*
+  Whether the segment from X0,Y0 to X1,Y1 intersects REGION, edges
+  included, computed exactly: the segment must overlap the region on
+  both axes, and the corners of the region must not all lie strictly
+  on one side of its line.
+*/
+static int intersects(int const x0, int const y0, int const x1, int const y1,
+		      struct m210_bounds const *const region)
+{
+	int sides[4];
+
+	if ((x0 < region->min_x && x1 < region->min_x)
+	    || (x0 > region->max_x && x1 > region->max_x)
+	    || (y0 < region->min_y && y1 < region->min_y)
+	    || (y0 > region->max_y && y1 > region->max_y)) {
+		return 0;
+	}
+	sides[0] = orientation(x0, y0, x1, y1, region->min_x, region->min_y);
+	sides[1] = orientation(x0, y0, x1, y1, region->min_x, region->max_y);
+	sides[2] = orientation(x0, y0, x1, y1, region->max_x, region->min_y);
+	sides[3] = orientation(x0, y0, x1, y1, region->max_x, region->max_y);
+	return !((sides[0] > 0 && sides[1] > 0 && sides[2] > 0 && sides[3] > 0)
+		 || (sides[0] < 0 && sides[1] < 0 && sides[2] < 0
+		     && sides[3] < 0));
+}
+
+static int inside(double const x, double const y,
+		  struct m210_bounds const *const region)
+{
+	return (x >= region->min_x - 1e-6 && x <= region->max_x + 1e-6
+		&& y >= region->min_y - 1e-6 && y <= region->max_y + 1e-6);
+}
+
+/*
+  Check a query of REGION against the COUNT SEGMENTS of the note,
+  unclipped clips from a query of the whole plane.
+*/
+static void test_query(m210_grid const grid, int const note,
+		       struct m210_grid_clip const *const segments,
+		       size_t const count,
+		       struct m210_bounds const *const region)
+{
+	struct m210_grid_clip const *clips;
+	size_t clip_count;
+	size_t i;
+	size_t j = 0;
+
+	if (m210_grid_query(grid, region, &clips, &clip_count)) {
+		fail(note, "query failed");
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		struct m210_grid_clip const *const segment = &segments[i];
+
+		if (!intersects(segment->x0, segment->y0, segment->x1,
+				segment->y1, region)) {
+			continue;
+		}
+		if (j == clip_count || clips[j].segment != segment->segment
+		    || clips[j].stroke != segment->stroke) {
+			fail(note, "segment missing from query");
+			return;
+		}
+		if (!inside(clips[j].x0, clips[j].y0, region)
+		    || !inside(clips[j].x1, clips[j].y1, region)) {
+			fail(note, "clip outside the region");
+		}
+		/* End points inside the region are kept exactly. */
+		if ((inside(segment->x0, segment->y0, region)
+		     && (clips[j].x0 != segment->x0
+			 || clips[j].y0 != segment->y0))
+		    || (inside(segment->x1, segment->y1, region)
+			&& (clips[j].x1 != segment->x1
+			    || clips[j].y1 != segment->y1))) {
+			fail(note, "end point inside the region moved");
+		}
+		++j;
+	}
+	if (j != clip_count) {
+		fail(note, "query returned segments outside the region");
+	}
+}
+
+int main(void)
+{
+	struct m210_bounds const plane = {
+		INT16_MIN, INT16_MIN, INT16_MAX, INT16_MAX
+	};
+	uint8_t *const raw = malloc(NOTE_COUNT * sizeof(struct m210_rawnote_head)
+				    + NOTE_COUNT * MAX_BODIES
+				    * sizeof(struct m210_rawnote_body));
+	struct m210_grid_clip *segments = NULL;
+	m210_strokes strokes = NULL;
+	m210_grid grid = NULL;
+	FILE *file = NULL;
+	size_t size;
+	int i;
+
+	if (raw == NULL) {
+		perror("malloc");
+		return 1;
+	}
+	size = raw_notes(raw);
+
+	file = fmemopen(raw, size, "rb");
+	if (file == NULL || m210_strokes_open(&strokes, file)
+	    || m210_grid_new(&grid)) {
+		fprintf(stderr, "FAIL: setup failed\n");
+		return 1;
+	}
+
+	for (i = 1; i <= NOTE_COUNT; ++i) {
+		struct m210_note_head head;
+		struct m210_grid_clip const *clips;
+		size_t count;
+		int j;
+
+		if (m210_strokes_next_note(strokes, &head) || head.number != i
+		    || m210_grid_build(grid, strokes)
+		    || m210_grid_query(grid, &plane, &clips, &count)) {
+			fail(i, "note was not indexed");
+			continue;
+		}
+
+		/* The whole plane leaves the segments as they are. */
+		free(segments);
+		segments = malloc((count ? count : 1) * sizeof(*segments));
+		if (segments == NULL) {
+			perror("malloc");
+			return 1;
+		}
+		if (count) {
+			memcpy(segments, clips, count * sizeof(*segments));
+		}
+
+		for (j = 0; j < QUERY_COUNT; ++j) {
+			struct m210_bounds region;
+			int16_t const x = random_coord(7000);
+			int16_t const y = 5000 + random_coord(6000);
+			/* Thin, small and large regions. */
+			int const spread = j % 3 ? 40 * (j % 50) : 0;
+
+			region.min_x = x;
+			region.min_y = y;
+			region.max_x = x + (j % 2 ? spread : random_coord(spread)
+					    + spread);
+			region.max_y = y + (j % 2 ? random_coord(spread) + spread
+					    : spread);
+			test_query(grid, i, segments, count, &region);
+		}
+		test_query(grid, i, segments, count, &plane);
+	}
+
+	free(segments);
+	m210_grid_free(&grid);
+	m210_strokes_close(&strokes);
+	fclose(file);
+	free(raw);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,466 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "grid.h"
+
+/* Cells are squares of at least this many device units, about 4 mm. */
+#define M210_GRID_MIN_CELL_SIZE 256
+#define M210_GRID_MAX_CELLS 65536
+
+struct m210_grid_segment {
+	struct m210_note_body const *from;
+	struct m210_note_body const *to;
+	uint32_t stroke;
+};
+
+struct m210_grid {
+	struct m210_grid_segment *segments;
+	size_t segment_count;
+	size_t segment_capacity;
+	int32_t origin_x;
+	int32_t origin_y;
+	int32_t cell_size;
+	int32_t cols;
+	int32_t rows;
+	/* Segments of cell C are cell_items[cell_starts[C]] up to
+	 * cell_items[cell_starts[C + 1]]. */
+	uint32_t *cell_starts;
+	size_t cell_starts_capacity;
+	uint32_t *cell_cursors;
+	uint32_t *cell_items;
+	size_t cell_items_capacity;
+	/* Stamp of the last query that visited each segment. */
+	uint32_t *stamps;
+	size_t stamps_capacity;
+	uint32_t stamp;
+	struct m210_grid_clip *clips;
+	size_t clips_capacity;
+};
+
+enum m210_err m210_grid_new(struct m210_grid **const grid_ptr_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_grid *grid_ptr = calloc(1, sizeof(struct m210_grid));
+
+	if (!grid_ptr) {
+		err = M210_ERR_SYS;
+	}
+	*grid_ptr_ptr = grid_ptr;
+	return err;
+}
+
+void m210_grid_free(struct m210_grid **const grid_ptr_ptr)
+{
+	struct m210_grid *const grid_ptr = *grid_ptr_ptr;
+
+	if (grid_ptr) {
+		free(grid_ptr->segments);
+		free(grid_ptr->cell_starts);
+		free(grid_ptr->cell_cursors);
+		free(grid_ptr->cell_items);
+		free(grid_ptr->stamps);
+		free(grid_ptr->clips);
+	}
+	free(grid_ptr);
+	*grid_ptr_ptr = NULL;
+}
+
+/*
+  Make sure the array at *ARRAY_PTR, of *CAPACITY_PTR elements of SIZE
+  bytes, can hold COUNT elements. The contents are not preserved.
+*/
+static enum m210_err m210_grid_reserve(void *const array_ptr,
+				       size_t *const capacity_ptr,
+				       size_t const count,
+				       size_t const size)
+{
+	void **const ptr_ptr = array_ptr;
+	size_t capacity = *capacity_ptr ? *capacity_ptr : 256;
+	void *array;
+
+	if (count <= *capacity_ptr) {
+		return M210_ERR_OK;
+	}
+
+	while (capacity < count) {
+		capacity *= 2;
+	}
+	array = malloc(capacity * size);
+	if (!array) {
+		return M210_ERR_SYS;
+	}
+	free(*ptr_ptr);
+	*ptr_ptr = array;
+	*capacity_ptr = capacity;
+	return M210_ERR_OK;
+}
+
+static enum m210_err m210_grid_add(struct m210_grid *const grid_ptr,
+				   struct m210_note_body const *const from,
+				   struct m210_note_body const *const to,
+				   uint32_t const stroke)
+{
+	struct m210_grid_segment *segment_ptr;
+
+	if (grid_ptr->segment_count == grid_ptr->segment_capacity) {
+		size_t const capacity = (grid_ptr->segment_capacity
+					 ? grid_ptr->segment_capacity * 2
+					 : 1024);
+		struct m210_grid_segment *const segments = realloc(
+			grid_ptr->segments,
+			capacity * sizeof(struct m210_grid_segment));
+		if (!segments) {
+			return M210_ERR_SYS;
+		}
+		grid_ptr->segments = segments;
+		grid_ptr->segment_capacity = capacity;
+	}
+
+	segment_ptr = &grid_ptr->segments[grid_ptr->segment_count++];
+	segment_ptr->from = from;
+	segment_ptr->to = to;
+	segment_ptr->stroke = stroke;
+	return M210_ERR_OK;
+}
+
+/*
+  Cell range [*C0, *C1] covered by the coordinates [V0, V1] along an
+  axis of SIZE cells starting at ORIGIN. Returns 0 if the range is
+  outside the grid.
+*/
+static int m210_grid_cells(struct m210_grid const *const grid_ptr,
+			   int32_t const origin, int32_t const size,
+			   int32_t v0, int32_t v1,
+			   int32_t *const c0_ptr, int32_t *const c1_ptr)
+{
+	if (v0 > v1) {
+		int32_t const v = v0;
+		v0 = v1;
+		v1 = v;
+	}
+	v0 -= origin;
+	v1 -= origin;
+	if (v1 < 0 || v0 >= size * grid_ptr->cell_size) {
+		return 0;
+	}
+	*c0_ptr = v0 < 0 ? 0 : v0 / grid_ptr->cell_size;
+	*c1_ptr = v1 / grid_ptr->cell_size;
+	if (*c1_ptr >= size) {
+		*c1_ptr = size - 1;
+	}
+	return 1;
+}
+
+enum m210_err m210_grid_build(struct m210_grid *const grid_ptr,
+			      struct m210_strokes *const strokes_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_bounds bounds = {INT16_MAX, INT16_MAX, INT16_MIN, INT16_MIN};
+	size_t cell_count;
+	size_t item_count;
+	uint32_t stroke = 0;
+	size_t i;
+
+	grid_ptr->segment_count = 0;
+	grid_ptr->cols = 0;
+	grid_ptr->rows = 0;
+
+	while (1) {
+		struct m210_stroke const *stroke_ptr;
+
+		err = m210_strokes_next(strokes_ptr, &stroke_ptr);
+		if (err) {
+			goto out;
+		}
+		if (!stroke_ptr) {
+			break;
+		}
+
+		if (stroke_ptr->min_x < bounds.min_x) {
+			bounds.min_x = stroke_ptr->min_x;
+		}
+		if (stroke_ptr->min_y < bounds.min_y) {
+			bounds.min_y = stroke_ptr->min_y;
+		}
+		if (stroke_ptr->max_x > bounds.max_x) {
+			bounds.max_x = stroke_ptr->max_x;
+		}
+		if (stroke_ptr->max_y > bounds.max_y) {
+			bounds.max_y = stroke_ptr->max_y;
+		}
+
+		if (stroke_ptr->point_count == 1) {
+			/* A segment of zero length. */
+			err = m210_grid_add(grid_ptr, stroke_ptr->points,
+					    stroke_ptr->points, stroke);
+		}
+		for (i = 1; !err && i < stroke_ptr->point_count; ++i) {
+			err = m210_grid_add(grid_ptr,
+					    &stroke_ptr->points[i - 1],
+					    &stroke_ptr->points[i], stroke);
+		}
+		if (err) {
+			goto out;
+		}
+		++stroke;
+	}
+
+	if (!grid_ptr->segment_count) {
+		goto out;
+	}
+
+	grid_ptr->origin_x = bounds.min_x;
+	grid_ptr->origin_y = bounds.min_y;
+	grid_ptr->cell_size = M210_GRID_MIN_CELL_SIZE;
+	while (1) {
+		grid_ptr->cols = ((bounds.max_x - bounds.min_x)
+				  / grid_ptr->cell_size + 1);
+		grid_ptr->rows = ((bounds.max_y - bounds.min_y)
+				  / grid_ptr->cell_size + 1);
+		if (grid_ptr->cols * grid_ptr->rows <= M210_GRID_MAX_CELLS) {
+			break;
+		}
+		grid_ptr->cell_size *= 2;
+	}
+	cell_count = grid_ptr->cols * grid_ptr->rows;
+
+	err = m210_grid_reserve(&grid_ptr->cell_starts,
+				&grid_ptr->cell_starts_capacity,
+				cell_count + 1, sizeof(uint32_t));
+	if (err) {
+		goto out;
+	}
+	/* Cursors have the same capacity as starts. */
+	free(grid_ptr->cell_cursors);
+	grid_ptr->cell_cursors = malloc(grid_ptr->cell_starts_capacity
+					* sizeof(uint32_t));
+	if (!grid_ptr->cell_cursors) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	/* Count the segments of each cell, then place them. */
+	memset(grid_ptr->cell_starts, 0, (cell_count + 1) * sizeof(uint32_t));
+	for (i = 0; i < grid_ptr->segment_count; ++i) {
+		struct m210_grid_segment const *const segment_ptr =
+			&grid_ptr->segments[i];
+		int32_t c0 = 0, c1 = -1, r0 = 0, r1 = -1, r, c;
+
+		m210_grid_cells(grid_ptr, grid_ptr->origin_x, grid_ptr->cols,
+				segment_ptr->from->x, segment_ptr->to->x,
+				&c0, &c1);
+		m210_grid_cells(grid_ptr, grid_ptr->origin_y, grid_ptr->rows,
+				segment_ptr->from->y, segment_ptr->to->y,
+				&r0, &r1);
+		for (r = r0; r <= r1; ++r) {
+			for (c = c0; c <= c1; ++c) {
+				++grid_ptr->cell_starts[r * grid_ptr->cols + c + 1];
+			}
+		}
+	}
+	for (i = 0; i < cell_count; ++i) {
+		grid_ptr->cell_starts[i + 1] += grid_ptr->cell_starts[i];
+	}
+	item_count = grid_ptr->cell_starts[cell_count];
+
+	err = m210_grid_reserve(&grid_ptr->cell_items,
+				&grid_ptr->cell_items_capacity,
+				item_count, sizeof(uint32_t));
+	if (err) {
+		goto out;
+	}
+	memcpy(grid_ptr->cell_cursors, grid_ptr->cell_starts,
+	       cell_count * sizeof(uint32_t));
+	for (i = 0; i < grid_ptr->segment_count; ++i) {
+		struct m210_grid_segment const *const segment_ptr =
+			&grid_ptr->segments[i];
+		int32_t c0 = 0, c1 = -1, r0 = 0, r1 = -1, r, c;
+
+		m210_grid_cells(grid_ptr, grid_ptr->origin_x, grid_ptr->cols,
+				segment_ptr->from->x, segment_ptr->to->x,
+				&c0, &c1);
+		m210_grid_cells(grid_ptr, grid_ptr->origin_y, grid_ptr->rows,
+				segment_ptr->from->y, segment_ptr->to->y,
+				&r0, &r1);
+		for (r = r0; r <= r1; ++r) {
+			for (c = c0; c <= c1; ++c) {
+				uint32_t *const cursor_ptr =
+					&grid_ptr->cell_cursors[
+						r * grid_ptr->cols + c];
+				grid_ptr->cell_items[(*cursor_ptr)++] = i;
+			}
+		}
+	}
+
+	err = m210_grid_reserve(&grid_ptr->stamps, &grid_ptr->stamps_capacity,
+				grid_ptr->segment_count, sizeof(uint32_t));
+	if (err) {
+		goto out;
+	}
+	memset(grid_ptr->stamps, 0, grid_ptr->segment_count * sizeof(uint32_t));
+	grid_ptr->stamp = 0;
+out:
+	if (err) {
+		grid_ptr->segment_count = 0;
+		grid_ptr->cols = 0;
+		grid_ptr->rows = 0;
+	}
+	return err;
+}
+
+/*
+  Clip SEGMENT to REGION with the Liang-Barsky algorithm. Returns 0 if
+  the segment is outside the region. Unclipped end points are copied
+  exactly.
+*/
+static int m210_grid_clip(struct m210_grid_segment const *const segment_ptr,
+			  struct m210_bounds const *const region_ptr,
+			  struct m210_grid_clip *const clip_ptr)
+{
+	double const x0 = segment_ptr->from->x;
+	double const y0 = segment_ptr->from->y;
+	double const dx = segment_ptr->to->x - x0;
+	double const dy = segment_ptr->to->y - y0;
+	double const p[4] = {-dx, dx, -dy, dy};
+	double const q[4] = {
+		x0 - region_ptr->min_x,
+		region_ptr->max_x - x0,
+		y0 - region_ptr->min_y,
+		region_ptr->max_y - y0
+	};
+	double t0 = 0;
+	double t1 = 1;
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		if (p[i] == 0) {
+			if (q[i] < 0) {
+				return 0;
+			}
+		} else {
+			double const t = q[i] / p[i];
+			if (p[i] < 0) {
+				if (t > t1) {
+					return 0;
+				}
+				if (t > t0) {
+					t0 = t;
+				}
+			} else {
+				if (t < t0) {
+					return 0;
+				}
+				if (t < t1) {
+					t1 = t;
+				}
+			}
+		}
+	}
+
+	clip_ptr->x0 = t0 == 0 ? x0 : x0 + t0 * dx;
+	clip_ptr->y0 = t0 == 0 ? y0 : y0 + t0 * dy;
+	clip_ptr->x1 = t1 == 1 ? segment_ptr->to->x : x0 + t1 * dx;
+	clip_ptr->y1 = t1 == 1 ? segment_ptr->to->y : y0 + t1 * dy;
+	return 1;
+}
+
+static int m210_grid_compare_clips(void const *const a, void const *const b)
+{
+	uint32_t const segment_a = ((struct m210_grid_clip const *) a)->segment;
+	uint32_t const segment_b = ((struct m210_grid_clip const *) b)->segment;
+
+	return (segment_a > segment_b) - (segment_a < segment_b);
+}
+
+enum m210_err m210_grid_query(struct m210_grid *const grid_ptr,
+			      struct m210_bounds const *const region_ptr,
+			      struct m210_grid_clip const **const clips_ptr,
+			      size_t *const count_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	size_t count = 0;
+	int32_t c0, c1, r0, r1, r, c;
+
+	if (!grid_ptr->segment_count
+	    || !m210_grid_cells(grid_ptr, grid_ptr->origin_x, grid_ptr->cols,
+				region_ptr->min_x, region_ptr->max_x,
+				&c0, &c1)
+	    || !m210_grid_cells(grid_ptr, grid_ptr->origin_y, grid_ptr->rows,
+				region_ptr->min_y, region_ptr->max_y,
+				&r0, &r1)) {
+		goto out;
+	}
+
+	if (++grid_ptr->stamp == 0) {
+		memset(grid_ptr->stamps, 0,
+		       grid_ptr->segment_count * sizeof(uint32_t));
+		grid_ptr->stamp = 1;
+	}
+
+	for (r = r0; r <= r1; ++r) {
+		for (c = c0; c <= c1; ++c) {
+			uint32_t const cell = r * grid_ptr->cols + c;
+			uint32_t item;
+
+			for (item = grid_ptr->cell_starts[cell];
+			     item < grid_ptr->cell_starts[cell + 1]; ++item) {
+				uint32_t const segment =
+					grid_ptr->cell_items[item];
+				struct m210_grid_clip clip;
+
+				if (grid_ptr->stamps[segment] == grid_ptr->stamp) {
+					continue;
+				}
+				grid_ptr->stamps[segment] = grid_ptr->stamp;
+
+				if (!m210_grid_clip(&grid_ptr->segments[segment],
+						    region_ptr, &clip)) {
+					continue;
+				}
+				clip.stroke = grid_ptr->segments[segment].stroke;
+				clip.segment = segment;
+
+				if (count == grid_ptr->clips_capacity) {
+					size_t const capacity = (
+						grid_ptr->clips_capacity
+						? grid_ptr->clips_capacity * 2
+						: 256);
+					struct m210_grid_clip *const clips =
+						realloc(grid_ptr->clips,
+							capacity * sizeof(clip));
+					if (!clips) {
+						err = M210_ERR_SYS;
+						goto out;
+					}
+					grid_ptr->clips = clips;
+					grid_ptr->clips_capacity = capacity;
+				}
+				grid_ptr->clips[count++] = clip;
+			}
+		}
+	}
+
+	qsort(grid_ptr->clips, count, sizeof(struct m210_grid_clip),
+	      m210_grid_compare_clips);
+out:
+	*clips_ptr = grid_ptr->clips;
+	*count_ptr = err ? 0 : count;
+	return err;
+}
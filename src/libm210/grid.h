@@ -0,0 +1,60 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_GRID_H
+#define M210_GRID_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "err.h"
+#include "stroke.h"
+
+/*
+  Uniform grid index over the stroke segments of a note, for finding
+  the parts of a note inside a region without walking all of it.
+
+  m210_grid_build() consumes the remaining strokes of the current note
+  of a stroke iterator; the segments refer to the points of those
+  strokes, which stay valid until the iterator moves to the next
+  note. m210_grid_query() returns the segments intersecting a region,
+  clipped to it, in stroke order. All storage is owned by the grid and
+  reused from note to note.
+*/
+
+typedef struct m210_grid *m210_grid;
+
+struct m210_grid_clip {
+	/* Index of the stroke and of the segment within the note. */
+	uint32_t stroke;
+	uint32_t segment;
+	/* The segment clipped to the region. */
+	double x0;
+	double y0;
+	double x1;
+	double y1;
+};
+
+enum m210_err m210_grid_new(m210_grid *gridp);
+void m210_grid_free(m210_grid *gridp);
+enum m210_err m210_grid_build(m210_grid grid, m210_strokes strokes);
+enum m210_err m210_grid_query(m210_grid grid,
+			      struct m210_bounds const *regionp,
+			      struct m210_grid_clip const **clipsp,
+			      size_t *countp);
+
+#endif /* M210_GRID_H */
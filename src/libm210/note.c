@@ -40,6 +40,7 @@ enum m210_err m210_note_read_head(struct m210_note_head *headp, FILE *file)
 	enum m210_err err;
 	struct m210_rawnote_head rawhead;
 	long cur_pos;
+	uint32_t next_pos;
 
 	if (fread(&rawhead, sizeof(struct m210_rawnote_head), 1, file) != 1) {
 		if (ferror(file)) {
@@ -60,6 +61,7 @@ enum m210_err m210_note_read_head(struct m210_note_head *headp, FILE *file)
 		 * purposes: notes are always downloaded in 62 byte
 		 * long packets.) */
 		headp->number = 0;
+		headp->state = 0;
 		headp->bodyc = 0;
 		err = M210_ERR_OK;
 		goto out;
@@ -72,15 +74,37 @@ enum m210_err m210_note_read_head(struct m210_note_head *headp, FILE *file)
 	}
 
 	/* The data section of a note consists of exactly N bodies. */
-	headp->bodyc = ((le24toh32(rawhead.next_pos) - cur_pos)
+	next_pos = le24toh32(rawhead.next_pos);
+	if (next_pos < cur_pos
+	    || (next_pos - cur_pos) % sizeof(struct m210_rawnote_body)) {
+		err = M210_ERR_BAD_RAWNOTE_HEAD;
+		goto out;
+	}
+	headp->bodyc = ((next_pos - cur_pos)
 			/ sizeof(struct m210_rawnote_body));
 	headp->number = rawhead.number;
+	headp->state = rawhead.state;
 
 	err = M210_ERR_OK;
 out:
 	return err;
 }
 
+static inline void to_body(struct m210_note_body *const bodyp,
+			   struct m210_rawnote_body const *const rawbodyp)
+{
+	uint16_t x;
+	uint16_t y;
+
+	/* Map byte arrays to coordinate values and mind the byte
+	 * order. */
+	memcpy(&x, rawbodyp->x, 2);
+	memcpy(&y, rawbodyp->y, 2);
+	bodyp->x = le16toh(x);
+	bodyp->y = le16toh(y);
+	bodyp->pressure = !is_penup(rawbodyp);
+}
+
 enum m210_err m210_note_read_body(struct m210_note_body *bodyp, FILE *file)
 {
 	enum m210_err err;
@@ -100,18 +124,39 @@ enum m210_err m210_note_read_body(struct m210_note_body *bodyp, FILE *file)
 		goto out;
 	}
 
-	/* Map byte arrays to coordinate values. */
-	memcpy(&(bodyp->x), rawbody.x, 2);
-	memcpy(&(bodyp->y), rawbody.y, 2);
+	to_body(bodyp, &rawbody);
+
+	err = M210_ERR_OK;
+out:
+	return err;
+}
+
+enum m210_err m210_note_read_bodies(struct m210_note_body *bodies,
+				    size_t count, FILE *file)
+{
+	enum m210_err err;
+	struct m210_rawnote_body rawbodies[1024];
+
+	while (count) {
+		size_t const chunk = (count < 1024 ? count : 1024);
+		size_t i;
+
+		if (fread(rawbodies, sizeof(struct m210_rawnote_body), chunk,
+			  file) != chunk) {
+			if (ferror(file)) {
+				err = M210_ERR_BAD_RAWNOTE_BODY;
+				goto out;
+			}
+			err = M210_ERR_UNEXPECTED_EOF;
+			goto out;
+		}
 
-	/* Mind the byte order. */
-	bodyp->x = le16toh(bodyp->x);
-	bodyp->y = le16toh(bodyp->y);
+		for (i = 0; i < chunk; ++i) {
+			to_body(&bodies[i], &rawbodies[i]);
+		}
 
-	if (is_penup(&rawbody)) {
-		bodyp->pressure = 0;
-	} else {
-		bodyp->pressure = 1;
+		bodies += chunk;
+		count -= chunk;
 	}
 
 	err = M210_ERR_OK;
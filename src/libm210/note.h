@@ -15,12 +15,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef NOTE_H
-#define NOTE_H
+#ifndef M210_NOTE_H
+#define M210_NOTE_H
 
 #include <stdio.h>
 #include <stdint.h>
 
+#include <sys/types.h>
+
 #include "err.h"
 
 struct m210_note_body {
@@ -31,10 +33,13 @@ struct m210_note_body {
 
 struct m210_note_head {
 	uint8_t number;
+	uint8_t state; /* One of M210_RAWNOTE_STATE_*. */
 	ssize_t bodyc;
 };
 
 enum m210_err m210_note_read_head(struct m210_note_head *headp, FILE *file);
 enum m210_err m210_note_read_body(struct m210_note_body *bodyp, FILE *file);
+enum m210_err m210_note_read_bodies(struct m210_note_body *bodies,
+				    size_t count, FILE *file);
 
-#endif /* NOTE_H */
+#endif /* M210_NOTE_H */
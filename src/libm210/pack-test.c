@@ -0,0 +1,200 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Tests of packed note streams, run by `make check'. A raw note stream
+  must come back byte for byte from m210_pack_encode() and
+  m210_pack_decode(), including whatever follows the empty head ending
+  it, and a packed stream with a damaged tail must be rejected.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pack.h"
+#include "rawnote.h"
+
+#define RAW_SIZE 4096
+
+static int failures;
+
+static void fail(char const *const name, char const *const what)
+{
+	fprintf(stderr, "FAIL: %s: %s\n", name, what);
+	++failures;
+}
+
+/*
+  Write a raw note stream of NOTEC notes to RAW, followed by the empty
+  head, and return the size of the notes and the empty head.
+*/
+static size_t raw_notes(uint8_t *const raw, int const notec)
+{
+	size_t pos = 0;
+
+	memset(raw, 0, RAW_SIZE);
+	for (int i = 0; i < notec; ++i) {
+		struct m210_rawnote_head head = M210_RAWNOTE_HEAD_LAST;
+		int const bodyc = 20 + 7 * i;
+		size_t const next_pos = (pos + sizeof(head)
+					 + bodyc * sizeof(struct m210_rawnote_body));
+
+		head.next_pos[0] = next_pos & 0xff;
+		head.next_pos[1] = (next_pos >> 8) & 0xff;
+		head.next_pos[2] = (next_pos >> 16) & 0xff;
+		head.state = M210_RAWNOTE_STATE_FINISHED_BY_USER;
+		head.number = i + 1;
+		head.last_number = notec;
+		memcpy(raw + pos, &head, sizeof(head));
+		pos += sizeof(head);
+
+		for (int j = 0; j < bodyc; ++j) {
+			struct m210_rawnote_body body;
+			uint16_t const x = 1000 + 3 * j + 200 * i;
+			uint16_t const y = 2000 - 5 * j;
+
+			if (j % 9 == 8) {
+				body = M210_RAWNOTE_BODY_PENUP;
+			} else {
+				body.x[0] = x & 0xff;
+				body.x[1] = x >> 8;
+				body.y[0] = y & 0xff;
+				body.y[1] = y >> 8;
+			}
+			memcpy(raw + pos, &body, sizeof(body));
+			pos += sizeof(body);
+		}
+	}
+	return pos + sizeof(M210_RAWNOTE_HEAD_LAST);
+}
+
+static enum m210_err encode(uint8_t const *const raw, size_t const raw_size,
+			    char **const pack_ptr, size_t *const pack_size_ptr)
+{
+	enum m210_err err;
+	FILE *pack_file = open_memstream(pack_ptr, pack_size_ptr);
+
+	if (pack_file == NULL) {
+		return M210_ERR_SYS;
+	}
+	err = m210_pack_encode(raw, raw_size, pack_file);
+	if (fclose(pack_file) && !err) {
+		err = M210_ERR_SYS;
+	}
+	return err;
+}
+
+static enum m210_err decode(char const *const pack, size_t const pack_size,
+			    char **const raw_ptr, size_t *const raw_size_ptr)
+{
+	enum m210_err err;
+	FILE *raw_file = open_memstream(raw_ptr, raw_size_ptr);
+
+	if (raw_file == NULL) {
+		return M210_ERR_SYS;
+	}
+	err = m210_pack_decode(pack, pack_size, raw_file);
+	if (fclose(raw_file) && !err) {
+		err = M210_ERR_SYS;
+	}
+	return err;
+}
+
+/*
+  Pack and unpack RAW and compare. If TAIL_SIZE is not 0, the tail is
+  stored at the end of the packed stream and damaging its last byte
+  must be noticed.
+*/
+static void test_round_trip(char const *const name, uint8_t const *const raw,
+			    size_t const raw_size, size_t const tail_size)
+{
+	char *pack = NULL;
+	size_t pack_size = 0;
+	char *decoded = NULL;
+	size_t decoded_size = 0;
+	enum m210_err err;
+
+	err = encode(raw, raw_size, &pack, &pack_size);
+	if (err) {
+		fail(name, m210_err_strerror(err));
+		goto out;
+	}
+	if (!m210_pack_is_packed(pack, pack_size)) {
+		fail(name, "output is not packed");
+		goto out;
+	}
+
+	err = decode(pack, pack_size, &decoded, &decoded_size);
+	if (err) {
+		fail(name, m210_err_strerror(err));
+		goto out;
+	}
+	if (decoded_size != raw_size || memcmp(decoded, raw, raw_size)) {
+		fail(name, "unpacked stream differs");
+		goto out;
+	}
+
+	if (tail_size) {
+		char *damaged = NULL;
+		size_t damaged_size = 0;
+
+		pack[pack_size - 1] ^= 0x5a;
+		err = decode(pack, pack_size, &damaged, &damaged_size);
+		free(damaged);
+		if (err != M210_ERR_BAD_PACK) {
+			fail(name, "damaged tail was accepted");
+		}
+	}
+out:
+	free(pack);
+	free(decoded);
+}
+
+int main(void)
+{
+	uint8_t *const raw = malloc(RAW_SIZE);
+	size_t size;
+
+	if (raw == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	size = raw_notes(raw, 0);
+	test_round_trip("empty", raw, size, 0);
+
+	size = raw_notes(raw, 5);
+	test_round_trip("no padding", raw, size, 0);
+	test_round_trip("zero padding", raw, RAW_SIZE, 0);
+
+	/* Leftovers of deleted notes after the empty head. */
+	for (size_t i = size; i < RAW_SIZE; i += 7) {
+		raw[i] = i & 0xff;
+	}
+	test_round_trip("tail", raw, RAW_SIZE, RAW_SIZE - size);
+
+	memset(raw + size, 0, RAW_SIZE - size);
+	raw[RAW_SIZE - 1] = 1;
+	test_round_trip("tail at the end", raw, RAW_SIZE, RAW_SIZE - size);
+
+	free(raw);
+	return failures ? 1 : 0;
+}
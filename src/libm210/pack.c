@@ -0,0 +1,464 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc.h"
+#include "pack.h"
+#include "rawnote.h"
+
+#define M210_PACK_HEADER_SIZE 28
+#define M210_PACK_HEADER_SIZE_V1 20
+#define M210_PACK_ENTRY_SIZE 28
+#define M210_PACK_HEAD_SIZE (sizeof(struct m210_rawnote_head) - 3)
+
+/* The longest encoding of a body: two 3 byte varints. */
+#define M210_PACK_MAX_BODY_SIZE 6
+
+#define M210_PACK_PENUP 1
+
+struct m210_pack_entry {
+	uint8_t head[M210_PACK_HEAD_SIZE];
+	uint32_t bodyc;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t crc;
+};
+
+static inline uint32_t m210_pack_get32(uint8_t const *const bytes)
+{
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return le32toh(value);
+}
+
+static inline void m210_pack_put32(uint8_t *const bytes, uint32_t const value)
+{
+	uint32_t const value_le = htole32(value);
+	memcpy(bytes, &value_le, sizeof(value_le));
+}
+
+static inline uint32_t m210_pack_zigzag(int32_t const value)
+{
+	return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static inline int32_t m210_pack_unzigzag(uint32_t const value)
+{
+	return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+static inline uint8_t *m210_pack_put_varint(uint8_t *bytes, uint32_t value)
+{
+	while (value >= 0x80) {
+		*bytes++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	*bytes++ = value;
+	return bytes;
+}
+
+/*
+  Return a pointer past the varint at BYTES, or NULL if the varint is
+  truncated or too long.
+*/
+static inline uint8_t const *m210_pack_get_varint(uint8_t const *bytes,
+						  uint8_t const *const end,
+						  uint32_t *const value_ptr)
+{
+	uint32_t value = 0;
+	int shift;
+
+	for (shift = 0; shift < 35 && bytes < end; shift += 7) {
+		uint8_t const byte = *bytes++;
+		value |= (uint32_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value_ptr = value;
+			return bytes;
+		}
+	}
+	return NULL;
+}
+
+int m210_pack_is_packed(void const *const data, size_t const size)
+{
+	return (size >= M210_PACK_MAGIC_SIZE
+		&& !memcmp(data, M210_PACK_MAGIC, M210_PACK_MAGIC_SIZE));
+}
+
+static uint8_t *m210_pack_encode_bodies(uint8_t *out,
+					struct m210_rawnote_body const *bodies,
+					size_t const bodyc)
+{
+	int32_t x = 0;
+	int32_t y = 0;
+	size_t i;
+
+	for (i = 0; i < bodyc; ++i) {
+		int32_t new_x;
+		int32_t new_y;
+
+		if (!memcmp(&bodies[i], &M210_RAWNOTE_BODY_PENUP,
+			    sizeof(struct m210_rawnote_body))) {
+			*out++ = M210_PACK_PENUP;
+			continue;
+		}
+
+		new_x = (int16_t) (bodies[i].x[0] | bodies[i].x[1] << 8);
+		new_y = (int16_t) (bodies[i].y[0] | bodies[i].y[1] << 8);
+		out = m210_pack_put_varint(out,
+					   m210_pack_zigzag(new_x - x) << 1);
+		out = m210_pack_put_varint(out, m210_pack_zigzag(new_y - y));
+		x = new_x;
+		y = new_y;
+	}
+	return out;
+}
+
+enum m210_err m210_pack_encode(void const *const raw_data,
+			       size_t const raw_size,
+			       FILE *const pack_file)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t const *const raw = raw_data;
+	struct m210_pack_entry *entries = NULL;
+	size_t entry_count = 0;
+	size_t entry_capacity = 0;
+	uint8_t *data = NULL;
+	uint8_t *data_end;
+	uint8_t *index = NULL;
+	uint8_t header[M210_PACK_HEADER_SIZE];
+	size_t pos = 0;
+	size_t tail_pos;
+	size_t tail_size = 0;
+	size_t i;
+
+	if (raw_size > UINT32_MAX) {
+		err = M210_ERR_BAD_RAWNOTE_HEAD;
+		goto out;
+	}
+
+	data = malloc(raw_size / sizeof(struct m210_rawnote_body)
+		      * M210_PACK_MAX_BODY_SIZE + 1);
+	if (!data) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	data_end = data;
+
+	while (1) {
+		struct m210_rawnote_head head;
+		struct m210_pack_entry *entry_ptr;
+		uint32_t next_pos = 0;
+		size_t body_pos;
+
+		if (raw_size - pos < sizeof(head)) {
+			err = M210_ERR_UNEXPECTED_EOF;
+			goto out;
+		}
+		memcpy(&head, raw + pos, sizeof(head));
+		if (!memcmp(&head, &M210_RAWNOTE_HEAD_LAST, sizeof(head))) {
+			break;
+		}
+
+		body_pos = pos + sizeof(head);
+		memcpy(&next_pos, head.next_pos, sizeof(head.next_pos));
+		next_pos = le32toh(next_pos);
+		if (next_pos < body_pos || next_pos > raw_size
+		    || (next_pos - body_pos) % sizeof(struct m210_rawnote_body)) {
+			err = M210_ERR_BAD_RAWNOTE_HEAD;
+			goto out;
+		}
+
+		if (entry_count == entry_capacity) {
+			struct m210_pack_entry *new_entries;
+			entry_capacity = entry_capacity ? entry_capacity * 2 : 16;
+			new_entries = realloc(entries, entry_capacity
+					      * sizeof(struct m210_pack_entry));
+			if (!new_entries) {
+				err = M210_ERR_SYS;
+				goto out;
+			}
+			entries = new_entries;
+		}
+
+		entry_ptr = &entries[entry_count++];
+		memcpy(entry_ptr->head, raw + pos + 3, M210_PACK_HEAD_SIZE);
+		entry_ptr->bodyc = ((next_pos - body_pos)
+				    / sizeof(struct m210_rawnote_body));
+		entry_ptr->offset = data_end - data;
+		entry_ptr->crc = m210_crc32c(0, raw + body_pos,
+					     next_pos - body_pos);
+		data_end = m210_pack_encode_bodies(
+			data_end,
+			(struct m210_rawnote_body const *) (raw + body_pos),
+			entry_ptr->bodyc);
+		entry_ptr->size = data_end - data - entry_ptr->offset;
+
+		pos = next_pos;
+	}
+
+	/* Keep the tail only if it is not plain padding. */
+	tail_pos = pos + sizeof(M210_RAWNOTE_HEAD_LAST);
+	for (i = tail_pos; i < raw_size; ++i) {
+		if (raw[i]) {
+			tail_size = raw_size - tail_pos;
+			break;
+		}
+	}
+
+	index = calloc(entry_count ? entry_count : 1, M210_PACK_ENTRY_SIZE);
+	if (!index) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	for (i = 0; i < entry_count; ++i) {
+		uint8_t *const entry = index + i * M210_PACK_ENTRY_SIZE;
+		memcpy(entry, entries[i].head, M210_PACK_HEAD_SIZE);
+		m210_pack_put32(entry + 12, entries[i].bodyc);
+		m210_pack_put32(entry + 16, (M210_PACK_HEADER_SIZE
+					     + entry_count * M210_PACK_ENTRY_SIZE
+					     + entries[i].offset));
+		m210_pack_put32(entry + 20, entries[i].size);
+		m210_pack_put32(entry + 24, entries[i].crc);
+	}
+
+	memcpy(header, M210_PACK_MAGIC, M210_PACK_MAGIC_SIZE);
+	header[7] = M210_PACK_VERSION;
+	m210_pack_put32(header + 8, entry_count);
+	m210_pack_put32(header + 12, raw_size);
+	m210_pack_put32(header + 16,
+			m210_crc32c(0, index,
+				    entry_count * M210_PACK_ENTRY_SIZE));
+	m210_pack_put32(header + 20, tail_size);
+	m210_pack_put32(header + 24, m210_crc32c(0, raw + tail_pos, tail_size));
+
+	if (fwrite(header, sizeof(header), 1, pack_file) != 1
+	    || (entry_count
+		&& fwrite(index, M210_PACK_ENTRY_SIZE, entry_count,
+			  pack_file) != entry_count)
+	    || (data_end != data
+		&& fwrite(data, data_end - data, 1, pack_file) != 1)
+	    || (tail_size
+		&& fwrite(raw + tail_pos, tail_size, 1, pack_file) != 1)) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	free(index);
+	free(data);
+	free(entries);
+	return err;
+}
+
+/*
+  Decode BODYC bodies from the note data in [BYTES, END) to BODIES.
+*/
+static enum m210_err m210_pack_decode_bodies(uint8_t const *bytes,
+					     uint8_t const *const end,
+					     struct m210_rawnote_body *bodies,
+					     uint32_t const bodyc)
+{
+	int32_t x = 0;
+	int32_t y = 0;
+	uint32_t i;
+
+	for (i = 0; i < bodyc; ++i) {
+		uint32_t value;
+
+		/* Fast path: both coordinates fit in one byte. */
+		if (end - bytes >= 2 && !((bytes[0] | bytes[1]) & 0x80)) {
+			value = bytes[0];
+			if (value & 1) {
+				if (value != M210_PACK_PENUP) {
+					return M210_ERR_BAD_PACK;
+				}
+				bodies[i] = M210_RAWNOTE_BODY_PENUP;
+				++bytes;
+				continue;
+			}
+			x += m210_pack_unzigzag(value >> 1);
+			y += m210_pack_unzigzag(bytes[1]);
+			bytes += 2;
+		} else {
+			bytes = m210_pack_get_varint(bytes, end, &value);
+			if (!bytes || (value & 1 && value != M210_PACK_PENUP)) {
+				return M210_ERR_BAD_PACK;
+			}
+			if (value == M210_PACK_PENUP) {
+				bodies[i] = M210_RAWNOTE_BODY_PENUP;
+				continue;
+			}
+			x += m210_pack_unzigzag(value >> 1);
+			bytes = m210_pack_get_varint(bytes, end, &value);
+			if (!bytes) {
+				return M210_ERR_BAD_PACK;
+			}
+			y += m210_pack_unzigzag(value);
+		}
+
+		x = (int16_t) x;
+		y = (int16_t) y;
+		bodies[i].x[0] = x & 0xff;
+		bodies[i].x[1] = (x >> 8) & 0xff;
+		bodies[i].y[0] = y & 0xff;
+		bodies[i].y[1] = (y >> 8) & 0xff;
+	}
+
+	return bytes == end ? M210_ERR_OK : M210_ERR_BAD_PACK;
+}
+
+enum m210_err m210_pack_decode(void const *const pack_data,
+			       size_t const pack_size,
+			       FILE *const raw_file)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t const *const pack = pack_data;
+	uint8_t const *index;
+	struct m210_rawnote_body *bodies = NULL;
+	uint32_t count;
+	uint32_t raw_size;
+	uint32_t tail_size = 0;
+	size_t header_size;
+	size_t pos = 0;
+	uint32_t i;
+
+	if (pack_size < M210_PACK_HEADER_SIZE_V1
+	    || !m210_pack_is_packed(pack, pack_size)
+	    || (pack[7] != M210_PACK_VERSION && pack[7] != 1)) {
+		err = M210_ERR_BAD_PACK;
+		goto out;
+	}
+
+	header_size = (pack[7] == 1 ? M210_PACK_HEADER_SIZE_V1
+		       : M210_PACK_HEADER_SIZE);
+	if (pack_size < header_size) {
+		err = M210_ERR_BAD_PACK;
+		goto out;
+	}
+
+	count = m210_pack_get32(pack + 8);
+	raw_size = m210_pack_get32(pack + 12);
+	if (header_size == M210_PACK_HEADER_SIZE) {
+		tail_size = m210_pack_get32(pack + 20);
+	}
+	index = pack + header_size;
+	if (count > (pack_size - header_size) / M210_PACK_ENTRY_SIZE
+	    || (m210_crc32c(0, index, (size_t) count * M210_PACK_ENTRY_SIZE)
+		!= m210_pack_get32(pack + 16))
+	    || tail_size > pack_size - header_size
+	    - (size_t) count * M210_PACK_ENTRY_SIZE
+	    || (tail_size
+		&& (m210_crc32c(0, pack + pack_size - tail_size, tail_size)
+		    != m210_pack_get32(pack + 24)))) {
+		err = M210_ERR_BAD_PACK;
+		goto out;
+	}
+
+	/* Every body takes at least one byte of note data. */
+	bodies = malloc(pack_size * sizeof(struct m210_rawnote_body));
+	if (!bodies) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	for (i = 0; i < count; ++i) {
+		uint8_t const *const entry = index + i * M210_PACK_ENTRY_SIZE;
+		uint32_t const bodyc = m210_pack_get32(entry + 12);
+		uint32_t const offset = m210_pack_get32(entry + 16);
+		uint32_t const size = m210_pack_get32(entry + 20);
+		size_t const body_size = ((size_t) bodyc
+					  * sizeof(struct m210_rawnote_body));
+		uint8_t head[sizeof(struct m210_rawnote_head)];
+		uint32_t next_pos;
+
+		if (offset > pack_size || size > pack_size - offset
+		    || bodyc > size) {
+			err = M210_ERR_BAD_PACK;
+			goto out;
+		}
+
+		err = m210_pack_decode_bodies(pack + offset,
+					      pack + offset + size,
+					      bodies, bodyc);
+		if (err) {
+			goto out;
+		}
+
+		if (m210_crc32c(0, bodies, body_size)
+		    != m210_pack_get32(entry + 24)) {
+			err = M210_ERR_SUM_MISMATCH;
+			goto out;
+		}
+
+		next_pos = pos + sizeof(head) + body_size;
+		if (next_pos > 0xffffff) {
+			err = M210_ERR_BAD_PACK;
+			goto out;
+		}
+		head[0] = next_pos & 0xff;
+		head[1] = (next_pos >> 8) & 0xff;
+		head[2] = (next_pos >> 16) & 0xff;
+		memcpy(head + 3, entry, M210_PACK_HEAD_SIZE);
+
+		if (fwrite(head, sizeof(head), 1, raw_file) != 1
+		    || (body_size
+			&& fwrite(bodies, body_size, 1, raw_file) != 1)) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		pos = next_pos;
+	}
+
+	if (fwrite(&M210_RAWNOTE_HEAD_LAST, sizeof(M210_RAWNOTE_HEAD_LAST), 1,
+		   raw_file) != 1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	pos += sizeof(M210_RAWNOTE_HEAD_LAST);
+
+	if (tail_size) {
+		if (pos + tail_size != raw_size) {
+			err = M210_ERR_BAD_PACK;
+			goto out;
+		}
+		if (fwrite(pack + pack_size - tail_size, tail_size, 1,
+			   raw_file) != 1) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		pos += tail_size;
+	}
+
+	/* Restore the padding of the original stream. */
+	while (pos < raw_size) {
+		static uint8_t const zeros[64];
+		size_t const chunk = (raw_size - pos < sizeof(zeros)
+				      ? raw_size - pos : sizeof(zeros));
+		if (fwrite(zeros, chunk, 1, raw_file) != 1) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+		pos += chunk;
+	}
+out:
+	free(bodies);
+	return err;
+}
@@ -0,0 +1,73 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_PACK_H
+#define M210_PACK_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+/*
+  Packed note file format, a compact archival form of a raw note
+  stream. All integers are little-endian.
+
+  HEADER (28 bytes):
+    magic      7 bytes, "M210PAK"
+    version    1 byte, M210_PACK_VERSION
+    count      4 bytes, number of notes
+    raw_size   4 bytes, size of the original raw note stream
+    index_crc  4 bytes, CRC-32C of the index
+    tail_size  4 bytes, size of the tail, 0 if the tail is all zeros
+    tail_crc   4 bytes, CRC-32C of the tail
+
+  INDEX (count * 28 bytes), one entry per note:
+    head       11 bytes, raw note head without next_pos
+    reserved   1 byte, zero
+    bodyc      4 bytes, number of bodies (points and pen-ups)
+    offset     4 bytes, position of the note data in the file
+    size       4 bytes, size of the note data
+    crc        4 bytes, CRC-32C of the raw body section, the same
+               value as in a checksum file
+
+  DATA: a sequence of unsigned LEB128 varints per note. A point is
+  encoded as two varints, zigzag(dx) << 1 and zigzag(dy), where dx and
+  dy are the deltas from the previous point of the note (the first
+  point is relative to 0,0). A pen-up is the single varint 1.
+
+  TAIL (tail_size bytes): the part of the raw note stream after the
+  empty head ending it, usually zero padding up to the packet size,
+  which is stored only if it is not all zeros. Otherwise the decoder
+  pads the stream with zeros up to raw_size.
+
+  Version 1 files have a 20 byte header without the tail fields and
+  are read as if their tail was all zeros.
+*/
+
+#define M210_PACK_VERSION 2
+
+#define M210_PACK_MAGIC "M210PAK"
+#define M210_PACK_MAGIC_SIZE 7
+
+int m210_pack_is_packed(void const *data, size_t size);
+enum m210_err m210_pack_encode(void const *raw_data, size_t raw_size,
+			       FILE *pack_file);
+enum m210_err m210_pack_decode(void const *pack_data, size_t pack_size,
+			       FILE *raw_file);
+
+#endif /* M210_PACK_H */
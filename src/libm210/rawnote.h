@@ -15,8 +15,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef RAWNOTE_H
-#define RAWNOTE_H
+#ifndef M210_RAWNOTE_H
+#define M210_RAWNOTE_H
 
 #include <stdint.h>
 
@@ -51,4 +51,4 @@ static struct m210_rawnote_body const M210_RAWNOTE_BODY_PENUP = {
 	{0x00, 0x80}
 };
 
-#endif /* RAWNOTE_H */
+#endif /* M210_RAWNOTE_H */
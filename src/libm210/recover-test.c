@@ -0,0 +1,192 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Tests of the recovery of damaged raw note streams, run by `make
+  check'. A stream of notes is damaged in the ways a dump breaks, and
+  the recovered stream must be the stream of the notes expected to
+  survive, built from scratch.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rawnote.h"
+#include "recover.h"
+
+#define NOTE_COUNT 5
+#define PACKET_SIZE 62
+
+static int failures;
+
+static void fail(char const *const name, char const *const what)
+{
+	fprintf(stderr, "FAIL: %s: %s\n", name, what);
+	++failures;
+}
+
+/* Number of bodies of note I, 0 for the first. */
+static size_t note_bodyc(int const i)
+{
+	return 10 + 17 * i;
+}
+
+/*
+  Write the notes of INCLUDED, a bit per note, to RAW followed by the
+  last head and return the size of the stream. The heads of the notes
+  are returned in HEADS, if not NULL.
+*/
+static size_t raw_notes(uint8_t *const raw, unsigned const included,
+			size_t *const heads)
+{
+	size_t pos = 0;
+	int i;
+
+	for (i = 0; i < NOTE_COUNT; ++i) {
+		struct m210_rawnote_head head = M210_RAWNOTE_HEAD_LAST;
+		size_t const next_pos = (pos + sizeof(head) + note_bodyc(i)
+					 * sizeof(struct m210_rawnote_body));
+		size_t j;
+
+		if (!(included & 1 << i)) {
+			continue;
+		}
+		if (heads) {
+			heads[i] = pos;
+		}
+		head.next_pos[0] = next_pos & 0xff;
+		head.next_pos[1] = (next_pos >> 8) & 0xff;
+		head.next_pos[2] = (next_pos >> 16) & 0xff;
+		head.state = M210_RAWNOTE_STATE_FINISHED_BY_USER;
+		head.number = i + 1;
+		head.last_number = NOTE_COUNT;
+		memcpy(raw + pos, &head, sizeof(head));
+		pos += sizeof(head);
+
+		for (j = 0; j < note_bodyc(i); ++j) {
+			struct m210_rawnote_body body = {
+				{j & 0xff, i}, {(j * 3) & 0xff, 0x10}
+			};
+
+			if (j % 6 == 5) {
+				body = M210_RAWNOTE_BODY_PENUP;
+			}
+			memcpy(raw + pos, &body, sizeof(body));
+			pos += sizeof(body);
+		}
+	}
+
+	memcpy(raw + pos, &M210_RAWNOTE_HEAD_LAST,
+	       sizeof(M210_RAWNOTE_HEAD_LAST));
+	return pos + sizeof(M210_RAWNOTE_HEAD_LAST);
+}
+
+/*
+  Recover the SIZE bytes of RAW and compare the result with the stream
+  of the notes of INCLUDED, padded to whole packets.
+*/
+static void expect(char const *const name, uint8_t const *const raw,
+		   size_t const size, unsigned const included,
+		   size_t const skipped_size)
+{
+	uint8_t expected[4096];
+	size_t expected_size;
+	char *recovered = NULL;
+	size_t recovered_size = 0;
+	struct m210_recover_stats stats;
+	FILE *file;
+	enum m210_err err;
+	int note_count = 0;
+	int i;
+
+	memset(expected, 0, sizeof(expected));
+	expected_size = raw_notes(expected, included, NULL);
+	expected_size += (PACKET_SIZE - expected_size % PACKET_SIZE)
+		% PACKET_SIZE;
+	for (i = 0; i < NOTE_COUNT; ++i) {
+		note_count += !!(included & 1 << i);
+	}
+
+	file = open_memstream(&recovered, &recovered_size);
+	if (file == NULL) {
+		fail(name, "open_memstream failed");
+		return;
+	}
+	err = m210_recover(raw, size, file, &stats);
+	if (fclose(file) && !err) {
+		err = M210_ERR_SYS;
+	}
+
+	if (err) {
+		fail(name, m210_err_strerror(err));
+	} else if (recovered_size != expected_size
+		   || memcmp(recovered, expected, expected_size)) {
+		fail(name, "recovered stream differs");
+	} else if (stats.note_count != (size_t) note_count) {
+		fail(name, "wrong number of recovered notes");
+	} else if (stats.skipped_size != skipped_size) {
+		fail(name, "wrong number of skipped bytes");
+	}
+	free(recovered);
+}
+
+int main(void)
+{
+	unsigned const all = (1 << NOTE_COUNT) - 1;
+	uint8_t raw[4096];
+	size_t heads[NOTE_COUNT];
+	size_t size;
+
+	memset(raw, 0, sizeof(raw));
+	size = raw_notes(raw, all, heads);
+	expect("intact", raw, size, all, 0);
+
+	/* Padding after the last head is not part of any note. */
+	expect("padded", raw, size + 100, all, 0);
+
+	/* A note with a broken state is skipped, the scan finds the
+	 * next head. */
+	raw[heads[2] + 3] = 0x42;
+	expect("bad state", raw, size, all & ~(1 << 2),
+	       heads[3] - heads[2]);
+	raw_notes(raw, all, NULL);
+
+	/* A next_pos pointing into the bodies of the next note is cut
+	 * back to the head found before it. */
+	raw[heads[1]] += 8;
+	expect("bad next_pos", raw, size, all, 0);
+	raw_notes(raw, all, NULL);
+
+	/* A next_pos past the end of the stream, and no head after it. */
+	raw[heads[4] + 2] = 0x7f;
+	expect("next_pos past the end", raw, size, all & ~(1 << 4),
+	       size - heads[4]);
+	raw_notes(raw, all, NULL);
+
+	/* The stream ends in the middle of the last note. */
+	expect("truncated", raw, heads[4] + 20, all & ~(1 << 4), 20);
+
+	/* Nothing of the first note is left but its bodies. */
+	memset(raw, 0xee, sizeof(struct m210_rawnote_head));
+	expect("bad first head", raw, size, all & ~1, heads[1]);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <string.h>
+
+#include "rawnote.h"
+#include "recover.h"
+#include "simd.h"
+
+/* Notes are downloaded in packets of this many bytes. */
+#define M210_RECOVER_PACKET_SIZE 62
+
+#define M210_RECOVER_STATE_OFFSET 3
+
+/* All valid states have the low five bits set. */
+#define M210_RECOVER_STATE_MASK 0x1f
+
+static int m210_recover_is_last(uint8_t const *const data, size_t const size,
+				size_t const pos)
+{
+	return (size - pos >= sizeof(struct m210_rawnote_head)
+		&& !memcmp(data + pos, &M210_RAWNOTE_HEAD_LAST,
+			   sizeof(struct m210_rawnote_head)));
+}
+
+/*
+  Return the next_pos of a valid head at POS, or 0 if there is none.
+*/
+static uint32_t m210_recover_check(uint8_t const *const data,
+				   size_t const size, size_t const pos)
+{
+	struct m210_rawnote_head head;
+	uint32_t next_pos = 0;
+	size_t body_pos;
+
+	if (size - pos < sizeof(head)) {
+		return 0;
+	}
+	memcpy(&head, data + pos, sizeof(head));
+
+	switch (head.state) {
+	case M210_RAWNOTE_STATE_EMPTY:
+	case M210_RAWNOTE_STATE_UNFINISHED:
+	case M210_RAWNOTE_STATE_FINISHED_BY_USER:
+	case M210_RAWNOTE_STATE_FINISHED_BY_SOFTWARE:
+		break;
+	default:
+		return 0;
+	}
+
+	body_pos = pos + sizeof(head);
+	memcpy(&next_pos, head.next_pos, sizeof(head.next_pos));
+	next_pos = le32toh(next_pos);
+	if (next_pos < body_pos || next_pos > size
+	    || (next_pos - body_pos) % sizeof(struct m210_rawnote_body)) {
+		return 0;
+	}
+	return next_pos;
+}
+
+/*
+  Whether the note chain can continue at NEXT_POS: there is a valid
+  head, the last head or the end of the stream.
+*/
+static int m210_recover_follows(uint8_t const *const data, size_t const size,
+				uint32_t const next_pos)
+{
+	return (size - next_pos < sizeof(struct m210_rawnote_head)
+		|| m210_recover_is_last(data, size, next_pos)
+		|| m210_recover_check(data, size, next_pos));
+}
+
+/*
+  A head found by scanning is plausible if it is valid and the note
+  chain can continue after it.
+*/
+static uint32_t m210_recover_check_found(uint8_t const *const data,
+					 size_t const size, size_t const pos)
+{
+	uint32_t const next_pos = m210_recover_check(data, size, pos);
+
+	if (next_pos && m210_recover_follows(data, size, next_pos)) {
+		return next_pos;
+	}
+	return 0;
+}
+
+/*
+  Find the next plausible head at or after FROM. Heads are always at
+  even positions: the first one is at 0 and notes are 14 + 4 * N bytes
+  long. Return SIZE if there is none.
+*/
+static size_t m210_recover_scan(uint8_t const *const data, size_t const size,
+				size_t const from, uint32_t *const next_pos_ptr)
+{
+	/* Position of the state byte of the first candidate. */
+	size_t i = from + from % 2 + M210_RECOVER_STATE_OFFSET;
+
+#ifdef M210_HAVE_SSE2
+	__m128i const mask = _mm_set1_epi8(M210_RECOVER_STATE_MASK);
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i const bytes = _mm_loadu_si128(
+			(__m128i const *) (void const *) (data + i));
+		/* Every other byte is a candidate state byte. */
+		unsigned bits = _mm_movemask_epi8(
+			_mm_cmpeq_epi8(_mm_and_si128(bytes, mask), mask))
+			& 0x5555;
+
+		while (bits) {
+			size_t const pos = (i + __builtin_ctz(bits)
+					    - M210_RECOVER_STATE_OFFSET);
+
+			*next_pos_ptr = m210_recover_check_found(data, size,
+								 pos);
+			if (*next_pos_ptr) {
+				return pos;
+			}
+			bits &= bits - 1;
+		}
+	}
+#endif /* M210_HAVE_SSE2 */
+
+	for (; i < size; i += 2) {
+		size_t const pos = i - M210_RECOVER_STATE_OFFSET;
+
+		if ((data[i] & M210_RECOVER_STATE_MASK)
+		    != M210_RECOVER_STATE_MASK) {
+			continue;
+		}
+		*next_pos_ptr = m210_recover_check_found(data, size, pos);
+		if (*next_pos_ptr) {
+			return pos;
+		}
+	}
+	return size;
+}
+
+enum m210_err m210_recover(void const *const data_ptr, size_t const size,
+			   FILE *const file,
+			   struct m210_recover_stats *const stats_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint8_t const *const data = data_ptr;
+	size_t pos = 0;
+	size_t out_pos = 0;
+	static uint8_t const zeros[M210_RECOVER_PACKET_SIZE];
+
+	stats_ptr->note_count = 0;
+	stats_ptr->skipped_size = 0;
+
+	while (pos < size && !m210_recover_is_last(data, size, pos)) {
+		uint8_t head[sizeof(struct m210_rawnote_head)];
+		uint32_t next_pos = m210_recover_check(data, size, pos);
+		uint32_t out_next_pos;
+
+		if (!next_pos) {
+			size_t const found = m210_recover_scan(data, size,
+							       pos + 1,
+							       &next_pos);
+			stats_ptr->skipped_size += found - pos;
+			pos = found;
+			if (pos == size) {
+				break;
+			}
+		} else if (!m210_recover_follows(data, size, next_pos)) {
+			/* Either this next_pos or the next head is
+			 * damaged. If there is a plausible head
+			 * before next_pos, at a whole number of bodies
+			 * from this head, next_pos is the damaged one
+			 * and the note ends there. */
+			uint32_t found_next_pos;
+			size_t const body_pos = pos + sizeof(head);
+			size_t const found = m210_recover_scan(
+				data, size, body_pos, &found_next_pos);
+
+			if (found < next_pos
+			    && !((found - body_pos)
+				 % sizeof(struct m210_rawnote_body))) {
+				next_pos = found;
+			}
+		}
+
+		out_next_pos = out_pos + (next_pos - pos);
+		if (out_next_pos > 0xffffff) {
+			err = M210_ERR_BAD_RAWNOTE_HEAD;
+			goto out;
+		}
+
+		memcpy(head, data + pos, sizeof(head));
+		head[0] = out_next_pos & 0xff;
+		head[1] = (out_next_pos >> 8) & 0xff;
+		head[2] = (out_next_pos >> 16) & 0xff;
+		if (fwrite(head, sizeof(head), 1, file) != 1
+		    || (next_pos - pos > sizeof(head)
+			&& fwrite(data + pos + sizeof(head),
+				  next_pos - pos - sizeof(head), 1,
+				  file) != 1)) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+
+		++stats_ptr->note_count;
+		out_pos = out_next_pos;
+		pos = next_pos;
+	}
+
+	if (fwrite(&M210_RAWNOTE_HEAD_LAST, sizeof(M210_RAWNOTE_HEAD_LAST), 1,
+		   file) != 1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+	out_pos += sizeof(M210_RAWNOTE_HEAD_LAST);
+
+	if (out_pos % M210_RECOVER_PACKET_SIZE
+	    && fwrite(zeros, (M210_RECOVER_PACKET_SIZE
+			      - out_pos % M210_RECOVER_PACKET_SIZE), 1,
+		      file) != 1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	return err;
+}
@@ -0,0 +1,48 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_RECOVER_H
+#define M210_RECOVER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+/*
+  Recovery of notes from a damaged raw note stream. The note chain is
+  followed from the beginning, and each head is validated: the state
+  must be one of M210_RAWNOTE_STATE_* and next_pos must point forward,
+  within the stream, past a whole number of bodies. When a head fails
+  validation, the stream is scanned forward for the next plausible
+  head, one whose next_pos also leads to a valid head, the last head
+  or the end of the stream, and the chain is followed from there.
+
+  The recovered notes are written to a new raw note stream, with
+  next_pos relocated, the last head and padding to whole packets.
+*/
+
+struct m210_recover_stats {
+	size_t note_count;
+	/* Bytes which did not belong to any recovered note. */
+	size_t skipped_size;
+};
+
+enum m210_err m210_recover(void const *data, size_t size, FILE *file,
+			   struct m210_recover_stats *statsp);
+
+#endif /* M210_RECOVER_H */
@@ -0,0 +1,193 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "session.h"
+
+struct m210_session {
+	pthread_mutex_t mutex;
+	m210_dev dev;
+	int stale; /* The device has to be reconnected before use. */
+};
+
+/* Does ERR mean that the device file is not usable anymore? */
+static int m210_session_is_gone(enum m210_err const err)
+{
+	return (err == M210_ERR_SYS
+		&& (errno == ENODEV || errno == EIO || errno == EBADF
+		    || errno == ENXIO));
+}
+
+static enum m210_err m210_session_begin(struct m210_session *const session_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	pthread_mutex_lock(&session_ptr->mutex);
+
+	if (session_ptr->stale) {
+		err = m210_dev_reconnect(session_ptr->dev);
+		if (err) {
+			goto out;
+		}
+		session_ptr->stale = 0;
+	}
+out:
+	if (err) {
+		pthread_mutex_unlock(&session_ptr->mutex);
+	}
+	return err;
+}
+
+static enum m210_err m210_session_end(struct m210_session *const session_ptr,
+				      enum m210_err const err)
+{
+	if (m210_session_is_gone(err)) {
+		session_ptr->stale = 1;
+	}
+
+	pthread_mutex_unlock(&session_ptr->mutex);
+	return err;
+}
+
+enum m210_err m210_session_open_dev(struct m210_session **const session_ptr_ptr,
+				    m210_dev const dev)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_session *session_ptr = NULL;
+	int retval;
+
+	session_ptr = malloc(sizeof(struct m210_session));
+	if (!session_ptr) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	retval = pthread_mutex_init(&session_ptr->mutex, NULL);
+	if (retval) {
+		errno = retval;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	session_ptr->dev = dev;
+	session_ptr->stale = 0;
+out:
+	if (err) {
+		free(session_ptr);
+		session_ptr = NULL;
+	}
+	*session_ptr_ptr = session_ptr;
+	return err;
+}
+
+enum m210_err m210_session_open(struct m210_session **const session_ptr_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	m210_dev dev = NULL;
+
+	err = m210_dev_connect(&dev);
+	if (err) {
+		goto out;
+	}
+
+	err = m210_session_open_dev(session_ptr_ptr, dev);
+	if (err) {
+		int const original_errno = errno;
+		m210_dev_disconnect(&dev);
+		errno = original_errno;
+		goto out;
+	}
+out:
+	return err;
+}
+
+enum m210_err m210_session_close(struct m210_session **const session_ptr_ptr)
+{
+	struct m210_session *const session_ptr = *session_ptr_ptr;
+	enum m210_err err = M210_ERR_OK;
+
+	if (!session_ptr) {
+		goto out;
+	}
+
+	err = m210_dev_disconnect(&session_ptr->dev);
+	pthread_mutex_destroy(&session_ptr->mutex);
+	free(session_ptr);
+	*session_ptr_ptr = NULL;
+out:
+	return err;
+}
+
+enum m210_err m210_session_get_info(struct m210_session *const session_ptr,
+				    struct m210_dev_info *const info_ptr)
+{
+	enum m210_err err = m210_session_begin(session_ptr);
+
+	if (err) {
+		return err;
+	}
+
+	err = m210_dev_get_info(session_ptr->dev, info_ptr);
+	if (m210_session_is_gone(err) && !m210_dev_reconnect(session_ptr->dev)) {
+		err = m210_dev_get_info(session_ptr->dev, info_ptr);
+	}
+
+	return m210_session_end(session_ptr, err);
+}
+
+enum m210_err m210_session_download_notes(struct m210_session *const session_ptr,
+					  FILE *const file)
+{
+	enum m210_err err = m210_session_begin(session_ptr);
+
+	if (err) {
+		return err;
+	}
+
+	err = m210_dev_download_notes(session_ptr->dev, file);
+
+	return m210_session_end(session_ptr, err);
+}
+
+enum m210_err m210_session_delete_notes(struct m210_session *const session_ptr)
+{
+	enum m210_err err = m210_session_begin(session_ptr);
+
+	if (err) {
+		return err;
+	}
+
+	err = m210_dev_delete_notes(session_ptr->dev);
+
+	return m210_session_end(session_ptr, err);
+}
+
+enum m210_err m210_session_erase_notes(struct m210_session *const session_ptr)
+{
+	enum m210_err err = m210_session_begin(session_ptr);
+
+	if (err) {
+		return err;
+	}
+
+	err = m210_dev_erase_notes(session_ptr->dev);
+
+	return m210_session_end(session_ptr, err);
+}
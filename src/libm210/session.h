@@ -0,0 +1,48 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_SESSION_H
+#define M210_SESSION_H
+
+#include <stdio.h>
+
+#include "dev.h"
+#include "err.h"
+
+/*
+  A session keeps the device open across operations, which makes it
+  suitable for long-running services. Operations of a session are
+  serialized, so a session can be shared between threads.
+
+  If the device disappears (for example, it is unplugged), the
+  operation fails, and the next operation reconnects the device
+  before doing anything else. Operations without side effects are
+  retried once right away.
+*/
+
+typedef struct m210_session *m210_session;
+
+enum m210_err m210_session_open(m210_session *sessionp);
+enum m210_err m210_session_open_dev(m210_session *sessionp, m210_dev dev);
+enum m210_err m210_session_close(m210_session *sessionp);
+enum m210_err m210_session_get_info(m210_session session,
+				    struct m210_dev_info *infop);
+enum m210_err m210_session_download_notes(m210_session session, FILE *file);
+enum m210_err m210_session_delete_notes(m210_session session);
+enum m210_err m210_session_erase_notes(m210_session session);
+
+#endif /* M210_SESSION_H */
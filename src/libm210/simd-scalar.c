@@ -0,0 +1,38 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  The statistics, stroke and recovery code of libm210 built without
+  the vector kernels, with its functions renamed, for simd-test.c to
+  compare with the library.
+*/
+
+#define M210_NO_SIMD 1
+
+#define m210_recover m210_recover_scalar
+#define m210_stats_bodies m210_stats_bodies_scalar
+#define m210_stats_next m210_stats_next_scalar
+#define m210_strokes_open m210_strokes_open_scalar
+#define m210_strokes_close m210_strokes_close_scalar
+#define m210_strokes_next_note m210_strokes_next_note_scalar
+#define m210_strokes_next m210_strokes_next_scalar
+#define m210_strokes_bounds m210_strokes_bounds_scalar
+#define m210_strokes_skip m210_strokes_skip_scalar
+
+#include "recover.c"
+#include "stats.c"
+#include "stroke.c"
@@ -0,0 +1,310 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Tests of the vector kernels, run by `make check'. The statistics,
+  bounds and recovery computed by the library must match those of the
+  scalar code, built by simd-scalar.c, on random bodies and on damaged
+  note streams. Lengths are summed in single precision by the vector
+  code, so they may differ in the last digits.
+*/
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rawnote.h"
+#include "recover.h"
+#include "stats.h"
+#include "stroke.h"
+
+void m210_stats_bodies_scalar(struct m210_stats *statsp,
+			      void const *raw_bodies, size_t count);
+enum m210_err m210_strokes_open_scalar(m210_strokes *strokesp, FILE *file);
+void m210_strokes_close_scalar(m210_strokes *strokesp);
+enum m210_err m210_strokes_next_note_scalar(m210_strokes strokes,
+					    struct m210_note_head *headp);
+enum m210_err m210_strokes_bounds_scalar(m210_strokes strokes,
+					 struct m210_bounds *boundsp);
+enum m210_err m210_recover_scalar(void const *data, size_t size, FILE *file,
+				  struct m210_recover_stats *statsp);
+
+#define MAX_BODIES 5000
+
+static int failures;
+static uint32_t seed = 1;
+
+/* SIZE is the number of bodies or the size of a note stream. */
+static void fail(char const *const name, size_t const size,
+		 char const *const what)
+{
+	fprintf(stderr, "FAIL: %s, %zu: %s\n", name, size, what);
+	++failures;
+}
+
+static uint32_t random_next(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/*
+  Fill BODIES with COUNT random bodies: strokes wandering around the
+  page, some at the extremes of the coordinates, and pen-ups, also
+  several in a row.
+*/
+static void random_bodies(struct m210_rawnote_body *const bodies,
+			  size_t const count)
+{
+	int16_t x = 0;
+	int16_t y = 5000;
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		uint32_t const r = random_next();
+
+		if (r % 8 == 0) {
+			bodies[i] = M210_RAWNOTE_BODY_PENUP;
+			continue;
+		}
+		if (r % 61 == 1) {
+			x = r & 0x100 ? INT16_MAX : INT16_MIN + 1;
+			y = r & 0x200 ? INT16_MAX : INT16_MIN;
+		} else {
+			x += (int16_t) (r >> 8 & 0xff) - 128;
+			y += (int16_t) (r >> 16 & 0xff) - 128;
+		}
+		/* A pen-up is x 0 and y -32768, keep clear of it. */
+		if (x == 0) {
+			x = 1;
+		}
+		bodies[i].x[0] = (uint16_t) x & 0xff;
+		bodies[i].x[1] = (uint16_t) x >> 8;
+		bodies[i].y[0] = (uint16_t) y & 0xff;
+		bodies[i].y[1] = (uint16_t) y >> 8;
+	}
+}
+
+/*
+  Write a note of the COUNT BODIES to RAW at POS and return the
+  position of the next note.
+*/
+static size_t raw_note(uint8_t *const raw, size_t const pos,
+		       uint8_t const number,
+		       struct m210_rawnote_body const *const bodies,
+		       size_t const count)
+{
+	struct m210_rawnote_head head = M210_RAWNOTE_HEAD_LAST;
+	size_t const next_pos = (pos + sizeof(head)
+				 + count * sizeof(struct m210_rawnote_body));
+
+	head.next_pos[0] = next_pos & 0xff;
+	head.next_pos[1] = (next_pos >> 8) & 0xff;
+	head.next_pos[2] = (next_pos >> 16) & 0xff;
+	head.state = M210_RAWNOTE_STATE_FINISHED_BY_USER;
+	head.number = number;
+	head.last_number = number;
+	memcpy(raw + pos, &head, sizeof(head));
+	memcpy(raw + pos + sizeof(head), bodies,
+	       count * sizeof(struct m210_rawnote_body));
+	return next_pos;
+}
+
+static void test_stats(struct m210_rawnote_body const *const bodies,
+		       size_t const count)
+{
+	struct m210_stats vector;
+	struct m210_stats scalar;
+
+	m210_stats_bodies(&vector, bodies, count);
+	m210_stats_bodies_scalar(&scalar, bodies, count);
+
+	if (vector.point_count != scalar.point_count
+	    || vector.penup_count != scalar.penup_count
+	    || vector.stroke_count != scalar.stroke_count) {
+		fail("stats", count, "counts differ");
+	}
+	if (memcmp(&vector.bounds, &scalar.bounds, sizeof(vector.bounds))) {
+		fail("stats", count, "bounds differ");
+	}
+	if (fabs(vector.length - scalar.length) > 1e-5 * (1 + scalar.length)) {
+		fail("stats", count, "lengths differ");
+	}
+}
+
+static int strokes_bounds(uint8_t *const raw, size_t const raw_size,
+			  int const scalar, struct m210_bounds *const bounds)
+{
+	int result = -1;
+	FILE *file = fmemopen(raw, raw_size, "rb");
+	m210_strokes strokes = NULL;
+	struct m210_note_head head;
+
+	if (file == NULL
+	    || (scalar ? m210_strokes_open_scalar(&strokes, file)
+		: m210_strokes_open(&strokes, file))
+	    || (scalar ? m210_strokes_next_note_scalar(strokes, &head)
+		: m210_strokes_next_note(strokes, &head))
+	    || (scalar ? m210_strokes_bounds_scalar(strokes, bounds)
+		: m210_strokes_bounds(strokes, bounds))) {
+		goto out;
+	}
+	result = 0;
+out:
+	if (scalar) {
+		m210_strokes_close_scalar(&strokes);
+	} else {
+		m210_strokes_close(&strokes);
+	}
+	if (file) {
+		fclose(file);
+	}
+	return result;
+}
+
+static void test_bounds(uint8_t *const raw,
+			struct m210_rawnote_body const *const bodies,
+			size_t const count)
+{
+	size_t const raw_size = raw_note(raw, 0, 1, bodies, count);
+	struct m210_bounds vector;
+	struct m210_bounds scalar;
+
+	memset(raw + raw_size, 0, sizeof(struct m210_rawnote_head));
+	if (strokes_bounds(raw, raw_size + sizeof(struct m210_rawnote_head), 0,
+			   &vector)
+	    || strokes_bounds(raw, raw_size + sizeof(struct m210_rawnote_head),
+			      1, &scalar)) {
+		fail("bounds", count, "note was not read");
+		return;
+	}
+	if (memcmp(&vector, &scalar, sizeof(vector))) {
+		fail("bounds", count, "bounds differ");
+	}
+}
+
+static enum m210_err recover(uint8_t const *const raw, size_t const raw_size,
+			     int const scalar, char **const data_ptr,
+			     size_t *const size_ptr,
+			     struct m210_recover_stats *const stats_ptr)
+{
+	enum m210_err err;
+	FILE *file = open_memstream(data_ptr, size_ptr);
+
+	if (file == NULL) {
+		return M210_ERR_SYS;
+	}
+	err = (scalar ? m210_recover_scalar(raw, raw_size, file, stats_ptr)
+	       : m210_recover(raw, raw_size, file, stats_ptr));
+	if (fclose(file) && !err) {
+		err = M210_ERR_SYS;
+	}
+	return err;
+}
+
+/*
+  Damage a stream of notes at random, the heads of some notes
+  included, and recover it with both the vector and the scalar scan
+  for heads.
+*/
+static void test_recover(uint8_t *const raw,
+			 struct m210_rawnote_body const *const bodies)
+{
+	size_t heads[20];
+	size_t raw_size = 0;
+	char *vector = NULL;
+	size_t vector_size = 0;
+	struct m210_recover_stats vector_stats;
+	char *scalar = NULL;
+	size_t scalar_size = 0;
+	struct m210_recover_stats scalar_stats;
+	int i;
+
+	for (i = 0; i < 20; ++i) {
+		heads[i] = raw_size;
+		raw_size = raw_note(raw, raw_size, i + 1, bodies + i * 50,
+				    random_next() % 200);
+	}
+	memset(raw + raw_size, 0, sizeof(struct m210_rawnote_head));
+	raw_size += sizeof(struct m210_rawnote_head);
+
+	for (i = 0; i < 10; ++i) {
+		raw[random_next() % raw_size] ^= 1 << random_next() % 8;
+	}
+	for (i = 0; i < 3; ++i) {
+		/* The state, or the high byte of next_pos. */
+		raw[heads[random_next() % 20] + 2 + random_next() % 2] = 0xff;
+	}
+
+	if (recover(raw, raw_size, 0, &vector, &vector_size, &vector_stats)
+	    || recover(raw, raw_size, 1, &scalar, &scalar_size,
+		       &scalar_stats)) {
+		fail("recover", raw_size, "stream was not recovered");
+	} else if (vector_size != scalar_size
+		   || memcmp(vector, scalar, vector_size)
+		   || vector_stats.note_count != scalar_stats.note_count
+		   || vector_stats.skipped_size != scalar_stats.skipped_size) {
+		fail("recover", raw_size, "recovered streams differ");
+	}
+	free(vector);
+	free(scalar);
+}
+
+int main(void)
+{
+	struct m210_rawnote_body *const bodies =
+		malloc((MAX_BODIES + 1) * sizeof(struct m210_rawnote_body));
+	uint8_t *const raw = malloc(2 * sizeof(struct m210_rawnote_head)
+				    + (MAX_BODIES + 1)
+				    * sizeof(struct m210_rawnote_body));
+	size_t count;
+	int i;
+
+	if (bodies == NULL || raw == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	/* Every tail length of the kernels, from aligned and unaligned
+	 * starts. */
+	for (count = 0; count <= 70; ++count) {
+		random_bodies(bodies, count + 1);
+		test_stats(bodies, count);
+		test_stats(bodies + 1, count);
+		test_bounds(raw, bodies, count);
+		test_bounds(raw, bodies + 1, count);
+	}
+
+	for (i = 0; i < 20; ++i) {
+		random_bodies(bodies, MAX_BODIES);
+		test_stats(bodies, MAX_BODIES);
+		test_bounds(raw, bodies, MAX_BODIES);
+	}
+
+	for (i = 0; i < 200; ++i) {
+		random_bodies(bodies, MAX_BODIES);
+		test_recover(raw, bodies);
+	}
+
+	free(raw);
+	free(bodies);
+	return failures ? 1 : 0;
+}
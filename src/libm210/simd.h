@@ -0,0 +1,32 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_SIMD_H
+#define M210_SIMD_H
+
+/*
+  Vector kernels are built when M210_HAVE_SSE2 is defined. SSE2 is part
+  of the x86-64 baseline, so no runtime check is needed; elsewhere only
+  the scalar code is built. Defining M210_NO_SIMD builds the scalar
+  code on x86-64 too, which the tests use to compare the two.
+*/
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(M210_NO_SIMD)
+#include <emmintrin.h>
+#define M210_HAVE_SSE2 1
+#endif
+
+#endif /* M210_SIMD_H */
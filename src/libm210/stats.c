@@ -0,0 +1,252 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rawnote.h"
+#include "simd.h"
+#include "stats.h"
+
+/* The vector code loads a struct m210_rawnote_body as one 32-bit lane. */
+#ifdef M210_HAVE_SSE2
+typedef char m210_stats_check_body_size[
+	sizeof(struct m210_rawnote_body) == 4 ? 1 : -1];
+#endif
+
+static inline int m210_stats_is_penup(struct m210_rawnote_body const *const body_ptr)
+{
+	return memcmp(body_ptr, &M210_RAWNOTE_BODY_PENUP,
+		      sizeof(struct m210_rawnote_body)) == 0;
+}
+
+static inline int16_t m210_stats_coord(uint8_t const *const bytes)
+{
+	uint16_t value;
+
+	memcpy(&value, bytes, sizeof(value));
+	return (int16_t) le16toh(value);
+}
+
+/* Add bodies FIRST..COUNT-1, each following the body before it. */
+static void m210_stats_scalar(struct m210_stats *const stats_ptr,
+			      struct m210_rawnote_body const *const bodies,
+			      size_t const first, size_t const count)
+{
+	size_t i;
+
+	for (i = first; i < count; ++i) {
+		int16_t x;
+		int16_t y;
+
+		if (m210_stats_is_penup(&bodies[i])) {
+			++stats_ptr->penup_count;
+			continue;
+		}
+
+		x = m210_stats_coord(bodies[i].x);
+		y = m210_stats_coord(bodies[i].y);
+		if (x < stats_ptr->bounds.min_x) {
+			stats_ptr->bounds.min_x = x;
+		}
+		if (x > stats_ptr->bounds.max_x) {
+			stats_ptr->bounds.max_x = x;
+		}
+		if (y < stats_ptr->bounds.min_y) {
+			stats_ptr->bounds.min_y = y;
+		}
+		if (y > stats_ptr->bounds.max_y) {
+			stats_ptr->bounds.max_y = y;
+		}
+
+		if (i == 0 || m210_stats_is_penup(&bodies[i - 1])) {
+			++stats_ptr->stroke_count;
+		} else {
+			double const dx = x - m210_stats_coord(bodies[i - 1].x);
+			double const dy = y - m210_stats_coord(bodies[i - 1].y);
+			stats_ptr->length += sqrt(dx * dx + dy * dy);
+		}
+	}
+}
+
+#ifdef M210_HAVE_SSE2
+/*
+  Four bodies are loaded to a register of four 32-bit lanes, x in the
+  low and y in the high half of each lane, and the four bodies before
+  them to another. A pen-up body is a single 32-bit value, so the
+  pen-up and stroke start masks take a comparison each. Segment
+  lengths are computed in single precision from the sign-extended
+  coordinates and summed in double precision, and the bounds are
+  reduced over the 16-bit halves of pen-down lanes.
+
+  Add bodies from 1 on, and return the index of the first body left
+  for the scalar code.
+*/
+static size_t m210_stats_sse2(struct m210_stats *const stats_ptr,
+			      struct m210_rawnote_body const *const bodies,
+			      size_t const count)
+{
+	__m128i const penup = _mm_set1_epi32(INT32_MIN);
+	__m128i const hi = _mm_set1_epi16(INT16_MAX);
+	__m128i const lo = _mm_set1_epi16(INT16_MIN);
+	__m128i penups = _mm_setzero_si128();
+	__m128i starts = _mm_setzero_si128();
+	__m128i min = hi;
+	__m128i max = lo;
+	__m128d length_lo = _mm_setzero_pd();
+	__m128d length_hi = _mm_setzero_pd();
+	int32_t counts[2][4];
+	int16_t lanes[2][8];
+	double lengths[4];
+	size_t i;
+	int j;
+
+	for (i = 1; i + 4 <= count; i += 4) {
+		__m128i const cur = _mm_loadu_si128(
+			(__m128i const *) (bodies + i));
+		__m128i const prev = _mm_loadu_si128(
+			(__m128i const *) (bodies + i - 1));
+		__m128i const up = _mm_cmpeq_epi32(cur, penup);
+		__m128i const prev_up = _mm_cmpeq_epi32(prev, penup);
+		/* Lanes which do not end a segment of a stroke. */
+		__m128i const gap = _mm_or_si128(up, prev_up);
+		__m128i const dx = _mm_sub_epi32(
+			_mm_srai_epi32(_mm_slli_epi32(cur, 16), 16),
+			_mm_srai_epi32(_mm_slli_epi32(prev, 16), 16));
+		__m128i const dy = _mm_sub_epi32(_mm_srai_epi32(cur, 16),
+						 _mm_srai_epi32(prev, 16));
+		__m128 const fx = _mm_cvtepi32_ps(dx);
+		__m128 const fy = _mm_cvtepi32_ps(dy);
+		__m128 const dist = _mm_andnot_ps(
+			_mm_castsi128_ps(gap),
+			_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(fx, fx),
+					       _mm_mul_ps(fy, fy))));
+
+		penups = _mm_sub_epi32(penups, up);
+		starts = _mm_sub_epi32(starts, _mm_andnot_si128(up, prev_up));
+		length_lo = _mm_add_pd(length_lo, _mm_cvtps_pd(dist));
+		length_hi = _mm_add_pd(length_hi,
+				       _mm_cvtps_pd(_mm_movehl_ps(dist, dist)));
+		min = _mm_min_epi16(min, _mm_or_si128(_mm_andnot_si128(up, cur),
+						      _mm_and_si128(up, hi)));
+		max = _mm_max_epi16(max, _mm_or_si128(_mm_andnot_si128(up, cur),
+						      _mm_and_si128(up, lo)));
+	}
+
+	_mm_storeu_si128((__m128i *) counts[0], penups);
+	_mm_storeu_si128((__m128i *) counts[1], starts);
+	_mm_storeu_si128((__m128i *) lanes[0], min);
+	_mm_storeu_si128((__m128i *) lanes[1], max);
+	_mm_storeu_pd(lengths, length_lo);
+	_mm_storeu_pd(lengths + 2, length_hi);
+
+	for (j = 0; j < 4; ++j) {
+		stats_ptr->penup_count += counts[0][j];
+		stats_ptr->stroke_count += counts[1][j];
+		stats_ptr->length += lengths[j];
+	}
+
+	/* Even lanes hold x and odd lanes y. */
+	for (j = 0; j < 8; j += 2) {
+		if (lanes[0][j] < stats_ptr->bounds.min_x) {
+			stats_ptr->bounds.min_x = lanes[0][j];
+		}
+		if (lanes[1][j] > stats_ptr->bounds.max_x) {
+			stats_ptr->bounds.max_x = lanes[1][j];
+		}
+		if (lanes[0][j + 1] < stats_ptr->bounds.min_y) {
+			stats_ptr->bounds.min_y = lanes[0][j + 1];
+		}
+		if (lanes[1][j + 1] > stats_ptr->bounds.max_y) {
+			stats_ptr->bounds.max_y = lanes[1][j + 1];
+		}
+	}
+
+	return i;
+}
+#endif /* M210_HAVE_SSE2 */
+
+void m210_stats_bodies(struct m210_stats *const stats_ptr,
+		       void const *const raw_bodies, size_t const count)
+{
+	struct m210_rawnote_body const *const bodies = raw_bodies;
+	size_t first = 1;
+
+	stats_ptr->penup_count = 0;
+	stats_ptr->stroke_count = 0;
+	stats_ptr->length = 0;
+	stats_ptr->bounds.min_x = INT16_MAX;
+	stats_ptr->bounds.min_y = INT16_MAX;
+	stats_ptr->bounds.max_x = INT16_MIN;
+	stats_ptr->bounds.max_y = INT16_MIN;
+
+	m210_stats_scalar(stats_ptr, bodies, 0, count ? 1 : 0);
+#ifdef M210_HAVE_SSE2
+	first = m210_stats_sse2(stats_ptr, bodies, count);
+#endif
+	m210_stats_scalar(stats_ptr, bodies, first, count);
+
+	stats_ptr->point_count = count - stats_ptr->penup_count;
+}
+
+enum m210_err m210_stats_next(struct m210_stats *const stats_ptr,
+			      void const *const raw_data, size_t const raw_size,
+			      size_t *const pos_ptr)
+{
+	enum m210_err err;
+	uint8_t const *const raw = raw_data;
+	size_t const pos = *pos_ptr;
+	size_t const body_pos = pos + sizeof(struct m210_rawnote_head);
+	struct m210_rawnote_head head;
+	uint32_t next_pos = 0;
+
+	if (pos > raw_size || raw_size - pos < sizeof(head)) {
+		err = M210_ERR_UNEXPECTED_EOF;
+		goto out;
+	}
+	memcpy(&head, raw + pos, sizeof(head));
+
+	if (!memcmp(&head, &M210_RAWNOTE_HEAD_LAST, sizeof(head))) {
+		stats_ptr->head.number = 0;
+		stats_ptr->head.state = 0;
+		stats_ptr->head.bodyc = 0;
+		m210_stats_bodies(stats_ptr, NULL, 0);
+		err = M210_ERR_OK;
+		goto out;
+	}
+
+	memcpy(&next_pos, head.next_pos, sizeof(head.next_pos));
+	next_pos = le32toh(next_pos);
+	if (next_pos < body_pos || next_pos > raw_size
+	    || (next_pos - body_pos) % sizeof(struct m210_rawnote_body)) {
+		err = M210_ERR_BAD_RAWNOTE_HEAD;
+		goto out;
+	}
+
+	stats_ptr->head.number = head.number;
+	stats_ptr->head.state = head.state;
+	stats_ptr->head.bodyc = ((next_pos - body_pos)
+				 / sizeof(struct m210_rawnote_body));
+	m210_stats_bodies(stats_ptr, raw + body_pos, stats_ptr->head.bodyc);
+	*pos_ptr = next_pos;
+
+	err = M210_ERR_OK;
+out:
+	return err;
+}
@@ -0,0 +1,57 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_STATS_H
+#define M210_STATS_H
+
+#include <stddef.h>
+
+#include "err.h"
+#include "note.h"
+#include "stroke.h"
+
+/*
+  Statistics of the notes of a raw note stream in memory, computed in
+  a single pass over the raw bodies without decoding them to struct
+  m210_note_body first.
+
+  m210_stats_next() follows the head chain from *POSP, the position
+  of a note head, and moves *POSP to the next one. At the end of the
+  note stream, the number of the head is 0.
+*/
+
+struct m210_stats {
+	struct m210_note_head head;
+	/* Number of pen-down and pen-up bodies. */
+	size_t point_count;
+	size_t penup_count;
+	/* Number of runs of pen-down bodies. */
+	size_t stroke_count;
+	/* Sum of the distances between consecutive pen-down points,
+	 * in device units. */
+	double length;
+	/* Bounds of the pen-down points, min_x > max_x if there are
+	 * none. */
+	struct m210_bounds bounds;
+};
+
+void m210_stats_bodies(struct m210_stats *statsp, void const *raw_bodies,
+		       size_t count);
+enum m210_err m210_stats_next(struct m210_stats *statsp, void const *raw_data,
+			      size_t raw_size, size_t *posp);
+
+#endif /* M210_STATS_H */
@@ -0,0 +1,242 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "stream.h"
+
+#define M210_STREAM_RING_SIZE 4096 /* Events, must be a power of 2. */
+
+struct m210_stream {
+	m210_dev dev;
+	pthread_t reader;
+	int eventfd; /* Wakes up the consumer. */
+
+	/* Written only by the reader, read by the consumer. */
+	uint64_t head;
+	uint64_t dropped;
+	int running;
+	enum m210_err err;
+
+	/* Written only by the consumer, read by the reader. */
+	uint64_t tail;
+	int stopping;
+
+	struct m210_stream_event ring[M210_STREAM_RING_SIZE];
+};
+
+static uint64_t m210_stream_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void m210_stream_wake(struct m210_stream *const stream_ptr)
+{
+	uint64_t const one = 1;
+	ssize_t retval;
+
+	do {
+		retval = write(stream_ptr->eventfd, &one, sizeof(one));
+	} while (retval == -1 && errno == EINTR);
+}
+
+static int m210_stream_push(struct m210_stream *const stream_ptr,
+			    struct m210_stream_event const *const event_ptr)
+{
+	uint64_t const head = stream_ptr->head;
+	uint64_t const tail = __atomic_load_n(&stream_ptr->tail,
+					      __ATOMIC_ACQUIRE);
+
+	if (head - tail == M210_STREAM_RING_SIZE) {
+		__atomic_store_n(&stream_ptr->dropped,
+				 stream_ptr->dropped + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	stream_ptr->ring[head & (M210_STREAM_RING_SIZE - 1)] = *event_ptr;
+	__atomic_store_n(&stream_ptr->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static void *m210_stream_reader(void *const arg)
+{
+	struct m210_stream *const stream_ptr = arg;
+	enum m210_err err = M210_ERR_OK;
+
+	while (!__atomic_load_n(&stream_ptr->stopping, __ATOMIC_ACQUIRE)) {
+		struct m210_stream_event event;
+
+		err = m210_dev_read_pen(stream_ptr->dev, &event.pen);
+		if (err) {
+			if (err == M210_ERR_DEV_TIMEOUT) {
+				/* Pen is idle, check whether we should
+				 * stop. */
+				err = M210_ERR_OK;
+				continue;
+			}
+			break;
+		}
+		event.time = m210_stream_now();
+
+		if (m210_stream_push(stream_ptr, &event)) {
+			m210_stream_wake(stream_ptr);
+		}
+	}
+
+	stream_ptr->err = err;
+	__atomic_store_n(&stream_ptr->running, 0, __ATOMIC_RELEASE);
+	m210_stream_wake(stream_ptr);
+	return NULL;
+}
+
+enum m210_err m210_stream_start(struct m210_stream **const stream_ptr_ptr,
+				m210_dev const dev)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_stream *stream_ptr = NULL;
+	int retval;
+
+	stream_ptr = calloc(1, sizeof(struct m210_stream));
+	if (!stream_ptr) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	stream_ptr->dev = dev;
+	stream_ptr->running = 1;
+	stream_ptr->eventfd = eventfd(0, EFD_CLOEXEC);
+	if (stream_ptr->eventfd == -1) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	retval = pthread_create(&stream_ptr->reader, NULL, m210_stream_reader,
+				stream_ptr);
+	if (retval) {
+		errno = retval;
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	if (err && stream_ptr) {
+		int const original_errno = errno;
+		if (stream_ptr->eventfd != -1) {
+			close(stream_ptr->eventfd);
+		}
+		free(stream_ptr);
+		stream_ptr = NULL;
+		errno = original_errno;
+	}
+	*stream_ptr_ptr = stream_ptr;
+	return err;
+}
+
+enum m210_err m210_stream_stop(struct m210_stream **const stream_ptr_ptr)
+{
+	struct m210_stream *const stream_ptr = *stream_ptr_ptr;
+	enum m210_err err = M210_ERR_OK;
+
+	if (!stream_ptr) {
+		goto out;
+	}
+
+	__atomic_store_n(&stream_ptr->stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(stream_ptr->reader, NULL);
+	if (close(stream_ptr->eventfd) == -1) {
+		err = M210_ERR_SYS;
+	}
+	free(stream_ptr);
+	*stream_ptr_ptr = NULL;
+out:
+	return err;
+}
+
+/*
+  Move up to MAX_COUNT events from the ring to EVENTS. If the ring is
+  empty, wait at most TIMEOUT milliseconds (-1 waits forever) for new
+  events. Returns M210_ERR_DEV_TIMEOUT if there were no events, or the
+  error which stopped the reader once all events have been read.
+*/
+enum m210_err m210_stream_read(struct m210_stream *const stream_ptr,
+			       struct m210_stream_event *const events,
+			       size_t const max_count,
+			       size_t *const count_ptr,
+			       int const timeout)
+{
+	enum m210_err err = M210_ERR_OK;
+	uint64_t const tail = stream_ptr->tail;
+	uint64_t head = __atomic_load_n(&stream_ptr->head, __ATOMIC_ACQUIRE);
+	size_t count = 0;
+
+	if (head == tail) {
+		struct pollfd pollfd = {stream_ptr->eventfd, POLLIN, 0};
+		uint64_t value;
+
+		if (!__atomic_load_n(&stream_ptr->running, __ATOMIC_ACQUIRE)) {
+			err = stream_ptr->err ? stream_ptr->err
+				: M210_ERR_DEV_TIMEOUT;
+			goto out;
+		}
+
+		switch (poll(&pollfd, 1, timeout)) {
+		case -1:
+			err = M210_ERR_SYS;
+			goto out;
+		case 0:
+			err = M210_ERR_DEV_TIMEOUT;
+			goto out;
+		default:
+			break;
+		}
+
+		if (read(stream_ptr->eventfd, &value, sizeof(value)) == -1) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+
+		head = __atomic_load_n(&stream_ptr->head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			err = M210_ERR_DEV_TIMEOUT;
+			goto out;
+		}
+	}
+
+	while (count < max_count && tail + count < head) {
+		events[count] = stream_ptr->ring[(tail + count)
+						 & (M210_STREAM_RING_SIZE - 1)];
+		++count;
+	}
+	__atomic_store_n(&stream_ptr->tail, tail + count, __ATOMIC_RELEASE);
+out:
+	*count_ptr = count;
+	return err;
+}
+
+uint64_t m210_stream_dropped(struct m210_stream *const stream_ptr)
+{
+	return __atomic_load_n(&stream_ptr->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,50 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_STREAM_H
+#define M210_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dev.h"
+#include "err.h"
+
+/*
+  Live pen event stream. A dedicated reader thread reads pen events
+  from the device and pushes them to a lock-free single-producer
+  single-consumer ring buffer. If the consumer falls behind and the
+  ring fills up, new events are dropped and counted, the reader never
+  waits for the consumer.
+*/
+
+typedef struct m210_stream *m210_stream;
+
+struct m210_stream_event {
+	uint64_t time; /* Microseconds, CLOCK_MONOTONIC. */
+	struct m210_dev_pen pen;
+};
+
+enum m210_err m210_stream_start(m210_stream *streamp, m210_dev dev);
+enum m210_err m210_stream_stop(m210_stream *streamp);
+enum m210_err m210_stream_read(m210_stream stream,
+			       struct m210_stream_event *events,
+			       size_t max_count, size_t *countp,
+			       int timeout);
+uint64_t m210_stream_dropped(m210_stream stream);
+
+#endif /* M210_STREAM_H */
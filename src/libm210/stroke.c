@@ -0,0 +1,421 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rawnote.h"
+#include "simd.h"
+#include "stroke.h"
+
+/* The vector code loads eight struct m210_note_body, three 16-bit
+   fields each, to three registers. */
+#ifdef M210_HAVE_SSE2
+typedef char m210_strokes_check_body_size[
+	sizeof(struct m210_note_body) == 6 ? 1 : -1];
+#endif
+
+/* Bodies are read from the stream in chunks of this many. */
+#define M210_STROKES_CHUNK 256
+
+struct m210_strokes {
+	FILE *file;
+	/* Arena: a bump allocator reset at the start of each note. */
+	char *arena;
+	size_t arena_size;
+	size_t arena_used;
+	/* Bodies of the current note. */
+	struct m210_note_body *bodies;
+	size_t body_count;
+	size_t read_count;
+	size_t next_body;
+};
+
+enum m210_err m210_strokes_open(struct m210_strokes **const strokes_ptr_ptr,
+				FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_strokes *strokes_ptr = calloc(1,
+						  sizeof(struct m210_strokes));
+
+	if (!strokes_ptr) {
+		err = M210_ERR_SYS;
+	} else {
+		strokes_ptr->file = file;
+	}
+	*strokes_ptr_ptr = strokes_ptr;
+	return err;
+}
+
+void m210_strokes_close(struct m210_strokes **const strokes_ptr_ptr)
+{
+	if (*strokes_ptr_ptr) {
+		free((*strokes_ptr_ptr)->arena);
+	}
+	free(*strokes_ptr_ptr);
+	*strokes_ptr_ptr = NULL;
+}
+
+/*
+  Reset the arena and make sure it can hold SIZE bytes.
+*/
+static enum m210_err m210_strokes_reset(struct m210_strokes *const strokes_ptr,
+					size_t const size)
+{
+	strokes_ptr->arena_used = 0;
+
+	if (size > strokes_ptr->arena_size) {
+		size_t arena_size = (strokes_ptr->arena_size
+				     ? strokes_ptr->arena_size : 65536);
+		char *arena;
+
+		while (arena_size < size) {
+			arena_size *= 2;
+		}
+		/* Nothing in the old arena needs to survive. */
+		arena = malloc(arena_size);
+		if (!arena) {
+			return M210_ERR_SYS;
+		}
+		free(strokes_ptr->arena);
+		strokes_ptr->arena = arena;
+		strokes_ptr->arena_size = arena_size;
+	}
+	return M210_ERR_OK;
+}
+
+static void *m210_strokes_alloc(struct m210_strokes *const strokes_ptr,
+				size_t const size)
+{
+	/* Keep everything carved from the arena suitably aligned. */
+	size_t const aligned_size = (size + sizeof(double) - 1)
+		/ sizeof(double) * sizeof(double);
+	void *const ptr = strokes_ptr->arena + strokes_ptr->arena_used;
+
+	strokes_ptr->arena_used += aligned_size;
+	return ptr;
+}
+
+/*
+  Read the next chunk of bodies of the current note.
+*/
+static enum m210_err m210_strokes_read(struct m210_strokes *const strokes_ptr)
+{
+	enum m210_err err;
+	size_t count = strokes_ptr->body_count - strokes_ptr->read_count;
+
+	if (count > M210_STROKES_CHUNK) {
+		count = M210_STROKES_CHUNK;
+	}
+
+	err = m210_note_read_bodies(strokes_ptr->bodies
+				    + strokes_ptr->read_count,
+				    count, strokes_ptr->file);
+	if (!err) {
+		strokes_ptr->read_count += count;
+	}
+	return err;
+}
+
+enum m210_err m210_strokes_next_note(struct m210_strokes *const strokes_ptr,
+				     struct m210_note_head *const head_ptr)
+{
+	enum m210_err err;
+	size_t body_count;
+
+	/* Skip the bodies of the previous note nobody asked for. */
+	while (strokes_ptr->read_count < strokes_ptr->body_count) {
+		err = m210_strokes_read(strokes_ptr);
+		if (err) {
+			goto out;
+		}
+	}
+	strokes_ptr->body_count = 0;
+	strokes_ptr->read_count = 0;
+	strokes_ptr->next_body = 0;
+
+	err = m210_note_read_head(head_ptr, strokes_ptr->file);
+	if (err) {
+		goto out;
+	}
+
+	if (head_ptr->bodyc < 0) {
+		err = M210_ERR_BAD_RAWNOTE_HEAD;
+		goto out;
+	}
+	body_count = head_ptr->bodyc;
+
+	/* A note has at most one stroke per two bodies, plus one. */
+	err = m210_strokes_reset(
+		strokes_ptr,
+		(body_count * sizeof(struct m210_note_body)
+		 + (body_count / 2 + 1) * sizeof(struct m210_stroke)
+		 + 2 * sizeof(double)));
+	if (err) {
+		goto out;
+	}
+
+	strokes_ptr->bodies = m210_strokes_alloc(
+		strokes_ptr, body_count * sizeof(struct m210_note_body));
+	strokes_ptr->body_count = body_count;
+out:
+	return err;
+}
+
+enum m210_err m210_strokes_next(struct m210_strokes *const strokes_ptr,
+				struct m210_stroke const **const stroke_ptr_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_stroke *stroke_ptr = NULL;
+	size_t i;
+
+	/* Skip pen-ups before the stroke. */
+	while (1) {
+		if (strokes_ptr->next_body == strokes_ptr->read_count) {
+			if (strokes_ptr->read_count == strokes_ptr->body_count) {
+				/* End of note. */
+				goto out;
+			}
+			err = m210_strokes_read(strokes_ptr);
+			if (err) {
+				goto out;
+			}
+		}
+		if (strokes_ptr->bodies[strokes_ptr->next_body].pressure) {
+			break;
+		}
+		++strokes_ptr->next_body;
+	}
+
+	/* The stroke ends at the next pen-up or at the end of note. */
+	i = strokes_ptr->next_body;
+	while (1) {
+		if (i == strokes_ptr->read_count) {
+			if (strokes_ptr->read_count == strokes_ptr->body_count) {
+				break;
+			}
+			err = m210_strokes_read(strokes_ptr);
+			if (err) {
+				goto out;
+			}
+		}
+		if (!strokes_ptr->bodies[i].pressure) {
+			break;
+		}
+		++i;
+	}
+
+	stroke_ptr = m210_strokes_alloc(strokes_ptr,
+					sizeof(struct m210_stroke));
+	stroke_ptr->points = strokes_ptr->bodies + strokes_ptr->next_body;
+	stroke_ptr->point_count = i - strokes_ptr->next_body;
+	stroke_ptr->min_x = stroke_ptr->max_x = stroke_ptr->points[0].x;
+	stroke_ptr->min_y = stroke_ptr->max_y = stroke_ptr->points[0].y;
+	stroke_ptr->length = 0;
+	for (i = 1; i < stroke_ptr->point_count; ++i) {
+		struct m210_note_body const *const point_ptr =
+			&stroke_ptr->points[i];
+		double const dx = point_ptr->x - point_ptr[-1].x;
+		double const dy = point_ptr->y - point_ptr[-1].y;
+
+		if (point_ptr->x < stroke_ptr->min_x) {
+			stroke_ptr->min_x = point_ptr->x;
+		}
+		if (point_ptr->x > stroke_ptr->max_x) {
+			stroke_ptr->max_x = point_ptr->x;
+		}
+		if (point_ptr->y < stroke_ptr->min_y) {
+			stroke_ptr->min_y = point_ptr->y;
+		}
+		if (point_ptr->y > stroke_ptr->max_y) {
+			stroke_ptr->max_y = point_ptr->y;
+		}
+		stroke_ptr->length += sqrt(dx * dx + dy * dy);
+	}
+
+	strokes_ptr->next_body += stroke_ptr->point_count;
+out:
+	*stroke_ptr_ptr = stroke_ptr;
+	return err;
+}
+
+static void m210_strokes_minmax_scalar(struct m210_note_body const *bodies,
+				       size_t count,
+				       struct m210_bounds *const bounds_ptr)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		if (!bodies[i].pressure) {
+			continue;
+		}
+		if (bodies[i].x < bounds_ptr->min_x) {
+			bounds_ptr->min_x = bodies[i].x;
+		}
+		if (bodies[i].x > bounds_ptr->max_x) {
+			bounds_ptr->max_x = bodies[i].x;
+		}
+		if (bodies[i].y < bounds_ptr->min_y) {
+			bounds_ptr->min_y = bodies[i].y;
+		}
+		if (bodies[i].y > bounds_ptr->max_y) {
+			bounds_ptr->max_y = bodies[i].y;
+		}
+	}
+}
+
+#ifdef M210_HAVE_SSE2
+/*
+  Eight bodies (x, y, pressure) are loaded to three registers of eight
+  16-bit lanes:
+
+    r0: x0 y0 p0 x1 y1 p1 x2 y2
+    r1: p2 x3 y3 p3 x4 y4 p4 x5
+    r2: y5 p5 x6 y6 p6 x7 y7 p7
+
+  The pen-down flag of each body is spread from its pressure lane to
+  its coordinate lanes, pen-up coordinates are replaced by the neutral
+  values of min and max, and the lanes are reduced with pminsw and
+  pmaxsw. Lanes are sorted out to x and y only at the end.
+*/
+static void m210_strokes_minmax_sse2(struct m210_note_body const *bodies,
+				     size_t count,
+				     struct m210_bounds *const bounds_ptr)
+{
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const hi = _mm_set1_epi16(INT16_MAX);
+	__m128i const lo = _mm_set1_epi16(INT16_MIN);
+	__m128i const p0 = _mm_setr_epi16(0, 0, -1, 0, 0, -1, 0, 0);
+	__m128i const p1 = _mm_setr_epi16(-1, 0, 0, -1, 0, 0, -1, 0);
+	__m128i const p2 = _mm_setr_epi16(0, -1, 0, 0, -1, 0, 0, -1);
+	__m128i min[3] = {hi, hi, hi};
+	__m128i max[3] = {lo, lo, lo};
+	int16_t lanes[2][3][8];
+	size_t i;
+	int j;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i const *const src = (__m128i const *) (bodies + i);
+		__m128i const r[3] = {
+			_mm_loadu_si128(src),
+			_mm_loadu_si128(src + 1),
+			_mm_loadu_si128(src + 2)
+		};
+		__m128i down[3];
+		__m128i mask[3];
+
+		down[0] = _mm_andnot_si128(_mm_cmpeq_epi16(r[0], zero), p0);
+		down[1] = _mm_andnot_si128(_mm_cmpeq_epi16(r[1], zero), p1);
+		down[2] = _mm_andnot_si128(_mm_cmpeq_epi16(r[2], zero), p2);
+
+		mask[0] = _mm_or_si128(
+			_mm_or_si128(_mm_srli_si128(down[0], 2),
+				     _mm_srli_si128(down[0], 4)),
+			_mm_or_si128(_mm_slli_si128(down[1], 12),
+				     _mm_slli_si128(down[1], 14)));
+		mask[1] = _mm_or_si128(
+			_mm_or_si128(_mm_srli_si128(down[1], 2),
+				     _mm_srli_si128(down[1], 4)),
+			_mm_slli_si128(down[2], 12));
+		mask[2] = _mm_or_si128(_mm_srli_si128(down[2], 2),
+				       _mm_srli_si128(down[2], 4));
+
+		for (j = 0; j < 3; ++j) {
+			__m128i const kept = _mm_and_si128(mask[j], r[j]);
+			min[j] = _mm_min_epi16(
+				min[j],
+				_mm_or_si128(kept, _mm_andnot_si128(mask[j], hi)));
+			max[j] = _mm_max_epi16(
+				max[j],
+				_mm_or_si128(kept, _mm_andnot_si128(mask[j], lo)));
+		}
+	}
+
+	for (j = 0; j < 3; ++j) {
+		_mm_storeu_si128((__m128i *) lanes[0][j], min[j]);
+		_mm_storeu_si128((__m128i *) lanes[1][j], max[j]);
+	}
+
+	/* Lane k of register j holds field (8 * j + k) % 3 of a
+	 * body: 0 is x, 1 is y and 2 is pressure. */
+	for (j = 0; j < 24; ++j) {
+		int16_t const min_lane = lanes[0][j / 8][j % 8];
+		int16_t const max_lane = lanes[1][j / 8][j % 8];
+
+		if (j % 3 == 0) {
+			if (min_lane < bounds_ptr->min_x) {
+				bounds_ptr->min_x = min_lane;
+			}
+			if (max_lane > bounds_ptr->max_x) {
+				bounds_ptr->max_x = max_lane;
+			}
+		} else if (j % 3 == 1) {
+			if (min_lane < bounds_ptr->min_y) {
+				bounds_ptr->min_y = min_lane;
+			}
+			if (max_lane > bounds_ptr->max_y) {
+				bounds_ptr->max_y = max_lane;
+			}
+		}
+	}
+
+	m210_strokes_minmax_scalar(bodies + i, count - i, bounds_ptr);
+}
+#endif /* M210_HAVE_SSE2 */
+
+enum m210_err m210_strokes_bounds(struct m210_strokes *const strokes_ptr,
+				  struct m210_bounds *const bounds_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	while (strokes_ptr->read_count < strokes_ptr->body_count) {
+		err = m210_strokes_read(strokes_ptr);
+		if (err) {
+			goto out;
+		}
+	}
+
+	bounds_ptr->min_x = INT16_MAX;
+	bounds_ptr->min_y = INT16_MAX;
+	bounds_ptr->max_x = INT16_MIN;
+	bounds_ptr->max_y = INT16_MIN;
+#ifdef M210_HAVE_SSE2
+	m210_strokes_minmax_sse2(strokes_ptr->bodies, strokes_ptr->body_count,
+				 bounds_ptr);
+#else
+	m210_strokes_minmax_scalar(strokes_ptr->bodies,
+				   strokes_ptr->body_count, bounds_ptr);
+#endif
+out:
+	return err;
+}
+
+enum m210_err m210_strokes_skip(struct m210_strokes *const strokes_ptr)
+{
+	size_t const count = strokes_ptr->body_count - strokes_ptr->read_count;
+
+	if (count && fseek(strokes_ptr->file,
+			   count * sizeof(struct m210_rawnote_body),
+			   SEEK_CUR)) {
+		return M210_ERR_SYS;
+	}
+	strokes_ptr->body_count = strokes_ptr->read_count;
+	strokes_ptr->next_body = strokes_ptr->read_count;
+	return M210_ERR_OK;
+}
@@ -0,0 +1,76 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_STROKE_H
+#define M210_STROKE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+#include "note.h"
+
+/*
+  Stroke iterator over a raw note stream. Notes are walked one by one
+  with m210_strokes_next_note(), and the strokes of the current note,
+  maximal runs of pen-down points, with m210_strokes_next(). Bodies are
+  read from the stream lazily, as strokes are requested.
+
+  m210_strokes_bounds() reads the rest of the current note at once to
+  compute its bounds, strokes can still be iterated afterwards.
+  m210_strokes_skip() seeks past the unread bodies of the current note
+  for callers which read them by other means; the note then ends.
+
+  Points and strokes are carved from an arena owned by the iterator.
+  The arena is reset, not freed, when the next note is started, so
+  strokes stay valid until then and walking a whole dump allocates
+  only when a note is larger than any note before it.
+*/
+
+typedef struct m210_strokes *m210_strokes;
+
+struct m210_stroke {
+	struct m210_note_body const *points;
+	size_t point_count;
+	int16_t min_x;
+	int16_t min_y;
+	int16_t max_x;
+	int16_t max_y;
+	/* Sum of the distances between consecutive points. */
+	double length;
+};
+
+/* Bounds of the pen-down points of a note. If there are none,
+   min_x > max_x. */
+struct m210_bounds {
+	int16_t min_x;
+	int16_t min_y;
+	int16_t max_x;
+	int16_t max_y;
+};
+
+enum m210_err m210_strokes_open(m210_strokes *strokesp, FILE *file);
+void m210_strokes_close(m210_strokes *strokesp);
+enum m210_err m210_strokes_next_note(m210_strokes strokes,
+				     struct m210_note_head *headp);
+enum m210_err m210_strokes_next(m210_strokes strokes,
+				struct m210_stroke const **strokep);
+enum m210_err m210_strokes_bounds(m210_strokes strokes,
+				  struct m210_bounds *boundsp);
+enum m210_err m210_strokes_skip(m210_strokes strokes);
+
+#endif /* M210_STROKE_H */
@@ -0,0 +1,231 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc.h"
+#include "rawnote.h"
+#include "sum.h"
+
+#define M210_SUM_VERSION 1
+
+enum m210_sum_state {
+	M210_SUM_STATE_HEAD,
+	M210_SUM_STATE_BODY,
+	M210_SUM_STATE_DONE
+};
+
+struct m210_sum {
+	enum m210_sum_state state;
+	uint64_t size;
+	uint32_t crc;
+	uint8_t head[sizeof(struct m210_rawnote_head)];
+	size_t head_size;
+	uint32_t body_left;
+	size_t note_count;
+	struct m210_sum_note notes[M210_SUM_MAX_NOTES];
+};
+
+enum m210_err m210_sum_new(struct m210_sum **const sum_ptr_ptr)
+{
+	enum m210_err err = M210_ERR_OK;
+	struct m210_sum *sum_ptr = calloc(1, sizeof(struct m210_sum));
+
+	if (!sum_ptr) {
+		err = M210_ERR_SYS;
+	}
+	*sum_ptr_ptr = sum_ptr;
+	return err;
+}
+
+void m210_sum_free(struct m210_sum **const sum_ptr_ptr)
+{
+	free(*sum_ptr_ptr);
+	*sum_ptr_ptr = NULL;
+}
+
+static void m210_sum_begin_note(struct m210_sum *const sum_ptr)
+{
+	struct m210_rawnote_head head;
+	struct m210_sum_note *note_ptr;
+	uint32_t next_pos = 0;
+
+	memcpy(&head, sum_ptr->head, sizeof(head));
+	memcpy(&next_pos, head.next_pos, sizeof(head.next_pos));
+	next_pos = le32toh(next_pos);
+
+	if (!memcmp(&head, &M210_RAWNOTE_HEAD_LAST, sizeof(head))
+	    || next_pos < sum_ptr->size
+	    || sum_ptr->note_count == M210_SUM_MAX_NOTES) {
+		/* End of the note chain. */
+		sum_ptr->state = M210_SUM_STATE_DONE;
+		return;
+	}
+
+	note_ptr = &sum_ptr->notes[sum_ptr->note_count++];
+	note_ptr->number = head.number;
+	note_ptr->offset = sum_ptr->size;
+	note_ptr->size = next_pos - sum_ptr->size;
+	note_ptr->crc = 0;
+
+	sum_ptr->body_left = note_ptr->size;
+	sum_ptr->state = (sum_ptr->body_left ? M210_SUM_STATE_BODY
+			  : M210_SUM_STATE_HEAD);
+	sum_ptr->head_size = 0;
+}
+
+void m210_sum_update(struct m210_sum *const sum_ptr,
+		     void const *const data, size_t const size)
+{
+	uint8_t const *bytes = data;
+	size_t left = size;
+
+	sum_ptr->crc = m210_crc32c(sum_ptr->crc, data, size);
+
+	while (left && sum_ptr->state != M210_SUM_STATE_DONE) {
+		size_t chunk;
+
+		if (sum_ptr->state == M210_SUM_STATE_HEAD) {
+			chunk = sizeof(sum_ptr->head) - sum_ptr->head_size;
+			chunk = chunk < left ? chunk : left;
+			memcpy(sum_ptr->head + sum_ptr->head_size, bytes,
+			       chunk);
+			sum_ptr->head_size += chunk;
+			sum_ptr->size += chunk;
+			if (sum_ptr->head_size == sizeof(sum_ptr->head)) {
+				m210_sum_begin_note(sum_ptr);
+			}
+		} else {
+			struct m210_sum_note *const note_ptr =
+				&sum_ptr->notes[sum_ptr->note_count - 1];
+			chunk = (sum_ptr->body_left < left
+				 ? sum_ptr->body_left : left);
+			note_ptr->crc = m210_crc32c(note_ptr->crc, bytes, chunk);
+			sum_ptr->body_left -= chunk;
+			sum_ptr->size += chunk;
+			if (!sum_ptr->body_left) {
+				sum_ptr->state = M210_SUM_STATE_HEAD;
+			}
+		}
+
+		bytes += chunk;
+		left -= chunk;
+	}
+
+	/* Trailing bytes (padding) after the end of the chain. */
+	sum_ptr->size += left;
+}
+
+enum m210_err m210_sum_write(struct m210_sum *const sum_ptr,
+			     FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	if (fprintf(file, "m210-sum %d\nsize %" PRIu64 "\ndump %08" PRIx32 "\n",
+		    M210_SUM_VERSION, sum_ptr->size, sum_ptr->crc) < 0) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+
+	for (size_t i = 0; i < sum_ptr->note_count; ++i) {
+		struct m210_sum_note const *const note_ptr = &sum_ptr->notes[i];
+		if (fprintf(file, "note %d %" PRIu32 " %" PRIu32 " %08" PRIx32 "\n",
+			    note_ptr->number, note_ptr->offset,
+			    note_ptr->size, note_ptr->crc) < 0) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+	}
+
+	if (fflush(file)) {
+		err = M210_ERR_SYS;
+		goto out;
+	}
+out:
+	return err;
+}
+
+/*
+  Compare checksums computed from a stream to the ones stored in
+  FILE. The dump checksum covers every note, but notes are compared
+  too, to detect malformed sidecars.
+*/
+enum m210_err m210_sum_verify(struct m210_sum *const sum_ptr,
+			      FILE *const file)
+{
+	enum m210_err err = M210_ERR_OK;
+	int version;
+	uint64_t size;
+	uint32_t crc;
+	size_t note_count = 0;
+
+	if (fscanf(file, "m210-sum %d size %" SCNu64 " dump %" SCNx32,
+		   &version, &size, &crc) != 3
+	    || version != M210_SUM_VERSION) {
+		err = ferror(file) ? M210_ERR_SYS : M210_ERR_BAD_SUM;
+		goto out;
+	}
+
+	if (size != sum_ptr->size || crc != sum_ptr->crc) {
+		err = M210_ERR_SUM_MISMATCH;
+		goto out;
+	}
+
+	while (1) {
+		unsigned int number;
+		struct m210_sum_note note;
+		int const retval = fscanf(file, " note %u %" SCNu32 " %" SCNu32
+					  " %" SCNx32, &number, &note.offset,
+					  &note.size, &note.crc);
+		if (retval == EOF) {
+			break;
+		}
+		if (retval != 4 || note_count == sum_ptr->note_count) {
+			err = M210_ERR_BAD_SUM;
+			goto out;
+		}
+		note.number = number;
+		if (note.number != sum_ptr->notes[note_count].number
+		    || note.offset != sum_ptr->notes[note_count].offset
+		    || note.size != sum_ptr->notes[note_count].size
+		    || note.crc != sum_ptr->notes[note_count].crc) {
+			err = M210_ERR_SUM_MISMATCH;
+			goto out;
+		}
+		++note_count;
+	}
+
+	if (note_count != sum_ptr->note_count) {
+		err = M210_ERR_SUM_MISMATCH;
+		goto out;
+	}
+out:
+	return err;
+}
+
+enum m210_err m210_sum_compare(struct m210_sum *const sum_ptr,
+			       struct m210_sum *const other_ptr)
+{
+	if (sum_ptr->size != other_ptr->size
+	    || sum_ptr->crc != other_ptr->crc) {
+		return M210_ERR_SUM_MISMATCH;
+	}
+	return M210_ERR_OK;
+}
@@ -0,0 +1,60 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_SUM_H
+#define M210_SUM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "err.h"
+
+/*
+  Checksums of a raw note stream: CRC-32C of the whole stream and of
+  the body section of each note. Checksums are computed incrementally
+  while the stream is being written or read, and can be stored to a
+  small text file (sidecar) next to the stream:
+
+    m210-sum 1
+    size SIZE
+    dump CRC
+    note NUMBER OFFSET SIZE CRC
+    ...
+
+  where CRC is a hexadecimal CRC-32C, OFFSET and SIZE are the position
+  and the size of the body section of the note in bytes.
+*/
+
+#define M210_SUM_MAX_NOTES 256
+
+typedef struct m210_sum *m210_sum;
+
+struct m210_sum_note {
+	uint8_t number;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t crc;
+};
+
+enum m210_err m210_sum_new(m210_sum *sump);
+void m210_sum_free(m210_sum *sump);
+void m210_sum_update(m210_sum sum, void const *data, size_t size);
+enum m210_err m210_sum_write(m210_sum sum, FILE *file);
+enum m210_err m210_sum_verify(m210_sum sum, FILE *file);
+enum m210_err m210_sum_compare(m210_sum sum, m210_sum other);
+
+#endif /* M210_SUM_H */
@@ -0,0 +1,116 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+/* Set and cleared under the mutex, read atomically outside of it. */
+static FILE *m210_trace_file = NULL;
+static int m210_trace_event_count = 0;
+static pthread_mutex_t m210_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+  Start writing trace events to FILE. Without M210_TRACE there would
+  be no events, so it is an error to ask for them.
+*/
+enum m210_err m210_trace_open(FILE *const file)
+{
+#ifdef M210_TRACE
+	if (fputs("{\"traceEvents\":[\n", file) == EOF) {
+		return M210_ERR_SYS;
+	}
+	pthread_mutex_lock(&m210_trace_mutex);
+	m210_trace_event_count = 0;
+	__atomic_store_n(&m210_trace_file, file, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&m210_trace_mutex);
+	return M210_ERR_OK;
+#else
+	(void) file;
+	errno = ENOTSUP;
+	return M210_ERR_SYS;
+#endif
+}
+
+/* Finish the trace, the file is left open. */
+enum m210_err m210_trace_close(void)
+{
+	enum m210_err err = M210_ERR_OK;
+
+	pthread_mutex_lock(&m210_trace_mutex);
+	if (!m210_trace_file) {
+		goto out;
+	}
+	if (fputs("\n],\"displayTimeUnit\":\"ms\"}\n", m210_trace_file) == EOF
+	    || ferror(m210_trace_file)) {
+		err = M210_ERR_SYS;
+	}
+	__atomic_store_n(&m210_trace_file, NULL, __ATOMIC_RELEASE);
+out:
+	pthread_mutex_unlock(&m210_trace_mutex);
+	return err;
+}
+
+static void m210_trace_event(char const *const name, char const phase,
+			     char const *const arg_name, long const arg)
+{
+	struct timespec ts;
+	long const tid = syscall(SYS_gettid);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	pthread_mutex_lock(&m210_trace_mutex);
+	if (!m210_trace_file) {
+		goto out;
+	}
+	fprintf(m210_trace_file,
+		"%s{\"name\":\"%s\",\"cat\":\"m210\",\"ph\":\"%c\","
+		"\"ts\":%ld.%03ld,\"pid\":%ld,\"tid\":%ld",
+		m210_trace_event_count++ ? ",\n" : "", name, phase,
+		(long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000,
+		ts.tv_nsec % 1000, (long) getpid(), tid);
+	if (arg_name) {
+		fprintf(m210_trace_file, ",\"args\":{\"%s\":%ld}", arg_name,
+			arg);
+	}
+	fputc('}', m210_trace_file);
+out:
+	pthread_mutex_unlock(&m210_trace_mutex);
+}
+
+void m210_trace_begin(char const *const name, char const *const arg_name,
+		      long const arg)
+{
+	/* Only a shortcut, the file is checked again under the lock. */
+	if (__atomic_load_n(&m210_trace_file, __ATOMIC_ACQUIRE)) {
+		m210_trace_event(name, 'B', arg_name, arg);
+	}
+}
+
+void m210_trace_end(char const *const name)
+{
+	if (__atomic_load_n(&m210_trace_file, __ATOMIC_ACQUIRE)) {
+		m210_trace_event(name, 'E', NULL, 0);
+	}
+}
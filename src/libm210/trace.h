@@ -0,0 +1,49 @@
+/* libm210
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef M210_TRACE_H
+#define M210_TRACE_H
+
+#include <stdio.h>
+
+#include "err.h"
+
+/*
+  Phase level tracing in the Chrome trace event format, which Perfetto
+  and chrome://tracing open. Spans are begun and ended with the
+  M210_TRACE_* macros, which are compiled out unless M210_TRACE is
+  defined (configure --disable-trace). Names must be plain string
+  literals, they are written without escaping.
+*/
+
+enum m210_err m210_trace_open(FILE *file);
+enum m210_err m210_trace_close(void);
+void m210_trace_begin(char const *name, char const *arg_name, long arg);
+void m210_trace_end(char const *name);
+
+#ifdef M210_TRACE
+#define M210_TRACE_BEGIN(name) m210_trace_begin((name), NULL, 0)
+#define M210_TRACE_BEGIN_ARG(name, arg_name, arg)	\
+	m210_trace_begin((name), (arg_name), (arg))
+#define M210_TRACE_END(name) m210_trace_end(name)
+#else
+#define M210_TRACE_BEGIN(name) ((void) 0)
+#define M210_TRACE_BEGIN_ARG(name, arg_name, arg) ((void) 0)
+#define M210_TRACE_END(name) ((void) 0)
+#endif
+
+#endif /* M210_TRACE_H */
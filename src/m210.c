@@ -18,20 +18,46 @@
 #define _GNU_SOURCE
 
 #include <err.h>
+#include <errno.h>
+#include <endian.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "libm210/archive.h"
+#include "libm210/columnar.h"
+#include "libm210/compress.h"
 #include "libm210/dev.h"
+#include "libm210/grid.h"
 #include "libm210/note.h"
+#include "libm210/pack.h"
+#include "libm210/rawnote.h"
+#include "libm210/recover.h"
+#include "libm210/stream.h"
+#include "libm210/stroke.h"
+#include "libm210/sum.h"
+#include "libm210/trace.h"
+
+#include "curve.h"
+#include "ndjson.h"
+#include "preview.h"
+#include "report.h"
+#include "serve.h"
+#include "svg.h"
+#include "tee.h"
 
 extern char *program_invocation_name;
 
-static const int svg_stroke_width = 20;
-static const char *const svg_stroke_color = "black";
+static FILE *capture_file = NULL;
+static FILE *replay_file = NULL;
+static int replay_realtime = 0;
+static FILE *trace_file = NULL;
 
 static void print_help_hint(void)
 {
@@ -56,149 +82,1414 @@ static void print_help(void)
 	printf("Usage: %s --help\n"
 	       "  or:  %s --version\n"
 	       "  or:  %s info\n"
-	       "  or:  %s dump [--output-file=FILE]\n"
+	       "  or:  %s dump [--output-file=FILE [--delete-after]] [--checksum-file=FILE]\n"
+	       "                 [--checkpoint=FILE | --last=N | --note=N...] [--compress]\n"
+	       "                 [--raw=FILE] [--svg-dir=DIR] [--ndjson=FILE]\n"
 	       "  or:  %s convert [--input-file=FILE] [--output-dir=DIR] [--overwrite]\n"
+	       "                    [--checksum-file=FILE]\n"
+	       "                    [--crop[=MARGIN] | --region=X0,Y0,X1,Y1]\n"
+	       "                    [--threads=N | --curves[=TOLERANCE]] [--recover]\n"
+	       "                    [--format=svg|ndjson|ndjson-strokes] [--gallery=FILE]\n"
 	       "  or:  %s delete\n"
+	       "  or:  %s stream [--format=ndjson|binary]\n"
+	       "  or:  %s export [--format=columnar] [--input-file=FILE]\n"
+	       "                   [--output-file=FILE] [--checksum-file=FILE]\n"
+	       "  or:  %s pack [--input-file=FILE] [--output-file=FILE]\n"
+	       "  or:  %s unpack [--input-file=FILE] [--output-file=FILE]\n"
+	       "  or:  %s serve --socket=PATH [--threads=N] [--cache-size=MB] DUMP...\n"
+	       "  or:  %s archive add [--archive=DIR] [--device=NAME] DUMP...\n"
+	       "  or:  %s archive list [--archive=DIR]\n"
+	       "  or:  %s archive export [--archive=DIR] [--id=N...] [--output-file=FILE]\n"
+	       "  or:  %s stats [--json] [DUMP...]\n"
+	       "  or:  %s preview [--input-file=FILE] [--note=N] [--sixel]\n"
+	       "  or:  %s [--capture=FILE | --replay=FILE [--realtime]] [--trace=FILE]\n"
+	       "            COMMAND\n"
 	       "\n"
 	       "Download notes from Pegasus Tablet Mobile NoteTaker (M210) and\n"
 	       "convert them to SVG files.\n"
-	       "\n"
-	       "Options:\n"
-	       " --help                 display this help and exit\n"
-	       " --version              output version information and exit\n"
-	       "\n"
-	       "Dump options:\n"
-	       "    --output-file=FILE  defaults to standard output\n"
-	       "\n"
-	       "Convert options:\n"
-	       "    --input-file=FILE   defaults to standard input\n"
-	       "    --output-dir=DIR    directory for SVG files,\n"
-	       "                        defaults to current directory\n"
-	       "    --overwrite         overwrite existing SVG files\n"
-	       "\n"
-	       "Examples:\n"
-	       "Download notes to a file:\n"
-	       "  m210 dump > notes\n"
-	       "\n"
-	       "Convert downloaded notes to SVG files:\n"
-	       "  m210 convert < notes\n"
-	       "\n"
-	       "Erase notes from the device's memory:\n"
-	       "  m210 delete\n"
-	       "\n"
-	       "Display device information:\n"
-	       "  m210 info\n"
-	       "\n"
-	       "Report bugs to <%s>\n"
-	       "Homepage: <%s>\n"
 	       "\n",
 	       program_invocation_name, program_invocation_name,
 	       program_invocation_name, program_invocation_name,
 	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name, program_invocation_name,
+	       program_invocation_name);
+	fputs("Options:\n"
+	      " --help                 display this help and exit\n"
+	      " --version              output version information and exit\n"
+	      " --capture=FILE         record the device traffic to FILE\n"
+	      " --replay=FILE          replay the device traffic recorded in FILE\n"
+	      "                        instead of using a real device\n"
+	      " --realtime             replay at the recorded speed instead of\n"
+	      "                        as fast as possible\n"
+	      " --trace=FILE           write a trace of the command's phases to FILE\n"
+	      "                        in the Chrome trace event format\n"
+	      "\n"
+	      "Dump options:\n"
+	      "    --output-file=FILE  defaults to standard output\n"
+	      "    --checkpoint=FILE   keep track of received packets in FILE and\n"
+	      "                        resume an interrupted download from it\n"
+	      "    --last=N            download only the N newest notes\n"
+	      "    --note=N            download only the note number N, can be\n"
+	      "                        given multiple times\n"
+	      "    --checksum-file=FILE\n"
+	      "                        write checksums of the notes to FILE\n"
+	      "    --delete-after      delete notes from the device once they have\n"
+	      "                        been written to the output file and verified\n"
+	      "    --compress          compress the notes while they are downloaded\n"
+	      "    --raw=FILE          same as --output-file\n"
+	      "    --svg-dir=DIR       convert the notes to SVG files in DIR while\n"
+	      "                        they are downloaded\n"
+	      "    --ndjson=FILE       convert the notes to NDJSON records in FILE\n"
+	      "                        while they are downloaded\n"
+	      "                        (with --svg-dir or --ndjson, raw notes are\n"
+	      "                        written only if --raw is given)\n"
+	      "\n", stdout);
+	fputs("Convert options:\n"
+	      "    --input-file=FILE   raw, compressed or packed notes, defaults to\n"
+	      "                        standard input\n"
+	      "    --output-dir=DIR    directory for SVG and gallery files,\n"
+	      "                        defaults to current directory\n"
+	      "    --overwrite         overwrite existing SVG and gallery files\n"
+	      "    --checksum-file=FILE\n"
+	      "                        verify the notes against the checksums in\n"
+	      "                        FILE before converting\n"
+	      "    --crop[=MARGIN]     crop SVG files to the bounding box of the\n"
+	      "                        note plus MARGIN device units on each side,\n"
+	      "                        defaults to 100 (1.5 mm)\n"
+	      "    --region=X0,Y0,X1,Y1\n"
+	      "                        convert only the strokes inside the region,\n"
+	      "                        clipped to it, given in device units\n"
+	      "    --threads=N         convert large notes in N parallel chunks\n"
+	      "    --curves[=TOLERANCE]\n"
+	      "                        fit cubic Bézier curves to strokes, no point\n"
+	      "                        farther than TOLERANCE device units from\n"
+	      "                        them, defaults to 10 (0.15 mm)\n"
+	      "    --gallery=FILE      write all notes to a single HTML file\n"
+	      "                        instead of an SVG file per note\n"
+	      "    --recover           skip damaged parts of the input and convert\n"
+	      "                        all intact notes\n"
+	      "    --format=FORMAT     svg (the default): an SVG file per note,\n"
+	      "                        ndjson: newline delimited JSON to standard\n"
+	      "                        output, a record per note, or ndjson-strokes:\n"
+	      "                        a record per stroke\n"
+	      "\n"
+	      "Export options:\n"
+	      "    --format=FORMAT     columnar (the default): a binary file of\n"
+	      "                        aligned x and y arrays, a pen state bitmap\n"
+	      "                        and note and stroke tables, see\n"
+	      "                        libm210/columnar.h\n"
+	      "    --input-file=FILE   raw, compressed or packed notes, defaults to\n"
+	      "                        standard input\n"
+	      "    --output-file=FILE  defaults to standard output\n"
+	      "    --checksum-file=FILE\n"
+	      "                        verify the notes against the checksums in\n"
+	      "                        FILE before exporting\n"
+	      "\n"
+	      "Pack and unpack options:\n"
+	      "    --input-file=FILE   defaults to standard input\n"
+	      "    --output-file=FILE  defaults to standard output\n"
+	      "\n"
+	      "Stream options:\n"
+	      "    --format=FORMAT     output pen events as newline delimited JSON\n"
+	      "                        (ndjson, the default) or as 13 byte binary\n"
+	      "                        records (binary): time in microseconds (8),\n"
+	      "                        x (2), y (2), flags (1: in range, 2: tip,\n"
+	      "                        4: button), all little-endian\n"
+	      "\n", stdout);
+	fputs("Serve options:\n"
+	      "    --socket=PATH       listen on the Unix domain socket PATH for\n"
+	      "                        requests, one per line: list, svg ID or\n"
+	      "                        png ID SIZE, see src/serve.h\n"
+	      "    --threads=N         render notes on N threads, defaults to 2\n"
+	      "    --cache-size=MB     keep up to MB megabytes of rendered notes,\n"
+	      "                        defaults to 64\n"
+	      "\n"
+	      "Archive options:\n"
+	      "    --archive=DIR       archive directory, defaults to m210-archive\n"
+	      "    --device=NAME       record the notes as downloaded from NAME\n"
+	      "    --id=N              export only the note N of the archive list,\n"
+	      "                        can be given multiple times\n"
+	      "    --output-file=FILE  defaults to standard output\n"
+	      "\n"
+	      "Stats options:\n"
+	      "    --json              write newline delimited JSON records instead\n"
+	      "                        of lines of text, see src/report.h\n"
+	      "\n"
+	      "Preview options:\n"
+	      "    --input-file=FILE   raw, compressed or packed notes, defaults to\n"
+	      "                        standard input\n"
+	      "    --note=N            preview only the note number N\n"
+	      "    --sixel             draw sixel images instead of braille\n"
+	      "                        characters\n"
+	      "\n", stdout);
+	fputs("Examples:\n"
+	      "Download notes to a file:\n"
+	      "  m210 dump > notes\n"
+	      "\n"
+	      "Convert downloaded notes to SVG files:\n"
+	      "  m210 convert < notes\n"
+	      "\n"
+	      "Convert notes to smaller SVG files of smooth curves:\n"
+	      "  m210 convert --curves < notes\n"
+	      "\n"
+	      "Convert notes to a single HTML page:\n"
+	      "  m210 convert --gallery=notes.html < notes\n"
+	      "\n"
+	      "Erase notes from the device's memory:\n"
+	      "  m210 delete\n"
+	      "\n"
+	      "Download notes and convert them in one pass:\n"
+	      "  m210 dump --raw=notes --svg-dir=svg --ndjson=notes.ndjson\n"
+	      "\n"
+	      "Download notes to a compressed file:\n"
+	      "  m210 dump --compress > notes.lz\n"
+	      "\n"
+	      "Download notes to a file and then erase them from the device:\n"
+	      "  m210 dump --output-file=notes --delete-after\n"
+	      "\n"
+	      "Display device information:\n"
+	      "  m210 info\n"
+	      "\n"
+	      "Show the strokes, points, ink length and bounds of each note:\n"
+	      "  m210 stats notes\n"
+	      "\n"
+	      "Look at downloaded notes in the terminal:\n"
+	      "  m210 preview < notes\n"
+	      "\n"
+	      "Download notes, resuming where an interrupted download left off:\n"
+	      "  m210 dump --checkpoint=notes.ckpt > notes\n"
+	      "\n"
+	      "Download only the newest note:\n"
+	      "  m210 dump --last=1 > notes\n"
+	      "\n"
+	      "Pack downloaded notes for archival, convert them directly and\n"
+	      "unpack them back to the raw form:\n"
+	      "  m210 pack --input-file=notes --output-file=notes.m210pak\n"
+	      "  m210 convert --input-file=notes.m210pak\n"
+	      "  m210 unpack --input-file=notes.m210pak --output-file=notes\n"
+	      "\n"
+	      "Export notes for analytics tools which mmap the file:\n"
+	      "  m210 export --format=columnar --input-file=notes --output-file=notes.col\n"
+	      "\n"
+	      "Convert notes to newline delimited JSON, a record per stroke:\n"
+	      "  m210 convert --format=ndjson-strokes < notes > notes.ndjson\n"
+	      "\n"
+	      "Archive every dump, storing each note only once, and get them back:\n"
+	      "  m210 archive add notes\n"
+	      "  m210 archive export > all-notes\n"
+	      "\n"
+	      "Serve notes to a web front end over a Unix domain socket:\n"
+	      "  m210 serve --socket=/run/m210.sock notes\n"
+	      "\n"
+	      "Stream live pen events while the device is in tablet mode:\n"
+	      "  m210 stream\n"
+	      "\n"
+	      "Record a download session and replay it later:\n"
+	      "  m210 --capture=session dump > notes\n"
+	      "  m210 --replay=session dump > notes\n"
+	      "\n"
+	      "Trace a download to open it in Perfetto or chrome://tracing:\n"
+	      "  m210 --trace=dump.json dump > notes\n"
+	      "\n", stdout);
+	printf("Report bugs to <%s>\n"
+	       "Homepage: <%s>\n"
+	       "\n",
 	       PACKAGE_BUGREPORT, PACKAGE_URL);
 }
 
-static FILE* open_svg_file(int note_number, char *output_mode)
+/* Return the positive integer in STR, or -1 if STR is not one. */
+static long parse_note_count(char const *const str)
 {
-	FILE *file = NULL;
-	char *filename = NULL;
+	char *end;
+	long value;
+
+	errno = 0;
+	value = strtol(str, &end, 10);
+	if (errno || end == str || *end != '\0' || value <= 0) {
+		return -1;
+	}
+	return value;
+}
+
+/*
+  Parse a region "X0,Y0,X1,Y1" in STR to *REGIONP. Return -1 if STR is
+  not a region.
+*/
+static int parse_region(char const *const str,
+			struct m210_bounds *const regionp)
+{
+	long values[4];
+	int end = 0;
+	int i;
+
+	if (sscanf(str, "%ld,%ld,%ld,%ld%n", &values[0], &values[1],
+		   &values[2], &values[3], &end) != 4 || str[end] != '\0') {
+		return -1;
+	}
+	for (i = 0; i < 4; ++i) {
+		if (values[i] < INT16_MIN || values[i] > INT16_MAX) {
+			return -1;
+		}
+	}
+	regionp->min_x = values[0] < values[2] ? values[0] : values[2];
+	regionp->max_x = values[0] < values[2] ? values[2] : values[0];
+	regionp->min_y = values[1] < values[3] ? values[1] : values[3];
+	regionp->max_y = values[1] < values[3] ? values[3] : values[1];
+	return 0;
+}
+
+/* Return the non-negative coordinate distance in STR, or -1. */
+static long parse_distance(char const *const str)
+{
+	char *end;
+	long value;
+
+	errno = 0;
+	value = strtol(str, &end, 10);
+	if (errno || end == str || *end != '\0' || value < 0
+	    || value > INT16_MAX) {
+		return -1;
+	}
+	return value;
+}
+
+static enum m210_err connect_dev(m210_dev *devp)
+{
+	enum m210_err err;
 
-	if (asprintf(&filename, "m210_note_%d.svg", note_number) == -1) {
-		/* On error, asprintf() leaves the contents of
-		 * filename undefined. It needs to be NULLed to safely
-		 * call free(). */
-		filename = NULL;
+	if (replay_file) {
+		err = m210_dev_connect_replay(devp, replay_file,
+					      replay_realtime);
+	} else {
+		err = m210_dev_connect(devp);
+	}
+	if (err) {
 		goto out;
 	}
 
-	file = fopen(filename, output_mode);
+	if (capture_file) {
+		err = m210_dev_set_capture(*devp, capture_file);
+		if (err) {
+			m210_dev_disconnect(devp);
+			goto out;
+		}
+	}
 out:
-	free(filename);
-	return file;
+	return err;
 }
 
-static int note_to_svg(FILE *input_file, char *output_mode) {
+/*
+  Read the whole FILE to a newly allocated buffer. Raw note streams
+  are at most M210_DEV_MAX_MEMORY bytes, so this is cheap.
+*/
+static int read_file(FILE *const file, char **const datap,
+		     size_t *const sizep)
+{
 	int result = -1;
-	FILE *output_file = NULL;
-	struct m210_note_head head;
+	char *data = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+
+	while (1) {
+		size_t read_size;
+
+		if (size == capacity) {
+			char *new_data;
+			capacity = capacity ? capacity * 2 : 65536;
+			new_data = realloc(data, capacity);
+			if (new_data == NULL) {
+				goto out;
+			}
+			data = new_data;
+		}
+
+		read_size = fread(data + size, 1, capacity - size, file);
+		size += read_size;
+		if (read_size == 0) {
+			if (ferror(file)) {
+				goto out;
+			}
+			break;
+		}
+	}
+
+	result = 0;
+out:
+	if (result) {
+		free(data);
+		data = NULL;
+		size = 0;
+	}
+	*datap = data;
+	*sizep = size;
+	return result;
+}
+
+/*
+  Decode the packed or compressed note stream in *DATAP with DECODE to
+  a newly allocated raw note stream, which replaces *DATAP.
+*/
+static int decode_input(char **const datap, size_t *const sizep,
+			enum m210_err (*const decode)(void const *, size_t,
+						      FILE *))
+{
+	int result = -1;
+	FILE *raw_file = NULL;
+	char *raw_data = NULL;
+	size_t raw_size = 0;
+	enum m210_err err;
+
+	raw_file = open_memstream(&raw_data, &raw_size);
+	if (raw_file == NULL) {
+		perror("error: failed to decode input file");
+		goto out;
+	}
+
+	err = decode(*datap, *sizep, raw_file);
+	if (err) {
+		m210_err_perror(err, "error: failed to decode input file");
+		goto out;
+	}
+
+	if (fclose(raw_file)) {
+		raw_file = NULL;
+		perror("error: failed to decode input file");
+		goto out;
+	}
+	raw_file = NULL;
+
+	free(*datap);
+	*datap = raw_data;
+	*sizep = raw_size;
+	raw_data = NULL;
+
+	result = 0;
+out:
+	if (raw_file) {
+		fclose(raw_file);
+	}
+	free(raw_data);
+	return result;
+}
+
+/*
+  Recover the intact notes of the damaged raw note stream in *DATAP to
+  a newly allocated raw note stream, which replaces *DATAP.
+*/
+static int recover_input(char **const datap, size_t *const sizep)
+{
+	int result = -1;
+	FILE *raw_file = NULL;
+	char *raw_data = NULL;
+	size_t raw_size = 0;
+	struct m210_recover_stats stats;
+	enum m210_err err;
+
+	raw_file = open_memstream(&raw_data, &raw_size);
+	if (raw_file == NULL) {
+		perror("error: failed to recover notes");
+		goto out;
+	}
+
+	err = m210_recover(*datap, *sizep, raw_file, &stats);
+	if (err) {
+		m210_err_perror(err, "error: failed to recover notes");
+		goto out;
+	}
+
+	if (fclose(raw_file)) {
+		raw_file = NULL;
+		perror("error: failed to recover notes");
+		goto out;
+	}
+	raw_file = NULL;
+
+	fprintf(stderr, "recovered %zu notes, skipped %zu damaged bytes\n",
+		stats.note_count, stats.skipped_size);
+
+	free(*datap);
+	*datap = raw_data;
+	*sizep = raw_size;
+	raw_data = NULL;
+
+	result = 0;
+out:
+	if (raw_file) {
+		fclose(raw_file);
+	}
+	free(raw_data);
+	return result;
+}
+
+/*
+  Read the raw, compressed or packed note stream in INPUT_FILE to
+  memory, verify it against the checksums in SUM_FILE, if given, and
+  then recover the intact notes of it, if RECOVER is non-zero, so that
+  the checksums always cover the stream as it was read. Compressed
+  input is decompressed block by block while it is read. On success,
+  *INPUT_BUFFERP holds the raw note stream.
+*/
+static int load_input(FILE *const input_file, FILE *const sum_file,
+		      int const recover, char **const input_bufferp,
+		      size_t *const input_sizep)
+{
+	int result = -1;
+	FILE *raw_file = NULL;
+	m210_sum sum = NULL;
 	enum m210_err err;
-	int bodyi;
-	int has_path = 0;
 
-	err = m210_note_read_head(&head, input_file);
+	err = m210_compress_open_reader(&raw_file, input_file);
 	if (err) {
-		m210_err_perror(err, "error: failed to read note head");
+		m210_err_perror(err, "error: failed to read input file");
 		goto out;
 	}
 
-	if (head.number == 0) {
-		/* End of note stream. */
-		result = 0;
+	if (read_file(raw_file, input_bufferp, input_sizep)) {
+		if (errno == EBADMSG) {
+			m210_err_perror(M210_ERR_BAD_COMPRESSED,
+					"error: failed to decode input file");
+		} else {
+			perror("error: failed to read input file");
+		}
 		goto out;
 	}
 
-	output_file = open_svg_file(head.number, output_mode);
-	if (output_file == NULL) {
-		perror("error: failed to create SVG file");
+	if (m210_pack_is_packed(*input_bufferp, *input_sizep)
+	    && decode_input(input_bufferp, input_sizep, m210_pack_decode)) {
 		goto out;
 	}
 
-	fprintf(output_file, "%s\n", "<?xml version=\"1.0\"?>");
-	fprintf(output_file, "%s\n", "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">");
-	fprintf(output_file, "%s\n", "<svg width=\"210mm\" height=\"297mm\" viewBox=\"-7000 0 14000 20000\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">");
+	if (sum_file) {
+		err = m210_sum_new(&sum);
+		if (err) {
+			m210_err_perror(err,
+					"error: failed to compute checksums");
+			goto out;
+		}
+
+		m210_sum_update(sum, *input_bufferp, *input_sizep);
 
-	for (bodyi = 0; bodyi < head.bodyc; ++bodyi) {
-		struct m210_note_body body;
-		err = m210_note_read_body(&body, input_file);
+		err = m210_sum_verify(sum, sum_file);
 		if (err) {
-			m210_err_perror(err, "error: failed to read note body");
+			m210_err_perror(err,
+					"error: failed to verify input file");
 			goto out;
 		}
-		if (body.pressure) {
-			if (!has_path) {
-				fprintf(output_file,
-					"<polyline stroke-width=\"%d\" "
-					"stroke=\"%s\" fill=\"none\" points=\"",
-					svg_stroke_width, svg_stroke_color);
-				has_path = 1;
+	}
+
+	if (recover && recover_input(input_bufferp, input_sizep)) {
+		goto out;
+	}
+
+	result = 0;
+out:
+	m210_sum_free(&sum);
+	if (raw_file) {
+		fclose(raw_file);
+	}
+	return result;
+}
+
+static int convert_cmd(int argc, char **argv)
+{
+	int result = -1;
+	FILE *input_file = NULL;
+	FILE *sum_file = NULL;
+	FILE *loaded_file = NULL;
+	FILE *gallery_file = NULL;
+	char const *gallery_path = NULL;
+	m210_strokes strokes = NULL;
+	char *input_buffer = NULL;
+	size_t input_size = 0;
+	struct svg_options svg_options;
+	struct curve_fit curves;
+	int recover = 0;
+	int ndjson = 0;
+	int per_stroke = 0;
+	enum m210_err err;
+	const struct option opts[] = {
+		{"input-file", required_argument, NULL, 'i'},
+		{"output-dir", required_argument, NULL, 'd'},
+		{"overwrite", no_argument, NULL, 'f'},
+		{"checksum-file", required_argument, NULL, 's'},
+		{"crop", optional_argument, NULL, 'C'},
+		{"region", required_argument, NULL, 'R'},
+		{"threads", required_argument, NULL, 'j'},
+		{"recover", no_argument, NULL, 'r'},
+		{"format", required_argument, NULL, 'F'},
+		{"curves", optional_argument, NULL, 'c'},
+		{"gallery", required_argument, NULL, 'g'},
+		{0, 0, 0, 0}
+	};
+
+	input_file = stdin;
+	curve_fit_init(&curves, 10.0);
+
+	svg_options.output_mode = "wx";
+	svg_options.crop = 0;
+	svg_options.margin = svg_crop_margin;
+	svg_options.grid = NULL;
+	svg_options.threads = 1;
+	svg_options.output_file = NULL;
+	svg_options.output_dir = NULL;
+	svg_options.curves = NULL;
+	svg_options.gallery = NULL;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'i':
+			input_file = fopen(optarg, "rb");
+			if (input_file == NULL) {
+				perror("error: failed to open input file");
+				goto out;
 			}
-			fprintf(output_file, "%d,%d ", body.x, body.y);
-		} else {
-			fprintf(output_file, "%s\n", "\" />");
-			has_path = 0;
+			break;
+		case 'd':
+			if (chdir(optarg)) {
+				perror("error: failed to change the current "
+				       "working directory");
+				goto out;
+			}
+			break;
+		case 'f':
+			svg_options.output_mode = "w";
+			break;
+		case 'C':
+			svg_options.crop = 1;
+			if (optarg) {
+				long const margin = parse_distance(optarg);
+				if (margin == -1) {
+					fprintf(stderr, "error: invalid crop "
+						"margin '%s'\n", optarg);
+					print_help_hint();
+					goto out;
+				}
+				svg_options.margin = margin;
+			}
+			break;
+		case 'c':
+			svg_options.curves = &curves;
+			if (optarg) {
+				long const tolerance = parse_distance(optarg);
+				if (tolerance == -1) {
+					fprintf(stderr, "error: invalid curve "
+						"tolerance '%s'\n", optarg);
+					print_help_hint();
+					goto out;
+				}
+				curves.tolerance = tolerance;
+			}
+			break;
+		case 'g':
+			gallery_path = optarg;
+			break;
+		case 'r':
+			recover = 1;
+			break;
+		case 'F':
+			if (strcmp(optarg, "svg") == 0) {
+				ndjson = 0;
+			} else if (strcmp(optarg, "ndjson") == 0) {
+				ndjson = 1;
+				per_stroke = 0;
+			} else if (strcmp(optarg, "ndjson-strokes") == 0) {
+				ndjson = 1;
+				per_stroke = 1;
+			} else {
+				fprintf(stderr, "error: unknown convert format "
+					"'%s'\n", optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		case 'j':
+			svg_options.threads = parse_note_count(optarg);
+			if (svg_options.threads == -1) {
+				fprintf(stderr, "error: invalid thread count "
+					"'%s'\n", optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		case 'R':
+			if (parse_region(optarg, &svg_options.region)) {
+				fprintf(stderr, "error: invalid region '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			if (!svg_options.grid) {
+				err = m210_grid_new(&svg_options.grid);
+				if (err) {
+					m210_err_perror(err, "error: failed to "
+							"create note index");
+					goto out;
+				}
+			}
+			break;
+		case 's':
+			sum_file = fopen(optarg, "r");
+			if (sum_file == NULL) {
+				perror("error: failed to open checksum file");
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected convert arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (svg_options.crop && svg_options.grid) {
+		fprintf(stderr, "error: --crop and --region are mutually "
+			"exclusive\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (svg_options.curves && (svg_options.grid
+				   || svg_options.threads > 1)) {
+		fprintf(stderr, "error: --curves is mutually exclusive with "
+			"--region and --threads\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (ndjson && (svg_options.crop || svg_options.grid
+		       || svg_options.threads > 1 || svg_options.curves
+		       || gallery_path)) {
+		fprintf(stderr, "error: --crop, --region, --threads, --curves "
+			"and --gallery apply only to SVG files\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (recover && sum_file) {
+		fprintf(stderr, "error: --recover and --checksum-file are "
+			"mutually exclusive\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (load_input(input_file, sum_file, recover, &input_buffer,
+		       &input_size)) {
+		goto out;
+	}
+	loaded_file = fmemopen(input_buffer, input_size, "rb");
+	if (loaded_file == NULL) {
+		perror("error: failed to open input");
+		goto out;
+	}
+
+	if (ndjson) {
+		result = notes_to_ndjson(loaded_file, per_stroke, stdout);
+		goto out;
+	}
+
+	svg_options.input_file = loaded_file;
+	svg_options.input_data = input_buffer;
+
+	/* Like the SVG files, the gallery is written to the output
+	 * directory, whichever order the options are in. */
+	if (gallery_path) {
+		gallery_file = fopen(gallery_path, svg_options.output_mode);
+		if (gallery_file == NULL) {
+			perror("error: failed to open gallery file");
+			goto out;
+		}
+		svg_options.gallery = svg_gallery_open(gallery_file);
+		if (svg_options.gallery == NULL) {
+			perror("error: failed to write gallery");
+			goto out;
 		}
 	}
 
-	if (fprintf(output_file, "%s", "</svg>\n") < 0) {
-		perror("error: failed to write to output file");
+	err = m210_strokes_open(&strokes, loaded_file);
+	if (err) {
+		m210_err_perror(err, "error: failed to read input");
 		goto out;
 	}
 
-	result = 1;
+	while (1) {
+		result = note_to_svg(strokes, &svg_options);
+		if (result == -1) {
+			goto out;
+		} else if (result == 0) {
+			break;
+		}
+	}
+
 out:
-	if (output_file && output_file != stdout && fclose(output_file)) {
-		perror("error: failed to close output file");
+	if (svg_options.gallery && svg_gallery_close(svg_options.gallery)) {
+		perror("error: failed to write gallery");
+		result = -1;
+	}
+	if (gallery_file && fclose(gallery_file)) {
+		perror("error: failed to close gallery file");
+		result = -1;
+	}
+	curve_fit_free(&curves);
+	m210_grid_free(&svg_options.grid);
+	m210_strokes_close(&strokes);
+	if (loaded_file) {
+		fclose(loaded_file);
+	}
+	free(input_buffer);
+	if (sum_file) {
+		fclose(sum_file);
+	}
+	if (input_file && input_file != stdin && fclose(input_file)) {
+		perror("failed to close input file");
 		result = -1;
 	}
 	return result;
 }
 
-static int convert_cmd(int argc, char **argv)
+static int export_cmd(int argc, char **argv)
+{
+	int result = -1;
+	FILE *input_file = NULL;
+	FILE *output_file = NULL;
+	FILE *sum_file = NULL;
+	FILE *loaded_file = NULL;
+	char *input_buffer = NULL;
+	size_t input_size = 0;
+	enum m210_err err;
+	const struct option opts[] = {
+		{"input-file", required_argument, NULL, 'i'},
+		{"output-file", required_argument, NULL, 'o'},
+		{"checksum-file", required_argument, NULL, 's'},
+		{"format", required_argument, NULL, 'F'},
+		{0, 0, 0, 0}
+	};
+
+	input_file = stdin;
+	output_file = stdout;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'i':
+			input_file = fopen(optarg, "rb");
+			if (input_file == NULL) {
+				perror("error: failed to open input file");
+				goto out;
+			}
+			break;
+		case 'o':
+			output_file = fopen(optarg, "wb");
+			if (output_file == NULL) {
+				perror("error: failed to open output file");
+				goto out;
+			}
+			break;
+		case 's':
+			sum_file = fopen(optarg, "r");
+			if (sum_file == NULL) {
+				perror("error: failed to open checksum file");
+				goto out;
+			}
+			break;
+		case 'F':
+			if (strcmp(optarg, "columnar")) {
+				fprintf(stderr, "error: unknown export format "
+					"'%s'\n", optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected export arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (load_input(input_file, sum_file, 0, &input_buffer, &input_size)) {
+		goto out;
+	}
+	loaded_file = fmemopen(input_buffer, input_size, "rb");
+	if (loaded_file == NULL) {
+		perror("error: failed to open input");
+		goto out;
+	}
+
+	err = m210_columnar_write(loaded_file, output_file);
+	if (err) {
+		m210_err_perror(err, "error: failed to export notes");
+		goto out;
+	}
+
+	result = 0;
+out:
+	if (loaded_file) {
+		fclose(loaded_file);
+	}
+	free(input_buffer);
+	if (sum_file) {
+		fclose(sum_file);
+	}
+	if (output_file && output_file != stdout && fclose(output_file)) {
+		perror("error: failed to close output file");
+		result = -1;
+	}
+	if (input_file && input_file != stdin) {
+		fclose(input_file);
+	}
+	return result;
+}
+
+/*
+  Pack a raw note stream to the archival format, or unpack it back
+  if UNPACK is non-zero.
+*/
+static int pack_or_unpack(int argc, char **argv, int const unpack)
+{
+	int result = -1;
+	FILE *input_file = NULL;
+	FILE *output_file = NULL;
+	char *input_buffer = NULL;
+	size_t input_size = 0;
+	enum m210_err err;
+	const struct option opts[] = {
+		{"input-file", required_argument, NULL, 'i'},
+		{"output-file", required_argument, NULL, 'o'},
+		{0, 0, 0, 0}
+	};
+
+	input_file = stdin;
+	output_file = stdout;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'i':
+			input_file = fopen(optarg, "rb");
+			if (input_file == NULL) {
+				perror("error: failed to open input file");
+				goto out;
+			}
+			break;
+		case 'o':
+			output_file = fopen(optarg, "wb");
+			if (output_file == NULL) {
+				perror("error: failed to open output file");
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected %s arguments\n", argv[0]);
+		print_help_hint();
+		goto out;
+	}
+
+	if (read_file(input_file, &input_buffer, &input_size)) {
+		perror("error: failed to read input file");
+		goto out;
+	}
+
+	if (unpack) {
+		err = m210_pack_decode(input_buffer, input_size, output_file);
+	} else if (m210_pack_is_packed(input_buffer, input_size)) {
+		fprintf(stderr, "error: input file is already packed\n");
+		goto out;
+	} else {
+		err = m210_pack_encode(input_buffer, input_size, output_file);
+	}
+	if (err) {
+		m210_err_perror(err, unpack ? "error: failed to unpack notes"
+				: "error: failed to pack notes");
+		goto out;
+	}
+
+	result = 0;
+out:
+	free(input_buffer);
+	if (output_file && output_file != stdout && fclose(output_file)) {
+		perror("error: failed to close output file");
+		result = -1;
+	}
+	if (input_file && input_file != stdin) {
+		fclose(input_file);
+	}
+	return result;
+}
+
+static int pack_cmd(int argc, char **argv)
+{
+	return pack_or_unpack(argc, argv, 0);
+}
+
+static int unpack_cmd(int argc, char **argv)
+{
+	return pack_or_unpack(argc, argv, 1);
+}
+
+/* Default archive directory, relative to the current directory. */
+static char const *const archive_default_path = "m210-archive";
+
+static int archive_add(int argc, char **argv)
+{
+	int result = -1;
+	m210_archive archive = NULL;
+	char const *path = archive_default_path;
+	char const *device = "";
+	size_t total_added = 0;
+	enum m210_err err;
+	const struct option opts[] = {
+		{"archive", required_argument, NULL, 'a'},
+		{"device", required_argument, NULL, 'D'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'a':
+			path = optarg;
+			break;
+		case 'D':
+			if (strlen(optarg) >= M210_ARCHIVE_DEVICE_SIZE) {
+				fprintf(stderr, "error: device name is longer "
+					"than %d characters\n",
+					M210_ARCHIVE_DEVICE_SIZE - 1);
+				goto out;
+			}
+			device = optarg;
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind == argc) {
+		fprintf(stderr, "error: dump files are missing\n");
+		print_help_hint();
+		goto out;
+	}
+
+	err = m210_archive_open(&archive, path);
+	if (err) {
+		m210_err_perror(err, "error: failed to open archive");
+		goto out;
+	}
+
+	for (; optind < argc; ++optind) {
+		FILE *input_file;
+		char *input_buffer = NULL;
+		size_t input_size = 0;
+		size_t added;
+
+		input_file = fopen(argv[optind], "rb");
+		if (input_file == NULL) {
+			fprintf(stderr, "error: failed to open %s: %s\n",
+				argv[optind], strerror(errno));
+			goto out;
+		}
+		if (load_input(input_file, NULL, 0, &input_buffer,
+			       &input_size)) {
+			fclose(input_file);
+			goto out;
+		}
+		fclose(input_file);
+
+		err = m210_archive_add(archive, input_buffer, input_size,
+				       device, &added);
+		free(input_buffer);
+		if (err) {
+			m210_err_perror(err, "error: failed to archive notes");
+			goto out;
+		}
+		total_added += added;
+	}
+
+	fprintf(stderr, "added %zu new notes, %zu notes in the archive\n",
+		total_added, m210_archive_count(archive));
+	result = 0;
+out:
+	m210_archive_close(&archive);
+	return result;
+}
+
+static int archive_list(int argc, char **argv)
+{
+	int result = -1;
+	m210_archive archive = NULL;
+	char const *path = archive_default_path;
+	size_t i;
+	enum m210_err err;
+	const struct option opts[] = {
+		{"archive", required_argument, NULL, 'a'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'a':
+			path = optarg;
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected archive arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	err = m210_archive_open(&archive, path);
+	if (err) {
+		m210_err_perror(err, "error: failed to open archive");
+		goto out;
+	}
+
+	for (i = 0; i < m210_archive_count(archive); ++i) {
+		struct m210_archive_entry const *const entry =
+			m210_archive_entry(archive, i);
+		time_t const added = le64toh(entry->time);
+		char added_str[32];
+		char device[M210_ARCHIVE_DEVICE_SIZE + 1];
+
+		memcpy(device, entry->device, M210_ARCHIVE_DEVICE_SIZE);
+		device[M210_ARCHIVE_DEVICE_SIZE] = '\0';
+		strftime(added_str, sizeof(added_str), "%Y-%m-%dT%H:%M:%S",
+			 localtime(&added));
+
+		printf("%zu %s %d 0x%02x %" PRIu32 " %08" PRIx32 " %s\n",
+		       i + 1, device[0] ? device : "-", entry->number,
+		       entry->state, le32toh(entry->bodyc),
+		       le32toh(entry->hash), added_str);
+	}
+
+	result = 0;
+out:
+	m210_archive_close(&archive);
+	return result;
+}
+
+static int archive_export(int argc, char **argv)
+{
+	int result = -1;
+	m210_archive archive = NULL;
+	char const *path = archive_default_path;
+	FILE *output_file = stdout;
+	size_t *ids = NULL;
+	size_t id_count = 0;
+	enum m210_err err;
+	const struct option opts[] = {
+		{"archive", required_argument, NULL, 'a'},
+		{"id", required_argument, NULL, 'n'},
+		{"output-file", required_argument, NULL, 'o'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+		long id;
+		size_t *new_ids;
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'a':
+			path = optarg;
+			break;
+		case 'n':
+			id = parse_note_count(optarg);
+			if (id == -1) {
+				fprintf(stderr, "error: invalid note id '%s'\n",
+					optarg);
+				print_help_hint();
+				goto out;
+			}
+			new_ids = realloc(ids, (id_count + 1) * sizeof(size_t));
+			if (new_ids == NULL) {
+				perror("error: failed to export notes");
+				goto out;
+			}
+			ids = new_ids;
+			ids[id_count++] = id - 1;
+			break;
+		case 'o':
+			if (output_file != stdout) {
+				fclose(output_file);
+			}
+			output_file = fopen(optarg, "wb");
+			if (output_file == NULL) {
+				perror("error: failed to open output file");
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected archive arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	err = m210_archive_open(&archive, path);
+	if (err) {
+		m210_err_perror(err, "error: failed to open archive");
+		goto out;
+	}
+
+	err = m210_archive_export(archive, ids, id_count, output_file);
+	if (err) {
+		m210_err_perror(err, "error: failed to export notes");
+		goto out;
+	}
+
+	result = 0;
+out:
+	m210_archive_close(&archive);
+	free(ids);
+	if (output_file && output_file != stdout && fclose(output_file)) {
+		perror("error: failed to close output file");
+		result = -1;
+	}
+	return result;
+}
+
+static int archive_cmd(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "error: archive command is missing\n");
+		print_help_hint();
+		return -1;
+	}
+
+	if (strcmp(argv[1], "add") == 0) {
+		return archive_add(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "list") == 0) {
+		return archive_list(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "export") == 0) {
+		return archive_export(argc - 1, argv + 1);
+	}
+
+	fprintf(stderr, "error: unknown archive command '%s'\n", argv[1]);
+	print_help_hint();
+	return -1;
+}
+
+static int serve_cmd(int argc, char **argv)
+{
+	int result = -1;
+	struct serve_options options;
+	long cache_size = 64;
+	const struct option opts[] = {
+		{"socket", required_argument, NULL, 's'},
+		{"threads", required_argument, NULL, 'j'},
+		{"cache-size", required_argument, NULL, 'c'},
+		{0, 0, 0, 0}
+	};
+
+	options.socket_path = NULL;
+	options.threads = 2;
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 's':
+			options.socket_path = optarg;
+			break;
+		case 'j':
+			options.threads = parse_note_count(optarg);
+			if (options.threads == -1) {
+				fprintf(stderr, "error: invalid thread count "
+					"'%s'\n", optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		case 'c':
+			cache_size = parse_note_count(optarg);
+			if (cache_size == -1 || cache_size > 65536) {
+				fprintf(stderr, "error: invalid cache size "
+					"'%s'\n", optarg);
+				print_help_hint();
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (options.socket_path == NULL) {
+		fprintf(stderr, "error: --socket is missing\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (optind == argc) {
+		fprintf(stderr, "error: dump files are missing\n");
+		print_help_hint();
+		goto out;
+	}
+
+	options.cache_size = (size_t) cache_size * 1024 * 1024;
+	result = serve(argv + optind, argc - optind, &options);
+out:
+	return result;
+}
+
+static int stats_cmd(int argc, char **argv)
+{
+	int result = -1;
+	int json = 0;
+	const struct option opts[] = {
+		{"json", no_argument, NULL, 'J'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'J':
+			json = 1;
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind == argc) {
+		char *input_buffer = NULL;
+		size_t input_size = 0;
+
+		if (load_input(stdin, NULL, 0, &input_buffer, &input_size)) {
+			goto out;
+		}
+		result = report_notes("-", input_buffer, input_size, json,
+				      stdout);
+		free(input_buffer);
+		goto out;
+	}
+
+	for (; optind < argc; ++optind) {
+		FILE *input_file;
+		char *input_buffer = NULL;
+		size_t input_size = 0;
+		int reported;
+
+		input_file = fopen(argv[optind], "rb");
+		if (input_file == NULL) {
+			fprintf(stderr, "error: failed to open %s: %s\n",
+				argv[optind], strerror(errno));
+			goto out;
+		}
+		if (load_input(input_file, NULL, 0, &input_buffer,
+			       &input_size)) {
+			fclose(input_file);
+			goto out;
+		}
+		fclose(input_file);
+
+		reported = report_notes(argv[optind], input_buffer, input_size,
+					json, stdout);
+		free(input_buffer);
+		if (reported) {
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	return result;
+}
+
+static int preview_cmd(int argc, char **argv)
 {
 	int result = -1;
-	FILE *input_file = NULL;
-	char *output_mode = "wx";
+	FILE *input_file = stdin;
+	FILE *loaded_file = NULL;
+	char *input_buffer = NULL;
+	size_t input_size = 0;
+	struct preview_options options;
 	const struct option opts[] = {
 		{"input-file", required_argument, NULL, 'i'},
-		{"output-dir", required_argument, NULL, 'd'},
-		{"overwrite", no_argument, NULL, 'f'},
+		{"note", required_argument, NULL, 'n'},
+		{"sixel", no_argument, NULL, 'x'},
 		{0, 0, 0, 0}
 	};
 
-	input_file = stdin;
+	options.note_number = 0;
+	options.sixel = 0;
 
 	while (1) {
 		int option = getopt_long(argc, argv, "+", opts, NULL);
+		long number;
 
 		if (option == -1) {
 			break;
@@ -206,21 +1497,27 @@ static int convert_cmd(int argc, char **argv)
 
 		switch (option) {
 		case 'i':
+			if (input_file != stdin) {
+				fclose(input_file);
+			}
 			input_file = fopen(optarg, "rb");
 			if (input_file == NULL) {
 				perror("error: failed to open input file");
 				goto out;
 			}
 			break;
-		case 'd':
-			if (chdir(optarg)) {
-				perror("error: failed to change the current "
-				       "working directory");
+		case 'n':
+			number = parse_note_count(optarg);
+			if (number == -1 || number > UINT8_MAX) {
+				fprintf(stderr, "error: invalid note number "
+					"'%s'\n", optarg);
+				print_help_hint();
 				goto out;
 			}
+			options.note_number = number;
 			break;
-		case 'f':
-			output_mode = "w";
+		case 'x':
+			options.sixel = 1;
 			break;
 		default:
 			print_help_hint();
@@ -229,21 +1526,26 @@ static int convert_cmd(int argc, char **argv)
 	}
 
 	if (optind != argc) {
-		fprintf(stderr, "error: unexpected convert arguments\n");
+		fprintf(stderr, "error: unexpected preview arguments\n");
 		print_help_hint();
 		goto out;
 	}
 
-	while (1) {
-		result = note_to_svg(input_file, output_mode);
-		if (result == -1) {
-			goto out;
-		} else if (result == 0) {
-			break;
-		}
+	if (load_input(input_file, NULL, 0, &input_buffer, &input_size)) {
+		goto out;
+	}
+	loaded_file = fmemopen(input_buffer, input_size, "rb");
+	if (loaded_file == NULL) {
+		perror("error: failed to open input");
+		goto out;
 	}
 
+	result = preview_notes(loaded_file, &options, stdout);
 out:
+	if (loaded_file) {
+		fclose(loaded_file);
+	}
+	free(input_buffer);
 	if (input_file && input_file != stdin && fclose(input_file)) {
 		perror("failed to close input file");
 		result = -1;
@@ -254,7 +1556,7 @@ out:
 static int delete_cmd(int argc, char **argv)
 {
 	int result = -1;
-	m210_dev dev;
+	m210_dev dev = NULL;
 	enum m210_err err;
 	const struct option opts[] = {
 		{0, 0, 0, 0}
@@ -280,7 +1582,7 @@ static int delete_cmd(int argc, char **argv)
 		goto out;
 	}
 
-	err = m210_dev_connect(&dev);
+	err = connect_dev(&dev);
 	if (err) {
 		m210_err_perror(err, "failed to open device");
 		goto out;
@@ -303,14 +1605,107 @@ out:
 	return result;
 }
 
+/*
+  Make sure the dump in OUTPUT_FILE is on the disk and that reading it
+  back gives the same checksum as was computed while downloading.
+*/
+static int sync_output(FILE *const output_file, char const *const path,
+		       m210_sum const sum)
+{
+	int result = -1;
+	FILE *stored_file = NULL;
+	FILE *file = NULL;
+	m210_sum file_sum = NULL;
+	enum m210_err err;
+
+	if (fflush(output_file) || fsync(fileno(output_file))) {
+		perror("error: failed to sync output file");
+		goto out;
+	}
+
+	stored_file = fopen(path, "rb");
+	if (stored_file == NULL) {
+		perror("error: failed to open output file for verification");
+		goto out;
+	}
+
+	/* Compressed output is verified by decompressing it. */
+	err = m210_compress_open_reader(&file, stored_file);
+	if (err) {
+		m210_err_perror(err, "error: failed to read output file");
+		goto out;
+	}
+
+	err = m210_sum_new(&file_sum);
+	if (err) {
+		m210_err_perror(err, "error: failed to compute checksums");
+		goto out;
+	}
+
+	while (1) {
+		char buffer[65536];
+		size_t const size = fread(buffer, 1, sizeof(buffer), file);
+
+		m210_sum_update(file_sum, buffer, size);
+		if (size < sizeof(buffer)) {
+			if (ferror(file)) {
+				perror("error: failed to read output file");
+				goto out;
+			}
+			break;
+		}
+	}
+
+	err = m210_sum_compare(sum, file_sum);
+	if (err) {
+		m210_err_perror(err, "error: failed to verify output file");
+		goto out;
+	}
+
+	result = 0;
+out:
+	m210_sum_free(&file_sum);
+	if (file) {
+		fclose(file);
+	}
+	if (stored_file) {
+		fclose(stored_file);
+	}
+	return result;
+}
+
 static int dump_cmd(int argc, char **argv)
 {
 	int result = -1;
-	m210_dev dev;
+	m210_dev dev = NULL;
 	FILE *output_file = NULL;
+	FILE *compress_file = NULL;
+	FILE *tee_file = NULL;
+	FILE *dump_file = NULL;
+	FILE *ndjson_file = NULL;
+	char const *output_path = NULL;
+	char const *svg_dir = NULL;
+	int compress = 0;
+	int delete_after = 0;
+	FILE *checkpoint_file = NULL;
+	char const *checkpoint_path = NULL;
+	FILE *sum_file = NULL;
+	m210_sum sum = NULL;
+	long last_count = 0;
+	uint8_t numbers[UINT8_MAX];
+	size_t number_count = 0;
 	enum m210_err err;
 	const struct option opts[] = {
 		{"output-file", required_argument, NULL, 'o'},
+		{"raw", required_argument, NULL, 'o'},
+		{"svg-dir", required_argument, NULL, 'S'},
+		{"ndjson", required_argument, NULL, 'J'},
+		{"checkpoint", required_argument, NULL, 'c'},
+		{"last", required_argument, NULL, 'l'},
+		{"note", required_argument, NULL, 'n'},
+		{"checksum-file", required_argument, NULL, 's'},
+		{"delete-after", no_argument, NULL, 'D'},
+		{"compress", no_argument, NULL, 'z'},
 		{0, 0, 0, 0}
 	};
 
@@ -330,6 +1725,55 @@ static int dump_cmd(int argc, char **argv)
 				perror("error: failed to open output file");
 				goto out;
 			}
+			output_path = optarg;
+			break;
+		case 'D':
+			delete_after = 1;
+			break;
+		case 'z':
+			compress = 1;
+			break;
+		case 'S':
+			svg_dir = optarg;
+			break;
+		case 'J':
+			ndjson_file = fopen(optarg, "w");
+			if (ndjson_file == NULL) {
+				perror("error: failed to open NDJSON file");
+				goto out;
+			}
+			break;
+		case 'c':
+			checkpoint_path = optarg;
+			break;
+		case 'l':
+			last_count = parse_note_count(optarg);
+			if (last_count <= 0) {
+				fprintf(stderr, "error: invalid note count\n");
+				goto out;
+			}
+			break;
+		case 'n': {
+			long const number = parse_note_count(optarg);
+			if (number <= 0 || number > UINT8_MAX) {
+				fprintf(stderr, "error: invalid note number\n");
+				goto out;
+			}
+			if (number_count == sizeof(numbers)) {
+				fprintf(stderr, "error: too many note numbers, "
+					"at most %zu can be given\n",
+					sizeof(numbers));
+				goto out;
+			}
+			numbers[number_count++] = number;
+			break;
+		}
+		case 's':
+			sum_file = fopen(optarg, "w");
+			if (sum_file == NULL) {
+				perror("error: failed to open checksum file");
+				goto out;
+			}
 			break;
 		default:
 			print_help_hint();
@@ -343,20 +1787,165 @@ static int dump_cmd(int argc, char **argv)
 		goto out;
 	}
 
-	err = m210_dev_connect(&dev);
+	if ((last_count && number_count)
+	    || (checkpoint_path && (last_count || number_count))) {
+		fprintf(stderr, "error: --last, --note and --checkpoint "
+			"are mutually exclusive\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (delete_after && (last_count || number_count)) {
+		fprintf(stderr, "error: --delete-after cannot be used with "
+			"--last or --note\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (delete_after && !output_path) {
+		fprintf(stderr, "error: --delete-after requires "
+			"--output-file\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (compress && !output_path && (svg_dir || ndjson_file)) {
+		fprintf(stderr, "error: --compress requires --raw with "
+			"--svg-dir or --ndjson\n");
+		print_help_hint();
+		goto out;
+	}
+
+	if (checkpoint_path) {
+		int const fd = open(checkpoint_path, O_RDWR | O_CREAT, 0644);
+		if (fd == -1 || !(checkpoint_file = fdopen(fd, "r+b"))) {
+			perror("error: failed to open checkpoint file");
+			if (fd != -1) {
+				close(fd);
+			}
+			goto out;
+		}
+	}
+
+	dump_file = output_file;
+	if (compress) {
+		err = m210_compress_open_writer(&compress_file, output_file);
+		if (err) {
+			m210_err_perror(err, "failed to compress notes");
+			goto out;
+		}
+		dump_file = compress_file;
+	}
+
+	/* Other outputs are written on their own threads while the
+	 * notes are downloaded, the raw notes only if asked for. */
+	if (svg_dir || ndjson_file) {
+		struct tee_options tee_options;
+
+		tee_options.raw_file = output_path ? dump_file : NULL;
+		tee_options.svg_dir = svg_dir;
+		tee_options.ndjson_file = ndjson_file;
+		tee_file = tee_open(&tee_options);
+		if (tee_file == NULL) {
+			perror("error: failed to start writers");
+			goto out;
+		}
+		dump_file = tee_file;
+	}
+
+	err = connect_dev(&dev);
 	if (err) {
 		m210_err_perror(err, "failed to open device");
 		goto out;
 	}
 
-	err = m210_dev_download_notes(dev, output_file);
+	if (sum_file || delete_after) {
+		err = m210_sum_new(&sum);
+		if (err) {
+			m210_err_perror(err, "failed to compute checksums");
+			goto out;
+		}
+		m210_dev_set_sum(dev, sum);
+	}
+
+	if (last_count) {
+		err = m210_dev_download_last_notes(dev, dump_file,
+						   last_count);
+	} else if (number_count) {
+		err = m210_dev_download_numbered_notes(dev, dump_file,
+						       numbers, number_count);
+	} else {
+		err = m210_dev_download_notes_checkpointed(dev, dump_file,
+							   checkpoint_file);
+	}
 	if (err) {
 		m210_err_perror(err, "failed to download notes");
 		goto out;
 	}
 
+	if (tee_file) {
+		int const failed = fclose(tee_file);
+		tee_file = NULL;
+		if (failed) {
+			fprintf(stderr, "error: failed to write all outputs\n");
+			goto out;
+		}
+	}
+
+	/* Finish the compressed stream before it is verified. */
+	if (compress_file) {
+		int const failed = fclose(compress_file);
+		compress_file = NULL;
+		if (failed) {
+			perror("error: failed to compress notes");
+			goto out;
+		}
+	}
+
+	if (checkpoint_path && unlink(checkpoint_path)) {
+		perror("error: failed to remove checkpoint file");
+		goto out;
+	}
+
+	if (sum_file) {
+		err = m210_sum_write(sum, sum_file);
+		if (err) {
+			m210_err_perror(err, "failed to write checksums");
+			goto out;
+		}
+	}
+
+	if (delete_after) {
+		if (sync_output(output_file, output_path, sum)) {
+			fprintf(stderr, "error: notes were not deleted\n");
+			goto out;
+		}
+
+		if (sum_file && fsync(fileno(sum_file))) {
+			perror("error: failed to sync checksum file");
+			fprintf(stderr, "error: notes were not deleted\n");
+			goto out;
+		}
+
+		err = m210_dev_erase_notes(dev);
+		if (err) {
+			m210_err_perror(err, "failed to delete notes");
+			goto out;
+		}
+	}
+
 	result = 0;
 out:
+	m210_sum_free(&sum);
+	if (sum_file && fclose(sum_file)) {
+		perror("failed to close checksum file");
+		result = -1;
+	}
+	if (checkpoint_file && fclose(checkpoint_file)) {
+		perror("failed to close checkpoint file");
+		result = -1;
+	}
+
 	if (dev) {
 		err = m210_dev_disconnect(&dev);
 		if (err) {
@@ -365,6 +1954,18 @@ out:
 		}
 	}
 
+	if (tee_file && fclose(tee_file)) {
+		fprintf(stderr, "error: failed to write all outputs\n");
+		result = -1;
+	}
+	if (ndjson_file && fclose(ndjson_file)) {
+		perror("failed to close NDJSON file");
+		result = -1;
+	}
+	if (compress_file && fclose(compress_file)) {
+		perror("failed to compress notes");
+		result = -1;
+	}
 	if (output_file && output_file != stdout && fclose(output_file)) {
 		perror("failed to close output file");
 		result = -1;
@@ -372,10 +1973,158 @@ out:
 	return result;
 }
 
+static volatile sig_atomic_t stream_stopping = 0;
+
+static void stop_stream(int const signum)
+{
+	(void) signum;
+	stream_stopping = 1;
+}
+
+static int write_stream_event(struct m210_stream_event const *const eventp,
+			      int const binary)
+{
+	if (binary) {
+		/* 13 bytes, little-endian: time (8), x (2), y (2),
+		 * flags (1). */
+		uint8_t record[13];
+		uint64_t const time = htole64(eventp->time);
+		uint16_t const x = htole16(eventp->pen.x);
+		uint16_t const y = htole16(eventp->pen.y);
+
+		memcpy(record, &time, 8);
+		memcpy(record + 8, &x, 2);
+		memcpy(record + 10, &y, 2);
+		record[12] = (eventp->pen.in_range
+			      | eventp->pen.tip << 1
+			      | eventp->pen.button << 2);
+		return fwrite(record, sizeof(record), 1, stdout) == 1 ? 0 : -1;
+	}
+
+	return printf("{\"time\":%" PRIu64 ",\"x\":%d,\"y\":%d,"
+		      "\"in_range\":%d,\"tip\":%d,\"button\":%d}\n",
+		      eventp->time, eventp->pen.x, eventp->pen.y,
+		      eventp->pen.in_range, eventp->pen.tip,
+		      eventp->pen.button) < 0 ? -1 : 0;
+}
+
+static int stream_cmd(int argc, char **argv)
+{
+	int result = -1;
+	m210_dev dev = NULL;
+	m210_stream stream = NULL;
+	enum m210_err err;
+	int binary = 0;
+	struct sigaction action;
+	const struct option opts[] = {
+		{"format", required_argument, NULL, 'f'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		int option = getopt_long(argc, argv, "+", opts, NULL);
+
+		if (option == -1) {
+			break;
+		}
+
+		switch (option) {
+		case 'f':
+			if (strcmp(optarg, "ndjson") == 0) {
+				binary = 0;
+			} else if (strcmp(optarg, "binary") == 0) {
+				binary = 1;
+			} else {
+				fprintf(stderr, "error: unknown format '%s'\n",
+					optarg);
+				goto out;
+			}
+			break;
+		default:
+			print_help_hint();
+			goto out;
+		}
+	}
+
+	if (optind != argc) {
+		fprintf(stderr, "error: unexpected stream arguments\n");
+		print_help_hint();
+		goto out;
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_stream;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	err = connect_dev(&dev);
+	if (err) {
+		m210_err_perror(err, "failed to open device");
+		goto out;
+	}
+
+	err = m210_stream_start(&stream, dev);
+	if (err) {
+		m210_err_perror(err, "failed to start streaming");
+		goto out;
+	}
+
+	while (!stream_stopping) {
+		struct m210_stream_event events[256];
+		size_t count;
+
+		err = m210_stream_read(stream, events,
+				       sizeof(events) / sizeof(events[0]),
+				       &count, 100);
+		if (err == M210_ERR_DEV_TIMEOUT) {
+			continue;
+		}
+		if (err == M210_ERR_SYS && errno == EINTR) {
+			continue;
+		}
+		if (err) {
+			m210_err_perror(err, "failed to read pen events");
+			goto out;
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			if (write_stream_event(&events[i], binary)) {
+				perror("error: failed to write pen events");
+				goto out;
+			}
+		}
+
+		/* Deliver the batch right away. */
+		if (fflush(stdout)) {
+			perror("error: failed to write pen events");
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	if (stream) {
+		uint64_t const dropped = m210_stream_dropped(stream);
+		if (dropped) {
+			fprintf(stderr, "warning: %" PRIu64 " pen events dropped\n",
+				dropped);
+		}
+		m210_stream_stop(&stream);
+	}
+	if (dev) {
+		err = m210_dev_disconnect(&dev);
+		if (err) {
+			m210_err_perror(err, "error: failed to disconnect");
+			result = -1;
+		}
+	}
+	return result;
+}
+
 static int info_cmd(int argc, char **argv)
 {
 	int result = -1;
-	m210_dev dev;
+	m210_dev dev = NULL;
 	enum m210_err err;
 	struct m210_dev_info info;
 	const char *device_mode;
@@ -403,7 +2152,7 @@ static int info_cmd(int argc, char **argv)
 		goto out;
 	}
 
-	err = m210_dev_connect(&dev);
+	err = connect_dev(&dev);
 	if (err) {
 		m210_err_perror(err, "failed to open device");
 		goto out;
@@ -453,8 +2202,12 @@ int main(int argc, char **argv)
 	const char *cmd;
 	int (*cmdfn)(int, char**);
 	const struct option opts[] = {
-		{"help",    no_argument, NULL, 'h'},
-		{"version", no_argument, NULL, 'v'},
+		{"help",     no_argument,       NULL, 'h'},
+		{"version",  no_argument,       NULL, 'v'},
+		{"capture",  required_argument, NULL, 'c'},
+		{"replay",   required_argument, NULL, 'r'},
+		{"realtime", no_argument,       NULL, 't'},
+		{"trace",    required_argument, NULL, 'T'},
 		{0, 0, 0, 0}
 	};
 
@@ -472,6 +2225,30 @@ int main(int argc, char **argv)
 			print_version();
 			exitval = EXIT_SUCCESS;
 			goto out;
+		case 'c':
+			capture_file = fopen(optarg, "wb");
+			if (capture_file == NULL) {
+				perror("error: failed to open capture file");
+				goto out;
+			}
+			break;
+		case 'r':
+			replay_file = fopen(optarg, "rb");
+			if (replay_file == NULL) {
+				perror("error: failed to open replay file");
+				goto out;
+			}
+			break;
+		case 't':
+			replay_realtime = 1;
+			break;
+		case 'T':
+			trace_file = fopen(optarg, "w");
+			if (trace_file == NULL) {
+				perror("error: failed to open trace file");
+				goto out;
+			}
+			break;
 		default:
 			print_help_hint();
 			goto out;
@@ -498,18 +2275,62 @@ int main(int argc, char **argv)
 		cmdfn = &convert_cmd;
 	} else if (strcmp(cmd, "delete") == 0) {
 		cmdfn = &delete_cmd;
+	} else if (strcmp(cmd, "stream") == 0) {
+		cmdfn = &stream_cmd;
+	} else if (strcmp(cmd, "export") == 0) {
+		cmdfn = &export_cmd;
+	} else if (strcmp(cmd, "pack") == 0) {
+		cmdfn = &pack_cmd;
+	} else if (strcmp(cmd, "unpack") == 0) {
+		cmdfn = &unpack_cmd;
+	} else if (strcmp(cmd, "serve") == 0) {
+		cmdfn = &serve_cmd;
+	} else if (strcmp(cmd, "archive") == 0) {
+		cmdfn = &archive_cmd;
+	} else if (strcmp(cmd, "stats") == 0) {
+		cmdfn = &stats_cmd;
+	} else if (strcmp(cmd, "preview") == 0) {
+		cmdfn = &preview_cmd;
 	} else {
 		fprintf(stderr, "error: unknown command '%s'\n", cmd);
 		print_help_hint();
 		goto out;
 	}
 
+	if (trace_file) {
+		enum m210_err err = m210_trace_open(trace_file);
+		if (err) {
+			m210_err_perror(err, "error: failed to start trace");
+			goto out;
+		}
+	}
+
+	M210_TRACE_BEGIN(cmd);
 	if (cmdfn(cmd_argc, cmd_argv) == -1) {
+		M210_TRACE_END(cmd);
 		fprintf(stderr, "error: %s failed\n", cmd);
 		goto out;
 	}
+	M210_TRACE_END(cmd);
 
 	exitval = EXIT_SUCCESS;
 out:
+	if (capture_file && fclose(capture_file)) {
+		perror("error: failed to close capture file");
+		exitval = EXIT_FAILURE;
+	}
+	if (replay_file) {
+		fclose(replay_file);
+	}
+	if (trace_file) {
+		if (m210_trace_close()) {
+			perror("error: failed to write trace file");
+			exitval = EXIT_FAILURE;
+		}
+		if (fclose(trace_file)) {
+			perror("error: failed to close trace file");
+			exitval = EXIT_FAILURE;
+		}
+	}
 	return exitval;
 }
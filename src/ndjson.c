@@ -0,0 +1,264 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libm210/note.h"
+#include "libm210/rawnote.h"
+#include "libm210/trace.h"
+
+#include "ndjson.h"
+
+/*
+  Output is formatted to a fixed buffer, which is written out as a
+  batch when full, so memory use does not depend on the size of the
+  notes.
+*/
+#define NDJSON_BATCH_SIZE 65536
+
+/* Longest output of a single ndjson_put_*() call. */
+#define NDJSON_MAX_ITEM_SIZE 64
+
+struct ndjson_writer {
+	FILE *file;
+	size_t used;
+	int failed;
+	char buffer[NDJSON_BATCH_SIZE];
+};
+
+static void ndjson_flush(struct ndjson_writer *const writer)
+{
+	if (writer->used && !writer->failed
+	    && (fwrite(writer->buffer, writer->used, 1, writer->file) != 1
+		|| fflush(writer->file))) {
+		writer->failed = 1;
+	}
+	writer->used = 0;
+}
+
+static inline char *ndjson_reserve(struct ndjson_writer *const writer)
+{
+	if (NDJSON_BATCH_SIZE - writer->used < NDJSON_MAX_ITEM_SIZE) {
+		ndjson_flush(writer);
+	}
+	return writer->buffer + writer->used;
+}
+
+static inline void ndjson_put_str(struct ndjson_writer *const writer,
+				  char const *const str, size_t const len)
+{
+	memcpy(ndjson_reserve(writer), str, len);
+	writer->used += len;
+}
+
+#define NDJSON_PUT_LITERAL(writer, literal)			\
+	ndjson_put_str((writer), (literal), sizeof(literal) - 1)
+
+/* Write VALUE in decimal, followed by SUFFIX. */
+static inline void ndjson_put_int(struct ndjson_writer *const writer,
+				  long const value, char const suffix)
+{
+	char *const dst = ndjson_reserve(writer);
+	char digits[24];
+	unsigned long magnitude = (value < 0 ? 0UL - (unsigned long) value
+				   : (unsigned long) value);
+	size_t count = 0;
+	size_t len = 0;
+
+	do {
+		digits[count++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude);
+
+	if (value < 0) {
+		dst[len++] = '-';
+	}
+	while (count) {
+		dst[len++] = digits[--count];
+	}
+	dst[len++] = suffix;
+	writer->used += len;
+}
+
+static inline void ndjson_put_point(struct ndjson_writer *const writer,
+				    struct m210_note_body const *const body)
+{
+	NDJSON_PUT_LITERAL(writer, "[");
+	ndjson_put_int(writer, body->x, ',');
+	ndjson_put_int(writer, body->y, ']');
+}
+
+char const *ndjson_state_name(int const state)
+{
+	switch (state) {
+	case M210_RAWNOTE_STATE_EMPTY:
+		return "empty";
+	case M210_RAWNOTE_STATE_UNFINISHED:
+		return "unfinished";
+	case M210_RAWNOTE_STATE_FINISHED_BY_USER:
+		return "finished_by_user";
+	case M210_RAWNOTE_STATE_FINISHED_BY_SOFTWARE:
+		return "finished_by_software";
+	default:
+		return "unknown";
+	}
+}
+
+static void ndjson_put_note(struct ndjson_writer *const writer,
+			    struct m210_note_head const *const head)
+{
+	char const *const state = ndjson_state_name(head->state);
+
+	NDJSON_PUT_LITERAL(writer, "{\"note\":");
+	ndjson_put_int(writer, head->number, ',');
+	NDJSON_PUT_LITERAL(writer, "\"state\":\"");
+	ndjson_put_str(writer, state, strlen(state));
+	NDJSON_PUT_LITERAL(writer, "\",");
+}
+
+static void ndjson_close_stroke(struct ndjson_writer *const writer,
+				int const per_stroke)
+{
+	if (per_stroke) {
+		NDJSON_PUT_LITERAL(writer, "]}\n");
+	} else {
+		NDJSON_PUT_LITERAL(writer, "]");
+	}
+}
+
+/*
+  Write the records of a note. A stroke is opened at the first
+  pen-down body after a pen-up and closed at the next pen-up or at the
+  end of the note.
+*/
+static enum m210_err ndjson_put_bodies(struct ndjson_writer *const writer,
+				       struct m210_note_head const *const head,
+				       int const per_stroke,
+				       FILE *const input_file)
+{
+	enum m210_err err = M210_ERR_OK;
+	size_t left = head->bodyc;
+	long stroke_count = 0;
+	int open = 0;
+
+	if (!per_stroke) {
+		ndjson_put_note(writer, head);
+		NDJSON_PUT_LITERAL(writer, "\"strokes\":[");
+	}
+
+	while (left) {
+		struct m210_note_body bodies[1024];
+		size_t const count = left < 1024 ? left : 1024;
+		size_t i;
+
+		err = m210_note_read_bodies(bodies, count, input_file);
+		if (err) {
+			goto out;
+		}
+
+		for (i = 0; i < count; ++i) {
+			if (!bodies[i].pressure) {
+				if (open) {
+					ndjson_close_stroke(writer, per_stroke);
+					open = 0;
+				}
+				continue;
+			}
+			if (open) {
+				NDJSON_PUT_LITERAL(writer, ",");
+			} else if (per_stroke) {
+				ndjson_put_note(writer, head);
+				NDJSON_PUT_LITERAL(writer, "\"stroke\":");
+				ndjson_put_int(writer, stroke_count++, ',');
+				NDJSON_PUT_LITERAL(writer, "\"points\":[");
+				open = 1;
+			} else {
+				if (stroke_count++) {
+					NDJSON_PUT_LITERAL(writer, ",");
+				}
+				NDJSON_PUT_LITERAL(writer, "[");
+				open = 1;
+			}
+			ndjson_put_point(writer, &bodies[i]);
+		}
+		left -= count;
+	}
+
+	if (open) {
+		ndjson_close_stroke(writer, per_stroke);
+	}
+	if (!per_stroke) {
+		NDJSON_PUT_LITERAL(writer, "]}\n");
+	}
+out:
+	return err;
+}
+
+int notes_to_ndjson(FILE *const input_file, int const per_stroke,
+		    FILE *const output_file)
+{
+	int result = -1;
+	struct ndjson_writer *writer = NULL;
+	enum m210_err err;
+
+	writer = malloc(sizeof(struct ndjson_writer));
+	if (writer == NULL) {
+		perror("error: failed to convert notes");
+		goto out;
+	}
+	writer->file = output_file;
+	writer->used = 0;
+	writer->failed = 0;
+
+	while (1) {
+		struct m210_note_head head;
+
+		err = m210_note_read_head(&head, input_file);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note head");
+			goto out;
+		}
+		if (head.number == 0) {
+			break;
+		}
+
+		M210_TRACE_BEGIN_ARG("convert note", "number", head.number);
+		err = ndjson_put_bodies(writer, &head, per_stroke, input_file);
+		M210_TRACE_END("convert note");
+		if (err) {
+			m210_err_perror(err, "error: failed to read note body");
+			goto out;
+		}
+		if (writer->failed) {
+			break;
+		}
+	}
+
+	result = 0;
+out:
+	if (writer) {
+		ndjson_flush(writer);
+		if (writer->failed) {
+			perror("error: failed to write to output file");
+			result = -1;
+		}
+	}
+	free(writer);
+	return result;
+}
@@ -0,0 +1,41 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NDJSON_H
+#define NDJSON_H
+
+#include <stdio.h>
+
+/*
+  Write the notes of the raw note stream INPUT_FILE to OUTPUT_FILE as
+  newline delimited JSON, one record per note:
+
+    {"note":1,"state":"finished_by_user","strokes":[[[x,y],...],...]}
+
+  or, if PER_STROKE is set, one record per stroke:
+
+    {"note":1,"state":"finished_by_user","stroke":0,"points":[[x,y],...]}
+
+  Return 0 on success and -1 on error, which has already been
+  reported.
+*/
+int notes_to_ndjson(FILE *input_file, int per_stroke, FILE *output_file);
+
+/* Name of the note state STATE, one of M210_RAWNOTE_STATE_*. */
+char const *ndjson_state_name(int state);
+
+#endif /* NDJSON_H */
@@ -0,0 +1,376 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libm210/note.h"
+
+#include "png.h"
+
+/*
+  A minimal PNG encoder: 8-bit grayscale, no filtering and a zlib
+  stream of one deflate block with the fixed Huffman codes. Pixels are
+  only compressed as runs, matches at distance 1, which is enough for
+  the white pages with thin strokes of thumbnails.
+*/
+
+#define PNG_MAX_MATCH 258
+
+/* The page, in device units. */
+static const int png_page_min_x = -7000;
+static const int png_page_width = 14000;
+static const int png_page_height = 20000;
+
+static uint32_t png_crc_table[256];
+
+static void png_init_crc_table(void)
+{
+	uint32_t n;
+
+	for (n = 0; n < 256; ++n) {
+		uint32_t c = n;
+		int k;
+
+		for (k = 0; k < 8; ++k) {
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		}
+		png_crc_table[n] = c;
+	}
+}
+
+/* CRC-32 of PNG chunks, which is not CRC-32C of libm210. */
+static uint32_t png_crc(uint32_t crc, uint8_t const *data, size_t size)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, png_init_crc_table);
+
+	crc = ~crc;
+	while (size--) {
+		crc = png_crc_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static uint32_t png_adler32(uint8_t const *data, size_t size)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+
+	while (size) {
+		/* 5552 is the most bytes that cannot overflow B. */
+		size_t n = size < 5552 ? size : 5552;
+
+		size -= n;
+		while (n--) {
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return b << 16 | a;
+}
+
+struct png_bits {
+	uint8_t *data;
+	size_t size;
+	uint32_t acc;
+	int count;
+};
+
+/* Append the COUNT low bits of VALUE, least significant first. */
+static void png_put_bits(struct png_bits *const bits, uint32_t const value,
+			 int const count)
+{
+	bits->acc |= value << bits->count;
+	bits->count += count;
+	while (bits->count >= 8) {
+		bits->data[bits->size++] = bits->acc & 0xff;
+		bits->acc >>= 8;
+		bits->count -= 8;
+	}
+}
+
+/* Append the Huffman CODE of LEN bits, most significant first. */
+static void png_put_code(struct png_bits *const bits, uint32_t const code,
+			 int const len)
+{
+	uint32_t reversed = 0;
+	int i;
+
+	for (i = 0; i < len; ++i) {
+		reversed |= (code >> i & 1) << (len - 1 - i);
+	}
+	png_put_bits(bits, reversed, len);
+}
+
+/* Append the fixed Huffman code of literal or length SYMBOL. */
+static void png_put_symbol(struct png_bits *const bits, int const symbol)
+{
+	if (symbol < 144) {
+		png_put_code(bits, 0x30 + symbol, 8);
+	} else if (symbol < 256) {
+		png_put_code(bits, 0x190 + symbol - 144, 9);
+	} else if (symbol < 280) {
+		png_put_code(bits, symbol - 256, 7);
+	} else {
+		png_put_code(bits, 0xc0 + symbol - 280, 8);
+	}
+}
+
+/* Append a match of LEN bytes at distance 1. */
+static void png_put_match(struct png_bits *const bits, int const len)
+{
+	static uint16_t const bases[29] = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+	};
+	static uint8_t const extra_bits[29] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+	};
+	int code = 28;
+
+	while (bases[code] > len) {
+		--code;
+	}
+	png_put_symbol(bits, 257 + code);
+	png_put_bits(bits, len - bases[code], extra_bits[code]);
+	png_put_code(bits, 0, 5); /* Distance 1. */
+}
+
+/*
+  Deflate RAW_SIZE bytes of RAW to DATA as one fixed Huffman block and
+  return the size of the block. DATA must have room for 9 bits per
+  byte, the longest code of a literal, and 3 bytes more.
+*/
+static size_t png_deflate(uint8_t *const data, uint8_t const *const raw,
+			  size_t const raw_size)
+{
+	struct png_bits bits = {data, 0, 0, 0};
+	size_t pos = 0;
+
+	png_put_bits(&bits, 1, 1); /* BFINAL. */
+	png_put_bits(&bits, 1, 2); /* BTYPE, fixed Huffman codes. */
+
+	while (pos < raw_size) {
+		size_t len = 0;
+
+		if (pos) {
+			while (pos + len < raw_size && len < PNG_MAX_MATCH
+			       && raw[pos + len] == raw[pos - 1]) {
+				++len;
+			}
+		}
+		if (len >= 3) {
+			png_put_match(&bits, len);
+			pos += len;
+		} else {
+			png_put_symbol(&bits, raw[pos++]);
+		}
+	}
+	png_put_symbol(&bits, 256); /* End of block. */
+	if (bits.count) {
+		png_put_bits(&bits, 0, 8 - bits.count);
+	}
+	return bits.size;
+}
+
+static void png_put_u32(uint8_t *const dst, uint32_t const value)
+{
+	uint32_t const value_be = htobe32(value);
+
+	memcpy(dst, &value_be, 4);
+}
+
+static int png_write_chunk(FILE *const file, char const type[4],
+			   uint8_t const *const data, size_t const size)
+{
+	uint8_t head[8];
+	uint8_t tail[4];
+	uint32_t crc;
+
+	png_put_u32(head, size);
+	memcpy(head + 4, type, 4);
+	crc = png_crc(0, head + 4, 4);
+	crc = png_crc(crc, data, size);
+	png_put_u32(tail, crc);
+
+	if (fwrite(head, sizeof(head), 1, file) != 1
+	    || (size && fwrite(data, size, 1, file) != 1)
+	    || fwrite(tail, sizeof(tail), 1, file) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Write the grayscale image of SIZE x SIZE PIXELS, a row per SIZE. */
+static int png_write(FILE *const file, uint8_t const *const pixels,
+		     int const size)
+{
+	int result = -1;
+	static uint8_t const signature[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+	};
+	uint8_t ihdr[13];
+	size_t const raw_size = (size_t) size * (size + 1);
+	uint8_t *raw = NULL;
+	uint8_t *idat = NULL;
+	size_t idat_size;
+	int row;
+
+	/* Each row starts with filter type 0, none. */
+	raw = malloc(raw_size);
+	idat = malloc(2 + raw_size / 8 * 9 + 16 + 4);
+	if (raw == NULL || idat == NULL) {
+		goto out;
+	}
+	for (row = 0; row < size; ++row) {
+		raw[row * (size + 1)] = 0;
+		memcpy(raw + row * (size + 1) + 1, pixels + row * size, size);
+	}
+
+	idat[0] = 0x78; /* Deflate, 32K window. */
+	idat[1] = 0x01; /* No preset dictionary, check bits. */
+	idat_size = 2 + png_deflate(idat + 2, raw, raw_size);
+	png_put_u32(idat + idat_size, png_adler32(raw, raw_size));
+	idat_size += 4;
+
+	png_put_u32(ihdr, size);
+	png_put_u32(ihdr + 4, size);
+	ihdr[8] = 8; /* Bit depth. */
+	ihdr[9] = 0; /* Grayscale. */
+	ihdr[10] = 0; /* Deflate. */
+	ihdr[11] = 0; /* Adaptive filtering. */
+	ihdr[12] = 0; /* No interlace. */
+
+	if (fwrite(signature, sizeof(signature), 1, file) != 1
+	    || png_write_chunk(file, "IHDR", ihdr, sizeof(ihdr))
+	    || png_write_chunk(file, "IDAT", idat, idat_size)
+	    || png_write_chunk(file, "IEND", NULL, 0)) {
+		goto out;
+	}
+
+	result = 0;
+out:
+	free(idat);
+	free(raw);
+	return result;
+}
+
+/* Draw a black line from X0,Y0 to X1,Y1 with Bresenham's algorithm. */
+static void png_draw_line(uint8_t *const pixels, int const size,
+			  int x0, int y0, int const x1, int const y1)
+{
+	int const dx = abs(x1 - x0);
+	int const dy = -abs(y1 - y0);
+	int const sx = x0 < x1 ? 1 : -1;
+	int const sy = y0 < y1 ? 1 : -1;
+	int error = dx + dy;
+
+	while (1) {
+		int const error2 = 2 * error;
+
+		if (x0 >= 0 && x0 < size && y0 >= 0 && y0 < size) {
+			pixels[y0 * size + x0] = 0;
+		}
+		if (x0 == x1 && y0 == y1) {
+			break;
+		}
+		if (error2 >= dy) {
+			error += dy;
+			x0 += sx;
+		}
+		if (error2 <= dx) {
+			error += dx;
+			y0 += sy;
+		}
+	}
+}
+
+int note_to_png(m210_strokes strokes, int const size, FILE *const output_file)
+{
+	int result = -1;
+	uint8_t *pixels = NULL;
+	/* Fit the page to the image, centered horizontally. */
+	double const scale = (double) size / png_page_height;
+	double const offset_x = (size - png_page_width * scale) / 2;
+	struct m210_note_head head;
+	enum m210_err err;
+
+	err = m210_strokes_next_note(strokes, &head);
+	if (err) {
+		m210_err_perror(err, "error: failed to read note head");
+		goto out;
+	}
+
+	if (head.number == 0) {
+		/* End of note stream. */
+		result = 0;
+		goto out;
+	}
+
+	pixels = malloc((size_t) size * size);
+	if (pixels == NULL) {
+		perror("error: failed to render note");
+		goto out;
+	}
+	memset(pixels, 0xff, (size_t) size * size);
+
+	while (1) {
+		struct m210_stroke const *stroke;
+		int prev_x = 0;
+		int prev_y = 0;
+		size_t pointi;
+
+		err = m210_strokes_next(strokes, &stroke);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note body");
+			goto out;
+		}
+		if (stroke == NULL) {
+			break;
+		}
+
+		for (pointi = 0; pointi < stroke->point_count; ++pointi) {
+			int const x = ((stroke->points[pointi].x - png_page_min_x)
+				       * scale + offset_x);
+			int const y = stroke->points[pointi].y * scale;
+
+			png_draw_line(pixels, size, pointi ? prev_x : x,
+				      pointi ? prev_y : y, x, y);
+			prev_x = x;
+			prev_y = y;
+		}
+	}
+
+	if (png_write(output_file, pixels, size)) {
+		perror("error: failed to write PNG image");
+		goto out;
+	}
+
+	result = 1;
+out:
+	free(pixels);
+	return result;
+}
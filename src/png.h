@@ -0,0 +1,36 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PNG_H
+#define PNG_H
+
+#include <stdio.h>
+
+#include "libm210/stroke.h"
+
+/* Largest width and height of a thumbnail, in pixels. */
+#define PNG_MAX_SIZE 2048
+
+/*
+  Render the next note of STROKES to a SIZE x SIZE grayscale PNG
+  thumbnail of the whole page. Return 1 if a note was rendered, 0 at
+  the end of the note stream and -1 on error, which has already been
+  reported.
+*/
+int note_to_png(m210_strokes strokes, int size, FILE *output_file);
+
+#endif /* PNG_H */
@@ -0,0 +1,374 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "libm210/stroke.h"
+
+#include "ndjson.h"
+#include "preview.h"
+
+/* Terminal size if it cannot be queried, in cells and in pixels per
+   cell. */
+#define PREVIEW_DEFAULT_COLUMNS 80
+#define PREVIEW_DEFAULT_ROWS 24
+#define PREVIEW_DEFAULT_CELL_WIDTH 10
+#define PREVIEW_DEFAULT_CELL_HEIGHT 20
+
+/* Bits of the dots of a braille cell, 2 dots wide and 4 dots high,
+   indexed by row and column. */
+static uint8_t const preview_braille_dots[4][2] = {
+	{0x01, 0x08},
+	{0x02, 0x10},
+	{0x04, 0x20},
+	{0x40, 0x80}
+};
+
+/* A bitmap of dots, reused from note to note. */
+struct preview_frame {
+	/* Size of the current note, in dots. */
+	int width;
+	int height;
+	/* Room for the current note: the terminal, in dots. */
+	int max_width;
+	int max_height;
+	uint8_t bits[PREVIEW_MAX_SIZE][PREVIEW_MAX_SIZE / 8];
+};
+
+static inline void preview_set(struct preview_frame *const frame,
+			       int const x, int const y)
+{
+	frame->bits[y][x >> 3] |= 0x80 >> (x & 7);
+}
+
+static inline int preview_get(struct preview_frame const *const frame,
+			      int const x, int const y)
+{
+	return (x < frame->width && y < frame->height
+		&& frame->bits[y][x >> 3] & (0x80 >> (x & 7)));
+}
+
+/* Set the room for notes to the size of the terminal OUTPUT_FILE, or
+   of $COLUMNS and $LINES if it is not a terminal, leaving a line for
+   the title of the note and one for the prompt. */
+static void preview_fit_terminal(struct preview_frame *const frame,
+				 int const sixel, FILE *const output_file)
+{
+	struct winsize size;
+	int columns = PREVIEW_DEFAULT_COLUMNS;
+	int rows = PREVIEW_DEFAULT_ROWS;
+	int cell_width = PREVIEW_DEFAULT_CELL_WIDTH;
+	int cell_height = PREVIEW_DEFAULT_CELL_HEIGHT;
+
+	if (ioctl(fileno(output_file), TIOCGWINSZ, &size) == 0
+	    && size.ws_col && size.ws_row) {
+		columns = size.ws_col;
+		rows = size.ws_row;
+		if (size.ws_xpixel && size.ws_ypixel) {
+			cell_width = size.ws_xpixel / columns;
+			cell_height = size.ws_ypixel / rows;
+		}
+	} else {
+		/* Not a terminal, but the shell may know its size. */
+		char const *const columns_str = getenv("COLUMNS");
+		char const *const rows_str = getenv("LINES");
+
+		if (columns_str && atoi(columns_str) > 0) {
+			columns = atoi(columns_str);
+		}
+		if (rows_str && atoi(rows_str) > 0) {
+			rows = atoi(rows_str);
+		}
+	}
+	rows = rows > 3 ? rows - 2 : 1;
+
+	if (sixel) {
+		frame->max_width = columns * cell_width;
+		frame->max_height = rows * cell_height;
+	} else {
+		frame->max_width = columns * 2;
+		frame->max_height = rows * 4;
+	}
+	if (frame->max_width > PREVIEW_MAX_SIZE) {
+		frame->max_width = PREVIEW_MAX_SIZE;
+	}
+	if (frame->max_height > PREVIEW_MAX_SIZE) {
+		frame->max_height = PREVIEW_MAX_SIZE;
+	}
+}
+
+/* Draw a line from X0,Y0 to X1,Y1 with Bresenham's algorithm. */
+static void preview_draw_line(struct preview_frame *const frame,
+			      int x0, int y0, int const x1, int const y1)
+{
+	int const dx = abs(x1 - x0);
+	int const dy = -abs(y1 - y0);
+	int const sx = x0 < x1 ? 1 : -1;
+	int const sy = y0 < y1 ? 1 : -1;
+	int error = dx + dy;
+
+	while (1) {
+		int const error2 = 2 * error;
+
+		preview_set(frame, x0, y0);
+		if (x0 == x1 && y0 == y1) {
+			break;
+		}
+		if (error2 >= dy) {
+			error += dy;
+			x0 += sx;
+		}
+		if (error2 <= dx) {
+			error += dx;
+			y0 += sy;
+		}
+	}
+}
+
+/* Draw the current note of STROKES, with BOUNDS scaled to fit the
+   frame. */
+static int preview_draw(struct preview_frame *const frame,
+			m210_strokes strokes,
+			struct m210_bounds const *const bounds)
+{
+	int result = -1;
+	int const note_width = bounds->max_x - bounds->min_x;
+	int const note_height = bounds->max_y - bounds->min_y;
+	double const scale_x = (note_width
+				? (frame->max_width - 1.0) / note_width : 1.0);
+	double const scale_y = (note_height
+				? (frame->max_height - 1.0) / note_height : 1.0);
+	double const scale = scale_x < scale_y ? scale_x : scale_y;
+	int y;
+	enum m210_err err;
+
+	frame->width = note_width * scale + 1;
+	frame->height = note_height * scale + 1;
+	for (y = 0; y < frame->height; ++y) {
+		memset(frame->bits[y], 0, (frame->width + 7) / 8);
+	}
+
+	while (1) {
+		struct m210_stroke const *stroke;
+		int prev_x = 0;
+		int prev_y = 0;
+		size_t pointi;
+
+		err = m210_strokes_next(strokes, &stroke);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note body");
+			goto out;
+		}
+		if (stroke == NULL) {
+			break;
+		}
+
+		for (pointi = 0; pointi < stroke->point_count; ++pointi) {
+			int const x = ((stroke->points[pointi].x - bounds->min_x)
+				       * scale);
+			int const y = ((stroke->points[pointi].y - bounds->min_y)
+				       * scale);
+
+			preview_draw_line(frame, pointi ? prev_x : x,
+					  pointi ? prev_y : y, x, y);
+			prev_x = x;
+			prev_y = y;
+		}
+	}
+
+	result = 0;
+out:
+	return result;
+}
+
+/* Write the frame as lines of braille characters, U+2800 plus the bits
+   of the dots, encoded in UTF-8. */
+static void preview_put_braille(struct preview_frame const *const frame,
+				FILE *const output_file)
+{
+	int row;
+
+	for (row = 0; row * 4 < frame->height; ++row) {
+		int column;
+
+		for (column = 0; column * 2 < frame->width; ++column) {
+			unsigned int cell = 0x2800;
+			int i;
+			int j;
+
+			for (i = 0; i < 4; ++i) {
+				for (j = 0; j < 2; ++j) {
+					if (preview_get(frame, column * 2 + j,
+							row * 4 + i)) {
+						cell |= preview_braille_dots[i][j];
+					}
+				}
+			}
+			putc(0xe0 | cell >> 12, output_file);
+			putc(0x80 | (cell >> 6 & 0x3f), output_file);
+			putc(0x80 | (cell & 0x3f), output_file);
+		}
+		putc('\n', output_file);
+	}
+}
+
+/* Write a run of COUNT sixels of VALUE, compressed if it is long. */
+static void preview_put_sixels(int const value, int const count,
+			       FILE *const output_file)
+{
+	if (count > 3) {
+		fprintf(output_file, "!%d%c", count, 63 + value);
+	} else {
+		int i;
+
+		for (i = 0; i < count; ++i) {
+			putc(63 + value, output_file);
+		}
+	}
+}
+
+/*
+  Write the frame as a sixel image, black on white. Each band of six
+  rows is drawn twice, first the paper in color 0 and then the ink in
+  color 1 over it.
+*/
+static void preview_put_sixel(struct preview_frame const *const frame,
+			      FILE *const output_file)
+{
+	int band;
+
+	fprintf(output_file, "\033Pq\"1;1;%d;%d#0;2;100;100;100#1;2;0;0;0",
+		frame->width, frame->height);
+	for (band = 0; band * 6 < frame->height; ++band) {
+		int color;
+
+		for (color = 0; color < 2; ++color) {
+			int run_value = -1;
+			int run_count = 0;
+			int x;
+
+			fprintf(output_file, "#%d", color);
+			for (x = 0; x < frame->width; ++x) {
+				int value = 0;
+				int i;
+
+				for (i = 0; i < 6; ++i) {
+					int const y = band * 6 + i;
+
+					if (y < frame->height
+					    && preview_get(frame, x, y) == color) {
+						value |= 1 << i;
+					}
+				}
+				if (value != run_value) {
+					preview_put_sixels(run_value, run_count,
+							   output_file);
+					run_value = value;
+					run_count = 0;
+				}
+				++run_count;
+			}
+			preview_put_sixels(run_value, run_count, output_file);
+			putc(color ? '-' : '$', output_file);
+		}
+	}
+	fputs("\033\\\n", output_file);
+}
+
+int preview_notes(FILE *const input_file,
+		  struct preview_options const *const options,
+		  FILE *const output_file)
+{
+	int result = -1;
+	struct preview_frame *frame = NULL;
+	m210_strokes strokes = NULL;
+	enum m210_err err;
+
+	frame = malloc(sizeof(struct preview_frame));
+	if (frame == NULL) {
+		perror("error: failed to allocate framebuffer");
+		goto out;
+	}
+	preview_fit_terminal(frame, options->sixel, output_file);
+
+	err = m210_strokes_open(&strokes, input_file);
+	if (err) {
+		m210_err_perror(err, "error: failed to read input");
+		goto out;
+	}
+
+	while (1) {
+		struct m210_note_head head;
+		struct m210_bounds bounds;
+
+		err = m210_strokes_next_note(strokes, &head);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note head");
+			goto out;
+		}
+		if (head.number == 0) {
+			break;
+		}
+
+		if (options->note_number
+		    && head.number != options->note_number) {
+			err = m210_strokes_skip(strokes);
+			if (err) {
+				m210_err_perror(err, "error: failed to read "
+						"note body");
+				goto out;
+			}
+			continue;
+		}
+
+		err = m210_strokes_bounds(strokes, &bounds);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note body");
+			goto out;
+		}
+
+		fprintf(output_file, "Note %d (%s)%s\n", head.number,
+			ndjson_state_name(head.state),
+			bounds.min_x > bounds.max_x ? ": empty" : "");
+		if (bounds.min_x <= bounds.max_x) {
+			if (preview_draw(frame, strokes, &bounds)) {
+				goto out;
+			}
+			if (options->sixel) {
+				preview_put_sixel(frame, output_file);
+			} else {
+				preview_put_braille(frame, output_file);
+			}
+		}
+		if (fflush(output_file)) {
+			perror("error: failed to write preview");
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	m210_strokes_close(&strokes);
+	free(frame);
+	return result;
+}
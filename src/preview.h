@@ -0,0 +1,44 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stdio.h>
+
+/* Largest width and height of a preview, in braille dots or sixel
+   pixels. */
+#define PREVIEW_MAX_SIZE 2048
+
+struct preview_options {
+	/* Preview only the note of this number, every note if 0. */
+	int note_number;
+	/* Draw sixel images instead of braille characters. */
+	int sixel;
+};
+
+/*
+  Draw the notes of the raw note stream INPUT_FILE to the terminal
+  OUTPUT_FILE one by one as they are read, each scaled to fit the
+  terminal. Every note is drawn to the same framebuffer, allocated
+  once. Return 0 on success and -1 on error, which has already been
+  reported.
+*/
+int preview_notes(FILE *input_file, struct preview_options const *options,
+		  FILE *output_file);
+
+#endif /* PREVIEW_H */
@@ -0,0 +1,176 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "libm210/rawnote.h"
+#include "libm210/stats.h"
+
+#include "ndjson.h"
+#include "report.h"
+
+/* Sums over the notes of a dump. */
+struct report_totals {
+	size_t note_count;
+	/* Notes with ink, each of them takes a page of the pad. */
+	size_t page_count;
+	size_t unfinished_count;
+	struct m210_stats stats;
+};
+
+static void report_put_name(char const *const name, FILE *const output_file)
+{
+	char const *c;
+
+	fputc('"', output_file);
+	for (c = name; *c; ++c) {
+		if (*c == '"' || *c == '\\') {
+			fprintf(output_file, "\\%c", *c);
+		} else if ((unsigned char) *c < 0x20) {
+			fprintf(output_file, "\\u%04x", (unsigned char) *c);
+		} else {
+			fputc(*c, output_file);
+		}
+	}
+	fputc('"', output_file);
+}
+
+static void report_put_stats(struct m210_stats const *const stats,
+			     int const json, FILE *const output_file)
+{
+	struct m210_bounds const *const bounds = &stats->bounds;
+
+	if (json) {
+		fprintf(output_file, "\"strokes\":%zu,\"points\":%zu,"
+			"\"penups\":%zu,\"ink\":%.1f,\"bounds\":",
+			stats->stroke_count, stats->point_count,
+			stats->penup_count, stats->length);
+		if (bounds->min_x <= bounds->max_x) {
+			fprintf(output_file, "[%d,%d,%d,%d]}\n",
+				bounds->min_x, bounds->min_y,
+				bounds->max_x, bounds->max_y);
+		} else {
+			fputs("null}\n", output_file);
+		}
+	} else {
+		fprintf(output_file, "%zu %zu %zu %.1f ", stats->stroke_count,
+			stats->point_count, stats->penup_count, stats->length);
+		if (bounds->min_x <= bounds->max_x) {
+			fprintf(output_file, "%d %d %d %d\n",
+				bounds->min_x, bounds->min_y,
+				bounds->max_x, bounds->max_y);
+		} else {
+			fputs("- - - -\n", output_file);
+		}
+	}
+}
+
+static void report_add(struct report_totals *const totals,
+		       struct m210_stats const *const stats)
+{
+	struct m210_bounds *const bounds = &totals->stats.bounds;
+
+	++totals->note_count;
+	if (stats->point_count) {
+		++totals->page_count;
+	}
+	if (stats->head.state == M210_RAWNOTE_STATE_UNFINISHED) {
+		++totals->unfinished_count;
+	}
+	totals->stats.stroke_count += stats->stroke_count;
+	totals->stats.point_count += stats->point_count;
+	totals->stats.penup_count += stats->penup_count;
+	totals->stats.length += stats->length;
+	if (stats->bounds.min_x < bounds->min_x) {
+		bounds->min_x = stats->bounds.min_x;
+	}
+	if (stats->bounds.min_y < bounds->min_y) {
+		bounds->min_y = stats->bounds.min_y;
+	}
+	if (stats->bounds.max_x > bounds->max_x) {
+		bounds->max_x = stats->bounds.max_x;
+	}
+	if (stats->bounds.max_y > bounds->max_y) {
+		bounds->max_y = stats->bounds.max_y;
+	}
+}
+
+int report_notes(char const *const name, char const *const data,
+		 size_t const size, int const json, FILE *const output_file)
+{
+	int result = -1;
+	struct report_totals totals;
+	size_t pos = 0;
+	enum m210_err err;
+
+	memset(&totals, 0, sizeof(totals));
+	totals.stats.bounds.min_x = INT16_MAX;
+	totals.stats.bounds.min_y = INT16_MAX;
+	totals.stats.bounds.max_x = INT16_MIN;
+	totals.stats.bounds.max_y = INT16_MIN;
+
+	while (1) {
+		struct m210_stats stats;
+		char const *state;
+
+		err = m210_stats_next(&stats, data, size, &pos);
+		if (err) {
+			fprintf(stderr, "error: failed to read %s: %s\n", name,
+				m210_err_strerror(err));
+			goto out;
+		}
+		if (stats.head.number == 0) {
+			break;
+		}
+		report_add(&totals, &stats);
+
+		state = ndjson_state_name(stats.head.state);
+		if (json) {
+			fputs("{\"dump\":", output_file);
+			report_put_name(name, output_file);
+			fprintf(output_file, ",\"note\":%d,\"state\":\"%s\",",
+				stats.head.number, state);
+		} else {
+			fprintf(output_file, "%s %d %s ", name,
+				stats.head.number, state);
+		}
+		report_put_stats(&stats, json, output_file);
+	}
+
+	if (json) {
+		fputs("{\"dump\":", output_file);
+		report_put_name(name, output_file);
+		fprintf(output_file, ",\"notes\":%zu,\"pages\":%zu,"
+			"\"unfinished\":%zu,", totals.note_count,
+			totals.page_count, totals.unfinished_count);
+	} else {
+		fprintf(output_file, "%s total %zu %zu %zu ", name,
+			totals.note_count, totals.page_count,
+			totals.unfinished_count);
+	}
+	report_put_stats(&totals.stats, json, output_file);
+
+	if (ferror(output_file)) {
+		perror("error: failed to write statistics");
+		goto out;
+	}
+
+	result = 0;
+out:
+	return result;
+}
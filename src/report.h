@@ -0,0 +1,50 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+  Write statistics of the notes of the raw note stream DATA of SIZE
+  bytes, read from the dump NAME, to OUTPUT_FILE: a line per note
+
+    NAME NUMBER STATE STROKES POINTS PENUPS INK MIN_X MIN_Y MAX_X MAX_Y
+
+  followed by a summary line of the dump
+
+    NAME total NOTES PAGES UNFINISHED STROKES POINTS PENUPS INK MIN_X MIN_Y MAX_X MAX_Y
+
+  INK is the length of the strokes in device units, and the bounds are
+  "-" if there are no pen-down points. PAGES is the number of notes
+  with any pen-down points, the pages of the pad written on. If JSON is set, the lines are
+  newline delimited JSON records instead:
+
+    {"dump":NAME,"note":1,"state":"finished_by_user","strokes":3,
+     "points":120,"penups":3,"ink":4113.2,"bounds":[-10,20,400,380]}
+    {"dump":NAME,"notes":1,"pages":1,"unfinished":0,"strokes":3,
+     "points":120,"penups":3,"ink":4113.2,"bounds":[-10,20,400,380]}
+
+  Return 0 on success and -1 on error, which has already been
+  reported.
+*/
+int report_notes(char const *name, char const *data, size_t size, int json,
+		 FILE *output_file);
+
+#endif /* REPORT_H */
@@ -0,0 +1,1123 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "libm210/compress.h"
+#include "libm210/crc.h"
+#include "libm210/note.h"
+#include "libm210/pack.h"
+#include "libm210/rawnote.h"
+#include "libm210/stroke.h"
+
+#include "png.h"
+#include "serve.h"
+#include "svg.h"
+
+#define SERVE_MAX_REQUEST_SIZE 256
+#define SERVE_MAX_EVENTS 64
+#define SERVE_CACHE_BUCKETS 1024
+
+struct serve_dump {
+	char const *path;
+	char *data;
+	size_t size;
+	/* Whether DATA is mapped from the file or a decoded copy. */
+	int mapped;
+};
+
+struct serve_note {
+	struct serve_dump const *dump;
+	long head_pos;
+	uint8_t number;
+	uint8_t state;
+	uint32_t bodyc;
+	/* CRC-32C of the bodies. */
+	uint32_t hash;
+};
+
+/*
+  Notes with the same content render the same, whatever their dump.
+  BODIES points to the mapped dump of the first note rendered, which
+  stays mapped as long as the cache, and is compared on every lookup.
+*/
+struct serve_cache_key {
+	uint32_t hash;
+	uint32_t bodyc;
+	char const *bodies;
+	/* 0 for SVG, the size of PNG thumbnails. */
+	uint32_t size;
+};
+
+struct serve_cache_entry {
+	struct serve_cache_key key;
+	char *data;
+	size_t data_size;
+	struct serve_cache_entry *chain;
+	/* Least recently used order, most recent first. */
+	struct serve_cache_entry *prev;
+	struct serve_cache_entry *next;
+};
+
+struct serve_cache {
+	pthread_mutex_t mutex;
+	size_t max_size;
+	size_t size;
+	struct serve_cache_entry *buckets[SERVE_CACHE_BUCKETS];
+	struct serve_cache_entry *first;
+	struct serve_cache_entry *last;
+};
+
+struct serve_conn {
+	int fd;
+	/* A worker is handling REQUEST. */
+	int busy;
+	/* The client is gone, free the connection once not busy. */
+	int closed;
+	char in[SERVE_MAX_REQUEST_SIZE];
+	size_t in_used;
+	char request[SERVE_MAX_REQUEST_SIZE];
+	char *out;
+	size_t out_size;
+	size_t out_sent;
+	/* In the job or done queue. */
+	struct serve_conn *next_queued;
+	/* All connections, for cleanup, or the dead ones. */
+	struct serve_conn *prev_conn;
+	struct serve_conn *next_conn;
+};
+
+struct serve_server {
+	struct serve_dump *dumps;
+	size_t dump_count;
+	struct serve_note *notes;
+	size_t note_count;
+	struct serve_cache cache;
+	int epoll_fd;
+	int listen_fd;
+	int event_fd;
+	struct serve_conn *conns;
+	/* Closed connections, freed after the events at hand. */
+	struct serve_conn *dead;
+	/* Protects the queues and STOPPING. */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct serve_conn *jobs;
+	struct serve_conn *done;
+	int stopping;
+	pthread_t *workers;
+	int worker_count;
+};
+
+static volatile sig_atomic_t serve_stopping = 0;
+
+static void serve_stop(int const signum)
+{
+	(void) signum;
+	serve_stopping = 1;
+}
+
+static size_t serve_cache_bucket(struct serve_cache_key const *const key)
+{
+	return (key->hash ^ key->bodyc * 2654435761u ^ key->size)
+		% SERVE_CACHE_BUCKETS;
+}
+
+static int serve_cache_key_eq(struct serve_cache_key const *const a,
+			      struct serve_cache_key const *const b)
+{
+	return (a->hash == b->hash && a->bodyc == b->bodyc
+		&& a->size == b->size
+		&& (a->bodies == b->bodies
+		    || !memcmp(a->bodies, b->bodies,
+			       a->bodyc * sizeof(struct m210_rawnote_body))));
+}
+
+static void serve_cache_unlink(struct serve_cache *const cache,
+			       struct serve_cache_entry *const entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->first = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->last = entry->prev;
+	}
+}
+
+static void serve_cache_push(struct serve_cache *const cache,
+			     struct serve_cache_entry *const entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->first;
+	if (cache->first) {
+		cache->first->prev = entry;
+	} else {
+		cache->last = entry;
+	}
+	cache->first = entry;
+}
+
+static void serve_cache_evict(struct serve_cache *const cache)
+{
+	struct serve_cache_entry *const entry = cache->last;
+	struct serve_cache_entry **entry_ptr_ptr =
+		&cache->buckets[serve_cache_bucket(&entry->key)];
+
+	while (*entry_ptr_ptr != entry) {
+		entry_ptr_ptr = &(*entry_ptr_ptr)->chain;
+	}
+	*entry_ptr_ptr = entry->chain;
+
+	serve_cache_unlink(cache, entry);
+	cache->size -= entry->data_size;
+	free(entry->data);
+	free(entry);
+}
+
+/*
+  Copy the cached content of KEY to DATA, prefixed by PREFIX_SIZE
+  unset bytes. Return 1 on a hit and 0 on a miss.
+*/
+static int serve_cache_get(struct serve_cache *const cache,
+			   struct serve_cache_key const *const key,
+			   size_t const prefix_size,
+			   char **const datap, size_t *const sizep)
+{
+	int hit = 0;
+	struct serve_cache_entry *entry;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	for (entry = cache->buckets[serve_cache_bucket(key)]; entry;
+	     entry = entry->chain) {
+		if (serve_cache_key_eq(&entry->key, key)) {
+			break;
+		}
+	}
+	if (entry == NULL) {
+		goto out;
+	}
+
+	*datap = malloc(prefix_size + entry->data_size);
+	if (*datap == NULL) {
+		goto out;
+	}
+	memcpy(*datap + prefix_size, entry->data, entry->data_size);
+	*sizep = entry->data_size;
+
+	serve_cache_unlink(cache, entry);
+	serve_cache_push(cache, entry);
+	hit = 1;
+out:
+	pthread_mutex_unlock(&cache->mutex);
+	return hit;
+}
+
+/* Cache a copy of DATA. Failing to do so is not an error. */
+static void serve_cache_put(struct serve_cache *const cache,
+			    struct serve_cache_key const *const key,
+			    char const *const data, size_t const size)
+{
+	struct serve_cache_entry *entry = NULL;
+	size_t const bucket = serve_cache_bucket(key);
+
+	if (size > cache->max_size) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+
+	/* Another worker may have rendered the same note. */
+	for (entry = cache->buckets[bucket]; entry; entry = entry->chain) {
+		if (serve_cache_key_eq(&entry->key, key)) {
+			goto out;
+		}
+	}
+
+	entry = malloc(sizeof(struct serve_cache_entry));
+	if (entry == NULL) {
+		goto out;
+	}
+	entry->data = malloc(size);
+	if (entry->data == NULL) {
+		free(entry);
+		goto out;
+	}
+	memcpy(entry->data, data, size);
+	entry->data_size = size;
+	entry->key = *key;
+
+	while (cache->size + size > cache->max_size) {
+		serve_cache_evict(cache);
+	}
+
+	entry->chain = cache->buckets[bucket];
+	cache->buckets[bucket] = entry;
+	serve_cache_push(cache, entry);
+	cache->size += size;
+out:
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+static void serve_cache_clear(struct serve_cache *const cache)
+{
+	while (cache->last) {
+		serve_cache_evict(cache);
+	}
+}
+
+/*
+  Map the dump at PATH. Packed and compressed dumps are decoded to
+  memory, as their notes are needed in the raw form.
+*/
+static int serve_load_dump(struct serve_dump *const dump)
+{
+	int result = -1;
+	int fd = -1;
+	struct stat st;
+	FILE *raw_file = NULL;
+	char *raw_data = NULL;
+	size_t raw_size = 0;
+	enum m210_err (*decode)(void const *, size_t, FILE *) = NULL;
+	enum m210_err err;
+
+	fd = open(dump->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st)) {
+		fprintf(stderr, "error: failed to open %s: %s\n", dump->path,
+			strerror(errno));
+		goto out;
+	}
+	if (st.st_size == 0) {
+		fprintf(stderr, "error: %s is empty\n", dump->path);
+		goto out;
+	}
+
+	dump->size = st.st_size;
+	dump->data = mmap(NULL, dump->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (dump->data == MAP_FAILED) {
+		dump->data = NULL;
+		fprintf(stderr, "error: failed to map %s: %s\n", dump->path,
+			strerror(errno));
+		goto out;
+	}
+	dump->mapped = 1;
+
+	if (m210_compress_is_compressed(dump->data, dump->size)) {
+		decode = m210_compress_decode;
+	} else if (m210_pack_is_packed(dump->data, dump->size)) {
+		decode = m210_pack_decode;
+	}
+
+	if (decode) {
+		raw_file = open_memstream(&raw_data, &raw_size);
+		if (raw_file == NULL) {
+			perror("error: failed to decode notes");
+			goto out;
+		}
+		err = decode(dump->data, dump->size, raw_file);
+		if (fclose(raw_file) && !err) {
+			err = M210_ERR_SYS;
+		}
+		if (err) {
+			fprintf(stderr, "error: failed to decode %s: %s\n",
+				dump->path, m210_err_strerror(err));
+			free(raw_data);
+			goto out;
+		}
+		munmap(dump->data, dump->size);
+		dump->data = raw_data;
+		dump->size = raw_size;
+		dump->mapped = 0;
+	}
+
+	result = 0;
+out:
+	if (fd != -1) {
+		close(fd);
+	}
+	return result;
+}
+
+static void serve_unload_dump(struct serve_dump *const dump)
+{
+	if (dump->mapped) {
+		munmap(dump->data, dump->size);
+	} else {
+		free(dump->data);
+	}
+	dump->data = NULL;
+}
+
+/* Add the notes of DUMP to the note list of SERVER. */
+static int serve_index_dump(struct serve_server *const server,
+			    struct serve_dump const *const dump)
+{
+	int result = -1;
+	FILE *file = NULL;
+	size_t capacity = server->note_count;
+	enum m210_err err = M210_ERR_OK;
+
+	file = fmemopen(dump->data, dump->size, "rb");
+	if (file == NULL) {
+		perror("error: failed to read notes");
+		goto out;
+	}
+
+	while (1) {
+		struct serve_note *note;
+		struct m210_note_head head;
+		long const head_pos = ftell(file);
+		size_t bodies_size;
+
+		err = m210_note_read_head(&head, file);
+		if (err) {
+			goto out;
+		}
+		if (head.number == 0) {
+			break;
+		}
+
+		bodies_size = head.bodyc * sizeof(struct m210_rawnote_body);
+		if (head_pos + sizeof(struct m210_rawnote_head) + bodies_size
+		    > dump->size) {
+			err = M210_ERR_UNEXPECTED_EOF;
+			goto out;
+		}
+
+		if (server->note_count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			note = realloc(server->notes,
+				       capacity * sizeof(struct serve_note));
+			if (note == NULL) {
+				err = M210_ERR_SYS;
+				goto out;
+			}
+			server->notes = note;
+		}
+
+		note = &server->notes[server->note_count++];
+		note->dump = dump;
+		note->head_pos = head_pos;
+		note->number = head.number;
+		note->state = head.state;
+		note->bodyc = head.bodyc;
+		note->hash = m210_crc32c(0, dump->data + head_pos
+					 + sizeof(struct m210_rawnote_head),
+					 bodies_size);
+
+		if (fseek(file, bodies_size, SEEK_CUR)) {
+			err = M210_ERR_SYS;
+			goto out;
+		}
+	}
+
+	result = 0;
+out:
+	if (err) {
+		fprintf(stderr, "error: failed to read notes of %s: %s\n",
+			dump->path, m210_err_strerror(err));
+	}
+	if (file) {
+		fclose(file);
+	}
+	return result;
+}
+
+/* Render NOTE to memory as SVG if SIZE is 0, otherwise as PNG. */
+static int serve_render(struct serve_note const *const note, int const size,
+			char **const datap, size_t *const sizep)
+{
+	int result = -1;
+	FILE *input = NULL;
+	FILE *output = NULL;
+	m210_strokes strokes = NULL;
+	enum m210_err err;
+
+	input = fmemopen(note->dump->data, note->dump->size, "rb");
+	output = open_memstream(datap, sizep);
+	if (input == NULL || output == NULL
+	    || fseek(input, note->head_pos, SEEK_SET)) {
+		perror("error: failed to render note");
+		goto out;
+	}
+
+	err = m210_strokes_open(&strokes, input);
+	if (err) {
+		m210_err_perror(err, "error: failed to render note");
+		goto out;
+	}
+
+	if (size) {
+		result = note_to_png(strokes, size, output) == 1 ? 0 : -1;
+	} else {
+		struct svg_options options;
+
+		memset(&options, 0, sizeof(options));
+		options.threads = 1;
+		options.input_file = input;
+		options.output_file = output;
+		result = note_to_svg(strokes, &options) == 1 ? 0 : -1;
+	}
+out:
+	m210_strokes_close(&strokes);
+	if (output && fclose(output)) {
+		result = -1;
+	}
+	if (input) {
+		fclose(input);
+	}
+	if (result) {
+		free(*datap);
+		*datap = NULL;
+	}
+	return result;
+}
+
+static void serve_reply_error(struct serve_conn *const conn,
+			      char const *const message)
+{
+	if (asprintf(&conn->out, "ERR %s\n", message) == -1) {
+		conn->out = NULL;
+		conn->out_size = 0;
+		return;
+	}
+	conn->out_size = strlen(conn->out);
+}
+
+/*
+  Reply CONTENT of CONTENT_SIZE bytes, which follows HEADER_SIZE
+  unused bytes in the same buffer.
+*/
+static void serve_reply(struct serve_conn *const conn, char *const content,
+			size_t const header_size, size_t const content_size,
+			char const *const type)
+{
+	char header[64];
+	int const len = snprintf(header, sizeof(header), "OK %zu %s\n",
+				 content_size, type);
+
+	/* The header is written right before the content. */
+	memcpy(content + header_size - len, header, len);
+	memmove(content, content + header_size - len, len + content_size);
+	conn->out = content;
+	conn->out_size = len + content_size;
+}
+
+static void serve_list(struct serve_server *const server,
+		       struct serve_conn *const conn)
+{
+	FILE *output;
+	char *data = NULL;
+	size_t size = 0;
+	size_t i;
+
+	output = open_memstream(&data, &size);
+	if (output == NULL) {
+		serve_reply_error(conn, "out of memory");
+		return;
+	}
+	/* Room for the header. */
+	fprintf(output, "%63s", "");
+	for (i = 0; i < server->note_count; ++i) {
+		struct serve_note const *const note = &server->notes[i];
+
+		fprintf(output, "%zu %d 0x%02x %" PRIu32 " %08" PRIx32 " %s\n",
+			i + 1, note->number, note->state, note->bodyc,
+			note->hash, note->dump->path);
+	}
+	if (fclose(output)) {
+		free(data);
+		serve_reply_error(conn, "out of memory");
+		return;
+	}
+	serve_reply(conn, data, 63, size - 63, "text/plain");
+}
+
+static void serve_note(struct serve_server *const server,
+		       struct serve_conn *const conn,
+		       unsigned long const id, int const size)
+{
+	struct serve_note const *note;
+	struct serve_cache_key key;
+	char *data = NULL;
+	size_t data_size = 0;
+	char *content;
+	size_t const header_size = 64;
+	char const *const type = size ? "image/png" : "image/svg+xml";
+
+	if (id < 1 || id > server->note_count) {
+		serve_reply_error(conn, "no such note");
+		return;
+	}
+	note = &server->notes[id - 1];
+
+	key.hash = note->hash;
+	key.bodyc = note->bodyc;
+	key.bodies = (note->dump->data + note->head_pos
+		      + sizeof(struct m210_rawnote_head));
+	key.size = size;
+
+	if (serve_cache_get(&server->cache, &key, header_size, &content,
+			    &data_size)) {
+		serve_reply(conn, content, header_size, data_size, type);
+		return;
+	}
+
+	if (serve_render(note, size, &data, &data_size)) {
+		serve_reply_error(conn, "failed to render note");
+		return;
+	}
+	serve_cache_put(&server->cache, &key, data, data_size);
+
+	content = malloc(header_size + data_size);
+	if (content == NULL) {
+		free(data);
+		serve_reply_error(conn, "out of memory");
+		return;
+	}
+	memcpy(content + header_size, data, data_size);
+	free(data);
+	serve_reply(conn, content, header_size, data_size, type);
+}
+
+static void serve_handle(struct serve_server *const server,
+			 struct serve_conn *const conn)
+{
+	unsigned long id;
+	int size;
+	char end;
+
+	if (strcmp(conn->request, "list") == 0) {
+		serve_list(server, conn);
+	} else if (sscanf(conn->request, "svg %lu%c", &id, &end) == 1) {
+		serve_note(server, conn, id, 0);
+	} else if (sscanf(conn->request, "png %lu %d%c", &id, &size,
+			  &end) == 2) {
+		if (size < 1 || size > PNG_MAX_SIZE) {
+			serve_reply_error(conn, "invalid size");
+			return;
+		}
+		serve_note(server, conn, id, size);
+	} else {
+		serve_reply_error(conn, "unknown request");
+	}
+}
+
+static void *serve_work(void *const arg)
+{
+	struct serve_server *const server = arg;
+	uint64_t const one = 1;
+
+	while (1) {
+		struct serve_conn *conn;
+
+		pthread_mutex_lock(&server->mutex);
+		while (!server->jobs && !server->stopping) {
+			pthread_cond_wait(&server->cond, &server->mutex);
+		}
+		if (server->stopping) {
+			pthread_mutex_unlock(&server->mutex);
+			break;
+		}
+		conn = server->jobs;
+		server->jobs = conn->next_queued;
+		pthread_mutex_unlock(&server->mutex);
+
+		serve_handle(server, conn);
+
+		pthread_mutex_lock(&server->mutex);
+		conn->next_queued = server->done;
+		server->done = conn;
+		pthread_mutex_unlock(&server->mutex);
+
+		/* Wake up the event loop. */
+		if (write(server->event_fd, &one, sizeof(one)) == -1) {
+			perror("error: failed to signal the event loop");
+		}
+	}
+	return NULL;
+}
+
+static void serve_close(struct serve_server *const server,
+			struct serve_conn *const conn)
+{
+	if (conn->fd != -1) {
+		epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	conn->closed = 1;
+	if (conn->busy) {
+		/* Freed once the worker is done with it. */
+		return;
+	}
+
+	if (conn->prev_conn) {
+		conn->prev_conn->next_conn = conn->next_conn;
+	} else {
+		server->conns = conn->next_conn;
+	}
+	if (conn->next_conn) {
+		conn->next_conn->prev_conn = conn->prev_conn;
+	}
+	conn->next_conn = server->dead;
+	server->dead = conn;
+}
+
+static void serve_free_dead(struct serve_server *const server)
+{
+	while (server->dead) {
+		struct serve_conn *const conn = server->dead;
+
+		server->dead = conn->next_conn;
+		free(conn->out);
+		free(conn);
+	}
+}
+
+static int serve_watch(struct serve_server *const server,
+		       struct serve_conn *const conn, uint32_t const events)
+{
+	struct epoll_event event;
+
+	event.events = events;
+	event.data.ptr = conn;
+	return epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+/*
+  Hand the next buffered request of CONN to the workers, or wait for
+  more input if there is no complete request.
+*/
+static void serve_dispatch(struct serve_server *const server,
+			   struct serve_conn *const conn)
+{
+	char *const newline = memchr(conn->in, '\n', conn->in_used);
+	size_t len;
+
+	if (conn->busy || conn->out) {
+		/* Dispatched once the response has been sent. */
+		return;
+	}
+
+	if (newline == NULL) {
+		if (conn->in_used == sizeof(conn->in)) {
+			/* Too long to be a request. */
+			serve_close(server, conn);
+		} else if (serve_watch(server, conn, EPOLLIN)) {
+			serve_close(server, conn);
+		}
+		return;
+	}
+
+	len = newline - conn->in;
+	memcpy(conn->request, conn->in, len);
+	conn->request[len] = '\0';
+	if (len && conn->request[len - 1] == '\r') {
+		conn->request[len - 1] = '\0';
+	}
+	conn->in_used -= len + 1;
+	memmove(conn->in, newline + 1, conn->in_used);
+
+	/* Stop reading until the response has been sent, so that
+	 * responses go out in order. */
+	if (serve_watch(server, conn, 0)) {
+		serve_close(server, conn);
+		return;
+	}
+	conn->busy = 1;
+
+	pthread_mutex_lock(&server->mutex);
+	conn->next_queued = NULL;
+	if (server->jobs) {
+		struct serve_conn *last = server->jobs;
+		while (last->next_queued) {
+			last = last->next_queued;
+		}
+		last->next_queued = conn;
+	} else {
+		server->jobs = conn;
+	}
+	pthread_cond_signal(&server->cond);
+	pthread_mutex_unlock(&server->mutex);
+}
+
+static void serve_send(struct serve_server *const server,
+		       struct serve_conn *const conn)
+{
+	while (conn->out_sent < conn->out_size) {
+		ssize_t const sent = send(conn->fd, conn->out + conn->out_sent,
+					  conn->out_size - conn->out_sent,
+					  MSG_NOSIGNAL);
+		if (sent == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				if (serve_watch(server, conn, EPOLLOUT)) {
+					serve_close(server, conn);
+				}
+				return;
+			}
+			serve_close(server, conn);
+			return;
+		}
+		conn->out_sent += sent;
+	}
+
+	free(conn->out);
+	conn->out = NULL;
+	conn->out_size = 0;
+	conn->out_sent = 0;
+	serve_dispatch(server, conn);
+}
+
+static void serve_receive(struct serve_server *const server,
+			  struct serve_conn *const conn)
+{
+	ssize_t const got = recv(conn->fd, conn->in + conn->in_used,
+				 sizeof(conn->in) - conn->in_used, 0);
+
+	if (got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK
+			  || errno == EINTR)) {
+		return;
+	}
+	if (got <= 0) {
+		serve_close(server, conn);
+		return;
+	}
+	conn->in_used += got;
+	serve_dispatch(server, conn);
+}
+
+static void serve_accept(struct serve_server *const server)
+{
+	while (1) {
+		struct serve_conn *conn;
+		struct epoll_event event;
+		int const fd = accept4(server->listen_fd, NULL, NULL,
+				       SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+			    && errno != EINTR) {
+				perror("warning: failed to accept a connection");
+			}
+			return;
+		}
+
+		conn = calloc(1, sizeof(struct serve_conn));
+		if (conn == NULL) {
+			perror("warning: failed to accept a connection");
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+
+		event.events = EPOLLIN;
+		event.data.ptr = conn;
+		if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+			perror("warning: failed to accept a connection");
+			close(fd);
+			free(conn);
+			continue;
+		}
+
+		conn->next_conn = server->conns;
+		if (server->conns) {
+			server->conns->prev_conn = conn;
+		}
+		server->conns = conn;
+	}
+}
+
+/* Send the responses the workers have finished. */
+static void serve_finish(struct serve_server *const server)
+{
+	struct serve_conn *conn;
+	uint64_t count;
+
+	if (read(server->event_fd, &count, sizeof(count)) == -1
+	    && errno != EAGAIN) {
+		perror("warning: failed to read worker events");
+	}
+
+	pthread_mutex_lock(&server->mutex);
+	conn = server->done;
+	server->done = NULL;
+	pthread_mutex_unlock(&server->mutex);
+
+	while (conn) {
+		struct serve_conn *const next = conn->next_queued;
+
+		conn->busy = 0;
+		if (conn->closed) {
+			serve_close(server, conn);
+		} else if (conn->out == NULL) {
+			serve_close(server, conn);
+		} else {
+			serve_send(server, conn);
+		}
+		conn = next;
+	}
+}
+
+static int serve_listen(struct serve_server *const server,
+			char const *const path)
+{
+	int result = -1;
+	struct sockaddr_un addr;
+	struct epoll_event event;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "error: socket path is too long\n");
+		goto out;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	server->listen_fd = socket(AF_UNIX,
+				   SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				   0);
+	if (server->listen_fd == -1
+	    || bind(server->listen_fd, (struct sockaddr *) &addr,
+		    sizeof(addr))
+	    || listen(server->listen_fd, SOMAXCONN)) {
+		fprintf(stderr, "error: failed to listen on %s: %s\n", path,
+			strerror(errno));
+		goto out;
+	}
+
+	server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	server->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (server->epoll_fd == -1 || server->event_fd == -1) {
+		perror("error: failed to create event loop");
+		goto out;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = &server->listen_fd;
+	if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd,
+		      &event)) {
+		perror("error: failed to create event loop");
+		goto out;
+	}
+	event.data.ptr = &server->event_fd;
+	if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->event_fd,
+		      &event)) {
+		perror("error: failed to create event loop");
+		goto out;
+	}
+
+	result = 0;
+out:
+	return result;
+}
+
+static int serve_start_workers(struct serve_server *const server,
+			       int const count)
+{
+	int result = -1;
+	sigset_t all;
+	sigset_t old;
+
+	server->workers = calloc(count, sizeof(pthread_t));
+	if (server->workers == NULL) {
+		perror("error: failed to start workers");
+		goto out;
+	}
+
+	/* Signals are for the event loop. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (; server->worker_count < count; ++server->worker_count) {
+		int const retval = pthread_create(
+			&server->workers[server->worker_count], NULL,
+			serve_work, server);
+		if (retval) {
+			errno = retval;
+			perror("error: failed to start workers");
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (server->worker_count < count) {
+		goto out;
+	}
+
+	result = 0;
+out:
+	return result;
+}
+
+static void serve_stop_workers(struct serve_server *const server)
+{
+	int i;
+
+	pthread_mutex_lock(&server->mutex);
+	server->stopping = 1;
+	pthread_cond_broadcast(&server->cond);
+	pthread_mutex_unlock(&server->mutex);
+
+	for (i = 0; i < server->worker_count; ++i) {
+		pthread_join(server->workers[i], NULL);
+	}
+	free(server->workers);
+	server->workers = NULL;
+	server->worker_count = 0;
+}
+
+int serve(char *const *const dump_paths, size_t const dump_count,
+	  struct serve_options const *const options)
+{
+	int result = -1;
+	struct serve_server server;
+	struct sigaction action;
+	int listening = 0;
+	size_t i;
+
+	memset(&server, 0, sizeof(server));
+	server.epoll_fd = -1;
+	server.listen_fd = -1;
+	server.event_fd = -1;
+	server.cache.max_size = options->cache_size;
+	pthread_mutex_init(&server.cache.mutex, NULL);
+	pthread_mutex_init(&server.mutex, NULL);
+	pthread_cond_init(&server.cond, NULL);
+
+	server.dumps = calloc(dump_count, sizeof(struct serve_dump));
+	if (server.dumps == NULL) {
+		perror("error: failed to load notes");
+		goto out;
+	}
+	for (i = 0; i < dump_count; ++i) {
+		server.dumps[i].path = dump_paths[i];
+		if (serve_load_dump(&server.dumps[i])) {
+			goto out;
+		}
+		++server.dump_count;
+		if (serve_index_dump(&server, &server.dumps[i])) {
+			goto out;
+		}
+	}
+
+	if (serve_listen(&server, options->socket_path)) {
+		goto out;
+	}
+	listening = 1;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = serve_stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if (serve_start_workers(&server, options->threads)) {
+		goto out;
+	}
+
+	fprintf(stderr, "serving %zu notes on %s\n", server.note_count,
+		options->socket_path);
+
+	while (!serve_stopping) {
+		struct epoll_event events[SERVE_MAX_EVENTS];
+		int const count = epoll_wait(server.epoll_fd, events,
+					     SERVE_MAX_EVENTS, -1);
+		int eventi;
+
+		if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("error: failed to wait for events");
+			goto out;
+		}
+
+		for (eventi = 0; eventi < count; ++eventi) {
+			void *const ptr = events[eventi].data.ptr;
+			uint32_t const flags = events[eventi].events;
+			struct serve_conn *const conn = ptr;
+
+			if (ptr == &server.listen_fd) {
+				serve_accept(&server);
+			} else if (ptr == &server.event_fd) {
+				serve_finish(&server);
+			} else if (conn->closed) {
+				continue;
+			} else if (flags & EPOLLOUT) {
+				serve_send(&server, conn);
+			} else if (flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+				serve_receive(&server, conn);
+			}
+		}
+		serve_free_dead(&server);
+	}
+
+	result = 0;
+out:
+	serve_stop_workers(&server);
+	while (server.conns) {
+		server.conns->busy = 0;
+		serve_close(&server, server.conns);
+	}
+	serve_free_dead(&server);
+	if (server.epoll_fd != -1) {
+		close(server.epoll_fd);
+	}
+	if (server.event_fd != -1) {
+		close(server.event_fd);
+	}
+	if (server.listen_fd != -1) {
+		close(server.listen_fd);
+	}
+	if (listening) {
+		unlink(options->socket_path);
+	}
+	serve_cache_clear(&server.cache);
+	for (i = 0; i < server.dump_count; ++i) {
+		serve_unload_dump(&server.dumps[i]);
+	}
+	free(server.dumps);
+	free(server.notes);
+	pthread_cond_destroy(&server.cond);
+	pthread_mutex_destroy(&server.mutex);
+	pthread_mutex_destroy(&server.cache.mutex);
+	return result;
+}
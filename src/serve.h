@@ -0,0 +1,52 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stddef.h>
+
+/*
+  Note server protocol: a client sends requests as lines of text over
+  a Unix domain stream socket and gets the responses in order. Notes
+  are identified by their position in the list, starting from 1.
+
+    list           text/plain, a line per note: id, note number, state,
+                   number of bodies, content hash and dump file
+    svg ID         image/svg+xml of the note
+    png ID SIZE    image/png thumbnail of the page, SIZE pixels high
+
+  A response starts with a line "OK SIZE TYPE" followed by SIZE bytes
+  of content, or is a single line "ERR MESSAGE".
+*/
+
+struct serve_options {
+	char const *socket_path;
+	int threads;
+	/* Most bytes of rendered notes kept in the cache. */
+	size_t cache_size;
+};
+
+/*
+  Serve the notes of DUMP_COUNT dump files, raw, compressed or
+  packed, until interrupted. Return 0 on success and -1 on error,
+  which has already been reported.
+*/
+int serve(char *const *dump_paths, size_t dump_count,
+	  struct serve_options const *options);
+
+#endif /* SERVE_H */
@@ -0,0 +1,622 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libm210/note.h"
+#include "libm210/rawnote.h"
+#include "libm210/trace.h"
+
+#include "curve.h"
+#include "svg.h"
+
+static const int svg_stroke_width = 20;
+static const char *const svg_stroke_color = "black";
+const int svg_crop_margin = 100;
+
+/* A gallery of notes in a single HTML document. */
+struct svg_gallery {
+	FILE *file;
+	/* Symbols of the notes, written after the figures which use
+	   them, so the page can be laid out before they are read. */
+	FILE *symbols_file;
+	char *symbols;
+	size_t symbols_size;
+	size_t note_count;
+};
+
+/* Smallest number of bodies worth converting on a thread of its own. */
+static const size_t svg_min_chunk_size = 16384;
+
+/* Part of the bodies of a note, converted by a thread. */
+struct svg_chunk {
+	char const *bodies;
+	size_t count;
+	/* Whether a polyline is open when the chunk starts. */
+	int open;
+	/* Whether the attributes of strokes are shared, see
+	   svg_open_stroke(). */
+	int shared;
+	char *output;
+	size_t output_size;
+	enum m210_err err;
+	pthread_t thread;
+};
+
+static FILE* open_svg_file(int note_number, char const *output_dir,
+			   char *output_mode)
+{
+	FILE *file = NULL;
+	char *filename = NULL;
+
+	if (asprintf(&filename, "%s%sm210_note_%d.svg",
+		     output_dir ? output_dir : "", output_dir ? "/" : "",
+		     note_number) == -1) {
+		/* On error, asprintf() leaves the contents of
+		 * filename undefined. It needs to be NULLed to safely
+		 * call free(). */
+		filename = NULL;
+		goto out;
+	}
+
+	file = fopen(filename, output_mode);
+out:
+	free(filename);
+	return file;
+}
+
+/*
+  Start a stroke ELEMENT. In a gallery, the attributes common to all
+  strokes are SHARED in its style sheet instead.
+*/
+static void svg_open_stroke(FILE *const output_file, char const *const element,
+			    int const shared)
+{
+	if (shared) {
+		fprintf(output_file, "<%s ", element);
+	} else {
+		fprintf(output_file, "<%s stroke-width=\"%d\" stroke=\"%s\" "
+			"fill=\"none\" ", element, svg_stroke_width,
+			svg_stroke_color);
+	}
+}
+
+/*
+  Write polylines of the parts of the current note inside the region
+  of OPTIONS. Consecutive segments of a stroke which were not clipped
+  in between are joined to a single polyline.
+*/
+static int region_to_svg(m210_strokes strokes,
+			 struct svg_options const *const options,
+			 FILE *const output_file)
+{
+	int result = -1;
+	struct m210_grid_clip const *clips;
+	size_t clip_count;
+	size_t clipi;
+	enum m210_err err;
+
+	err = m210_grid_build(options->grid, strokes);
+	if (err) {
+		m210_err_perror(err, "error: failed to index note");
+		goto out;
+	}
+
+	err = m210_grid_query(options->grid, &options->region, &clips,
+			      &clip_count);
+	if (err) {
+		m210_err_perror(err, "error: failed to query note");
+		goto out;
+	}
+
+	for (clipi = 0; clipi < clip_count; ++clipi) {
+		struct m210_grid_clip const *const clip = &clips[clipi];
+		struct m210_grid_clip const *const prev = clipi ? clip - 1 : NULL;
+
+		if (!prev || prev->stroke != clip->stroke
+		    || prev->segment + 1 != clip->segment
+		    || prev->x1 != clip->x0 || prev->y1 != clip->y0) {
+			if (prev) {
+				fprintf(output_file, "%s\n", "\" />");
+			}
+			svg_open_stroke(output_file, "polyline",
+					options->gallery != NULL);
+			fprintf(output_file, "points=\"%g,%g ", clip->x0,
+				clip->y0);
+		}
+		fprintf(output_file, "%g,%g ", clip->x1, clip->y1);
+	}
+	if (clip_count) {
+		fprintf(output_file, "%s\n", "\" />");
+	}
+
+	result = 0;
+out:
+	return result;
+}
+
+/*
+  Write a polyline for each stroke of the current note.
+*/
+static int strokes_to_svg(m210_strokes strokes, int const shared,
+			  FILE *const output_file)
+{
+	int result = -1;
+	enum m210_err err;
+
+	while (1) {
+		struct m210_stroke const *stroke;
+		size_t pointi;
+
+		err = m210_strokes_next(strokes, &stroke);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note body");
+			goto out;
+		}
+		if (stroke == NULL) {
+			break;
+		}
+
+		svg_open_stroke(output_file, "polyline", shared);
+		fputs("points=\"", output_file);
+		for (pointi = 0; pointi < stroke->point_count; ++pointi) {
+			fprintf(output_file, "%d,%d ", stroke->points[pointi].x,
+				stroke->points[pointi].y);
+		}
+		fprintf(output_file, "%s\n", "\" />");
+	}
+
+	result = 0;
+out:
+	return result;
+}
+
+/*
+  Write a path of cubic Bézier curves fitted with CURVES for each
+  stroke of the current note.
+*/
+static int curves_to_svg(m210_strokes strokes, struct curve_fit *const curves,
+			 int const shared, FILE *const output_file)
+{
+	int result = -1;
+	enum m210_err err;
+
+	while (1) {
+		struct m210_stroke const *stroke;
+		size_t bezieri;
+		long x;
+		long y;
+
+		err = m210_strokes_next(strokes, &stroke);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note body");
+			goto out;
+		}
+		if (stroke == NULL) {
+			break;
+		}
+
+		if (curve_fit_stroke(curves, stroke->points,
+				     stroke->point_count)) {
+			perror("error: failed to fit curves");
+			goto out;
+		}
+
+		/* Control points are written relative to the start of
+		 * each curve, which is rounded just like the end of
+		 * the previous one, so rounding errors do not add up. */
+		x = lround(curves->start.x);
+		y = lround(curves->start.y);
+		svg_open_stroke(output_file, "path", shared);
+		fprintf(output_file, "d=\"M%ld,%ld", x, y);
+		for (bezieri = 0; bezieri < curves->bezier_count; ++bezieri) {
+			struct curve_point const *const p =
+				curves->beziers[bezieri].p;
+			long const x3 = lround(p[3].x);
+			long const y3 = lround(p[3].y);
+			fprintf(output_file, "%c%ld,%ld %ld,%ld %ld,%ld",
+				bezieri ? ' ' : 'c',
+				lround(p[1].x) - x, lround(p[1].y) - y,
+				lround(p[2].x) - x, lround(p[2].y) - y,
+				x3 - x, y3 - y);
+			x = x3;
+			y = y3;
+		}
+		fprintf(output_file, "%s\n", "\" />");
+	}
+
+	result = 0;
+out:
+	return result;
+}
+
+/*
+  Convert the bodies of a chunk to polylines in memory. A polyline is
+  opened at the first pen-down body after a pen-up and closed at the
+  next pen-up, so a stroke crossing chunk boundaries continues from
+  one output buffer to the next.
+*/
+static void *svg_chunk_run(void *const arg)
+{
+	struct svg_chunk *const chunk = arg;
+	FILE *input = NULL;
+	FILE *output = NULL;
+	int open = chunk->open;
+	size_t left = chunk->count;
+
+	chunk->err = M210_ERR_SYS;
+
+	input = fmemopen((void *) chunk->bodies,
+			 chunk->count * sizeof(struct m210_rawnote_body), "rb");
+	output = open_memstream(&chunk->output, &chunk->output_size);
+	if (input == NULL || output == NULL) {
+		goto out;
+	}
+
+	while (left) {
+		struct m210_note_body bodies[1024];
+		size_t const count = left < 1024 ? left : 1024;
+		size_t i;
+
+		chunk->err = m210_note_read_bodies(bodies, count, input);
+		if (chunk->err) {
+			goto out;
+		}
+
+		for (i = 0; i < count; ++i) {
+			if (!bodies[i].pressure) {
+				if (open) {
+					fprintf(output, "%s\n", "\" />");
+					open = 0;
+				}
+				continue;
+			}
+			if (!open) {
+				svg_open_stroke(output, "polyline",
+						chunk->shared);
+				fputs("points=\"", output);
+				open = 1;
+			}
+			fprintf(output, "%d,%d ", bodies[i].x, bodies[i].y);
+		}
+		left -= count;
+	}
+
+	chunk->err = ferror(output) ? M210_ERR_SYS : M210_ERR_OK;
+out:
+	if (output && fclose(output) && !chunk->err) {
+		chunk->err = M210_ERR_SYS;
+	}
+	if (input) {
+		fclose(input);
+	}
+	return NULL;
+}
+
+/*
+  Write polylines of the BODYC bodies of the current note, whose head
+  is at HEAD_POS of the input, converting CHUNK_COUNT chunks of them
+  in parallel.
+*/
+static int chunks_to_svg(m210_strokes strokes,
+			 struct svg_options const *const options,
+			 long const head_pos, size_t const bodyc,
+			 size_t const chunk_count, FILE *const output_file)
+{
+	int result = -1;
+	struct svg_chunk *chunks = NULL;
+	char const *const bodies = (options->input_data + head_pos
+				    + sizeof(struct m210_rawnote_head));
+	size_t started = 0;
+	size_t i;
+	enum m210_err err;
+
+	chunks = calloc(chunk_count, sizeof(struct svg_chunk));
+	if (chunks == NULL) {
+		perror("error: failed to convert note");
+		goto out;
+	}
+
+	for (i = 0; i < chunk_count; ++i) {
+		size_t const first = bodyc * i / chunk_count;
+		size_t const last = bodyc * (i + 1) / chunk_count;
+
+		chunks[i].bodies = bodies + first * sizeof(struct m210_rawnote_body);
+		chunks[i].count = last - first;
+		chunks[i].shared = options->gallery != NULL;
+		chunks[i].open = first && memcmp(
+			chunks[i].bodies - sizeof(struct m210_rawnote_body),
+			&M210_RAWNOTE_BODY_PENUP,
+			sizeof(struct m210_rawnote_body));
+	}
+
+	/* The first chunk is converted by this thread. */
+	for (started = 1; started < chunk_count; ++started) {
+		int const retval = pthread_create(&chunks[started].thread, NULL,
+						  svg_chunk_run,
+						  &chunks[started]);
+		if (retval) {
+			errno = retval;
+			perror("error: failed to start a conversion thread");
+			break;
+		}
+	}
+	svg_chunk_run(&chunks[0]);
+	for (i = 1; i < started; ++i) {
+		pthread_join(chunks[i].thread, NULL);
+	}
+	if (started < chunk_count) {
+		goto out;
+	}
+
+	for (i = 0; i < chunk_count; ++i) {
+		if (chunks[i].err) {
+			m210_err_perror(chunks[i].err,
+					"error: failed to read note body");
+			goto out;
+		}
+		if (chunks[i].output_size
+		    && fwrite(chunks[i].output, chunks[i].output_size, 1,
+			      output_file) != 1) {
+			perror("error: failed to write to output file");
+			goto out;
+		}
+	}
+
+	/* Close the stroke which runs to the end of the note. */
+	if (memcmp(bodies + (bodyc - 1) * sizeof(struct m210_rawnote_body),
+		   &M210_RAWNOTE_BODY_PENUP, sizeof(struct m210_rawnote_body))) {
+		fprintf(output_file, "%s\n", "\" />");
+	}
+
+	err = m210_strokes_skip(strokes);
+	if (err) {
+		m210_err_perror(err, "error: failed to skip note");
+		goto out;
+	}
+
+	result = 0;
+out:
+	if (chunks) {
+		for (i = 0; i < chunk_count; ++i) {
+			free(chunks[i].output);
+		}
+	}
+	free(chunks);
+	return result;
+}
+
+int note_to_svg(m210_strokes strokes, struct svg_options const *const options)
+{
+	int result = -1;
+	FILE *output_file = NULL;
+	struct m210_note_head head;
+	struct m210_bounds bounds;
+	/* Size and viewBox attributes of the drawing. */
+	char size[64];
+	char view_box[64];
+	size_t chunk_count = 1;
+	long head_pos = 0;
+	enum m210_err err;
+
+	head.number = 0;
+	if (options->threads > 1) {
+		head_pos = ftell(options->input_file);
+		if (head_pos == -1) {
+			perror("error: failed to read note head");
+			goto out;
+		}
+	}
+
+	err = m210_strokes_next_note(strokes, &head);
+	if (err) {
+		m210_err_perror(err, "error: failed to read note head");
+		goto out;
+	}
+
+	if (head.number == 0) {
+		/* End of note stream. */
+		result = 0;
+		goto out;
+	}
+	M210_TRACE_BEGIN_ARG("convert note", "number", head.number);
+
+	if (!options->grid && options->threads > 1) {
+		chunk_count = head.bodyc / svg_min_chunk_size;
+		if (chunk_count > (size_t) options->threads) {
+			chunk_count = options->threads;
+		}
+	}
+
+	bounds.min_x = 1;
+	bounds.max_x = 0;
+	if (options->grid) {
+		bounds = options->region;
+	} else if (options->crop) {
+		err = m210_strokes_bounds(strokes, &bounds);
+		if (err) {
+			m210_err_perror(err, "error: failed to read note body");
+			goto out;
+		}
+	}
+
+	if (bounds.min_x <= bounds.max_x) {
+		/* Keep the scale of the full page: 14000 units is
+		 * 210 mm and 20000 units is 297 mm. */
+		int const margin = options->grid ? 0 : options->margin;
+		int const width = bounds.max_x - bounds.min_x + 2 * margin;
+		int const height = bounds.max_y - bounds.min_y + 2 * margin;
+		snprintf(size, sizeof(size),
+			 "width=\"%.2fmm\" height=\"%.2fmm\"",
+			 width * 210.0 / 14000, height * 297.0 / 20000);
+		snprintf(view_box, sizeof(view_box),
+			 "viewBox=\"%d %d %d %d\"",
+			 bounds.min_x - margin, bounds.min_y - margin,
+			 width, height);
+	} else {
+		snprintf(size, sizeof(size), "%s", "width=\"210mm\" height=\"297mm\"");
+		snprintf(view_box, sizeof(view_box), "%s", "viewBox=\"-7000 0 14000 20000\"");
+	}
+
+	if (options->gallery) {
+		/* The figure refers to the symbol of the note, which
+		 * follows once all figures have been written. Both
+		 * have the same viewBox and the symbol fills the
+		 * figure, so strokes are placed as in an SVG file. */
+		struct svg_gallery *const gallery = options->gallery;
+
+		++gallery->note_count;
+		fprintf(gallery->file, "<figure><svg %s %s><use href=\"#n%zu\" "
+			"width=\"100%%\" height=\"100%%\"/></svg>"
+			"<figcaption>Note %d</figcaption></figure>\n",
+			size, view_box, gallery->note_count, head.number);
+		output_file = gallery->symbols_file;
+		fprintf(output_file, "<symbol id=\"n%zu\" %s>\n",
+			gallery->note_count, view_box);
+	} else {
+		output_file = options->output_file;
+		if (output_file == NULL) {
+			output_file = open_svg_file(head.number,
+						    options->output_dir,
+						    options->output_mode);
+		}
+		if (output_file == NULL) {
+			perror("error: failed to create SVG file");
+			goto out;
+		}
+
+		fprintf(output_file, "%s\n", "<?xml version=\"1.0\"?>");
+		fprintf(output_file, "%s\n", "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">");
+		fprintf(output_file, "<svg %s %s xmlns=\"http://www.w3.org/2000/svg\" "
+			"version=\"1.1\">\n", size, view_box);
+	}
+
+	if (options->grid) {
+		if (region_to_svg(strokes, options, output_file)) {
+			goto out;
+		}
+	} else if (chunk_count > 1) {
+		if (chunks_to_svg(strokes, options, head_pos, head.bodyc,
+				  chunk_count, output_file)) {
+			goto out;
+		}
+	} else if (options->curves) {
+		if (curves_to_svg(strokes, options->curves,
+				  options->gallery != NULL, output_file)) {
+			goto out;
+		}
+	} else if (strokes_to_svg(strokes, options->gallery != NULL,
+				  output_file)) {
+		goto out;
+	}
+
+	if (fprintf(output_file, "%s", options->gallery ? "</symbol>\n"
+		    : "</svg>\n") < 0) {
+		perror("error: failed to write to output file");
+		goto out;
+	}
+
+	result = 1;
+out:
+	if (output_file && output_file != options->output_file
+	    && !options->gallery && fclose(output_file)) {
+		perror("error: failed to close output file");
+		result = -1;
+	}
+	if (head.number) {
+		M210_TRACE_END("convert note");
+	}
+	return result;
+}
+
+struct svg_gallery *svg_gallery_open(FILE *const file)
+{
+	struct svg_gallery *gallery = NULL;
+
+	gallery = calloc(1, sizeof(struct svg_gallery));
+	if (gallery == NULL) {
+		goto err;
+	}
+	gallery->file = file;
+	gallery->symbols_file = open_memstream(&gallery->symbols,
+					       &gallery->symbols_size);
+	if (gallery->symbols_file == NULL) {
+		goto err;
+	}
+
+	/* Figures are rendered only when they are scrolled to, and
+	 * the strokes are styled once for all notes. */
+	fprintf(file,
+		"<!DOCTYPE html>\n"
+		"<html>\n"
+		"<head>\n"
+		"<meta charset=\"utf-8\">\n"
+		"<title>Notes</title>\n"
+		"<style>\n"
+		"figure{display:inline-block;margin:1em;"
+		"content-visibility:auto;"
+		"contain-intrinsic-size:auto 210mm auto 297mm}\n"
+		"figure svg{display:block;border:1px solid #ccc}\n"
+		"polyline,path{stroke-width:%d;stroke:%s;fill:none}\n"
+		"</style>\n"
+		"</head>\n"
+		"<body>\n",
+		svg_stroke_width, svg_stroke_color);
+	return gallery;
+err:
+	free(gallery);
+	return NULL;
+}
+
+int svg_gallery_close(struct svg_gallery *const gallery)
+{
+	int result = -1;
+
+	if (fclose(gallery->symbols_file)) {
+		goto out;
+	}
+	gallery->symbols_file = NULL;
+
+	fputs("<svg style=\"display:none\">\n", gallery->file);
+	if (gallery->symbols_size
+	    && fwrite(gallery->symbols, gallery->symbols_size, 1,
+		      gallery->file) != 1) {
+		goto out;
+	}
+	fputs("</svg>\n"
+	      "</body>\n"
+	      "</html>\n", gallery->file);
+	if (ferror(gallery->file)) {
+		goto out;
+	}
+
+	result = 0;
+out:
+	if (gallery->symbols_file) {
+		fclose(gallery->symbols_file);
+	}
+	free(gallery->symbols);
+	free(gallery);
+	return result;
+}
@@ -0,0 +1,79 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SVG_H
+#define SVG_H
+
+#include <stdio.h>
+
+#include "libm210/grid.h"
+#include "libm210/stroke.h"
+
+#include "curve.h"
+
+/* Default margin around cropped notes, in device units. */
+extern const int svg_crop_margin;
+
+struct svg_options {
+	char *output_mode;
+	int crop;
+	int margin;
+	/* If not NULL, only the part of each note inside REGION is
+	 * converted, found with GRID. */
+	m210_grid grid;
+	struct m210_bounds region;
+	/* Notes with many bodies are converted in THREADS chunks
+	 * straight from INPUT_DATA, the contents of INPUT_FILE. */
+	int threads;
+	FILE *input_file;
+	char const *input_data;
+	/* If not NULL, every note is written to OUTPUT_FILE instead
+	 * of a file of its own. */
+	FILE *output_file;
+	/* Directory of the files of their own, the current
+	 * directory if NULL. */
+	char const *output_dir;
+	/* If not NULL, strokes are written as paths of cubic Bézier
+	 * curves fitted with CURVES instead of polylines. */
+	struct curve_fit *curves;
+	/* If not NULL, every note is added to GALLERY instead of
+	 * written as an SVG document. */
+	struct svg_gallery *gallery;
+};
+
+/*
+  Convert the next note of STROKES to SVG. Return 1 if a note was
+  converted, 0 at the end of the note stream and -1 on error, which
+  has already been reported.
+*/
+int note_to_svg(m210_strokes strokes, struct svg_options const *options);
+
+/*
+  A gallery is a single HTML document of notes. Each note is a figure
+  which draws the symbol of the note with <use>, and the symbols follow
+  all figures. The attributes of strokes are set once in a style sheet
+  instead of on every stroke.
+
+  svg_gallery_open() writes the head of the document to FILE and
+  returns NULL on error with errno set. svg_gallery_close() writes the
+  symbols and the end of the document, frees GALLERY and returns 0 on
+  success and -1 on error with errno set. FILE is not closed.
+*/
+struct svg_gallery *svg_gallery_open(FILE *file);
+int svg_gallery_close(struct svg_gallery *gallery);
+
+#endif /* SVG_H */
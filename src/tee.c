@@ -0,0 +1,365 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libm210/stroke.h"
+
+#include "ndjson.h"
+#include "svg.h"
+#include "tee.h"
+
+#define TEE_MAX_SINKS 3
+
+/*
+  Written data is queued in a list of chunks. Every sink reads every
+  chunk in order and a chunk is freed once the last sink has moved
+  past it, so the freed chunks are always at the head of the list.
+*/
+struct tee_chunk {
+	struct tee_chunk *next;
+	size_t size;
+	size_t readers;
+	char data[];
+};
+
+struct tee;
+
+struct tee_sink {
+	struct tee *tee;
+	int (*write)(struct tee_sink *sink, FILE *input_file);
+	FILE *output_file;
+	char const *output_dir;
+	pthread_t thread;
+	/* The chunk being read, NULL before the first one. */
+	struct tee_chunk *chunk;
+	size_t chunk_pos;
+	long pos;
+	int failed;
+};
+
+struct tee {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct tee_chunk *first;
+	struct tee_chunk *last;
+	size_t size;
+	int closed;
+	size_t sink_count;
+	struct tee_sink sinks[TEE_MAX_SINKS];
+};
+
+/* Move SINK to the chunk after its current one, if there is one. */
+static struct tee_chunk *tee_next_chunk(struct tee *const tee,
+					struct tee_sink *const sink)
+{
+	struct tee_chunk *const chunk = sink->chunk;
+
+	if (chunk == NULL) {
+		sink->chunk = tee->first;
+		return sink->chunk;
+	}
+	if (chunk->next == NULL) {
+		return NULL;
+	}
+
+	sink->chunk = chunk->next;
+	sink->chunk_pos = 0;
+	if (--chunk->readers == 0) {
+		tee->first = chunk->next;
+		tee->size -= chunk->size;
+		free(chunk);
+		pthread_cond_broadcast(&tee->cond);
+	}
+	return sink->chunk;
+}
+
+static ssize_t tee_read(void *const cookie, char *const buf,
+			size_t const size)
+{
+	struct tee_sink *const sink = cookie;
+	struct tee *const tee = sink->tee;
+	struct tee_chunk *chunk;
+	size_t count;
+
+	pthread_mutex_lock(&tee->mutex);
+	while (1) {
+		chunk = sink->chunk;
+		if (chunk && sink->chunk_pos < chunk->size) {
+			break;
+		}
+		chunk = tee_next_chunk(tee, sink);
+		if (chunk && sink->chunk_pos < chunk->size) {
+			break;
+		}
+		if (tee->closed && (chunk == NULL || chunk->next == NULL)) {
+			pthread_mutex_unlock(&tee->mutex);
+			return 0;
+		}
+		pthread_cond_wait(&tee->cond, &tee->mutex);
+	}
+	pthread_mutex_unlock(&tee->mutex);
+
+	/* The chunk is not freed before this sink moves past it. */
+	count = chunk->size - sink->chunk_pos;
+	if (count > size) {
+		count = size;
+	}
+	memcpy(buf, chunk->data + sink->chunk_pos, count);
+	sink->chunk_pos += count;
+	sink->pos += count;
+	return count;
+}
+
+/* Only telling the position is supported, note heads need it. */
+static int tee_seek(void *const cookie, off64_t *const offset_ptr,
+		    int const whence)
+{
+	struct tee_sink *const sink = cookie;
+
+	if (whence != SEEK_CUR || *offset_ptr != 0) {
+		errno = ESPIPE;
+		return -1;
+	}
+	*offset_ptr = sink->pos;
+	return 0;
+}
+
+static int tee_write_raw(struct tee_sink *const sink, FILE *const input_file)
+{
+	while (1) {
+		char buffer[65536];
+		size_t const count = fread(buffer, 1, sizeof(buffer),
+					   input_file);
+
+		if (fwrite(buffer, 1, count, sink->output_file) != count) {
+			perror("error: failed to write raw notes");
+			return -1;
+		}
+		if (count < sizeof(buffer)) {
+			return 0;
+		}
+	}
+}
+
+static int tee_write_svg(struct tee_sink *const sink, FILE *const input_file)
+{
+	int result = -1;
+	m210_strokes strokes = NULL;
+	struct svg_options options;
+	enum m210_err err;
+
+	memset(&options, 0, sizeof(options));
+	options.output_mode = "wx";
+	options.margin = svg_crop_margin;
+	options.threads = 1;
+	options.input_file = input_file;
+	options.output_dir = sink->output_dir;
+
+	err = m210_strokes_open(&strokes, input_file);
+	if (err) {
+		m210_err_perror(err, "error: failed to read notes");
+		goto out;
+	}
+
+	do {
+		result = note_to_svg(strokes, &options);
+	} while (result == 1);
+out:
+	m210_strokes_close(&strokes);
+	return result;
+}
+
+static int tee_write_ndjson(struct tee_sink *const sink,
+			    FILE *const input_file)
+{
+	return notes_to_ndjson(input_file, 0, sink->output_file);
+}
+
+static void *tee_run_sink(void *const arg)
+{
+	static cookie_io_functions_t const functions = {
+		.read = tee_read,
+		.seek = tee_seek
+	};
+	struct tee_sink *const sink = arg;
+	FILE *input_file;
+
+	input_file = fopencookie(sink, "r", functions);
+	if (input_file == NULL) {
+		perror("error: failed to start writer");
+		sink->failed = 1;
+		return NULL;
+	}
+
+	if (sink->write(sink, input_file)) {
+		sink->failed = 1;
+	}
+
+	/* Read the rest, which the writer did not need or could not
+	 * handle, to let the others go on. */
+	while (1) {
+		char buffer[65536];
+		if (fread(buffer, 1, sizeof(buffer), input_file)
+		    < sizeof(buffer)) {
+			break;
+		}
+	}
+
+	fclose(input_file);
+	return NULL;
+}
+
+static ssize_t tee_write(void *const cookie, char const *const buf,
+			 size_t const size)
+{
+	struct tee *const tee = cookie;
+	struct tee_chunk *chunk;
+
+	chunk = malloc(sizeof(struct tee_chunk) + size);
+	if (chunk == NULL) {
+		return -1;
+	}
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->readers = tee->sink_count;
+	memcpy(chunk->data, buf, size);
+
+	pthread_mutex_lock(&tee->mutex);
+	while (tee->size && tee->size + size > TEE_QUEUE_SIZE) {
+		pthread_cond_wait(&tee->cond, &tee->mutex);
+	}
+	if (tee->last) {
+		tee->last->next = chunk;
+	} else {
+		tee->first = chunk;
+	}
+	tee->last = chunk;
+	tee->size += size;
+	pthread_cond_broadcast(&tee->cond);
+	pthread_mutex_unlock(&tee->mutex);
+
+	return size;
+}
+
+/* Stop the first STARTED sinks of TEE and free it. */
+static int tee_stop(struct tee *const tee, size_t const started)
+{
+	int result = 0;
+
+	pthread_mutex_lock(&tee->mutex);
+	tee->closed = 1;
+	pthread_cond_broadcast(&tee->cond);
+	pthread_mutex_unlock(&tee->mutex);
+
+	for (size_t i = 0; i < started; ++i) {
+		pthread_join(tee->sinks[i].thread, NULL);
+		if (tee->sinks[i].failed) {
+			result = -1;
+		}
+	}
+
+	while (tee->first) {
+		struct tee_chunk *const next = tee->first->next;
+		free(tee->first);
+		tee->first = next;
+	}
+	pthread_cond_destroy(&tee->cond);
+	pthread_mutex_destroy(&tee->mutex);
+	free(tee);
+	return result;
+}
+
+static int tee_close(void *const cookie)
+{
+	struct tee *const tee = cookie;
+
+	if (tee_stop(tee, tee->sink_count)) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+static void tee_add_sink(struct tee *const tee,
+			 int (*const write)(struct tee_sink *, FILE *),
+			 FILE *const output_file, char const *const output_dir)
+{
+	struct tee_sink *const sink = &tee->sinks[tee->sink_count++];
+
+	sink->tee = tee;
+	sink->write = write;
+	sink->output_file = output_file;
+	sink->output_dir = output_dir;
+}
+
+FILE *tee_open(struct tee_options const *const options)
+{
+	static cookie_io_functions_t const functions = {
+		.write = tee_write,
+		.close = tee_close
+	};
+	struct tee *tee;
+	FILE *file;
+	size_t started;
+
+	tee = calloc(1, sizeof(struct tee));
+	if (tee == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&tee->mutex, NULL);
+	pthread_cond_init(&tee->cond, NULL);
+
+	if (options->raw_file) {
+		tee_add_sink(tee, tee_write_raw, options->raw_file, NULL);
+	}
+	if (options->svg_dir) {
+		tee_add_sink(tee, tee_write_svg, NULL, options->svg_dir);
+	}
+	if (options->ndjson_file) {
+		tee_add_sink(tee, tee_write_ndjson, options->ndjson_file,
+			     NULL);
+	}
+
+	for (started = 0; started < tee->sink_count; ++started) {
+		int const error = pthread_create(&tee->sinks[started].thread,
+						 NULL, tee_run_sink,
+						 &tee->sinks[started]);
+		if (error) {
+			errno = error;
+			goto err;
+		}
+	}
+
+	file = fopencookie(tee, "w", functions);
+	if (file == NULL) {
+		goto err;
+	}
+	return file;
+err:
+	{
+		int const original_errno = errno;
+		tee_stop(tee, started);
+		errno = original_errno;
+	}
+	return NULL;
+}
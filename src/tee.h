@@ -0,0 +1,51 @@
+/* m210 - control Pegasus Tablet Mobile NoteTaker
+ * Copyright (C) 2011, 2013 Tuomas Räsänen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEE_H
+#define TEE_H
+
+#include <stdio.h>
+
+/*
+  A tee fans a raw note stream out to several writers while it is
+  being written, for example while notes are downloaded. Each writer
+  runs on a thread of its own and reads the stream from a queue shared
+  by all writers, so a slow writer does not hold up the others nor the
+  producer, until the queue holds TEE_QUEUE_SIZE bytes which the
+  slowest writer has not read yet.
+*/
+
+/* Large enough for the whole memory of a device. */
+#define TEE_QUEUE_SIZE (4 << 20)
+
+struct tee_options {
+	/* Each writer is used if not NULL. */
+	FILE *raw_file;
+	char const *svg_dir;
+	FILE *ndjson_file;
+};
+
+/*
+  Open a stream which passes everything written to it to the writers
+  of OPTIONS. Closing the stream waits for the writers to finish and
+  fails if any of them failed; their errors have already been
+  reported. The files of OPTIONS are left open. Returns NULL and sets
+  errno on error.
+*/
+FILE *tee_open(struct tee_options const *options);
+
+#endif /* TEE_H */